@@ -16,12 +16,22 @@
 
 // Our own headers
 #include <shader.hpp>
+#include <shader_variants.hpp>
+#include <render_queue.hpp>
+#include <scene.hpp>
+#include <light_clusters.hpp>
+#include <gbuffer.hpp>
+#include <gpu_timer.hpp>
+#include <uniform_buffers.hpp>
 #include <camera.hpp>
 #include <heightmap.hpp>
 #include <track.hpp>
 #include <model.hpp>
+#include <ibl_baker.hpp>
+#include <material_library.hpp>
 
 // Basic C++ and C headers
+#include <algorithm>
 #include <iostream>
 #include <string>
 #include <limits>
@@ -43,10 +53,11 @@ void framebuffer_size_callback(GLFWwindow* window, int width, int height);
 void mouse_callback(GLFWwindow* window, double xpos, double ypos);
 void scroll_callback(GLFWwindow* window, double xoffset, double yoffset);
 void processInput(GLFWwindow *window);
-unsigned int loadTexture(const char *path);
 unsigned int loadCubemap(std::vector<std::string> faces);
-void set_lighting(Shader shader, glm::vec3 * pointLightPositions);
+unsigned int loadCubemapUncached(const std::vector<std::string> &faces, size_t &gpuBytes);
+void set_lighting(LightsBlock &lights, glm::vec3 * pointLightPositions);
 unsigned load_environment_map(const char *);
+unsigned load_environment_map_uncached(const char *, size_t &gpuBytes);
 
 
 // settings
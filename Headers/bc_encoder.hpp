@@ -0,0 +1,440 @@
+#pragma once
+
+#include <thread_pool.hpp>
+
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+// CPU block compression for the texture cooker. Every encoder takes one 4x4 block of RGBA8 pixels
+// (row major, 64 bytes) and writes one compressed block.
+//   BC1: RGB, 8 bytes. BC3: BC1 colour + BC4 alpha, 16 bytes. BC4: one channel (red), 8 bytes.
+//   BC5: two BC4 blocks for red and green, 16 bytes (normal maps). BC7: RGBA, 16 bytes, mode 6 only.
+// Endpoints come from the principal axis of the block's colours. That's not the last word in quality
+// but it's close and fast enough to cook a few hundred textures without waiting around.
+// BC4 can also be decoded, for loaders that repack cooked single channel maps (see material_library.hpp).
+
+enum BCFormat {
+	BC_FORMAT_BC1,
+	BC_FORMAT_BC3,
+	BC_FORMAT_BC4,
+	BC_FORMAT_BC5,
+	BC_FORMAT_BC7
+};
+
+inline unsigned int bc_block_bytes(BCFormat format)
+{
+	return format == BC_FORMAT_BC1 || format == BC_FORMAT_BC4 ? 8 : 16;
+}
+
+// principal axis of n points with the given number of channels, by power iteration on the covariance matrix.
+// mean and axis are filled in, axis is not normalized (zero when all points are equal).
+inline void bc_principal_axis(const float *points, int n, int channels, float *mean, float *axis)
+{
+	for (int c = 0; c < channels; c++)
+	{
+		mean[c] = 0.0f;
+		for (int i = 0; i < n; i++)
+			mean[c] += points[i * channels + c];
+		mean[c] /= n;
+	}
+	float cov[4][4] = {};
+	for (int i = 0; i < n; i++)
+		for (int a = 0; a < channels; a++)
+			for (int b = 0; b < channels; b++)
+				cov[a][b] += (points[i * channels + a] - mean[a]) * (points[i * channels + b] - mean[b]);
+
+	for (int c = 0; c < channels; c++)
+		axis[c] = 1.0f;
+	for (int iteration = 0; iteration < 8; iteration++)
+	{
+		float next[4] = {};
+		float largest = 0.0f;
+		for (int a = 0; a < channels; a++)
+		{
+			for (int b = 0; b < channels; b++)
+				next[a] += cov[a][b] * axis[b];
+			largest = fmaxf(largest, fabsf(next[a]));
+		}
+		if (largest == 0.0f)
+		{
+			for (int c = 0; c < channels; c++)
+				axis[c] = 0.0f;
+			return;
+		}
+		for (int c = 0; c < channels; c++)
+			axis[c] = next[c] / largest;
+	}
+}
+
+// the two points at the extremes of the principal axis
+inline void bc_axis_endpoints(const float *points, int n, int channels, float *low, float *high)
+{
+	float mean[4], axis[4];
+	bc_principal_axis(points, n, channels, mean, axis);
+	float minT = 0.0f, maxT = 0.0f;
+	for (int i = 0; i < n; i++)
+	{
+		float t = 0.0f;
+		for (int c = 0; c < channels; c++)
+			t += (points[i * channels + c] - mean[c]) * axis[c];
+		minT = i ? fminf(minT, t) : t;
+		maxT = i ? fmaxf(maxT, t) : t;
+	}
+	for (int c = 0; c < channels; c++)
+	{
+		low[c] = mean[c] + axis[c] * minT;
+		high[c] = mean[c] + axis[c] * maxT;
+	}
+}
+
+inline int bc_clamp(int v, int lo, int hi)
+{
+	return v < lo ? lo : (v > hi ? hi : v);
+}
+
+inline uint16_t bc_pack565(const float *c)
+{
+	int r = bc_clamp((int)(c[0] * 31.0f / 255.0f + 0.5f), 0, 31);
+	int g = bc_clamp((int)(c[1] * 63.0f / 255.0f + 0.5f), 0, 63);
+	int b = bc_clamp((int)(c[2] * 31.0f / 255.0f + 0.5f), 0, 31);
+	return (uint16_t)((r << 11) | (g << 5) | b);
+}
+
+inline void bc_unpack565(uint16_t packed, float *c)
+{
+	int r = (packed >> 11) & 31, g = (packed >> 5) & 63, b = packed & 31;
+	c[0] = (float)((r << 3) | (r >> 2));
+	c[1] = (float)((g << 2) | (g >> 4));
+	c[2] = (float)((b << 3) | (b >> 2));
+}
+
+// BC1 colour block in four colour mode. Picks endpoints on the principal axis, then refines them once by
+// least squares against the chosen indices and keeps whichever fits better.
+inline void bc_encode_bc1_colour(const unsigned char *rgba, unsigned char *out)
+{
+	float points[16 * 3];
+	for (int i = 0; i < 16; i++)
+		for (int c = 0; c < 3; c++)
+			points[i * 3 + c] = rgba[i * 4 + c];
+
+	float low[3], high[3];
+	bc_axis_endpoints(points, 16, 3, low, high);
+	// pull the endpoints in a little, the extremes are rarely worth a whole palette entry
+	for (int c = 0; c < 3; c++)
+	{
+		float inset = (high[c] - low[c]) / 16.0f;
+		low[c] += inset;
+		high[c] -= inset;
+	}
+
+	uint16_t bestC0 = 0, bestC1 = 0;
+	uint32_t bestIndices = 0;
+	float bestError = -1.0f;
+	for (int attempt = 0; attempt < 2; attempt++)
+	{
+		uint16_t c0 = bc_pack565(high), c1 = bc_pack565(low);
+		if (c0 < c1)
+		{
+			uint16_t t = c0;
+			c0 = c1;
+			c1 = t;
+		}
+		float palette[4][3];
+		bc_unpack565(c0, palette[0]);
+		bc_unpack565(c1, palette[1]);
+		for (int c = 0; c < 3; c++)
+		{
+			palette[2][c] = (2.0f * palette[0][c] + palette[1][c]) / 3.0f;
+			palette[3][c] = (palette[0][c] + 2.0f * palette[1][c]) / 3.0f;
+		}
+
+		uint32_t indices = 0;
+		float error = 0.0f;
+		int chosen[16];
+		for (int i = 0; i < 16; i++)
+		{
+			int best = 0;
+			float bestDistance = 0.0f;
+			for (int p = 0; p < (c0 == c1 ? 1 : 4); p++)
+			{
+				float d = 0.0f;
+				for (int c = 0; c < 3; c++)
+					d += (points[i * 3 + c] - palette[p][c]) * (points[i * 3 + c] - palette[p][c]);
+				if (p == 0 || d < bestDistance)
+				{
+					best = p;
+					bestDistance = d;
+				}
+			}
+			chosen[i] = best;
+			indices |= (uint32_t)best << (i * 2);
+			error += bestDistance;
+		}
+		if (bestError < 0.0f || error < bestError)
+		{
+			bestError = error;
+			bestC0 = c0;
+			bestC1 = c1;
+			bestIndices = indices;
+		}
+		if (c0 == c1)
+			break;
+
+		// least squares endpoints for these indices: point = a * w + b * (1 - w)
+		static const float weight[4] = { 1.0f, 0.0f, 2.0f / 3.0f, 1.0f / 3.0f };
+		float aa = 0.0f, ab = 0.0f, bb = 0.0f, ax[3] = {}, bx[3] = {};
+		for (int i = 0; i < 16; i++)
+		{
+			float w = weight[chosen[i]];
+			aa += w * w;
+			ab += w * (1.0f - w);
+			bb += (1.0f - w) * (1.0f - w);
+			for (int c = 0; c < 3; c++)
+			{
+				ax[c] += w * points[i * 3 + c];
+				bx[c] += (1.0f - w) * points[i * 3 + c];
+			}
+		}
+		float det = aa * bb - ab * ab;
+		if (fabsf(det) < 1e-6f)
+			break;
+		for (int c = 0; c < 3; c++)
+		{
+			high[c] = (ax[c] * bb - bx[c] * ab) / det;
+			low[c] = (bx[c] * aa - ax[c] * ab) / det;
+			high[c] = fminf(fmaxf(high[c], 0.0f), 255.0f);
+			low[c] = fminf(fmaxf(low[c], 0.0f), 255.0f);
+		}
+	}
+
+	out[0] = (unsigned char)(bestC0 & 0xFF);
+	out[1] = (unsigned char)(bestC0 >> 8);
+	out[2] = (unsigned char)(bestC1 & 0xFF);
+	out[3] = (unsigned char)(bestC1 >> 8);
+	for (int i = 0; i < 4; i++)
+		out[4 + i] = (unsigned char)(bestIndices >> (i * 8));
+}
+
+// BC4 block of one channel, stride is the distance between the block's values in bytes
+inline void bc_encode_bc4_channel(const unsigned char *values, int stride, unsigned char *out)
+{
+	int lo = 255, hi = 0;
+	for (int i = 0; i < 16; i++)
+	{
+		lo = values[i * stride] < lo ? values[i * stride] : lo;
+		hi = values[i * stride] > hi ? values[i * stride] : hi;
+	}
+	// eight value mode: r0 > r1, palette index 0 is r0, 1 is r1, 2..7 blend from r0 towards r1
+	out[0] = (unsigned char)hi;
+	out[1] = (unsigned char)lo;
+	uint64_t indices = 0;
+	if (hi > lo)
+	{
+		for (int i = 0; i < 16; i++)
+		{
+			// sevenths of the way from lo to hi
+			int t = (int)(((values[i * stride] - lo) * 7.0f) / (hi - lo) + 0.5f);
+			int index = t == 7 ? 0 : (t == 0 ? 1 : 8 - t);
+			indices |= (uint64_t)index << (i * 3);
+		}
+	}
+	for (int i = 0; i < 6; i++)
+		out[2 + i] = (unsigned char)(indices >> (i * 8));
+}
+
+// the 16 values of a BC4 block, written stride bytes apart like bc_encode_bc4_channel reads them
+inline void bc_decode_bc4_channel(const unsigned char *block, unsigned char *values, int stride)
+{
+	int r0 = block[0], r1 = block[1];
+	int palette[8] = { r0, r1, 0, 0, 0, 0, 0, 255 };
+	if (r0 > r1)
+		for (int i = 1; i < 7; i++)
+			palette[i + 1] = ((7 - i) * r0 + i * r1 + 3) / 7;
+	else
+		for (int i = 1; i < 5; i++)
+			palette[i + 1] = ((5 - i) * r0 + i * r1 + 2) / 5;
+	uint64_t indices = 0;
+	for (int i = 0; i < 6; i++)
+		indices |= (uint64_t)block[2 + i] << (i * 8);
+	for (int i = 0; i < 16; i++)
+		values[i * stride] = (unsigned char)palette[(indices >> (i * 3)) & 7];
+}
+
+// writes bits starting at the least significant bit of the block
+struct BCBitWriter {
+	unsigned char *out;
+	int position;
+
+	explicit BCBitWriter(unsigned char *out) : out(out), position(0) { memset(out, 0, 16); }
+
+	void put(uint32_t value, int bits)
+	{
+		for (int i = 0; i < bits; i++, position++)
+			if (value & (1u << i))
+				out[position >> 3] |= (unsigned char)(1 << (position & 7));
+	}
+};
+
+// BC7 mode 6: one subset, RGBA endpoints with 7 bits plus a shared per endpoint p-bit, 4 bit indices
+inline void bc_encode_bc7_mode6(const unsigned char *rgba, unsigned char *out)
+{
+	static const int weights[16] = { 0, 4, 9, 13, 17, 21, 26, 30, 34, 38, 43, 47, 51, 55, 60, 64 };
+
+	float points[16 * 4];
+	for (int i = 0; i < 64; i++)
+		points[i] = rgba[i];
+	float low[4], high[4];
+	bc_axis_endpoints(points, 16, 4, low, high);
+
+	int bestEndpoint[2][4] = {}, bestP[2] = {};
+	int bestIndices[16] = {};
+	long bestError = -1;
+	// try every p-bit combination, each one shifts the reachable endpoint values by one
+	for (int p0 = 0; p0 < 2; p0++)
+	{
+		for (int p1 = 0; p1 < 2; p1++)
+		{
+			int q[2][4], e[2][4];
+			for (int c = 0; c < 4; c++)
+			{
+				q[0][c] = bc_clamp((int)((low[c] - p0) / 2.0f + 0.5f), 0, 127);
+				q[1][c] = bc_clamp((int)((high[c] - p1) / 2.0f + 0.5f), 0, 127);
+				e[0][c] = (q[0][c] << 1) | p0;
+				e[1][c] = (q[1][c] << 1) | p1;
+			}
+			int palette[16][4];
+			for (int w = 0; w < 16; w++)
+				for (int c = 0; c < 4; c++)
+					palette[w][c] = ((64 - weights[w]) * e[0][c] + weights[w] * e[1][c] + 32) >> 6;
+
+			long error = 0;
+			int indices[16];
+			for (int i = 0; i < 16; i++)
+			{
+				long best = -1;
+				for (int w = 0; w < 16; w++)
+				{
+					long d = 0;
+					for (int c = 0; c < 4; c++)
+						d += (long)(rgba[i * 4 + c] - palette[w][c]) * (rgba[i * 4 + c] - palette[w][c]);
+					if (best < 0 || d < best)
+					{
+						best = d;
+						indices[i] = w;
+					}
+				}
+				error += best;
+			}
+			if (bestError < 0 || error < bestError)
+			{
+				bestError = error;
+				memcpy(bestEndpoint, q, sizeof(q));
+				bestP[0] = p0;
+				bestP[1] = p1;
+				memcpy(bestIndices, indices, sizeof(indices));
+			}
+		}
+	}
+
+	// the first index is stored with 3 bits, so its top bit must be 0: swap the endpoints if it isn't
+	if (bestIndices[0] & 8)
+	{
+		for (int c = 0; c < 4; c++)
+		{
+			int t = bestEndpoint[0][c];
+			bestEndpoint[0][c] = bestEndpoint[1][c];
+			bestEndpoint[1][c] = t;
+		}
+		int t = bestP[0];
+		bestP[0] = bestP[1];
+		bestP[1] = t;
+		for (int i = 0; i < 16; i++)
+			bestIndices[i] = 15 - bestIndices[i];
+	}
+
+	BCBitWriter bits(out);
+	bits.put(1u << 6, 7); // mode 6
+	for (int c = 0; c < 4; c++)
+	{
+		bits.put(bestEndpoint[0][c], 7);
+		bits.put(bestEndpoint[1][c], 7);
+	}
+	bits.put(bestP[0], 1);
+	bits.put(bestP[1], 1);
+	bits.put(bestIndices[0], 3);
+	for (int i = 1; i < 16; i++)
+		bits.put(bestIndices[i], 4);
+}
+
+inline void bc_encode_block(BCFormat format, const unsigned char *rgba, unsigned char *out)
+{
+	switch (format)
+	{
+	case BC_FORMAT_BC1:
+		bc_encode_bc1_colour(rgba, out);
+		break;
+	case BC_FORMAT_BC3:
+		bc_encode_bc4_channel(rgba + 3, 4, out);
+		bc_encode_bc1_colour(rgba, out + 8);
+		break;
+	case BC_FORMAT_BC4:
+		bc_encode_bc4_channel(rgba, 4, out);
+		break;
+	case BC_FORMAT_BC5:
+		bc_encode_bc4_channel(rgba, 4, out);
+		bc_encode_bc4_channel(rgba + 1, 4, out + 8);
+		break;
+	case BC_FORMAT_BC7:
+		bc_encode_bc7_mode6(rgba, out);
+		break;
+	}
+}
+
+// compresses a whole RGBA8 image, rows of blocks are spread over the pool if one is given.
+// partial blocks at the right and bottom edge repeat the last pixel.
+inline void bc_encode_image(const unsigned char *rgba, int width, int height, BCFormat format, std::vector<unsigned char> &out, ThreadPool *pool = nullptr)
+{
+	int blocksX = (width + 3) / 4, blocksY = (height + 3) / 4;
+	unsigned int blockBytes = bc_block_bytes(format);
+	out.resize((size_t)blocksX * blocksY * blockBytes);
+
+	std::function<void(size_t)> encodeRow = [&](size_t by) {
+		unsigned char block[64];
+		for (int bx = 0; bx < blocksX; bx++)
+		{
+			for (int y = 0; y < 4; y++)
+			{
+				int sy = bc_clamp((int)by * 4 + y, 0, height - 1);
+				for (int x = 0; x < 4; x++)
+				{
+					int sx = bc_clamp(bx * 4 + x, 0, width - 1);
+					memcpy(block + (y * 4 + x) * 4, rgba + ((size_t)sy * width + sx) * 4, 4);
+				}
+			}
+			bc_encode_block(format, block, &out[((size_t)by * blocksX + bx) * blockBytes]);
+		}
+	};
+
+	if (pool)
+		pool->parallel_for(blocksY, encodeRow);
+	else
+		for (int by = 0; by < blocksY; by++)
+			encodeRow(by);
+}
+
+// a whole BC4 image into the first channel of width x height RGBA8 pixels, the other channels are left alone
+inline void bc_decode_bc4_image(const unsigned char *blocks, int width, int height, unsigned char *rgba)
+{
+	int blocksX = (width + 3) / 4, blocksY = (height + 3) / 4;
+	unsigned char values[16];
+	for (int by = 0; by < blocksY; by++)
+		for (int bx = 0; bx < blocksX; bx++)
+		{
+			bc_decode_bc4_channel(blocks + ((size_t)by * blocksX + bx) * 8, values, 1);
+			for (int y = 0; y < 4 && by * 4 + y < height; y++)
+				for (int x = 0; x < 4 && bx * 4 + x < width; x++)
+					rgba[((size_t)(by * 4 + y) * width + bx * 4 + x) * 4] = values[y * 4 + x];
+		}
+}
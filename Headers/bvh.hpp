@@ -0,0 +1,428 @@
+#pragma once
+
+#include <glm/glm.hpp>
+
+#include <frustum_culling.hpp>
+
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+
+// binned SAH build: candidate splits per axis, and how many boxes a leaf may hold at most
+#define BVH_BINS 16
+#define BVH_MAX_LEAF 4
+// cost of visiting a node relative to testing one box, for the surface area heuristic
+#define BVH_TRAVERSAL_COST 1.0f
+// below this depth nodes are halved by count instead, which bounds the depth (and the query stacks) whatever the boxes
+#define BVH_SAH_DEPTH 64
+#define BVH_STACK_SIZE 128
+// parent of the root, and the leaf of a box that isn't in the tree
+#define BVH_NO_NODE 0xFFFFFFFFu
+
+// bounding volume hierarchy over a set of boxes, identified by the index they were given to build() with
+struct BvhNode {
+	glm::vec3 boundsMin;
+	uint32_t first;		// leaf: first entry in the primitive list, inner node: left child (the right one follows it)
+	glm::vec3 boundsMax;
+	uint32_t count;		// boxes in a leaf, 0 for an inner node
+};
+
+// Built top down with a binned surface area heuristic. When boxes move, refit() fits the nodes around their new
+// positions without changing the tree, walking up from the leaves of the moved boxes only as far as the bounds
+// actually change. The tree gets worse as things drift apart; the refit keeps the SAH sum up to date as it goes, so
+// cost() says how much without visiting the tree, and the owner rebuilds once it's gone too far (see Scene).
+//
+// Queries walk the tree with a small stack and append box indices, all visits are logarithmic in the number of boxes
+// for queries that touch few of them.
+class Bvh
+{
+public:
+	Bvh() : weightedArea(0.0), builtCost(0.0f) {}
+
+	// boxes[i] for every i in ids; the ids are what queries report
+	void build(const std::vector<glm::vec3> &boxMin, const std::vector<glm::vec3> &boxMax, const std::vector<uint32_t> &ids)
+	{
+		nodes.clear();
+		parents.clear();
+		builtCost = 0.0f;
+		primitives = ids;
+		centroids.resize(boxMin.size());
+		leaves.assign(boxMin.size(), BVH_NO_NODE);
+		for (size_t i = 0; i < ids.size(); i++)
+			centroids[ids[i]] = (boxMin[ids[i]] + boxMax[ids[i]]) * 0.5f;
+		weightedArea = 0.0;
+		if (ids.empty())
+			return;
+		nodes.reserve(ids.size() * 2);
+		parents.reserve(ids.size() * 2);
+		nodes.push_back(BvhNode());
+		parents.push_back(BVH_NO_NODE);
+		subdivide(0, 0, (uint32_t)ids.size(), 0, boxMin, boxMax);
+		for (uint32_t i = 0; i < (uint32_t)nodes.size(); i++)
+			for (uint32_t p = nodes[i].first; p < nodes[i].first + nodes[i].count; p++)
+				leaves[primitives[p]] = i;
+		sumAreas();
+		builtCost = cost();
+	}
+
+	// recomputes every node's bounds from the current boxes, the tree itself stays as it is
+	void refit(const std::vector<glm::vec3> &boxMin, const std::vector<glm::vec3> &boxMax)
+	{
+		// children are always stored after their parent, so walking backwards visits them first
+		for (size_t i = nodes.size(); i-- > 0;)
+		{
+			BvhNode &node = nodes[i];
+			if (node.count)
+				leafBounds(node, boxMin, boxMax);
+			else
+				childBounds(node);
+		}
+		sumAreas();
+	}
+
+	// refit for when only the boxes in moved changed (duplicates are fine): each one's leaf is refitted, then its
+	// ancestors up to the first one whose bounds come out the same. Ids that weren't in the last build are ignored
+	void refit(const std::vector<glm::vec3> &boxMin, const std::vector<glm::vec3> &boxMax, const std::vector<uint32_t> &moved)
+	{
+		for (size_t m = 0; m < moved.size(); m++)
+		{
+			uint32_t index = moved[m] < leaves.size() ? leaves[moved[m]] : BVH_NO_NODE;
+			while (index != BVH_NO_NODE)
+			{
+				BvhNode &node = nodes[index];
+				glm::vec3 oldMin = node.boundsMin, oldMax = node.boundsMax;
+				if (node.count)
+					leafBounds(node, boxMin, boxMax);
+				else
+					childBounds(node);
+				if (node.boundsMin == oldMin && node.boundsMax == oldMax)
+					break;
+				weightedArea += (double)weight(node) * (area(node.boundsMin, node.boundsMax) - area(oldMin, oldMax));
+				index = parents[index];
+			}
+		}
+	}
+
+	// expected cost of a query by the surface area heuristic, relative to testing the root's box. Kept up to date
+	// by build() and refit(), so it's cheap to ask every frame
+	float cost() const
+	{
+		if (nodes.empty())
+			return 0.0f;
+		float root = area(nodes[0].boundsMin, nodes[0].boundsMax);
+		return root > 0.0f ? (float)(weightedArea / root) : 0.0f;
+	}
+
+	// cost() right after the last build
+	float costAtBuild() const { return builtCost; }
+
+	// boxes touching the frustum, conservatively. Subtrees entirely inside are taken without testing their boxes
+	void queryFrustum(const Frustum &frustum, std::vector<uint32_t> &out, const std::vector<glm::vec3> &boxMin, const std::vector<glm::vec3> &boxMax) const
+	{
+		if (nodes.empty())
+			return;
+		uint32_t stack[BVH_STACK_SIZE];
+		int top = 0;
+		stack[top++] = 0;
+		while (top)
+		{
+			const BvhNode &node = nodes[stack[--top]];
+			if (!frustum.boxVisible(node.boundsMin, node.boundsMax))
+				continue;
+			if (frustum.boxInside(node.boundsMin, node.boundsMax))
+			{
+				collect(node, out);
+				continue;
+			}
+			if (node.count)
+			{
+				for (uint32_t i = node.first; i < node.first + node.count; i++)
+					if (frustum.boxVisible(boxMin[primitives[i]], boxMax[primitives[i]]))
+						out.push_back(primitives[i]);
+				continue;
+			}
+			stack[top++] = node.first;
+			stack[top++] = node.first + 1;
+		}
+	}
+
+	// boxes within radius of center
+	void querySphere(const glm::vec3 &center, float radius, std::vector<uint32_t> &out, const std::vector<glm::vec3> &boxMin, const std::vector<glm::vec3> &boxMax) const
+	{
+		if (nodes.empty())
+			return;
+		uint32_t stack[BVH_STACK_SIZE];
+		int top = 0;
+		stack[top++] = 0;
+		while (top)
+		{
+			const BvhNode &node = nodes[stack[--top]];
+			if (!sphereTouches(center, radius, node.boundsMin, node.boundsMax))
+				continue;
+			if (node.count)
+			{
+				for (uint32_t i = node.first; i < node.first + node.count; i++)
+					if (sphereTouches(center, radius, boxMin[primitives[i]], boxMax[primitives[i]]))
+						out.push_back(primitives[i]);
+				continue;
+			}
+			stack[top++] = node.first;
+			stack[top++] = node.first + 1;
+		}
+	}
+
+	// nearest box the ray enters within maxDistance (direction needn't be normalized, distances are in its
+	// units). False if none, otherwise hit and distance are set; a ray starting inside a box hits it at 0
+	bool queryRay(const glm::vec3 &origin, const glm::vec3 &direction, float maxDistance, uint32_t &hit, float &distance,
+		const std::vector<glm::vec3> &boxMin, const std::vector<glm::vec3> &boxMax) const
+	{
+		if (nodes.empty())
+			return false;
+		glm::vec3 inverse(1.0f / direction.x, 1.0f / direction.y, 1.0f / direction.z);
+		float nearest = maxDistance;
+		bool found = false;
+		uint32_t stack[BVH_STACK_SIZE];
+		int top = 0;
+		stack[top++] = 0;
+		while (top)
+		{
+			const BvhNode &node = nodes[stack[--top]];
+			float entry;
+			if (!rayEnters(origin, inverse, nearest, node.boundsMin, node.boundsMax, entry))
+				continue;
+			if (node.count)
+			{
+				for (uint32_t i = node.first; i < node.first + node.count; i++)
+					if (rayEnters(origin, inverse, nearest, boxMin[primitives[i]], boxMax[primitives[i]], entry))
+					{
+						nearest = entry;
+						hit = primitives[i];
+						found = true;
+					}
+				continue;
+			}
+			// the nearer child goes on top so it's visited first and shortens the ray for the other one
+			float left, right;
+			bool hitLeft = rayEnters(origin, inverse, nearest, nodes[node.first].boundsMin, nodes[node.first].boundsMax, left);
+			bool hitRight = rayEnters(origin, inverse, nearest, nodes[node.first + 1].boundsMin, nodes[node.first + 1].boundsMax, right);
+			if (hitLeft && hitRight)
+			{
+				stack[top++] = left < right ? node.first + 1 : node.first;
+				stack[top++] = left < right ? node.first : node.first + 1;
+			}
+			else if (hitLeft)
+				stack[top++] = node.first;
+			else if (hitRight)
+				stack[top++] = node.first + 1;
+		}
+		if (found)
+			distance = nearest;
+		return found;
+	}
+
+	size_t nodeCount() const { return nodes.size(); }
+
+	unsigned int depth() const { return nodes.empty() ? 0 : depthBelow(0); }
+
+private:
+	std::vector<BvhNode> nodes;
+	std::vector<uint32_t> parents;		// by node, BVH_NO_NODE for the root
+	std::vector<uint32_t> primitives;	// box ids, each leaf is a range of them
+	std::vector<uint32_t> leaves;		// by box id, the leaf holding it or BVH_NO_NODE
+	std::vector<glm::vec3> centroids;	// by box id, only used while building
+	double weightedArea;	// sum of every node's area times weight(), in double so incremental updates don't drift
+	float builtCost;
+
+	struct Bin {
+		glm::vec3 boundsMin, boundsMax;
+		uint32_t count;
+	};
+
+	static float area(const glm::vec3 &min, const glm::vec3 &max)
+	{
+		glm::vec3 e = glm::max(max - min, glm::vec3(0.0f));
+		return 2.0f * (e.x * e.y + e.y * e.z + e.z * e.x);
+	}
+
+	// what a node's area counts for in the SAH: a visit for inner nodes, a test per box for leaves
+	static float weight(const BvhNode &node)
+	{
+		return node.count ? (float)node.count : BVH_TRAVERSAL_COST;
+	}
+
+	void sumAreas()
+	{
+		weightedArea = 0.0;
+		for (size_t i = 0; i < nodes.size(); i++)
+			weightedArea += (double)weight(nodes[i]) * area(nodes[i].boundsMin, nodes[i].boundsMax);
+	}
+
+	void childBounds(BvhNode &node) const
+	{
+		node.boundsMin = glm::min(nodes[node.first].boundsMin, nodes[node.first + 1].boundsMin);
+		node.boundsMax = glm::max(nodes[node.first].boundsMax, nodes[node.first + 1].boundsMax);
+	}
+
+	void leafBounds(BvhNode &node, const std::vector<glm::vec3> &boxMin, const std::vector<glm::vec3> &boxMax) const
+	{
+		node.boundsMin = boxMin[primitives[node.first]];
+		node.boundsMax = boxMax[primitives[node.first]];
+		for (uint32_t i = node.first + 1; i < node.first + node.count; i++)
+		{
+			node.boundsMin = glm::min(node.boundsMin, boxMin[primitives[i]]);
+			node.boundsMax = glm::max(node.boundsMax, boxMax[primitives[i]]);
+		}
+	}
+
+	// makes nodes[index] cover primitives[first, first + count) and splits it while the heuristic says that pays
+	void subdivide(uint32_t index, uint32_t first, uint32_t count, unsigned int depth, const std::vector<glm::vec3> &boxMin, const std::vector<glm::vec3> &boxMax)
+	{
+		BvhNode node;
+		node.first = first;
+		node.count = count;
+		leafBounds(node, boxMin, boxMax);
+		nodes[index] = node;
+		if (count <= 1)
+			return;
+
+		glm::vec3 centroidMin = centroids[primitives[first]], centroidMax = centroidMin;
+		for (uint32_t i = first + 1; i < first + count; i++)
+		{
+			centroidMin = glm::min(centroidMin, centroids[primitives[i]]);
+			centroidMax = glm::max(centroidMax, centroids[primitives[i]]);
+		}
+
+		// best bin boundary over the three axes
+		int bestAxis = -1, bestSplit = 0;
+		float bestCost = area(node.boundsMin, node.boundsMax) * count;
+		for (int axis = 0; axis < 3 && depth < BVH_SAH_DEPTH; axis++)
+		{
+			float extent = centroidMax[axis] - centroidMin[axis];
+			if (extent <= 0.0f)
+				continue;
+			Bin bins[BVH_BINS];
+			for (int b = 0; b < BVH_BINS; b++)
+				bins[b].count = 0;
+			float scale = BVH_BINS / extent;
+			for (uint32_t i = first; i < first + count; i++)
+			{
+				uint32_t id = primitives[i];
+				int b = std::min(BVH_BINS - 1, (int)((centroids[id][axis] - centroidMin[axis]) * scale));
+				bins[b].boundsMin = bins[b].count ? glm::min(bins[b].boundsMin, boxMin[id]) : boxMin[id];
+				bins[b].boundsMax = bins[b].count ? glm::max(bins[b].boundsMax, boxMax[id]) : boxMax[id];
+				bins[b].count++;
+			}
+			// sweep from the right to get the cost of every right side, then from the left
+			float rightArea[BVH_BINS];
+			uint32_t rightCount[BVH_BINS];
+			glm::vec3 sweepMin(0.0f), sweepMax(0.0f);
+			uint32_t sweepCount = 0;
+			for (int b = BVH_BINS - 1; b > 0; b--)
+			{
+				grow(sweepMin, sweepMax, sweepCount, bins[b]);
+				rightArea[b] = area(sweepMin, sweepMax);
+				rightCount[b] = sweepCount;
+			}
+			sweepCount = 0;
+			for (int b = 0; b < BVH_BINS - 1; b++)
+			{
+				grow(sweepMin, sweepMax, sweepCount, bins[b]);
+				if (!sweepCount || !rightCount[b + 1])
+					continue;
+				float cost = BVH_TRAVERSAL_COST * area(node.boundsMin, node.boundsMax) + area(sweepMin, sweepMax) * sweepCount + rightArea[b + 1] * rightCount[b + 1];
+				if (cost < bestCost)
+				{
+					bestCost = cost;
+					bestAxis = axis;
+					bestSplit = b + 1;
+				}
+			}
+		}
+
+		uint32_t middle;
+		if (bestAxis >= 0)
+		{
+			float scale = BVH_BINS / (centroidMax[bestAxis] - centroidMin[bestAxis]);
+			uint32_t *begin = &primitives[first], *end = begin + count;
+			const std::vector<glm::vec3> &c = centroids;
+			int axis = bestAxis, binMax = BVH_BINS - 1;
+			float minimum = centroidMin[axis];
+			// same binning as above, so the partition matches the evaluated split exactly
+			middle = first + (uint32_t)(std::partition(begin, end, [&](uint32_t id) {
+				return std::min(binMax, (int)((c[id][axis] - minimum) * scale)) < bestSplit;
+			}) - begin);
+		}
+		else if (count > BVH_MAX_LEAF)
+		{
+			// no split beats a leaf but the leaf would be too big (e.g. boxes on top of each other), or the tree is
+			// already too deep: halve by count
+			middle = first + count / 2;
+		}
+		else
+			return;
+
+		uint32_t left = (uint32_t)nodes.size();
+		nodes.push_back(BvhNode());
+		nodes.push_back(BvhNode());
+		parents.push_back(index);
+		parents.push_back(index);
+		nodes[index].first = left;
+		nodes[index].count = 0;
+		subdivide(left, first, middle - first, depth + 1, boxMin, boxMax);
+		subdivide(left + 1, middle, first + count - middle, depth + 1, boxMin, boxMax);
+	}
+
+	static void grow(glm::vec3 &min, glm::vec3 &max, uint32_t &count, const Bin &bin)
+	{
+		if (!bin.count)
+			return;
+		min = count ? glm::min(min, bin.boundsMin) : bin.boundsMin;
+		max = count ? glm::max(max, bin.boundsMax) : bin.boundsMax;
+		count += bin.count;
+	}
+
+	// every box under node, no tests
+	void collect(const BvhNode &root, std::vector<uint32_t> &out) const
+	{
+		uint32_t stack[BVH_STACK_SIZE];
+		int top = 0;
+		const BvhNode *node = &root;
+		for (;;)
+		{
+			if (node->count)
+			{
+				for (uint32_t i = node->first; i < node->first + node->count; i++)
+					out.push_back(primitives[i]);
+				if (!top)
+					return;
+				node = &nodes[stack[--top]];
+				continue;
+			}
+			stack[top++] = node->first + 1;
+			node = &nodes[node->first];
+		}
+	}
+
+	unsigned int depthBelow(uint32_t index) const
+	{
+		const BvhNode &node = nodes[index];
+		return node.count ? 1 : 1 + std::max(depthBelow(node.first), depthBelow(node.first + 1));
+	}
+
+	static bool sphereTouches(const glm::vec3 &center, float radius, const glm::vec3 &min, const glm::vec3 &max)
+	{
+		glm::vec3 offset = center - glm::clamp(center, min, max);
+		return glm::dot(offset, offset) <= radius * radius;
+	}
+
+	// slab test, entry is where the ray enters the box (0 if it starts inside)
+	static bool rayEnters(const glm::vec3 &origin, const glm::vec3 &inverse, float maxDistance, const glm::vec3 &min, const glm::vec3 &max, float &entry)
+	{
+		glm::vec3 t0 = (min - origin) * inverse, t1 = (max - origin) * inverse;
+		glm::vec3 tNear = glm::min(t0, t1), tFar = glm::max(t0, t1);
+		float enter = std::max(std::max(tNear.x, tNear.y), std::max(tNear.z, 0.0f));
+		float exit = std::min(std::min(tFar.x, tFar.y), std::min(tFar.z, maxDistance));
+		entry = enter;
+		return enter <= exit;
+	}
+};
@@ -0,0 +1,426 @@
+#pragma once
+
+#include <glad/glad.h>
+
+#include <gl_state.hpp>
+#include <cooked_texture.hpp>
+#include <file_utils.hpp>
+
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+
+// Block compressed texture loading from DDS (legacy and DX10 headers) and KTX2 files.
+// The file is memory mapped, every size and offset is validated against the mapping first, and each mip
+// level is handed to glCompressedTexImage2D straight from the mapping without an intermediate copy.
+
+// formats that older GL headers may not define
+#ifndef GL_COMPRESSED_RGB_S3TC_DXT1_EXT
+#define GL_COMPRESSED_RGB_S3TC_DXT1_EXT 0x83F0
+#endif
+#ifndef GL_COMPRESSED_RGBA_S3TC_DXT1_EXT
+#define GL_COMPRESSED_RGBA_S3TC_DXT1_EXT 0x83F1
+#endif
+#ifndef GL_COMPRESSED_RGBA_S3TC_DXT3_EXT
+#define GL_COMPRESSED_RGBA_S3TC_DXT3_EXT 0x83F2
+#endif
+#ifndef GL_COMPRESSED_RGBA_S3TC_DXT5_EXT
+#define GL_COMPRESSED_RGBA_S3TC_DXT5_EXT 0x83F3
+#endif
+#ifndef GL_COMPRESSED_SRGB_S3TC_DXT1_EXT
+#define GL_COMPRESSED_SRGB_S3TC_DXT1_EXT 0x8C4C
+#endif
+#ifndef GL_COMPRESSED_SRGB_ALPHA_S3TC_DXT1_EXT
+#define GL_COMPRESSED_SRGB_ALPHA_S3TC_DXT1_EXT 0x8C4D
+#endif
+#ifndef GL_COMPRESSED_SRGB_ALPHA_S3TC_DXT3_EXT
+#define GL_COMPRESSED_SRGB_ALPHA_S3TC_DXT3_EXT 0x8C4E
+#endif
+#ifndef GL_COMPRESSED_SRGB_ALPHA_S3TC_DXT5_EXT
+#define GL_COMPRESSED_SRGB_ALPHA_S3TC_DXT5_EXT 0x8C4F
+#endif
+#ifndef GL_COMPRESSED_RGBA_BPTC_UNORM
+#define GL_COMPRESSED_RGBA_BPTC_UNORM 0x8E8C
+#endif
+#ifndef GL_COMPRESSED_SRGB_ALPHA_BPTC_UNORM
+#define GL_COMPRESSED_SRGB_ALPHA_BPTC_UNORM 0x8E8D
+#endif
+#ifndef GL_COMPRESSED_RGB_BPTC_SIGNED_FLOAT
+#define GL_COMPRESSED_RGB_BPTC_SIGNED_FLOAT 0x8E8E
+#endif
+#ifndef GL_COMPRESSED_RGB_BPTC_UNSIGNED_FLOAT
+#define GL_COMPRESSED_RGB_BPTC_UNSIGNED_FLOAT 0x8E8F
+#endif
+
+// one mip level, data points into the mapped file
+struct CompressedLevel {
+	uint32_t width, height;
+	const unsigned char *data;
+	size_t size;
+};
+
+// a parsed block compressed 2D texture
+struct CompressedImage {
+	GLenum internalFormat;
+	uint32_t blockBytes;	// 8 for BC1/BC4, 16 for the rest
+	std::vector<CompressedLevel> levels;
+
+	size_t bytes() const
+	{
+		size_t total = 0;
+		for (size_t i = 0; i < levels.size(); i++)
+			total += levels[i].size;
+		return total;
+	}
+};
+
+// GL format and block size for a DXGI_FORMAT, false if it isn't a supported BC format
+inline bool compressed_format_from_dxgi(uint32_t dxgi, GLenum &format, uint32_t &blockBytes)
+{
+	blockBytes = 16;
+	switch (dxgi)
+	{
+	case 70: case 71: format = GL_COMPRESSED_RGBA_S3TC_DXT1_EXT; blockBytes = 8; return true;	// BC1_TYPELESS, BC1_UNORM
+	case 72: format = GL_COMPRESSED_SRGB_ALPHA_S3TC_DXT1_EXT; blockBytes = 8; return true;			// BC1_UNORM_SRGB
+	case 73: case 74: format = GL_COMPRESSED_RGBA_S3TC_DXT3_EXT; return true;						// BC2
+	case 75: format = GL_COMPRESSED_SRGB_ALPHA_S3TC_DXT3_EXT; return true;
+	case 76: case 77: format = GL_COMPRESSED_RGBA_S3TC_DXT5_EXT; return true;						// BC3
+	case 78: format = GL_COMPRESSED_SRGB_ALPHA_S3TC_DXT5_EXT; return true;
+	case 79: case 80: format = GL_COMPRESSED_RED_RGTC1; blockBytes = 8; return true;				// BC4
+	case 81: format = GL_COMPRESSED_SIGNED_RED_RGTC1; blockBytes = 8; return true;
+	case 82: case 83: format = GL_COMPRESSED_RG_RGTC2; return true;									// BC5
+	case 84: format = GL_COMPRESSED_SIGNED_RG_RGTC2; return true;
+	case 94: case 95: format = GL_COMPRESSED_RGB_BPTC_UNSIGNED_FLOAT; return true;					// BC6H
+	case 96: format = GL_COMPRESSED_RGB_BPTC_SIGNED_FLOAT; return true;
+	case 97: case 98: format = GL_COMPRESSED_RGBA_BPTC_UNORM; return true;							// BC7
+	case 99: format = GL_COMPRESSED_SRGB_ALPHA_BPTC_UNORM; return true;
+	}
+	return false;
+}
+
+// GL format and block size for a VkFormat (what KTX2 stores), false if it isn't a supported BC format
+inline bool compressed_format_from_vulkan(uint32_t vk, GLenum &format, uint32_t &blockBytes)
+{
+	blockBytes = 16;
+	switch (vk)
+	{
+	case 131: format = GL_COMPRESSED_RGB_S3TC_DXT1_EXT; blockBytes = 8; return true;
+	case 132: format = GL_COMPRESSED_SRGB_S3TC_DXT1_EXT; blockBytes = 8; return true;
+	case 133: format = GL_COMPRESSED_RGBA_S3TC_DXT1_EXT; blockBytes = 8; return true;
+	case 134: format = GL_COMPRESSED_SRGB_ALPHA_S3TC_DXT1_EXT; blockBytes = 8; return true;
+	case 135: format = GL_COMPRESSED_RGBA_S3TC_DXT3_EXT; return true;
+	case 136: format = GL_COMPRESSED_SRGB_ALPHA_S3TC_DXT3_EXT; return true;
+	case 137: format = GL_COMPRESSED_RGBA_S3TC_DXT5_EXT; return true;
+	case 138: format = GL_COMPRESSED_SRGB_ALPHA_S3TC_DXT5_EXT; return true;
+	case 139: format = GL_COMPRESSED_RED_RGTC1; blockBytes = 8; return true;
+	case 140: format = GL_COMPRESSED_SIGNED_RED_RGTC1; blockBytes = 8; return true;
+	case 141: format = GL_COMPRESSED_RG_RGTC2; return true;
+	case 142: format = GL_COMPRESSED_SIGNED_RG_RGTC2; return true;
+	case 143: format = GL_COMPRESSED_RGB_BPTC_UNSIGNED_FLOAT; return true;
+	case 144: format = GL_COMPRESSED_RGB_BPTC_SIGNED_FLOAT; return true;
+	case 145: format = GL_COMPRESSED_RGBA_BPTC_UNORM; return true;
+	case 146: format = GL_COMPRESSED_SRGB_ALPHA_BPTC_UNORM; return true;
+	}
+	return false;
+}
+
+inline uint32_t read_u32(const unsigned char *p)
+{
+	return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+inline uint64_t read_u64(const unsigned char *p)
+{
+	return (uint64_t)read_u32(p) | ((uint64_t)read_u32(p + 4) << 32);
+}
+
+// bytes of one mip level
+inline uint64_t compressed_level_size(uint32_t width, uint32_t height, uint32_t blockBytes)
+{
+	return (uint64_t)((width + 3) / 4) * ((height + 3) / 4) * blockBytes;
+}
+
+// checks the dimensions and level count make sense, so the size computations below can't overflow
+inline bool compressed_dimensions_valid(uint32_t width, uint32_t height, uint32_t levelCount)
+{
+	if (width == 0 || height == 0 || width > 65536 || height > 65536 || levelCount == 0)
+		return false;
+	uint32_t maxLevels = 1;
+	for (uint32_t size = width > height ? width : height; size > 1; size >>= 1)
+		maxLevels++;
+	return levelCount <= maxLevels;
+}
+
+// parses a DDS file (legacy FourCC or DX10 header). error is set when it returns false.
+inline bool parse_dds(const unsigned char *file, size_t size, CompressedImage &image, std::string &error)
+{
+	// "DDS " + 124 byte DDS_HEADER
+	if (size < 128 || memcmp(file, "DDS ", 4) != 0 || read_u32(file + 4) != 124)
+	{
+		error = "not a DDS file";
+		return false;
+	}
+	uint32_t height = read_u32(file + 12);
+	uint32_t width = read_u32(file + 16);
+	uint32_t depth = read_u32(file + 24);
+	uint32_t levelCount = read_u32(file + 28);
+	uint32_t pixelFormatFlags = read_u32(file + 80);
+	const unsigned char *fourCC = file + 84;
+	uint32_t caps2 = read_u32(file + 112);
+	if (levelCount == 0) // DDSD_MIPMAPCOUNT not set, only the base level
+		levelCount = 1;
+
+	if ((caps2 & 0x200) || (caps2 & 0x200000) || depth > 1) // DDSCAPS2_CUBEMAP, DDSCAPS2_VOLUME
+	{
+		error = "cubemaps and volume textures are not supported";
+		return false;
+	}
+	if (!(pixelFormatFlags & 0x4)) // DDPF_FOURCC
+	{
+		error = "uncompressed DDS files are not supported";
+		return false;
+	}
+
+	size_t dataOffset = 128;
+	bool known = true;
+	if (memcmp(fourCC, "DX10", 4) == 0)
+	{
+		// DDS_HEADER_DXT10: dxgiFormat, resourceDimension, miscFlag, arraySize, miscFlags2
+		if (size < 148)
+		{
+			error = "truncated DX10 header";
+			return false;
+		}
+		uint32_t dxgi = read_u32(file + 128);
+		uint32_t dimension = read_u32(file + 132);
+		uint32_t miscFlag = read_u32(file + 136);
+		uint32_t arraySize = read_u32(file + 140);
+		if (dimension != 3 || (miscFlag & 0x4) || arraySize > 1) // D3D10_RESOURCE_DIMENSION_TEXTURE2D, TEXTURECUBE
+		{
+			error = "only single 2D textures are supported";
+			return false;
+		}
+		known = compressed_format_from_dxgi(dxgi, image.internalFormat, image.blockBytes);
+		dataOffset = 148;
+	}
+	else if (memcmp(fourCC, "DXT1", 4) == 0)
+		known = compressed_format_from_dxgi(71, image.internalFormat, image.blockBytes);
+	else if (memcmp(fourCC, "DXT2", 4) == 0 || memcmp(fourCC, "DXT3", 4) == 0)
+		known = compressed_format_from_dxgi(74, image.internalFormat, image.blockBytes);
+	else if (memcmp(fourCC, "DXT4", 4) == 0 || memcmp(fourCC, "DXT5", 4) == 0)
+		known = compressed_format_from_dxgi(77, image.internalFormat, image.blockBytes);
+	else if (memcmp(fourCC, "ATI1", 4) == 0 || memcmp(fourCC, "BC4U", 4) == 0)
+		known = compressed_format_from_dxgi(80, image.internalFormat, image.blockBytes);
+	else if (memcmp(fourCC, "BC4S", 4) == 0)
+		known = compressed_format_from_dxgi(81, image.internalFormat, image.blockBytes);
+	else if (memcmp(fourCC, "ATI2", 4) == 0 || memcmp(fourCC, "BC5U", 4) == 0)
+		known = compressed_format_from_dxgi(83, image.internalFormat, image.blockBytes);
+	else if (memcmp(fourCC, "BC5S", 4) == 0)
+		known = compressed_format_from_dxgi(84, image.internalFormat, image.blockBytes);
+	else
+		known = false;
+	if (!known)
+	{
+		error = "unsupported pixel format";
+		return false;
+	}
+
+	if (!compressed_dimensions_valid(width, height, levelCount))
+	{
+		error = "invalid dimensions or mip count";
+		return false;
+	}
+
+	// levels are stored back to back, largest first
+	image.levels.clear();
+	uint64_t offset = dataOffset;
+	for (uint32_t i = 0; i < levelCount; i++)
+	{
+		CompressedLevel level;
+		level.width = width >> i ? width >> i : 1;
+		level.height = height >> i ? height >> i : 1;
+		uint64_t bytes = compressed_level_size(level.width, level.height, image.blockBytes);
+		if (offset + bytes > size)
+		{
+			error = "file is shorter than its mip chain";
+			return false;
+		}
+		level.data = file + offset;
+		level.size = (size_t)bytes;
+		image.levels.push_back(level);
+		offset += bytes;
+	}
+	return true;
+}
+
+// parses a KTX2 file holding a single 2D block compressed texture without supercompression
+inline bool parse_ktx2(const unsigned char *file, size_t size, CompressedImage &image, std::string &error)
+{
+	static const unsigned char identifier[12] = { 0xAB, 'K', 'T', 'X', ' ', '2', '0', 0xBB, '\r', '\n', 0x1A, '\n' };
+	// identifier + 9 u32 header fields + 4 u32 and 2 u64 index fields
+	const size_t headerSize = 12 + 9 * 4 + 4 * 4 + 2 * 8;
+	if (size < headerSize || memcmp(file, identifier, 12) != 0)
+	{
+		error = "not a KTX2 file";
+		return false;
+	}
+	uint32_t vkFormat = read_u32(file + 12);
+	uint32_t width = read_u32(file + 20);
+	uint32_t height = read_u32(file + 24);
+	uint32_t depth = read_u32(file + 28);
+	uint32_t layerCount = read_u32(file + 32);
+	uint32_t faceCount = read_u32(file + 36);
+	uint32_t levelCount = read_u32(file + 40);
+	uint32_t supercompression = read_u32(file + 44);
+	if (levelCount == 0) // the loader is asked to generate mips, a compressed texture can't
+		levelCount = 1;
+
+	if (depth > 0 || layerCount > 0 || faceCount != 1)
+	{
+		error = "only single 2D textures are supported";
+		return false;
+	}
+	if (supercompression != 0)
+	{
+		error = "supercompressed KTX2 files are not supported";
+		return false;
+	}
+	if (!compressed_format_from_vulkan(vkFormat, image.internalFormat, image.blockBytes))
+	{
+		error = "unsupported pixel format";
+		return false;
+	}
+	if (!compressed_dimensions_valid(width, height, levelCount))
+	{
+		error = "invalid dimensions or mip count";
+		return false;
+	}
+
+	// level index: byteOffset, byteLength, uncompressedByteLength per level, base level first
+	if (headerSize + (uint64_t)levelCount * 24 > size)
+	{
+		error = "truncated level index";
+		return false;
+	}
+	image.levels.clear();
+	for (uint32_t i = 0; i < levelCount; i++)
+	{
+		const unsigned char *entry = file + headerSize + i * 24;
+		uint64_t offset = read_u64(entry);
+		uint64_t length = read_u64(entry + 8);
+		CompressedLevel level;
+		level.width = width >> i ? width >> i : 1;
+		level.height = height >> i ? height >> i : 1;
+		if (length != compressed_level_size(level.width, level.height, image.blockBytes) || offset > size || length > size - offset)
+		{
+			error = "level size does not match the format or lies outside the file";
+			return false;
+		}
+		level.data = file + offset;
+		level.size = (size_t)length;
+		image.levels.push_back(level);
+	}
+	return true;
+}
+
+// parses either container, told apart by the DDS magic
+inline bool parse_compressed(const unsigned char *file, size_t size, CompressedImage &image, std::string &error)
+{
+	return size >= 4 && memcmp(file, "DDS ", 4) == 0 ? parse_dds(file, size, image, error) : parse_ktx2(file, size, image, error);
+}
+
+// whether the driver can sample this compressed format (BPTC needs GL 4.2 or ARB_texture_compression_bptc,
+// S3TC an extension that every desktop driver has)
+inline bool compressed_format_supported(GLenum format)
+{
+	static std::vector<GLint> formats;
+	if (formats.empty())
+	{
+		GLint count = 0;
+		glGetIntegerv(GL_NUM_COMPRESSED_TEXTURE_FORMATS, &count);
+		formats.resize(count > 0 ? count : 1, 0);
+		if (count > 0)
+			glGetIntegerv(GL_COMPRESSED_TEXTURE_FORMATS, &formats[0]);
+	}
+	// RGTC is core since 3.0 but not always listed
+	if (format == GL_COMPRESSED_RED_RGTC1 || format == GL_COMPRESSED_SIGNED_RED_RGTC1 || format == GL_COMPRESSED_RG_RGTC2 || format == GL_COMPRESSED_SIGNED_RG_RGTC2)
+		return true;
+	for (size_t i = 0; i < formats.size(); i++)
+		if ((GLenum)formats[i] == format)
+			return true;
+	return false;
+}
+
+// loads a .dds or .ktx2 file into a new GL texture, returns 0 on failure. gpuBytes (if given) receives the size of all levels.
+inline GLuint texture_loadCompressed(const char *path, size_t *gpuBytes = nullptr)
+{
+	MappedFile file;
+	if (!file.open(path))
+	{
+		printf("ERROR::TEXTURE::COMPRESSED could not open %s\n", path);
+		return 0;
+	}
+
+	CompressedImage image;
+	std::string error;
+	if (!parse_compressed(file.data(), file.size(), image, error))
+	{
+		printf("ERROR::TEXTURE::COMPRESSED %s: %s\n", path, error.c_str());
+		return 0;
+	}
+	if (!compressed_format_supported(image.internalFormat))
+	{
+		printf("ERROR::TEXTURE::COMPRESSED %s: format 0x%X is not supported by the driver\n", path, image.internalFormat);
+		return 0;
+	}
+
+	GLuint tid = 0;
+	glGenTextures(1, &tid);
+	GlState::get().bindTexture(GL_TEXTURE_2D, tid);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, 0);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, (GLint)image.levels.size() - 1);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, image.levels.size() > 1 ? GL_LINEAR_MIPMAP_LINEAR : GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
+	// straight from the mapping, the driver copies it before the call returns
+	for (size_t i = 0; i < image.levels.size(); i++)
+	{
+		const CompressedLevel &level = image.levels[i];
+		glCompressedTexImage2D(GL_TEXTURE_2D, (GLint)i, image.internalFormat, level.width, level.height, 0, (GLsizei)level.size, level.data);
+	}
+	GlState::get().bindTexture(GL_TEXTURE_2D, 0);
+
+	if (gpuBytes)
+		*gpuBytes = image.bytes();
+	return tid;
+}
+
+// the cooked version of an image if there is one that's at least as new as the source, was cooked by the current
+// cooker with the same vertical flip and had its mips built in space, otherwise an empty string. Normal maps cooked
+// without blue (BC5) only count if the caller rebuilds z (twoChannelNormals), see PBR_NORMAL_MAP_NO_BLUE
+inline std::string cooked_texture_path(const std::string &source, bool flipVertically, MipColorSpace space, bool twoChannelNormals = false)
+{
+	std::string cooked = source + ".dds";
+	int64_t cookedTime, sourceTime;
+	if (!file_mtime(cooked, cookedTime) || !file_mtime(source, sourceTime) || cookedTime < sourceTime)
+		return std::string();
+
+	uint32_t flags, settings;
+	if (!read_cooked_texture_header(cooked, flags, settings))
+		return std::string();
+	bool flipped = (flags & COOKED_TEXTURE_FLIPPED) != 0;
+	if (cooked_texture_version(settings) != COOKED_TEXTURE_VERSION || flipped != flipVertically || cooked_texture_space(flags) != space)
+		return std::string();
+	if (space == MIP_NORMAL && (flags & COOKED_TEXTURE_TWO_CHANNEL) && !twoChannelNormals)
+		return std::string();
+	return cooked;
+}
+
+// kept for existing callers
+inline GLuint texture_loadDDS(const char *path)
+{
+	return texture_loadCompressed(path);
+}
@@ -0,0 +1,57 @@
+#pragma once
+
+#include <mipmap.hpp>
+
+#include <cstdint>
+#include <cstdio>
+#include <string>
+
+// The texture cooker (Tools/texture_cooker.cpp) writes "<source>.dds" next to each image and tags it in the
+// DDS header's reserved words: COOKED_TEXTURE_TAG at offset 32, COOKED_TEXTURE_* flags at 36 and the settings it
+// was cooked with at 40. The cooker and the loaders (compressed_texture.hpp) both go through this header.
+#define COOKED_TEXTURE_TAG 0x4B4F4F43 // "COOK"
+#define COOKED_TEXTURE_HEADER_BYTES 44
+const uint32_t COOKED_TEXTURE_FLIPPED = 1;	// rows were flipped vertically, like stbi_set_flip_vertically_on_load(true)
+const uint32_t COOKED_TEXTURE_SPACE_SHIFT = 1;	// two bits: the MipColorSpace the mips were built in
+const uint32_t COOKED_TEXTURE_TWO_CHANNEL = 1 << 3;	// only red (BC4) or red and green (BC5) are stored, normals have no blue
+// bumped whenever the cooker's output changes for the same settings, so files from older cookers are redone
+const uint32_t COOKED_TEXTURE_VERSION = 2;
+
+// the cooker settings as stored at offset 40: version (8 bits) | requested format (4) | mip filter (4) |
+// normal, linear, sRGB format and flip (1 bit each)
+inline uint32_t cooked_texture_settings(uint32_t format, uint32_t filter, bool normal, bool linear, bool srgbFormat, bool flip)
+{
+	return COOKED_TEXTURE_VERSION << 24 | (format & 0xF) << 20 | (filter & 0xF) << 16 |
+		(normal ? 1u : 0u) << 3 | (linear ? 1u : 0u) << 2 | (srgbFormat ? 1u : 0u) << 1 | (flip ? 1u : 0u);
+}
+
+inline uint32_t cooked_texture_version(uint32_t settings)
+{
+	return settings >> 24;
+}
+
+inline MipColorSpace cooked_texture_space(uint32_t flags)
+{
+	return (MipColorSpace)((flags >> COOKED_TEXTURE_SPACE_SHIFT) & 3);
+}
+
+// flags and settings of a cooked file, false if it can't be read or wasn't written by the cooker
+inline bool read_cooked_texture_header(const std::string &path, uint32_t &flags, uint32_t &settings)
+{
+	unsigned char header[COOKED_TEXTURE_HEADER_BYTES];
+	FILE *f = fopen(path.c_str(), "rb");
+	if (!f)
+		return false;
+	bool read = fread(header, 1, sizeof(header), f) == sizeof(header);
+	fclose(f);
+	if (!read)
+		return false;
+	uint32_t words[3];
+	for (int w = 0; w < 3; w++)
+		words[w] = (uint32_t)header[32 + w * 4] | (uint32_t)header[33 + w * 4] << 8 | (uint32_t)header[34 + w * 4] << 16 | (uint32_t)header[35 + w * 4] << 24;
+	if (words[0] != COOKED_TEXTURE_TAG)
+		return false;
+	flags = words[1];
+	settings = words[2];
+	return true;
+}
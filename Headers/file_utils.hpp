@@ -0,0 +1,223 @@
+#pragma once
+
+// Small file helpers shared by the on-disk caches: a read-only memory mapped file and a fast content hash.
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#include <Windows.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <string>
+
+// read-only view of a whole file. The mapping stays valid until close() or the object is destroyed,
+// so anything pointing into data() must be consumed (e.g. uploaded to GL) before then.
+class MappedFile
+{
+public:
+	MappedFile() : ptr(nullptr), length(0)
+#ifdef _WIN32
+		, file(INVALID_HANDLE_VALUE), mapping(NULL)
+#endif
+	{
+	}
+
+	~MappedFile()
+	{
+		close();
+	}
+
+	bool open(const std::string &path)
+	{
+		close();
+#ifdef _WIN32
+		file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+		if (file == INVALID_HANDLE_VALUE)
+			return false;
+		LARGE_INTEGER fileSize;
+		if (!GetFileSizeEx(file, &fileSize) || fileSize.QuadPart == 0)
+		{
+			close();
+			return false;
+		}
+		mapping = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+		if (mapping == NULL)
+		{
+			close();
+			return false;
+		}
+		ptr = (const unsigned char*)MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+		if (!ptr)
+		{
+			close();
+			return false;
+		}
+		length = (size_t)fileSize.QuadPart;
+#else
+		int fd = ::open(path.c_str(), O_RDONLY);
+		if (fd < 0)
+			return false;
+		struct stat st;
+		if (fstat(fd, &st) != 0 || st.st_size == 0)
+		{
+			::close(fd);
+			return false;
+		}
+		void *view = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+		::close(fd); // the mapping keeps its own reference to the file
+		if (view == MAP_FAILED)
+			return false;
+		ptr = (const unsigned char*)view;
+		length = (size_t)st.st_size;
+#endif
+		return true;
+	}
+
+	void close()
+	{
+#ifdef _WIN32
+		if (ptr)
+			UnmapViewOfFile(ptr);
+		if (mapping != NULL)
+			CloseHandle(mapping);
+		if (file != INVALID_HANDLE_VALUE)
+			CloseHandle(file);
+		mapping = NULL;
+		file = INVALID_HANDLE_VALUE;
+#else
+		if (ptr)
+			munmap((void*)ptr, length);
+#endif
+		ptr = nullptr;
+		length = 0;
+	}
+
+	bool is_open() const { return ptr != nullptr; }
+	const unsigned char *data() const { return ptr; }
+	size_t size() const { return length; }
+
+private:
+	// a mapping owns OS handles, so it can't be copied
+	MappedFile(const MappedFile&);
+	MappedFile &operator=(const MappedFile&);
+
+	const unsigned char *ptr;
+	size_t length;
+#ifdef _WIN32
+	HANDLE file;
+	HANDLE mapping;
+#endif
+};
+
+// 64 bit hash of a byte range. Eight bytes are mixed per step so hashing a few hundred MB of model data
+// stays well under the cost of actually importing it.
+inline uint64_t hash_bytes(const void *data, size_t size, uint64_t seed = 0)
+{
+	const uint64_t m = 0xc6a4a7935bd1e995ULL;
+	const unsigned char *bytes = (const unsigned char*)data;
+	uint64_t h = seed ^ (size * m);
+
+	size_t blocks = size / 8;
+	for (size_t i = 0; i < blocks; i++)
+	{
+		uint64_t k;
+		memcpy(&k, bytes + i * 8, 8);
+		k *= m;
+		k ^= k >> 47;
+		k *= m;
+		h ^= k;
+		h *= m;
+	}
+
+	// tail bytes
+	const unsigned char *tail = bytes + blocks * 8;
+	uint64_t k = 0;
+	for (size_t i = 0; i < (size & 7); i++)
+		k |= (uint64_t)tail[i] << (8 * i);
+	if (size & 7)
+	{
+		h ^= k;
+		h *= m;
+	}
+
+	h ^= h >> 47;
+	h *= m;
+	h ^= h >> 47;
+	return h;
+}
+
+inline uint64_t hash_string(const std::string &s, uint64_t seed = 0)
+{
+	return hash_bytes(s.data(), s.size(), seed);
+}
+
+// hashes the contents of a file, returns false if it can't be read
+inline bool hash_file(const std::string &path, uint64_t &hash)
+{
+	MappedFile file;
+	if (!file.open(path))
+		return false;
+	hash = hash_bytes(file.data(), file.size());
+	return true;
+}
+
+// size of a file in bytes, 0 if it doesn't exist
+inline size_t file_size(const std::string &path)
+{
+	FILE *f = fopen(path.c_str(), "rb");
+	if (!f)
+		return 0;
+	fseek(f, 0, SEEK_END);
+	long size = ftell(f);
+	fclose(f);
+	return size > 0 ? (size_t)size : 0;
+}
+
+// last modification time of a file in seconds, returns false if it doesn't exist
+inline bool file_mtime(const std::string &path, int64_t &time)
+{
+#ifdef _WIN32
+	struct _stat64 st;
+	if (_stat64(path.c_str(), &st) != 0)
+		return false;
+#else
+	struct stat st;
+	if (stat(path.c_str(), &st) != 0)
+		return false;
+#endif
+	time = (int64_t)st.st_mtime;
+	return true;
+}
+
+// writes a file next to its final location and moves it into place once complete, so a crash mid-write
+// never leaves a truncated cache behind
+inline bool write_file_atomic(const std::string &path, const void *data, size_t size)
+{
+	std::string tmp = path + ".tmp";
+	FILE *f = fopen(tmp.c_str(), "wb");
+	if (!f)
+		return false;
+	bool ok = fwrite(data, 1, size, f) == size;
+	ok = (fclose(f) == 0) && ok;
+	if (!ok)
+	{
+		remove(tmp.c_str());
+		return false;
+	}
+	remove(path.c_str()); // rename won't overwrite on windows
+	return rename(tmp.c_str(), path.c_str()) == 0;
+}
@@ -0,0 +1,246 @@
+#pragma once
+
+#include <glm/glm.hpp>
+
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <vector>
+
+#if defined(__AVX__)
+#include <immintrin.h>
+#define CULL_AVX 1
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define CULL_SSE 1
+#endif
+
+// the six clip planes of a view projection matrix, world space when it is projection * view. A point p is inside
+// plane i when dot(planes[i].xyz, p) + planes[i].w >= 0. Planes are normalized, so that's also the distance.
+struct Frustum {
+	glm::vec4 planes[6];	// left, right, bottom, top, near, far
+
+	Frustum() {}
+
+	explicit Frustum(const glm::mat4 &viewProjection)
+	{
+		// each plane is the last row of the matrix plus or minus one of the others (Gribb and Hartmann)
+		glm::vec4 rows[4];
+		for (int r = 0; r < 4; r++)
+			rows[r] = glm::vec4(viewProjection[0][r], viewProjection[1][r], viewProjection[2][r], viewProjection[3][r]);
+		for (int i = 0; i < 3; i++)
+		{
+			planes[i * 2] = rows[3] + rows[i];
+			planes[i * 2 + 1] = rows[3] - rows[i];
+		}
+		for (int i = 0; i < 6; i++)
+			planes[i] /= glm::length(glm::vec3(planes[i]));
+	}
+
+	bool sphereVisible(const glm::vec3 &center, float radius) const
+	{
+		for (int i = 0; i < 6; i++)
+			if (glm::dot(glm::vec3(planes[i]), center) + planes[i].w < -radius)
+				return false;
+		return true;
+	}
+
+	// conservative: a box near a frustum corner can pass while being outside
+	bool boxVisible(const glm::vec3 &min, const glm::vec3 &max) const
+	{
+		glm::vec3 center = (min + max) * 0.5f, extent = (max - min) * 0.5f;
+		for (int i = 0; i < 6; i++)
+		{
+			glm::vec3 n(planes[i]);
+			if (glm::dot(n, center) + glm::dot(glm::abs(n), extent) + planes[i].w < 0.0f)
+				return false;
+		}
+		return true;
+	}
+
+	// true when the whole box is inside every plane, so nothing in it needs testing
+	bool boxInside(const glm::vec3 &min, const glm::vec3 &max) const
+	{
+		glm::vec3 center = (min + max) * 0.5f, extent = (max - min) * 0.5f;
+		for (int i = 0; i < 6; i++)
+		{
+			glm::vec3 n(planes[i]);
+			if (glm::dot(n, center) - glm::dot(glm::abs(n), extent) + planes[i].w < 0.0f)
+				return false;
+		}
+		return true;
+	}
+};
+
+// world space box around an object space box moved by transform: the centre is transformed, the half extents
+// go through the absolute value of the rotation and scale
+inline void transform_bounds(const glm::mat4 &transform, const glm::vec3 &min, const glm::vec3 &max, glm::vec3 &outMin, glm::vec3 &outMax)
+{
+	glm::vec3 center = glm::vec3(transform * glm::vec4((min + max) * 0.5f, 1.0f));
+	glm::vec3 extent = (max - min) * 0.5f;
+	glm::vec3 worldExtent(0.0f);
+	for (int c = 0; c < 3; c++)
+		worldExtent += glm::abs(glm::vec3(transform[c])) * extent[c];
+	outMin = center - worldExtent;
+	outMax = center + worldExtent;
+}
+
+// what a culling pass went over, for the per frame counters
+enum CullKind {
+	CULL_OBJECTS,	// scene objects, or render queue items the caller didn't cull
+	CULL_MESHES,	// meshes of the models that were drawn
+	CULL_TERRAIN,	// heightmap chunks
+	CULL_KINDS
+};
+
+// visible and culled counts of the current and the last finished frame, printed with P
+class CullStats
+{
+public:
+	static CullStats &get()
+	{
+		static CullStats stats;
+		return stats;
+	}
+
+	void count(CullKind kind, size_t visible, size_t tested)
+	{
+		counters[kind].visible += visible;
+		counters[kind].culled += tested - visible;
+	}
+
+	void endFrame()
+	{
+		for (int kind = 0; kind < CULL_KINDS; kind++)
+		{
+			lastFrame[kind] = counters[kind];
+			counters[kind] = Counter();
+		}
+	}
+
+	void printStats() const
+	{
+		static const char *names[CULL_KINDS] = { "objects", "meshes", "terrain chunks" };
+		printf("CULLING:: last frame\n");
+		for (int kind = 0; kind < CULL_KINDS; kind++)
+			printf("  %-15s %6u visible %6u culled\n", names[kind], (unsigned int)lastFrame[kind].visible, (unsigned int)lastFrame[kind].culled);
+	}
+
+private:
+	struct Counter {
+		size_t visible, culled;
+		Counter() : visible(0), culled(0) {}
+	};
+	Counter counters[CULL_KINDS], lastFrame[CULL_KINDS];
+
+	CullStats() {}
+	CullStats(const CullStats&);
+	CullStats &operator=(const CullStats&);
+};
+
+// A batch of boxes tested against a frustum together. They're kept as centres and half extents in structure of
+// arrays form, so one iteration tests a plane against 8 boxes with AVX or 4 with SSE2. The AVX loop is only
+// built when the compiler targets AVX, which the PROJECT2_AVX2 CMake option turns on.
+class BoxCuller
+{
+public:
+	void clear()
+	{
+		centerX.clear(); centerY.clear(); centerZ.clear();
+		extentX.clear(); extentY.clear(); extentZ.clear();
+	}
+
+	void add(const glm::vec3 &min, const glm::vec3 &max)
+	{
+		glm::vec3 center = (min + max) * 0.5f, extent = (max - min) * 0.5f;
+		centerX.push_back(center.x); centerY.push_back(center.y); centerZ.push_back(center.z);
+		extentX.push_back(extent.x); extentY.push_back(extent.y); extentZ.push_back(extent.z);
+	}
+
+	size_t size() const { return centerX.size(); }
+
+	// visible[i] is 1 when box i touches the frustum, returns how many do
+	size_t cull(const Frustum &frustum, std::vector<uint8_t> &visible)
+	{
+		size_t n = size();
+		visible.resize(n);
+		// the vector loop reads whole groups, padding boxes are zero sized and their results dropped
+		size_t padded = (n + CULL_WIDTH - 1) / CULL_WIDTH * CULL_WIDTH;
+		pad(padded);
+
+		size_t i = 0;
+#if defined(CULL_AVX)
+		for (; i < n; i += 8)
+		{
+			__m256 outside = _mm256_setzero_ps();
+			__m256 cx = _mm256_loadu_ps(&centerX[i]), cy = _mm256_loadu_ps(&centerY[i]), cz = _mm256_loadu_ps(&centerZ[i]);
+			__m256 ex = _mm256_loadu_ps(&extentX[i]), ey = _mm256_loadu_ps(&extentY[i]), ez = _mm256_loadu_ps(&extentZ[i]);
+			for (int p = 0; p < 6; p++)
+			{
+				const glm::vec4 &plane = frustum.planes[p];
+				__m256 d = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(cx, _mm256_set1_ps(plane.x)), _mm256_mul_ps(cy, _mm256_set1_ps(plane.y))),
+					_mm256_add_ps(_mm256_mul_ps(cz, _mm256_set1_ps(plane.z)), _mm256_set1_ps(plane.w)));
+				__m256 r = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(ex, _mm256_set1_ps(std::fabs(plane.x))), _mm256_mul_ps(ey, _mm256_set1_ps(std::fabs(plane.y)))),
+					_mm256_mul_ps(ez, _mm256_set1_ps(std::fabs(plane.z))));
+				outside = _mm256_or_ps(outside, _mm256_cmp_ps(_mm256_add_ps(d, r), _mm256_setzero_ps(), _CMP_LT_OQ));
+			}
+			int mask = _mm256_movemask_ps(outside);
+			for (size_t lane = 0; lane < 8 && i + lane < n; lane++)
+				visible[i + lane] = !((mask >> lane) & 1);
+		}
+#elif defined(CULL_SSE)
+		for (; i < n; i += 4)
+		{
+			__m128 outside = _mm_setzero_ps();
+			__m128 cx = _mm_loadu_ps(&centerX[i]), cy = _mm_loadu_ps(&centerY[i]), cz = _mm_loadu_ps(&centerZ[i]);
+			__m128 ex = _mm_loadu_ps(&extentX[i]), ey = _mm_loadu_ps(&extentY[i]), ez = _mm_loadu_ps(&extentZ[i]);
+			for (int p = 0; p < 6; p++)
+			{
+				const glm::vec4 &plane = frustum.planes[p];
+				__m128 d = _mm_add_ps(_mm_add_ps(_mm_mul_ps(cx, _mm_set1_ps(plane.x)), _mm_mul_ps(cy, _mm_set1_ps(plane.y))),
+					_mm_add_ps(_mm_mul_ps(cz, _mm_set1_ps(plane.z)), _mm_set1_ps(plane.w)));
+				__m128 r = _mm_add_ps(_mm_add_ps(_mm_mul_ps(ex, _mm_set1_ps(std::fabs(plane.x))), _mm_mul_ps(ey, _mm_set1_ps(std::fabs(plane.y)))),
+					_mm_mul_ps(ez, _mm_set1_ps(std::fabs(plane.z))));
+				outside = _mm_or_ps(outside, _mm_cmplt_ps(_mm_add_ps(d, r), _mm_setzero_ps()));
+			}
+			int mask = _mm_movemask_ps(outside);
+			for (size_t lane = 0; lane < 4 && i + lane < n; lane++)
+				visible[i + lane] = !((mask >> lane) & 1);
+		}
+#endif
+		for (; i < n; i++)
+		{
+			bool inside = true;
+			for (int p = 0; p < 6 && inside; p++)
+			{
+				const glm::vec4 &plane = frustum.planes[p];
+				float d = centerX[i] * plane.x + centerY[i] * plane.y + centerZ[i] * plane.z + plane.w;
+				float r = extentX[i] * std::fabs(plane.x) + extentY[i] * std::fabs(plane.y) + extentZ[i] * std::fabs(plane.z);
+				inside = d + r >= 0.0f;
+			}
+			visible[i] = inside;
+		}
+		pad(n);
+
+		size_t count = 0;
+		for (size_t b = 0; b < n; b++)
+			count += visible[b];
+		return count;
+	}
+
+private:
+#if defined(CULL_AVX)
+	enum { CULL_WIDTH = 8 };
+#elif defined(CULL_SSE)
+	enum { CULL_WIDTH = 4 };
+#else
+	enum { CULL_WIDTH = 1 };
+#endif
+	std::vector<float> centerX, centerY, centerZ, extentX, extentY, extentZ;
+
+	void pad(size_t n)
+	{
+		centerX.resize(n); centerY.resize(n); centerZ.resize(n);
+		extentX.resize(n); extentY.resize(n); extentZ.resize(n);
+	}
+};
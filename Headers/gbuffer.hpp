@@ -0,0 +1,112 @@
+#pragma once
+
+#include <glad/glad.h>
+
+#include <gl_state.hpp>
+
+#include <cstdio>
+
+// Render targets of the deferred path, 8 bytes of colour per pixel plus depth (layout in Shaders/gbuffer.glsl):
+//   albedoRoughness   SRGB8_A8  albedo, roughness (alpha is stored linear)
+//   normalMetalness   RGB10_A2  octahedral normal, metalness and occlusion packed in one 10 bit channel
+//   depth             DEPTH24_STENCIL8, also what the lighting pass rebuilds world positions from
+// Albedo is written with GL_FRAMEBUFFER_SRGB on, so the linear value the shader outputs is encoded on the way in
+// and decoded when the lighting pass reads it, which keeps dark albedos from banding at 8 bits.
+// The geometry pass only clears depth: the lighting pass skips pixels at the far plane, so stale colour there is
+// never read.
+class GBuffer
+{
+public:
+	GBuffer() : framebuffer(0), albedoRoughness(0), normalMetalness(0), depth(0), width(0), height(0) {}
+
+	~GBuffer() { release(); }
+
+	// (re)creates the targets when the size changed, false if the framebuffer can't be used
+	bool resize(int width, int height)
+	{
+		if (width <= 0 || height <= 0)
+			return false;
+		if (framebuffer && width == this->width && height == this->height)
+			return true;
+		release();
+		this->width = width;
+		this->height = height;
+
+		glGenFramebuffers(1, &framebuffer);
+		glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+		albedoRoughness = target(GL_SRGB8_ALPHA8, GL_RGBA, GL_UNSIGNED_BYTE);
+		normalMetalness = target(GL_RGB10_A2, GL_RGBA, GL_UNSIGNED_INT_2_10_10_10_REV);
+		depth = target(GL_DEPTH24_STENCIL8, GL_DEPTH_STENCIL, GL_UNSIGNED_INT_24_8);
+		glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, albedoRoughness, 0);
+		glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT1, GL_TEXTURE_2D, normalMetalness, 0);
+		glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_STENCIL_ATTACHMENT, GL_TEXTURE_2D, depth, 0);
+		const GLenum attachments[2] = { GL_COLOR_ATTACHMENT0, GL_COLOR_ATTACHMENT1 };
+		glDrawBuffers(2, attachments);
+
+		GLenum status = glCheckFramebufferStatus(GL_FRAMEBUFFER);
+		glBindFramebuffer(GL_FRAMEBUFFER, 0);
+		if (status != GL_FRAMEBUFFER_COMPLETE)
+		{
+			printf("ERROR::GBUFFER::INCOMPLETE status 0x%x at %dx%d\n", status, width, height);
+			release();
+			return false;
+		}
+		return true;
+	}
+
+	// binds the framebuffer for the geometry pass and clears its depth, endGeometry() goes back to the default one
+	void bindForGeometry() const
+	{
+		glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+		GlState::get().enable(GL_FRAMEBUFFER_SRGB);
+		GlState::get().depthMask(GL_TRUE);
+		glClear(GL_DEPTH_BUFFER_BIT);
+	}
+
+	void endGeometry() const
+	{
+		GlState::get().disable(GL_FRAMEBUFFER_SRGB);
+		glBindFramebuffer(GL_FRAMEBUFFER, 0);
+	}
+
+	// albedoRoughness, normalMetalness and depth on firstUnit, firstUnit + 1 and firstUnit + 2
+	void bind(unsigned int firstUnit) const
+	{
+		GlState::get().bindTextureUnit(firstUnit, GL_TEXTURE_2D, albedoRoughness);
+		GlState::get().bindTextureUnit(firstUnit + 1, GL_TEXTURE_2D, normalMetalness);
+		GlState::get().bindTextureUnit(firstUnit + 2, GL_TEXTURE_2D, depth);
+	}
+
+	bool valid() const { return framebuffer != 0; }
+
+private:
+	GLuint framebuffer, albedoRoughness, normalMetalness, depth;
+	int width, height;
+
+	// a screen sized texture, read one texel per pixel so there's no filtering or mips
+	GLuint target(GLenum internalFormat, GLenum format, GLenum type)
+	{
+		GLuint texture;
+		glGenTextures(1, &texture);
+		GlState::get().bindTexture(GL_TEXTURE_2D, texture);
+		glTexImage2D(GL_TEXTURE_2D, 0, internalFormat, width, height, 0, format, type, NULL);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+		return texture;
+	}
+
+	void release()
+	{
+		if (framebuffer)
+			glDeleteFramebuffers(1, &framebuffer);
+		GLuint textures[3] = { albedoRoughness, normalMetalness, depth };
+		if (albedoRoughness)
+			GlState::get().deleteTextures(3, textures);
+		framebuffer = albedoRoughness = normalMetalness = depth = 0;
+	}
+
+	GBuffer(const GBuffer&);
+	GBuffer &operator=(const GBuffer&);
+};
@@ -0,0 +1,172 @@
+#pragma once
+
+#include <glad/glad.h>
+
+#include <gl_state.hpp>
+
+#include <cstdint>
+#include <cstdio>
+#include <vector>
+
+// where a mesh ended up inside a GeometryArena
+struct ArenaAllocation {
+	int baseVertex;			// added to every index by glDrawElementsBaseVertex
+	size_t indexByteOffset;	// start of the mesh's indices in the arena's index buffer
+};
+
+// One vertex buffer and one index buffer behind a single VAO that many meshes are suballocated from, so a
+// whole model (or scene) draws without switching VAOs. Indices stay local to their mesh and are offset with
+// a base vertex, which keeps 16 bit indices usable for every mesh with at most 65536 vertices. 16 and 32 bit
+// indices can share the index buffer, the draw call decides how a range is read.
+// Only one vertex layout per arena, so it's built with a fixed stride and attribute setup.
+//
+// The buffers grow by doubling (copied on the GPU with glCopyBufferSubData). The VAO id never changes.
+// Must be used on the GL thread.
+class GeometryArena
+{
+public:
+	// setupAttributes is called with the VAO and vertex buffer bound whenever the vertex buffer changes
+	typedef void(*AttributeSetup)();
+
+	GeometryArena(size_t vertexStride, AttributeSetup setupAttributes, size_t vertexCapacity = 4 * 1024 * 1024, size_t indexCapacity = 1024 * 1024)
+		: stride(vertexStride), setupAttributes(setupAttributes), VAO(0), VBO(0), EBO(0),
+		vertexCapacity(vertexCapacity), indexCapacity(indexCapacity), vertexUsed(0), indexUsed(0),
+		meshCount(0), batchedMeshes(0), batchDraws(0)
+	{
+	}
+
+	unsigned int vertexArray()
+	{
+		create();
+		return VAO;
+	}
+
+	size_t vertexStride() const { return stride; }
+	size_t vertexBytes() const { return vertexUsed; }
+	size_t indexBytes() const { return indexUsed; }
+
+	// copies vertices and indices into the arena. indexType is GL_UNSIGNED_SHORT or GL_UNSIGNED_INT and must match indexData.
+	ArenaAllocation add(const void *vertexData, size_t vertexCount, const void *indexData, size_t indexCount, GLenum indexType)
+	{
+		create();
+		size_t indexSize = indexType == GL_UNSIGNED_SHORT ? 2 : 4;
+		size_t vertexBytes = vertexCount * stride;
+		// index ranges start aligned to their own size
+		size_t indexStart = (indexUsed + indexSize - 1) / indexSize * indexSize;
+		size_t indexBytes = indexCount * indexSize;
+
+		reserve(vertexUsed + vertexBytes, indexStart + indexBytes);
+
+		ArenaAllocation allocation;
+		allocation.baseVertex = (int)(vertexUsed / stride);
+		allocation.indexByteOffset = indexStart;
+
+		GlState::get().bindVertexArray(0);
+		GlState::get().bindBuffer(GL_ARRAY_BUFFER, VBO);
+		glBufferSubData(GL_ARRAY_BUFFER, vertexUsed, vertexBytes, vertexData);
+		GlState::get().bindBuffer(GL_ARRAY_BUFFER, 0);
+		GlState::get().bindBuffer(GL_COPY_WRITE_BUFFER, EBO);
+		glBufferSubData(GL_COPY_WRITE_BUFFER, indexStart, indexBytes, indexData);
+		GlState::get().bindBuffer(GL_COPY_WRITE_BUFFER, 0);
+
+		vertexUsed += vertexBytes;
+		indexUsed = indexStart + indexBytes;
+		meshCount++;
+		return allocation;
+	}
+
+	// a model drawing meshes of the arena with drawCalls multi-draws, for the stats
+	void countBatches(size_t meshes, size_t drawCalls)
+	{
+		batchedMeshes += meshes;
+		batchDraws += drawCalls;
+	}
+
+	void printStats() const
+	{
+		printf("GEOMETRYARENA:: %u meshes, vertices %.1f of %.1f KB, indices %.1f of %.1f KB\n", (unsigned int)meshCount,
+			vertexUsed / 1024.0, vertexCapacity / 1024.0, indexUsed / 1024.0, indexCapacity / 1024.0);
+		printf("GEOMETRYARENA:: batched models draw %u meshes in %u draw calls\n", (unsigned int)batchedMeshes, (unsigned int)batchDraws);
+	}
+
+private:
+	size_t stride;
+	AttributeSetup setupAttributes;
+	unsigned int VAO, VBO, EBO;
+	size_t vertexCapacity, indexCapacity;
+	size_t vertexUsed, indexUsed;
+	size_t meshCount, batchedMeshes, batchDraws;
+
+	void create()
+	{
+		if (VAO)
+			return;
+		glGenVertexArrays(1, &VAO);
+		VBO = createBuffer(vertexCapacity);
+		EBO = createBuffer(indexCapacity);
+		attach();
+	}
+
+	static unsigned int createBuffer(size_t bytes)
+	{
+		unsigned int buffer;
+		glGenBuffers(1, &buffer);
+		GlState::get().bindBuffer(GL_COPY_WRITE_BUFFER, buffer);
+		glBufferData(GL_COPY_WRITE_BUFFER, bytes, NULL, GL_STATIC_DRAW);
+		GlState::get().bindBuffer(GL_COPY_WRITE_BUFFER, 0);
+		return buffer;
+	}
+
+	// points the VAO at the current buffers
+	void attach()
+	{
+		GlState::get().bindVertexArray(VAO);
+		GlState::get().bindBuffer(GL_ARRAY_BUFFER, VBO);
+		GlState::get().bindBuffer(GL_ELEMENT_ARRAY_BUFFER, EBO);
+		setupAttributes();
+		GlState::get().bindVertexArray(0);
+		GlState::get().bindBuffer(GL_ARRAY_BUFFER, 0);
+	}
+
+	void reserve(size_t vertexBytes, size_t indexBytes)
+	{
+		bool grown = false;
+		if (vertexBytes > vertexCapacity)
+		{
+			size_t capacity = vertexCapacity ? vertexCapacity : 1;
+			while (capacity < vertexBytes)
+				capacity *= 2;
+			VBO = grow(VBO, vertexUsed, capacity);
+			vertexCapacity = capacity;
+			grown = true;
+		}
+		if (indexBytes > indexCapacity)
+		{
+			size_t capacity = indexCapacity ? indexCapacity : 1;
+			while (capacity < indexBytes)
+				capacity *= 2;
+			EBO = grow(EBO, indexUsed, capacity);
+			indexCapacity = capacity;
+			grown = true;
+		}
+		if (grown)
+			attach();
+	}
+
+	// replaces buffer with a bigger one holding the same first used bytes
+	static unsigned int grow(unsigned int buffer, size_t used, size_t capacity)
+	{
+		unsigned int bigger = createBuffer(capacity);
+		GlState::get().bindBuffer(GL_COPY_READ_BUFFER, buffer);
+		GlState::get().bindBuffer(GL_COPY_WRITE_BUFFER, bigger);
+		if (used)
+			glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, 0, 0, used);
+		GlState::get().bindBuffer(GL_COPY_READ_BUFFER, 0);
+		GlState::get().bindBuffer(GL_COPY_WRITE_BUFFER, 0);
+		GlState::get().deleteBuffers(1, &buffer);
+		return bigger;
+	}
+
+	GeometryArena(const GeometryArena&);
+	GeometryArena &operator=(const GeometryArena&);
+};
@@ -0,0 +1,330 @@
+#pragma once
+
+#include <glad/glad.h>
+
+#include <cstddef>
+#include <cstdio>
+
+// texture units and indexed uniform buffer bindings that are tracked, anything above goes straight to GL
+#define GL_STATE_TEXTURE_UNITS 16
+#define GL_STATE_UNIFORM_BINDINGS 16
+
+// what a filtered or issued call changed, for the per frame counters
+enum GlStateKind {
+	GLSTATE_PROGRAM,
+	GLSTATE_VERTEX_ARRAY,
+	GLSTATE_TEXTURE,
+	GLSTATE_BUFFER,
+	GLSTATE_FIXED_FUNCTION,	// enables, depth and blend state
+	GLSTATE_KINDS
+};
+
+// Mirror of the GL binding state, every bind in the renderer goes through here so a call that wouldn't change
+// anything never reaches the driver. It only knows what went through it: code calling GL directly has to leave
+// the state as it found it, or call invalidate() afterwards. Objects must be deleted through the delete functions
+// so a recycled name isn't mistaken for the one that is still recorded as bound.
+// Single GL thread only, like the GL calls themselves.
+class GlState
+{
+public:
+	static GlState &get()
+	{
+		static GlState state;
+		return state;
+	}
+
+	void useProgram(GLuint program)
+	{
+		if (count(GLSTATE_PROGRAM, program == currentProgram))
+			return;
+		currentProgram = program;
+		glUseProgram(program);
+	}
+
+	void bindVertexArray(GLuint vertexArray)
+	{
+		if (count(GLSTATE_VERTEX_ARRAY, vertexArray == currentVertexArray))
+			return;
+		currentVertexArray = vertexArray;
+		glBindVertexArray(vertexArray);
+	}
+
+	// GL_TEXTURE0 + n, as glActiveTexture takes it
+	void activeTexture(GLenum unit)
+	{
+		if (count(GLSTATE_TEXTURE, unit == activeUnit))
+			return;
+		activeUnit = unit;
+		glActiveTexture(unit);
+	}
+
+	// binds to the active unit
+	void bindTexture(GLenum target, GLuint texture)
+	{
+		GLuint *slot = textureSlot(activeUnit, target);
+		if (count(GLSTATE_TEXTURE, slot && *slot == texture))
+			return;
+		if (slot)
+			*slot = texture;
+		glBindTexture(target, texture);
+	}
+
+	// activeTexture and bindTexture in one go. If the texture is already there the unit isn't switched either
+	void bindTextureUnit(unsigned int unit, GLenum target, GLuint texture)
+	{
+		GLuint *slot = textureSlot(GL_TEXTURE0 + unit, target);
+		if (slot && *slot == texture)
+		{
+			counters[GLSTATE_TEXTURE].filtered += 2;
+			return;
+		}
+		activeTexture(GL_TEXTURE0 + unit);
+		bindTexture(target, texture);
+	}
+
+	// GL_ELEMENT_ARRAY_BUFFER belongs to the bound vertex array, it's passed through without being recorded
+	void bindBuffer(GLenum target, GLuint buffer)
+	{
+		GLuint *slot = bufferSlot(target);
+		if (count(GLSTATE_BUFFER, slot && *slot == buffer))
+			return;
+		if (slot)
+			*slot = buffer;
+		glBindBuffer(target, buffer);
+	}
+
+	void bindBufferBase(GLenum target, GLuint index, GLuint buffer)
+	{
+		bindBufferRange(target, index, buffer, 0, 0);
+	}
+
+	// size 0 binds the whole buffer (glBindBufferBase). Both also bind the buffer to the generic target
+	void bindBufferRange(GLenum target, GLuint index, GLuint buffer, GLintptr offset, GLsizeiptr size)
+	{
+		IndexedBinding *binding = target == GL_UNIFORM_BUFFER && index < GL_STATE_UNIFORM_BINDINGS ? &uniformBindings[index] : nullptr;
+		if (count(GLSTATE_BUFFER, binding && binding->buffer == buffer && binding->offset == offset && binding->size == size))
+			return;
+		if (binding)
+		{
+			binding->buffer = buffer;
+			binding->offset = offset;
+			binding->size = size;
+		}
+		if (GLuint *slot = bufferSlot(target))
+			*slot = buffer;
+		if (size == 0)
+			glBindBufferBase(target, index, buffer);
+		else
+			glBindBufferRange(target, index, buffer, offset, size);
+	}
+
+	void enable(GLenum capability) { setCapability(capability, true); }
+	void disable(GLenum capability) { setCapability(capability, false); }
+
+	void depthFunc(GLenum func)
+	{
+		if (count(GLSTATE_FIXED_FUNCTION, func == currentDepthFunc))
+			return;
+		currentDepthFunc = func;
+		glDepthFunc(func);
+	}
+
+	void depthMask(GLboolean mask)
+	{
+		if (count(GLSTATE_FIXED_FUNCTION, mask == currentDepthMask))
+			return;
+		currentDepthMask = mask;
+		glDepthMask(mask);
+	}
+
+	void blendFunc(GLenum source, GLenum destination)
+	{
+		if (count(GLSTATE_FIXED_FUNCTION, source == blendSource && destination == blendDestination))
+			return;
+		blendSource = source;
+		blendDestination = destination;
+		glBlendFunc(source, destination);
+	}
+
+	void deleteTextures(GLsizei n, const GLuint *textures)
+	{
+		for (GLsizei i = 0; i < n; i++)
+			for (int unit = 0; unit < GL_STATE_TEXTURE_UNITS; unit++)
+				for (int target = 0; target < TEXTURE_TARGETS; target++)
+					if (boundTextures[unit][target] == textures[i])
+						boundTextures[unit][target] = 0;
+		glDeleteTextures(n, textures);
+	}
+
+	void deleteBuffers(GLsizei n, const GLuint *buffers)
+	{
+		for (GLsizei i = 0; i < n; i++)
+		{
+			for (int target = 0; target < BUFFER_TARGETS; target++)
+				if (boundBuffers[target] == buffers[i])
+					boundBuffers[target] = 0;
+			for (int index = 0; index < GL_STATE_UNIFORM_BINDINGS; index++)
+				if (uniformBindings[index].buffer == buffers[i])
+					uniformBindings[index] = IndexedBinding();
+		}
+		glDeleteBuffers(n, buffers);
+	}
+
+	void deleteVertexArrays(GLsizei n, const GLuint *vertexArrays)
+	{
+		for (GLsizei i = 0; i < n; i++)
+			if (currentVertexArray == vertexArrays[i])
+				currentVertexArray = 0;
+		glDeleteVertexArrays(n, vertexArrays);
+	}
+
+	void deleteProgram(GLuint program)
+	{
+		if (currentProgram == program)
+			currentProgram = 0;
+		glDeleteProgram(program);
+	}
+
+	// forget everything, the next call of each kind goes to GL. For after code that changed state behind our back
+	void invalidate()
+	{
+		currentProgram = UNKNOWN;
+		currentVertexArray = UNKNOWN;
+		activeUnit = UNKNOWN;
+		for (int unit = 0; unit < GL_STATE_TEXTURE_UNITS; unit++)
+			for (int target = 0; target < TEXTURE_TARGETS; target++)
+				boundTextures[unit][target] = UNKNOWN;
+		for (int target = 0; target < BUFFER_TARGETS; target++)
+			boundBuffers[target] = UNKNOWN;
+		for (int index = 0; index < GL_STATE_UNIFORM_BINDINGS; index++)
+			uniformBindings[index] = IndexedBinding();
+		for (int capability = 0; capability < CAPABILITIES; capability++)
+			capabilities[capability] = -1;
+		currentDepthFunc = UNKNOWN;
+		currentDepthMask = 0xFF;
+		blendSource = blendDestination = UNKNOWN;
+	}
+
+	// closes the frame's counters, printStats() reports the last closed frame
+	void endFrame()
+	{
+		for (int kind = 0; kind < GLSTATE_KINDS; kind++)
+		{
+			lastFrame[kind] = counters[kind];
+			counters[kind] = Counter();
+		}
+	}
+
+	void printStats() const
+	{
+		static const char *names[GLSTATE_KINDS] = { "program", "vertex array", "texture", "buffer", "fixed function" };
+		size_t issued = 0, filtered = 0;
+		for (int kind = 0; kind < GLSTATE_KINDS; kind++)
+		{
+			issued += lastFrame[kind].issued;
+			filtered += lastFrame[kind].filtered;
+		}
+		printf("GLSTATE:: last frame %u calls issued, %u redundant ones filtered\n", (unsigned int)issued, (unsigned int)filtered);
+		for (int kind = 0; kind < GLSTATE_KINDS; kind++)
+			printf("  %-15s %6u issued %6u filtered\n", names[kind], (unsigned int)lastFrame[kind].issued, (unsigned int)lastFrame[kind].filtered);
+	}
+
+private:
+	enum { TEXTURE_TARGETS = 5, BUFFER_TARGETS = 7, CAPABILITIES = 8 };
+	static const GLuint UNKNOWN = 0xFFFFFFFFu;
+
+	struct Counter {
+		size_t issued, filtered;
+		Counter() : issued(0), filtered(0) {}
+	};
+
+	struct IndexedBinding {
+		GLuint buffer;
+		GLintptr offset;
+		GLsizeiptr size;
+		IndexedBinding() : buffer(UNKNOWN), offset(0), size(0) {}
+	};
+
+	GLuint currentProgram, currentVertexArray;
+	GLenum activeUnit;
+	GLuint boundTextures[GL_STATE_TEXTURE_UNITS][TEXTURE_TARGETS];
+	GLuint boundBuffers[BUFFER_TARGETS];
+	IndexedBinding uniformBindings[GL_STATE_UNIFORM_BINDINGS];
+	int capabilities[CAPABILITIES];	// -1 unknown
+	GLenum currentDepthFunc;
+	GLuint currentDepthMask;
+	GLenum blendSource, blendDestination;
+	Counter counters[GLSTATE_KINDS], lastFrame[GLSTATE_KINDS];
+
+	GlState() { invalidate(); }
+
+	// counts the call, returns redundant so callers can bail out
+	bool count(GlStateKind kind, bool redundant)
+	{
+		if (redundant)
+			counters[kind].filtered++;
+		else
+			counters[kind].issued++;
+		return redundant;
+	}
+
+	GLuint *textureSlot(GLenum unit, GLenum target)
+	{
+		if (unit < GL_TEXTURE0 || unit >= GL_TEXTURE0 + GL_STATE_TEXTURE_UNITS)
+			return nullptr;
+		int index;
+		switch (target)
+		{
+		case GL_TEXTURE_2D: index = 0; break;
+		case GL_TEXTURE_2D_ARRAY: index = 1; break;
+		case GL_TEXTURE_CUBE_MAP: index = 2; break;
+		case GL_TEXTURE_3D: index = 3; break;
+		case GL_TEXTURE_BUFFER: index = 4; break;
+		default: return nullptr;
+		}
+		return &boundTextures[unit - GL_TEXTURE0][index];
+	}
+
+	GLuint *bufferSlot(GLenum target)
+	{
+		switch (target)
+		{
+		case GL_ARRAY_BUFFER: return &boundBuffers[0];
+		case GL_UNIFORM_BUFFER: return &boundBuffers[1];
+		case GL_PIXEL_UNPACK_BUFFER: return &boundBuffers[2];
+		case GL_PIXEL_PACK_BUFFER: return &boundBuffers[3];
+		case GL_COPY_READ_BUFFER: return &boundBuffers[4];
+		case GL_COPY_WRITE_BUFFER: return &boundBuffers[5];
+		case GL_TEXTURE_BUFFER: return &boundBuffers[6];
+		}
+		return nullptr;
+	}
+
+	void setCapability(GLenum capability, bool on)
+	{
+		int index;
+		switch (capability)
+		{
+		case GL_DEPTH_TEST: index = 0; break;
+		case GL_BLEND: index = 1; break;
+		case GL_CULL_FACE: index = 2; break;
+		case GL_MULTISAMPLE: index = 3; break;
+		case GL_STENCIL_TEST: index = 4; break;
+		case GL_SCISSOR_TEST: index = 5; break;
+		case GL_FRAMEBUFFER_SRGB: index = 6; break;
+		case GL_TEXTURE_CUBE_MAP_SEAMLESS: index = 7; break;
+		default: index = -1;
+		}
+		if (count(GLSTATE_FIXED_FUNCTION, index >= 0 && capabilities[index] == (int)on))
+			return;
+		if (index >= 0)
+			capabilities[index] = on;
+		if (on)
+			glEnable(capability);
+		else
+			glDisable(capability);
+	}
+
+	GlState(const GlState&);
+	GlState &operator=(const GlState&);
+};
@@ -0,0 +1,71 @@
+#pragma once
+
+#include <glad/glad.h>
+
+#include <cstdio>
+
+// queries in flight per timer. Results are read a few frames late so reading them never waits on the GPU
+#define GPU_TIMER_LATENCY 4
+
+// GPU time of a stretch of GL commands, measured with GL_TIME_ELAPSED queries. Only one timer can be between
+// begin() and end() at a time, that's a limit of the query target, so passes are timed one after another.
+class GpuTimer
+{
+public:
+	GpuTimer() : queries(), issued(), next(0), lastMs(0.0) {}
+
+	~GpuTimer()
+	{
+		if (queries[0])
+			glDeleteQueries(GPU_TIMER_LATENCY, queries);
+	}
+
+	void begin()
+	{
+		if (!queries[0])
+			glGenQueries(GPU_TIMER_LATENCY, queries);
+		// the oldest query gets reused, collect its result first
+		collect(next);
+		glBeginQuery(GL_TIME_ELAPSED, queries[next]);
+	}
+
+	void end()
+	{
+		glEndQuery(GL_TIME_ELAPSED);
+		issued[next] = true;
+		next = (next + 1) % GPU_TIMER_LATENCY;
+	}
+
+	// the latest result that came back, in milliseconds
+	double milliseconds() const { return lastMs; }
+
+	void print(const char *name) const
+	{
+		printf("GPUTIMER:: %s %.3f ms\n", name, lastMs);
+	}
+
+private:
+	GLuint queries[GPU_TIMER_LATENCY];
+	bool issued[GPU_TIMER_LATENCY];
+	int next;
+	double lastMs;
+
+	void collect(int slot)
+	{
+		if (!issued[slot])
+			return;
+		GLint available = 0;
+		glGetQueryObjectiv(queries[slot], GL_QUERY_RESULT_AVAILABLE, &available);
+		if (available)
+		{
+			GLuint64 nanoseconds = 0;
+			glGetQueryObjectui64v(queries[slot], GL_QUERY_RESULT, &nanoseconds);
+			lastMs = nanoseconds / 1e6;
+		}
+		// not back yet, the result is dropped rather than waited for
+		issued[slot] = false;
+	}
+
+	GpuTimer(const GpuTimer&);
+	GpuTimer &operator=(const GpuTimer&);
+};
@@ -8,12 +8,17 @@
 #include <vector>
 #include <iostream>
 
+#include <frustum_culling.hpp>
+#include <gl_state.hpp>
 #include <shader.hpp>
 
 // Reference: https://github.com/nothings/stb/blob/master/stb_image.h#L4
 // To use stb_image, add this in *one* C++ source file.
 #include <stb_image.h>
 
+// quads per side of a culling chunk of the terrain
+#define HEIGHTMAP_CHUNK_QUADS 32
+
 struct Vertex {
 	// position
 	glm::vec3 Position;
@@ -37,9 +42,16 @@ public:
 
 	// Heightmap data
 	std::vector<Vertex> vertices;
-	// indices for EBO
+	// indices for EBO, chunk by chunk
 	std::vector<unsigned int> indices;
 
+	// a square of the terrain, its triangles are one range of indices
+	struct Chunk {
+		unsigned int indexOffset, indexCount;
+		glm::vec3 boundsMin, boundsMax;	// object space
+	};
+	std::vector<Chunk> chunks;
+
 
 	// constructor
 	Heightmap(const char* heightmapPath)
@@ -59,15 +71,16 @@ public:
 		setup_heightmap();
 	}
 
-	// render the mesh
-	void Draw(Shader shader, unsigned int textureID)
+	// render the mesh. With viewProjection the chunks outside the frustum are skipped, the visible ones go out as
+	// one draw per run of neighbouring chunks
+	void Draw(Shader &shader, unsigned int textureID, const glm::mat4 *viewProjection = nullptr)
 	{
 		// Set the shader properties
 		shader.use();
 		glm::mat4 heightmap_model;
 		heightmap_model = glm::translate(heightmap_model, glm::vec3(0.0f, -10.0f, 0.0f));
 		heightmap_model = glm::scale(heightmap_model, glm::vec3(20.0f, 10.0f, 20.0f));
-		shader.setMat4("model", heightmap_model);
+		UniformBuffers::get().setObject(heightmap_model);
 
 
 		// Set material properties
@@ -75,31 +88,50 @@ public:
 		shader.setFloat("material.shininess", 64.0f);
 
 
-		// active proper texture unit before binding
-		glActiveTexture(GL_TEXTURE0);
-		// and finally bind the textures
-		glBindTexture(GL_TEXTURE_2D, textureID);
+		// texture on unit 0 and the VAO, both skipped when they are already bound
+		GlState::get().bindTextureUnit(0, GL_TEXTURE_2D, textureID);
 
 		// draw mesh
-		glBindVertexArray(VAO);
-		glDrawElements(GL_TRIANGLES, indices.size(), GL_UNSIGNED_INT, 0);
-		glBindVertexArray(0);
+		GlState::get().bindVertexArray(VAO);
+		if (!viewProjection)
+		{
+			glDrawElements(GL_TRIANGLES, indices.size(), GL_UNSIGNED_INT, 0);
+			return;
+		}
 
-		// always good practice to set everything back to defaults once configured.
-		glActiveTexture(GL_TEXTURE0);
+		// object space frustum, the chunk boxes never change
+		size_t visible = chunkCuller.cull(Frustum(*viewProjection * heightmap_model), chunkVisible);
+		CullStats::get().count(CULL_TERRAIN, visible, chunks.size());
+		for (size_t i = 0; i < chunks.size();)
+		{
+			if (!chunkVisible[i])
+			{
+				i++;
+				continue;
+			}
+			// chunks are consecutive in the index buffer, a run of visible ones is one range
+			size_t end = i;
+			unsigned int count = 0;
+			while (end < chunks.size() && chunkVisible[end])
+				count += chunks[end++].indexCount;
+			glDrawElements(GL_TRIANGLES, count, GL_UNSIGNED_INT, (void*)(chunks[i].indexOffset * sizeof(unsigned int)));
+			i = end;
+		}
 	}
 
 	void delete_buffers()
 	{
-		glDeleteVertexArrays(1, &VAO);
-		glDeleteBuffers(1, &VBO);
-		glDeleteBuffers(1, &EBO);
+		GlState::get().deleteVertexArrays(1, &VAO);
+		GlState::get().deleteBuffers(1, &VBO);
+		GlState::get().deleteBuffers(1, &EBO);
 	}
 
 private:
 
 	/*  Render data  */
 	unsigned int VBO , EBO;
+	BoxCuller chunkCuller;
+	std::vector<uint8_t> chunkVisible;
 
 	void load_heightmap(const char* heightmapPath)
 	{
@@ -158,12 +190,24 @@ private:
 	}
 
 
+	// quads are emitted chunk by chunk so each chunk is one range of the index buffer
 	void create_indices()
 	{
+		for (int x = 0; x < width - 1; x += HEIGHTMAP_CHUNK_QUADS)
+			for (int y = 0; y < height - 1; y += HEIGHTMAP_CHUNK_QUADS)
+				create_chunk(x, y);
+	}
+
+	void create_chunk(int chunkX, int chunkY)
+	{
+		Chunk chunk;
+		chunk.indexOffset = (unsigned int)indices.size();
+		chunk.boundsMin = chunk.boundsMax = vertices[chunkX*width + chunkY].Position;
+
 		// convert heightmap to floats and set texture coordinates.  Also set normals for each triangle we define.
-		for (int x = 0; x < width - 1; x++)
+		for (int x = chunkX; x < width - 1 && x < chunkX + HEIGHTMAP_CHUNK_QUADS; x++)
 		{
-			for (int y = 0; y < height - 1; y++)
+			for (int y = chunkY; y < height - 1 && y < chunkY + HEIGHTMAP_CHUNK_QUADS; y++)
 			{
 
 				unsigned int a, b, c, d;
@@ -187,10 +231,19 @@ private:
 
 				//And again, add normals. 
 				set_normals(vertices[b], vertices[d], vertices[c]);
- 
+
+				unsigned int corners[4] = { a, b, c, d };
+				for (int i = 0; i < 4; i++)
+				{
+					chunk.boundsMin = glm::min(chunk.boundsMin, vertices[corners[i]].Position);
+					chunk.boundsMax = glm::max(chunk.boundsMax, vertices[corners[i]].Position);
+				}
 			}
 
 		}
+		chunk.indexCount = (unsigned int)indices.size() - chunk.indexOffset;
+		chunks.push_back(chunk);
+		chunkCuller.add(chunk.boundsMin, chunk.boundsMax);
 	}
 	
 
@@ -201,15 +254,15 @@ private:
 		glGenBuffers(1, &VBO);
 		glGenBuffers(1, &EBO);
 
-		glBindVertexArray(VAO);
+		GlState::get().bindVertexArray(VAO);
 		// load data into vertex buffers
-		glBindBuffer(GL_ARRAY_BUFFER, VBO);
+		GlState::get().bindBuffer(GL_ARRAY_BUFFER, VBO);
 		// A great thing about structs is that their memory layout is sequential for all its items.
 		// The effect is that we can simply pass a pointer to the struct and it translates perfectly to a glm::vec3/3/2 array which
 		// again translates to 3/3/2 floats which translates to a byte array.
 		glBufferData(GL_ARRAY_BUFFER, vertices.size() * sizeof(Vertex), &vertices[0], GL_STATIC_DRAW);
 
-		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, EBO);
+		GlState::get().bindBuffer(GL_ELEMENT_ARRAY_BUFFER, EBO);
 		glBufferData(GL_ELEMENT_ARRAY_BUFFER, indices.size() * sizeof(unsigned int), &indices[0], GL_STATIC_DRAW);
 
 		// set the vertex attribute pointers
@@ -224,7 +277,7 @@ private:
 		glEnableVertexAttribArray(2);
 		glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)offsetof(Vertex, TexCoords));
 
-		glBindVertexArray(0);
+		GlState::get().bindVertexArray(0);
 	}
 
 };
@@ -0,0 +1,624 @@
+#pragma once
+
+#include <glad/glad.h>
+#include <stb_image.h>
+
+#include <gl_state.hpp>
+#include <file_utils.hpp>
+#include <thread_pool.hpp>
+
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define IBL_SSE 1
+#endif
+
+// Image based lighting precompute for an equirectangular HDR environment. Everything the PBR shader needs
+// for ambient light is integrated once on the CPU (all cores, SSE where it helps):
+//   - irradiance as 9 spherical harmonics coefficients, with the cosine lobe and 1/pi folded in so the shader
+//     gets diffuse irradiance from a handful of multiply-adds
+//   - a GGX prefiltered specular cubemap, mip n holds roughness n / (mips - 1)
+//   - the split sum BRDF LUT, (scale, bias) to apply to F0, indexed by (NdotV, roughness)
+// Roughness here is perceptual, alpha = roughness^2 like the shader's GGX.
+//
+// The result is cached next to the HDR as "<hdr>.iblcache", keyed by a hash of the source file. Bump
+// IBL_CACHE_VERSION when anything below changes the baked data.
+#define IBL_CACHE_VERSION 1
+#define IBL_SPECULAR_SIZE 128
+#define IBL_SPECULAR_MIPS 6
+#define IBL_SPECULAR_SAMPLES 128
+#define IBL_BRDF_LUT_SIZE 64
+#define IBL_BRDF_SAMPLES 512
+
+struct IblData {
+	float sh[9][3];
+	int specularSize, specularMips;
+	std::vector<float> specular;	// RGB, mips largest first, each mip holds the 6 faces in GL cube order
+	int lutSize;
+	std::vector<float> brdfLut;		// RG, row = roughness, column = NdotV
+
+	IblData() : specularSize(0), specularMips(0), lutSize(0) { memset(sh, 0, sizeof(sh)); }
+
+	int faceSize(int mip) const { return specularSize >> mip > 0 ? specularSize >> mip : 1; }
+
+	// offset in floats of a face in specular
+	size_t faceOffset(int mip, int face) const
+	{
+		size_t offset = 0;
+		for (int m = 0; m < mip; m++)
+			offset += (size_t)faceSize(m) * faceSize(m) * 3 * 6;
+		return offset + (size_t)faceSize(mip) * faceSize(mip) * 3 * face;
+	}
+};
+
+// the GL side, what pbrShader binds
+struct IblMaps {
+	float sh[9][3];
+	unsigned int specularCube;
+	unsigned int brdfLut;
+	float specularMaxLod;
+
+	IblMaps() : specularCube(0), brdfLut(0), specularMaxLod(0.0f) { memset(sh, 0, sizeof(sh)); }
+	bool valid() const { return specularCube != 0 && brdfLut != 0; }
+};
+
+struct IblCacheHeader {
+	char magic[4];
+	uint32_t version;
+	uint64_t sourceHash;
+	uint32_t specularSize;
+	uint32_t specularMips;
+	uint32_t lutSize;
+	uint32_t reserved;
+};
+
+class IblBaker
+{
+public:
+	static std::string cachePathFor(const std::string &hdrPath)
+	{
+		return hdrPath + ".iblcache";
+	}
+
+	// bakes (or reads from the cache) and uploads the maps for an HDR file. Must be called on the GL thread.
+	static IblMaps load(const std::string &hdrPath)
+	{
+		std::chrono::high_resolution_clock::time_point start = std::chrono::high_resolution_clock::now();
+		IblMaps maps;
+		IblData data;
+		uint64_t sourceHash;
+		if (!hash_file(hdrPath, sourceHash))
+		{
+			printf("ERROR::IBL:: could not read %s\n", hdrPath.c_str());
+			return maps;
+		}
+
+		std::string cachePath = cachePathFor(hdrPath);
+		bool cached = readCache(cachePath, sourceHash, data);
+		if (!cached)
+		{
+			int width, height, components;
+			float *pixels = stbi_loadf(hdrPath.c_str(), &width, &height, &components, 3);
+			if (!pixels)
+			{
+				printf("ERROR::IBL:: could not decode %s\n", hdrPath.c_str());
+				return maps;
+			}
+			bake(pixels, width, height, data, ThreadPool::shared());
+			stbi_image_free(pixels);
+			if (!writeCache(cachePath, sourceHash, data))
+				printf("ERROR::IBL:: could not write %s\n", cachePath.c_str());
+		}
+
+		memcpy(maps.sh, data.sh, sizeof(maps.sh));
+		maps.specularCube = uploadSpecular(data);
+		maps.brdfLut = uploadBrdfLut(data);
+		maps.specularMaxLod = (float)(data.specularMips - 1);
+
+		double ms = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+		printf("IBL:: %s %s in %.1f ms (%dx%d specular, %d mips, %dx%d BRDF LUT)\n", cached ? "loaded" : "baked", hdrPath.c_str(), ms,
+			data.specularSize, data.specularSize, data.specularMips, data.lutSize, data.lutSize);
+		return maps;
+	}
+
+	// rgb is the equirectangular image as stb_image decodes it (top row first, 3 floats per pixel)
+	static void bake(const float *rgb, int width, int height, IblData &out, ThreadPool &pool)
+	{
+		std::vector<EquirectLevel> levels;
+		buildEquirectChain(rgb, width, height, levels);
+		projectSH(levels[0], out.sh, pool);
+		prefilterSpecular(levels, IBL_SPECULAR_SIZE, IBL_SPECULAR_MIPS, out, pool);
+		integrateBrdf(IBL_BRDF_LUT_SIZE, out, pool);
+	}
+
+	static bool readCache(const std::string &cachePath, uint64_t sourceHash, IblData &data)
+	{
+		MappedFile file;
+		if (!file.open(cachePath) || file.size() < sizeof(IblCacheHeader))
+			return false;
+		IblCacheHeader header;
+		memcpy(&header, file.data(), sizeof(header));
+		if (memcmp(header.magic, "RIBL", 4) != 0 || header.version != IBL_CACHE_VERSION || header.sourceHash != sourceHash ||
+			header.specularSize != IBL_SPECULAR_SIZE || header.specularMips != IBL_SPECULAR_MIPS || header.lutSize != IBL_BRDF_LUT_SIZE)
+			return false;
+
+		data.specularSize = IBL_SPECULAR_SIZE;
+		data.specularMips = IBL_SPECULAR_MIPS;
+		data.lutSize = IBL_BRDF_LUT_SIZE;
+		size_t specularFloats = data.faceOffset(data.specularMips, 0);
+		size_t lutFloats = (size_t)data.lutSize * data.lutSize * 2;
+		if (file.size() != sizeof(IblCacheHeader) + (27 + specularFloats + lutFloats) * sizeof(float))
+			return false;
+
+		const unsigned char *p = file.data() + sizeof(IblCacheHeader);
+		memcpy(data.sh, p, sizeof(data.sh));
+		p += sizeof(data.sh);
+		data.specular.resize(specularFloats);
+		memcpy(&data.specular[0], p, specularFloats * sizeof(float));
+		p += specularFloats * sizeof(float);
+		data.brdfLut.resize(lutFloats);
+		memcpy(&data.brdfLut[0], p, lutFloats * sizeof(float));
+		return true;
+	}
+
+	static bool writeCache(const std::string &cachePath, uint64_t sourceHash, const IblData &data)
+	{
+		IblCacheHeader header;
+		memcpy(header.magic, "RIBL", 4);
+		header.version = IBL_CACHE_VERSION;
+		header.sourceHash = sourceHash;
+		header.specularSize = data.specularSize;
+		header.specularMips = data.specularMips;
+		header.lutSize = data.lutSize;
+		header.reserved = 0;
+
+		std::vector<unsigned char> out(sizeof(header) + sizeof(data.sh) + (data.specular.size() + data.brdfLut.size()) * sizeof(float));
+		unsigned char *p = &out[0];
+		memcpy(p, &header, sizeof(header));
+		p += sizeof(header);
+		memcpy(p, data.sh, sizeof(data.sh));
+		p += sizeof(data.sh);
+		memcpy(p, data.specular.data(), data.specular.size() * sizeof(float));
+		p += data.specular.size() * sizeof(float);
+		memcpy(p, data.brdfLut.data(), data.brdfLut.size() * sizeof(float));
+		return write_file_atomic(cachePath, out.data(), out.size());
+	}
+
+	static unsigned int uploadSpecular(const IblData &data)
+	{
+		unsigned int id;
+		glGenTextures(1, &id);
+		GlState::get().bindTexture(GL_TEXTURE_CUBE_MAP, id);
+		for (int mip = 0; mip < data.specularMips; mip++)
+			for (int face = 0; face < 6; face++)
+				glTexImage2D(GL_TEXTURE_CUBE_MAP_POSITIVE_X + face, mip, GL_RGB16F, data.faceSize(mip), data.faceSize(mip), 0, GL_RGB, GL_FLOAT,
+					&data.specular[data.faceOffset(mip, face)]);
+		glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_BASE_LEVEL, 0);
+		glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MAX_LEVEL, data.specularMips - 1);
+		glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+		glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+		glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
+		glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+		glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+		// the small rough mips would show their face edges otherwise
+		GlState::get().enable(GL_TEXTURE_CUBE_MAP_SEAMLESS);
+		return id;
+	}
+
+	static unsigned int uploadBrdfLut(const IblData &data)
+	{
+		unsigned int id;
+		glGenTextures(1, &id);
+		GlState::get().bindTexture(GL_TEXTURE_2D, id);
+		glTexImage2D(GL_TEXTURE_2D, 0, GL_RG16F, data.lutSize, data.lutSize, 0, GL_RG, GL_FLOAT, data.brdfLut.data());
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+		return id;
+	}
+
+private:
+	struct EquirectLevel {
+		int width, height;
+		std::vector<float> rgb;
+	};
+
+	// a sample direction in the tangent frame of the lookup direction (N = V = R), with its weight and source mip
+	struct PrefilterSample {
+		float x, y, z;
+		float weight;
+		float lod;
+	};
+
+	// the equirect image and its 2x2 box filtered mips, sampled at a lower level the wider a GGX sample's lobe
+	static void buildEquirectChain(const float *rgb, int width, int height, std::vector<EquirectLevel> &levels)
+	{
+		levels.resize(1);
+		levels[0].width = width;
+		levels[0].height = height;
+		levels[0].rgb.assign(rgb, rgb + (size_t)width * height * 3);
+		while (levels.back().width > 1 && levels.back().height > 1)
+		{
+			const EquirectLevel &src = levels.back();
+			EquirectLevel next;
+			next.width = src.width / 2;
+			next.height = src.height / 2;
+			next.rgb.resize((size_t)next.width * next.height * 3);
+			for (int y = 0; y < next.height; y++)
+				for (int x = 0; x < next.width; x++)
+					for (int c = 0; c < 3; c++)
+					{
+						const float *row0 = &src.rgb[((size_t)(y * 2) * src.width + x * 2) * 3 + c];
+						const float *row1 = row0 + (size_t)src.width * 3;
+						next.rgb[((size_t)y * next.width + x) * 3 + c] = (row0[0] + row0[3] + row1[0] + row1[3]) * 0.25f;
+					}
+			levels.push_back(next);
+		}
+	}
+
+	// longitude/latitude of a direction, the same mapping the skybox shaders use for equirect maps (+y up)
+	static void directionToEquirect(float x, float y, float z, float &u, float &v)
+	{
+		u = atan2f(z, x) * (0.5f / 3.14159265f) + 0.5f;
+		v = 0.5f - asinf(y < -1.0f ? -1.0f : (y > 1.0f ? 1.0f : y)) * (1.0f / 3.14159265f);
+	}
+
+	// bilinear, wrapping around in longitude and clamped at the poles
+	static void sampleBilinear(const EquirectLevel &level, float u, float v, float *out)
+	{
+		float fx = u * level.width - 0.5f;
+		float fy = v * level.height - 0.5f;
+		int x0 = (int)floorf(fx), y0 = (int)floorf(fy);
+		float tx = fx - x0, ty = fy - y0;
+		int x1 = x0 + 1, y1 = y0 + 1;
+		x0 = (x0 % level.width + level.width) % level.width;
+		x1 = (x1 % level.width + level.width) % level.width;
+		y0 = y0 < 0 ? 0 : (y0 >= level.height ? level.height - 1 : y0);
+		y1 = y1 < 0 ? 0 : (y1 >= level.height ? level.height - 1 : y1);
+		const float *a = &level.rgb[((size_t)y0 * level.width + x0) * 3];
+		const float *b = &level.rgb[((size_t)y0 * level.width + x1) * 3];
+		const float *c = &level.rgb[((size_t)y1 * level.width + x0) * 3];
+		const float *d = &level.rgb[((size_t)y1 * level.width + x1) * 3];
+		for (int k = 0; k < 3; k++)
+		{
+			float top = a[k] + (b[k] - a[k]) * tx;
+			float bottom = c[k] + (d[k] - c[k]) * tx;
+			out[k] = top + (bottom - top) * ty;
+		}
+	}
+
+	// trilinear between the two nearest levels
+	static void sampleEquirect(const std::vector<EquirectLevel> &levels, float x, float y, float z, float lod, float *out)
+	{
+		float u, v;
+		directionToEquirect(x, y, z, u, v);
+		float maxLod = (float)(levels.size() - 1);
+		lod = lod < 0.0f ? 0.0f : (lod > maxLod ? maxLod : lod);
+		int l0 = (int)lod;
+		float t = lod - l0;
+		sampleBilinear(levels[l0], u, v, out);
+		if (t > 0.0f && l0 + 1 < (int)levels.size())
+		{
+			float upper[3];
+			sampleBilinear(levels[l0 + 1], u, v, upper);
+			for (int k = 0; k < 3; k++)
+				out[k] += (upper[k] - out[k]) * t;
+		}
+	}
+
+	// direction through the centre of a cube map texel, GL face order and orientation
+	static void cubeDirection(int face, float sc, float tc, float *dir)
+	{
+		switch (face)
+		{
+		case 0: dir[0] = 1.0f; dir[1] = -tc; dir[2] = -sc; break;
+		case 1: dir[0] = -1.0f; dir[1] = -tc; dir[2] = sc; break;
+		case 2: dir[0] = sc; dir[1] = 1.0f; dir[2] = tc; break;
+		case 3: dir[0] = sc; dir[1] = -1.0f; dir[2] = -tc; break;
+		case 4: dir[0] = sc; dir[1] = -tc; dir[2] = 1.0f; break;
+		default: dir[0] = -sc; dir[1] = -tc; dir[2] = -1.0f; break;
+		}
+		float length = sqrtf(dir[0] * dir[0] + dir[1] * dir[1] + dir[2] * dir[2]);
+		for (int k = 0; k < 3; k++)
+			dir[k] /= length;
+	}
+
+	static float radicalInverse(uint32_t bits)
+	{
+		bits = (bits << 16u) | (bits >> 16u);
+		bits = ((bits & 0x55555555u) << 1u) | ((bits & 0xAAAAAAAAu) >> 1u);
+		bits = ((bits & 0x33333333u) << 2u) | ((bits & 0xCCCCCCCCu) >> 2u);
+		bits = ((bits & 0x0F0F0F0Fu) << 4u) | ((bits & 0xF0F0F0F0u) >> 4u);
+		bits = ((bits & 0x00FF00FFu) << 8u) | ((bits & 0xFF00FF00u) >> 8u);
+		return (float)bits * 2.3283064365386963e-10f;
+	}
+
+	// GGX distributed half vector around +z for the i-th of count Hammersley points
+	static void importanceSampleGGX(uint32_t i, uint32_t count, float alpha, float *h)
+	{
+		float phi = 2.0f * 3.14159265f * (i + 0.5f) / count;
+		float xi = radicalInverse(i);
+		float cosTheta = sqrtf((1.0f - xi) / (1.0f + (alpha * alpha - 1.0f) * xi));
+		float sinTheta = sqrtf(1.0f - cosTheta * cosTheta);
+		h[0] = sinTheta * cosf(phi);
+		h[1] = sinTheta * sinf(phi);
+		h[2] = cosTheta;
+	}
+
+	// L2 projection of the radiance, one row at a time on the pool. Each row's sum is kept separately and
+	// added up in order afterwards so the result doesn't depend on scheduling.
+	static void projectSH(const EquirectLevel &level, float sh[9][3], ThreadPool &pool)
+	{
+		int width = level.width, height = level.height;
+		std::vector<float> cosPhi(width + 3, 0.0f), sinPhi(width + 3, 0.0f);
+		for (int x = 0; x < width; x++)
+		{
+			float phi = ((x + 0.5f) / width - 0.5f) * 2.0f * 3.14159265f;
+			cosPhi[x] = cosf(phi);
+			sinPhi[x] = sinf(phi);
+		}
+
+		std::vector<double> rows((size_t)height * 27, 0.0);
+		pool.parallel_for(height, [&](size_t y) {
+			float latitude = (0.5f - (y + 0.5f) / height) * 3.14159265f;
+			float cosLat = cosf(latitude), sinLat = sinf(latitude);
+			// solid angle of a texel in this row
+			float dOmega = (2.0f * 3.14159265f / width) * (3.14159265f / height) * cosLat;
+			const float *src = &level.rgb[y * width * 3];
+			float sum[9][3];
+			memset(sum, 0, sizeof(sum));
+			int x = 0;
+#ifdef IBL_SSE
+			__m128 acc[9][3];
+			for (int i = 0; i < 9; i++)
+				for (int c = 0; c < 3; c++)
+					acc[i][c] = _mm_setzero_ps();
+			__m128 cl = _mm_set1_ps(cosLat), dy = _mm_set1_ps(sinLat);
+			for (; x + 4 <= width; x += 4)
+			{
+				__m128 dx = _mm_mul_ps(cl, _mm_loadu_ps(&cosPhi[x]));
+				__m128 dz = _mm_mul_ps(cl, _mm_loadu_ps(&sinPhi[x]));
+				__m128 basis[9];
+				shBasis(dx, dy, dz, basis);
+				const float *p = src + x * 3;
+				__m128 radiance[3];
+				for (int c = 0; c < 3; c++)
+					radiance[c] = _mm_set_ps(p[9 + c], p[6 + c], p[3 + c], p[c]);
+				for (int i = 0; i < 9; i++)
+					for (int c = 0; c < 3; c++)
+						acc[i][c] = _mm_add_ps(acc[i][c], _mm_mul_ps(basis[i], radiance[c]));
+			}
+			for (int i = 0; i < 9; i++)
+				for (int c = 0; c < 3; c++)
+				{
+					float lanes[4];
+					_mm_storeu_ps(lanes, acc[i][c]);
+					sum[i][c] = (lanes[0] + lanes[1]) + (lanes[2] + lanes[3]);
+				}
+#endif
+			for (; x < width; x++)
+			{
+				float basis[9];
+				shBasis(cosLat * cosPhi[x], sinLat, cosLat * sinPhi[x], basis);
+				for (int i = 0; i < 9; i++)
+					for (int c = 0; c < 3; c++)
+						sum[i][c] += basis[i] * src[x * 3 + c];
+			}
+			for (int i = 0; i < 9; i++)
+				for (int c = 0; c < 3; c++)
+					rows[y * 27 + i * 3 + c] = (double)sum[i][c] * dOmega;
+		});
+
+		// convolution with the clamped cosine (pi, 2pi/3, pi/4 per band) and the 1/pi of the Lambert BRDF
+		static const double band[9] = { 1.0, 2.0 / 3.0, 2.0 / 3.0, 2.0 / 3.0, 0.25, 0.25, 0.25, 0.25, 0.25 };
+		for (int i = 0; i < 9; i++)
+			for (int c = 0; c < 3; c++)
+			{
+				double total = 0.0;
+				for (int y = 0; y < height; y++)
+					total += rows[(size_t)y * 27 + i * 3 + c];
+				// the shader evaluates the bare polynomials, so the basis constant goes in a second time
+				sh[i][c] = (float)(total * band[i] * shConstant(i));
+			}
+	}
+
+	static double shConstant(int i)
+	{
+		static const double k[9] = { 0.282095, 0.488603, 0.488603, 0.488603, 1.092548, 1.092548, 0.315392, 1.092548, 0.546274 };
+		return k[i];
+	}
+
+	// real SH basis up to l = 2, in the order the shader expects: 1, y, z, x, xy, yz, 3z^2 - 1, xz, x^2 - y^2
+	static void shBasis(float x, float y, float z, float *basis)
+	{
+		basis[0] = 0.282095f;
+		basis[1] = 0.488603f * y;
+		basis[2] = 0.488603f * z;
+		basis[3] = 0.488603f * x;
+		basis[4] = 1.092548f * x * y;
+		basis[5] = 1.092548f * y * z;
+		basis[6] = 0.315392f * (3.0f * z * z - 1.0f);
+		basis[7] = 1.092548f * x * z;
+		basis[8] = 0.546274f * (x * x - y * y);
+	}
+
+#ifdef IBL_SSE
+	static void shBasis(__m128 x, __m128 y, __m128 z, __m128 *basis)
+	{
+		__m128 k1 = _mm_set1_ps(0.488603f), k2 = _mm_set1_ps(1.092548f);
+		basis[0] = _mm_set1_ps(0.282095f);
+		basis[1] = _mm_mul_ps(k1, y);
+		basis[2] = _mm_mul_ps(k1, z);
+		basis[3] = _mm_mul_ps(k1, x);
+		basis[4] = _mm_mul_ps(k2, _mm_mul_ps(x, y));
+		basis[5] = _mm_mul_ps(k2, _mm_mul_ps(y, z));
+		basis[6] = _mm_mul_ps(_mm_set1_ps(0.315392f), _mm_sub_ps(_mm_mul_ps(_mm_set1_ps(3.0f), _mm_mul_ps(z, z)), _mm_set1_ps(1.0f)));
+		basis[7] = _mm_mul_ps(k2, _mm_mul_ps(x, z));
+		basis[8] = _mm_mul_ps(_mm_set1_ps(0.546274f), _mm_sub_ps(_mm_mul_ps(x, x), _mm_mul_ps(y, y)));
+	}
+#endif
+
+	// GGX importance samples in tangent space for one roughness. Each sample reads the source at the mip whose
+	// texels cover about the solid angle the sample stands for (filtered importance sampling), which keeps the
+	// sample count low without fireflies.
+	static void prefilterSamples(float roughness, float sourceTexelSolidAngle, std::vector<PrefilterSample> &samples)
+	{
+		float alpha = roughness * roughness;
+		samples.clear();
+		for (uint32_t i = 0; i < IBL_SPECULAR_SAMPLES; i++)
+		{
+			float h[3];
+			importanceSampleGGX(i, IBL_SPECULAR_SAMPLES, alpha, h);
+			// reflect N = V around H
+			float NdotH = h[2];
+			PrefilterSample s;
+			s.x = 2.0f * NdotH * h[0];
+			s.y = 2.0f * NdotH * h[1];
+			s.z = 2.0f * NdotH * NdotH - 1.0f;
+			if (s.z <= 0.0f)
+				continue;
+			// pdf of L is D * NdotH / (4 * VdotH), with V = N that's D / 4
+			float a2 = alpha * alpha;
+			float denom = NdotH * NdotH * (a2 - 1.0f) + 1.0f;
+			float D = a2 / (3.14159265f * denom * denom);
+			float pdf = D * 0.25f;
+			float sampleSolidAngle = 1.0f / (IBL_SPECULAR_SAMPLES * pdf + 0.0001f);
+			s.lod = 0.5f * log2f(sampleSolidAngle / sourceTexelSolidAngle) + 1.0f;
+			s.weight = s.z;
+			samples.push_back(s);
+		}
+		// padded to a multiple of 4 with zero weight samples for the SSE loop
+		while (samples.size() % 4)
+		{
+			PrefilterSample pad = { 0.0f, 0.0f, 1.0f, 0.0f, 0.0f };
+			samples.push_back(pad);
+		}
+	}
+
+	static void prefilterSpecular(const std::vector<EquirectLevel> &levels, int size, int mips, IblData &out, ThreadPool &pool)
+	{
+		out.specularSize = size;
+		out.specularMips = mips;
+		out.specular.assign(out.faceOffset(mips, 0), 0.0f);
+		float sourceTexelSolidAngle = 4.0f * 3.14159265f / ((float)levels[0].width * levels[0].height);
+
+		for (int mip = 0; mip < mips; mip++)
+		{
+			int faceSize = out.faceSize(mip);
+			float roughness = mips > 1 ? (float)mip / (mips - 1) : 0.0f;
+			std::vector<PrefilterSample> samples;
+			if (mip > 0)
+				prefilterSamples(roughness, sourceTexelSolidAngle, samples);
+			// a mirror only needs the source filtered down to the texel size of the face
+			float texelLod = 0.5f * log2f((4.0f * 3.14159265f / (6.0f * faceSize * faceSize)) / sourceTexelSolidAngle);
+
+			pool.parallel_for((size_t)6 * faceSize, [&](size_t job) {
+				int face = (int)(job / faceSize), t = (int)(job % faceSize);
+				float *row = &out.specular[out.faceOffset(mip, face) + (size_t)t * faceSize * 3];
+				for (int s = 0; s < faceSize; s++)
+				{
+					float N[3];
+					cubeDirection(face, 2.0f * (s + 0.5f) / faceSize - 1.0f, 2.0f * (t + 0.5f) / faceSize - 1.0f, N);
+					if (samples.empty())
+						sampleEquirect(levels, N[0], N[1], N[2], texelLod, row + s * 3);
+					else
+						prefilterTexel(levels, samples, N, row + s * 3);
+				}
+			});
+		}
+	}
+
+	static void prefilterTexel(const std::vector<EquirectLevel> &levels, const std::vector<PrefilterSample> &samples, const float *N, float *out)
+	{
+		// tangent frame around N
+		float up[3] = { 0.0f, 0.0f, 1.0f };
+		if (fabsf(N[2]) > 0.999f)
+		{
+			up[0] = 1.0f;
+			up[2] = 0.0f;
+		}
+		float T[3] = { up[1] * N[2] - up[2] * N[1], up[2] * N[0] - up[0] * N[2], up[0] * N[1] - up[1] * N[0] };
+		float length = sqrtf(T[0] * T[0] + T[1] * T[1] + T[2] * T[2]);
+		for (int k = 0; k < 3; k++)
+			T[k] /= length;
+		float B[3] = { N[1] * T[2] - N[2] * T[1], N[2] * T[0] - N[0] * T[2], N[0] * T[1] - N[1] * T[0] };
+
+		float sum[3] = { 0.0f, 0.0f, 0.0f }, totalWeight = 0.0f;
+		for (size_t i = 0; i < samples.size(); i += 4)
+		{
+			const PrefilterSample *s = &samples[i];
+			float wx[4], wy[4], wz[4];
+#ifdef IBL_SSE
+			// L = T * x + B * y + N * z for 4 samples at once
+			__m128 sx = _mm_set_ps(s[3].x, s[2].x, s[1].x, s[0].x);
+			__m128 sy = _mm_set_ps(s[3].y, s[2].y, s[1].y, s[0].y);
+			__m128 sz = _mm_set_ps(s[3].z, s[2].z, s[1].z, s[0].z);
+			_mm_storeu_ps(wx, _mm_add_ps(_mm_add_ps(_mm_mul_ps(sx, _mm_set1_ps(T[0])), _mm_mul_ps(sy, _mm_set1_ps(B[0]))), _mm_mul_ps(sz, _mm_set1_ps(N[0]))));
+			_mm_storeu_ps(wy, _mm_add_ps(_mm_add_ps(_mm_mul_ps(sx, _mm_set1_ps(T[1])), _mm_mul_ps(sy, _mm_set1_ps(B[1]))), _mm_mul_ps(sz, _mm_set1_ps(N[1]))));
+			_mm_storeu_ps(wz, _mm_add_ps(_mm_add_ps(_mm_mul_ps(sx, _mm_set1_ps(T[2])), _mm_mul_ps(sy, _mm_set1_ps(B[2]))), _mm_mul_ps(sz, _mm_set1_ps(N[2]))));
+#else
+			for (int j = 0; j < 4; j++)
+			{
+				wx[j] = s[j].x * T[0] + s[j].y * B[0] + s[j].z * N[0];
+				wy[j] = s[j].x * T[1] + s[j].y * B[1] + s[j].z * N[1];
+				wz[j] = s[j].x * T[2] + s[j].y * B[2] + s[j].z * N[2];
+			}
+#endif
+			for (int j = 0; j < 4; j++)
+			{
+				if (s[j].weight <= 0.0f)
+					continue;
+				float radiance[3];
+				sampleEquirect(levels, wx[j], wy[j], wz[j], s[j].lod, radiance);
+				for (int k = 0; k < 3; k++)
+					sum[k] += radiance[k] * s[j].weight;
+				totalWeight += s[j].weight;
+			}
+		}
+		for (int k = 0; k < 3; k++)
+			out[k] = totalWeight > 0.0f ? sum[k] / totalWeight : 0.0f;
+	}
+
+	// split sum BRDF (Karis 2013), Smith GGX visibility with k = alpha / 2
+	static void integrateBrdf(int size, IblData &out, ThreadPool &pool)
+	{
+		out.lutSize = size;
+		out.brdfLut.assign((size_t)size * size * 2, 0.0f);
+		pool.parallel_for(size, [&](size_t row) {
+			float roughness = (row + 0.5f) / size;
+			float alpha = roughness * roughness;
+			float k = alpha * 0.5f;
+			for (int column = 0; column < size; column++)
+			{
+				float NdotV = (column + 0.5f) / size;
+				float V[3] = { sqrtf(1.0f - NdotV * NdotV), 0.0f, NdotV };
+				float scale = 0.0f, bias = 0.0f;
+				for (uint32_t i = 0; i < IBL_BRDF_SAMPLES; i++)
+				{
+					float h[3];
+					importanceSampleGGX(i, IBL_BRDF_SAMPLES, alpha, h);
+					float VdotH = V[0] * h[0] + V[2] * h[2];
+					float NdotL = 2.0f * VdotH * h[2] - V[2];
+					if (NdotL <= 0.0f)
+						continue;
+					float NdotH = h[2];
+					float G = (NdotV / (NdotV * (1.0f - k) + k)) * (NdotL / (NdotL * (1.0f - k) + k));
+					float visibility = G * VdotH / (NdotH * NdotV);
+					float Fc = powf(1.0f - VdotH, 5.0f);
+					scale += (1.0f - Fc) * visibility;
+					bias += Fc * visibility;
+				}
+				out.brdfLut[(row * size + column) * 2] = scale / IBL_BRDF_SAMPLES;
+				out.brdfLut[(row * size + column) * 2 + 1] = bias / IBL_BRDF_SAMPLES;
+			}
+		});
+	}
+};
@@ -0,0 +1,89 @@
+#pragma once
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+
+#include <gl_state.hpp>
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// vertex attribute locations of the per instance data, after the mesh's own 0 to 4 (see pbrShader.vert). The
+// transform takes one location per column
+#define INSTANCE_ATTRIBUTE_TRANSFORM 5
+#define INSTANCE_ATTRIBUTE_PARAMETERS 9
+
+// what each copy of an instanced draw gets instead of the Object block and the per draw uniforms
+struct InstanceData {
+	glm::mat4 transform;
+	glm::vec4 parameters;	// same meaning as RenderItem::parameters, e.g. roughness and metalness
+};
+
+// Per instance data of a frame's instanced draws. Instances are collected on the CPU, sent in one upload before
+// drawing, and each draw points the instance attributes of its vertex array at its own range. GL 3.3 has no base
+// instance, so the range is picked with the attribute offsets instead.
+class InstanceBuffer
+{
+public:
+	InstanceBuffer() : buffer(0), capacity(0) {}
+
+	~InstanceBuffer()
+	{
+		if (buffer)
+			GlState::get().deleteBuffers(1, &buffer);
+	}
+
+	void clear() { instances.clear(); }
+
+	// returns the index of the first of the added instances
+	uint32_t add(const InstanceData *data, size_t count)
+	{
+		uint32_t first = (uint32_t)instances.size();
+		instances.insert(instances.end(), data, data + count);
+		return first;
+	}
+
+	size_t size() const { return instances.size(); }
+
+	// sends everything added since clear(). The storage is orphaned first, so draws of the last frame that still
+	// read it don't make the upload wait
+	void upload()
+	{
+		if (instances.empty())
+			return;
+		if (!buffer)
+			glGenBuffers(1, &buffer);
+		GlState::get().bindBuffer(GL_ARRAY_BUFFER, buffer);
+		if (instances.size() > capacity)
+			capacity = instances.size() > capacity * 2 ? instances.size() : capacity * 2;
+		glBufferData(GL_ARRAY_BUFFER, capacity * sizeof(InstanceData), nullptr, GL_STREAM_DRAW);
+		glBufferSubData(GL_ARRAY_BUFFER, 0, instances.size() * sizeof(InstanceData), instances.data());
+	}
+
+	// points the instance attributes of the bound vertex array at the uploaded instances from first on. The
+	// attributes stay enabled afterwards, shaders that don't declare them ignore them
+	void attach(uint32_t first)
+	{
+		GlState::get().bindBuffer(GL_ARRAY_BUFFER, buffer);
+		size_t base = first * sizeof(InstanceData);
+		for (int column = 0; column < 4; column++)
+		{
+			GLuint location = INSTANCE_ATTRIBUTE_TRANSFORM + column;
+			glEnableVertexAttribArray(location);
+			glVertexAttribPointer(location, 4, GL_FLOAT, GL_FALSE, sizeof(InstanceData), (void*)(base + offsetof(InstanceData, transform) + column * sizeof(glm::vec4)));
+			glVertexAttribDivisor(location, 1);
+		}
+		glEnableVertexAttribArray(INSTANCE_ATTRIBUTE_PARAMETERS);
+		glVertexAttribPointer(INSTANCE_ATTRIBUTE_PARAMETERS, 4, GL_FLOAT, GL_FALSE, sizeof(InstanceData), (void*)(base + offsetof(InstanceData, parameters)));
+		glVertexAttribDivisor(INSTANCE_ATTRIBUTE_PARAMETERS, 1);
+	}
+
+private:
+	std::vector<InstanceData> instances;
+	GLuint buffer;
+	size_t capacity;	// in instances
+
+	InstanceBuffer(const InstanceBuffer&);
+	InstanceBuffer &operator=(const InstanceBuffer&);
+};
@@ -0,0 +1,310 @@
+#pragma once
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+
+#include <gl_state.hpp>
+#include <thread_pool.hpp>
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <functional>
+#include <vector>
+
+// froxel grid: screen tiles times exponential depth slices between the near and far plane. Must match
+// Shaders/clusters.glsl
+#define CLUSTER_GRID_X 16
+#define CLUSTER_GRID_Y 9
+#define CLUSTER_GRID_Z 24
+#define CLUSTER_COUNT (CLUSTER_GRID_X * CLUSTER_GRID_Y * CLUSTER_GRID_Z)
+// light indices are 16 bit
+#define CLUSTER_MAX_LIGHTS 65535
+
+// a point light for clustered shading. Past radius it contributes nothing, see cluster_light_radius()
+struct ClusterLight {
+	glm::vec3 position;
+	float radius;
+	glm::vec3 color;
+
+	ClusterLight() : position(0.0f), radius(1.0f), color(1.0f) {}
+	ClusterLight(const glm::vec3 &position, float radius, const glm::vec3 &color) : position(position), radius(radius), color(color) {}
+};
+
+// distance at which an inverse square light of this colour (times scale, the shader's exposure) drops below cutoff
+inline float cluster_light_radius(const glm::vec3 &color, float scale, float cutoff = 0.01f)
+{
+	float peak = std::max(color.r, std::max(color.g, color.b)) * scale;
+	return peak > 0.0f ? std::sqrt(peak / cutoff) : 0.0f;
+}
+
+// Bins lights into the froxels of the current view every frame and uploads the result as three buffer textures:
+//   lights   RGBA32F, two texels per light: world position and radius, colour
+//   grid     RG32UI per cluster: first entry in indices and light count
+//   indices  R16UI, the lights of each cluster back to back
+// The fragment shader finds its cluster from gl_FragCoord and its view depth and only loops over those lights.
+//
+// Binning works on the lights in structure of arrays form: a light first gets the range of slices and tiles its
+// bounding box covers, then every candidate cluster is tested against the sphere. Slices are binned in parallel,
+// each one only writes its own clusters.
+class LightClusters
+{
+public:
+	std::vector<ClusterLight> lights;
+
+	struct Stats {
+		size_t lights, visible, indices, maxPerCluster;
+		double binMs;
+		Stats() : lights(0), visible(0), indices(0), maxPerCluster(0), binMs(0.0) {}
+	};
+
+	LightClusters() : projectionKey(0.0f), buffers(), textures(), nearPlane(0.1f), farPlane(100.0f),
+		boxMin(CLUSTER_COUNT), boxMax(CLUSTER_COUNT), clusterLights(CLUSTER_COUNT), grid(CLUSTER_COUNT * 2) {}
+
+	~LightClusters()
+	{
+		if (textures[0])
+		{
+			GlState::get().deleteTextures(3, textures);
+			GlState::get().deleteBuffers(3, buffers);
+		}
+	}
+
+	// bins lights for this view and projection (a symmetric perspective one) and uploads the tables
+	void update(const glm::mat4 &view, const glm::mat4 &projection, ThreadPool *pool = &ThreadPool::shared())
+	{
+		std::chrono::high_resolution_clock::time_point start = std::chrono::high_resolution_clock::now();
+		glm::vec4 key(projection[0][0], projection[1][1], projection[2][2], projection[3][2]);
+		if (key != projectionKey)
+		{
+			projectionKey = key;
+			buildClusterBounds(projection);
+		}
+
+		size_t count = std::min(lights.size(), (size_t)CLUSTER_MAX_LIGHTS);
+		prepareLights(view, projection, count);
+
+		// per slice, every cluster collects the lights whose sphere reaches its box
+		std::function<void(size_t)> binSlice = [this, count](size_t z) {
+			for (int c = (int)z * CLUSTER_GRID_X * CLUSTER_GRID_Y; c < ((int)z + 1) * CLUSTER_GRID_X * CLUSTER_GRID_Y; c++)
+				clusterLights[c].clear();
+			for (size_t i = 0; i < count; i++)
+			{
+				if ((int)z < sliceMin[i] || (int)z > sliceMax[i])
+					continue;
+				for (int y = tileMinY[i]; y <= tileMaxY[i]; y++)
+					for (int x = tileMinX[i]; x <= tileMaxX[i]; x++)
+					{
+						int c = x + CLUSTER_GRID_X * (y + CLUSTER_GRID_Y * (int)z);
+						if (sphereTouchesBox(i, c))
+							clusterLights[c].push_back((uint16_t)i);
+					}
+			}
+		};
+		if (pool)
+			pool->parallel_for(CLUSTER_GRID_Z, binSlice);
+		else
+			for (size_t z = 0; z < CLUSTER_GRID_Z; z++)
+				binSlice(z);
+
+		// flatten into the grid and index tables
+		indices.clear();
+		stats.maxPerCluster = 0;
+		for (int c = 0; c < CLUSTER_COUNT; c++)
+		{
+			grid[c * 2] = (uint32_t)indices.size();
+			grid[c * 2 + 1] = (uint32_t)clusterLights[c].size();
+			indices.insert(indices.end(), clusterLights[c].begin(), clusterLights[c].end());
+			stats.maxPerCluster = std::max(stats.maxPerCluster, clusterLights[c].size());
+		}
+		stats.lights = count;
+		stats.indices = indices.size();
+		upload(count);
+		stats.binMs = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+	}
+
+	// binds lights, grid and indices to firstUnit, firstUnit + 1 and firstUnit + 2
+	void bind(unsigned int firstUnit) const
+	{
+		for (int i = 0; i < 3; i++)
+			GlState::get().bindTextureUnit(firstUnit + i, GL_TEXTURE_BUFFER, textures[i]);
+	}
+
+	// the shader's clusterParams: clusters per pixel in x and y, then scale and bias that turn log(view depth)
+	// into a slice
+	glm::vec4 shaderParams(float width, float height) const
+	{
+		float scale = CLUSTER_GRID_Z / std::log(farPlane / nearPlane);
+		return glm::vec4(CLUSTER_GRID_X / width, CLUSTER_GRID_Y / height, scale, -std::log(nearPlane) * scale);
+	}
+
+	const Stats &lastStats() const { return stats; }
+
+	void printStats() const
+	{
+		printf("CLUSTERS:: %u lights, %u visible, %u indices, at most %u in a cluster, binned in %.2f ms\n",
+			(unsigned int)stats.lights, (unsigned int)stats.visible, (unsigned int)stats.indices, (unsigned int)stats.maxPerCluster, stats.binMs);
+	}
+
+private:
+	glm::vec4 projectionKey;
+	GLuint buffers[3], textures[3];	// lights, grid, indices
+	float nearPlane, farPlane;
+	// view space bounds of every cluster
+	std::vector<glm::vec3> boxMin, boxMax;
+	// this frame's lights in view space, depth is positive in front of the camera
+	std::vector<float> centerX, centerY, centerDepth, radius;
+	std::vector<int> sliceMin, sliceMax, tileMinX, tileMaxX, tileMinY, tileMaxY;
+	std::vector<std::vector<uint16_t> > clusterLights;
+	std::vector<uint32_t> grid;
+	std::vector<uint16_t> indices;
+	std::vector<glm::vec4> lightTexels;
+	Stats stats;
+
+	float sliceDepth(int slice) const
+	{
+		return nearPlane * std::pow(farPlane / nearPlane, (float)slice / CLUSTER_GRID_Z);
+	}
+
+	int sliceOf(float depth) const
+	{
+		int slice = (int)std::floor(std::log(depth / nearPlane) / std::log(farPlane / nearPlane) * CLUSTER_GRID_Z);
+		return std::min(std::max(slice, 0), CLUSTER_GRID_Z - 1);
+	}
+
+	static int tileOf(float ndc, int tiles)
+	{
+		int tile = (int)std::floor((ndc * 0.5f + 0.5f) * tiles);
+		return std::min(std::max(tile, 0), tiles - 1);
+	}
+
+	// a view space point at depth d projects to ndc x = x * P00 / d, so a tile's box over a slice spans the
+	// extremes of its ndc edges at the slice's near and far depth
+	void buildClusterBounds(const glm::mat4 &projection)
+	{
+		nearPlane = projection[3][2] / (projection[2][2] - 1.0f);
+		farPlane = projection[3][2] / (projection[2][2] + 1.0f);
+		float sx = 1.0f / projection[0][0], sy = 1.0f / projection[1][1];
+		for (int z = 0; z < CLUSTER_GRID_Z; z++)
+		{
+			float d0 = sliceDepth(z), d1 = sliceDepth(z + 1);
+			for (int y = 0; y < CLUSTER_GRID_Y; y++)
+				for (int x = 0; x < CLUSTER_GRID_X; x++)
+				{
+					float nx0 = 2.0f * x / CLUSTER_GRID_X - 1.0f, nx1 = 2.0f * (x + 1) / CLUSTER_GRID_X - 1.0f;
+					float ny0 = 2.0f * y / CLUSTER_GRID_Y - 1.0f, ny1 = 2.0f * (y + 1) / CLUSTER_GRID_Y - 1.0f;
+					int c = x + CLUSTER_GRID_X * (y + CLUSTER_GRID_Y * z);
+					boxMin[c] = glm::vec3(std::min(nx0 * d0, nx0 * d1) * sx, std::min(ny0 * d0, ny0 * d1) * sy, -d1);
+					boxMax[c] = glm::vec3(std::max(nx1 * d0, nx1 * d1) * sx, std::max(ny1 * d0, ny1 * d1) * sy, -d0);
+				}
+		}
+	}
+
+	// moves the lights to view space and finds the slices and tiles each one can touch. Lights outside the
+	// depth range get an empty slice range
+	void prepareLights(const glm::mat4 &view, const glm::mat4 &projection, size_t count)
+	{
+		centerX.resize(count); centerY.resize(count); centerDepth.resize(count); radius.resize(count);
+		sliceMin.resize(count); sliceMax.resize(count);
+		tileMinX.resize(count); tileMaxX.resize(count); tileMinY.resize(count); tileMaxY.resize(count);
+		stats.visible = 0;
+		for (size_t i = 0; i < count; i++)
+		{
+			glm::vec4 p = view * glm::vec4(lights[i].position, 1.0f);
+			float r = lights[i].radius, d = -p.z;
+			centerX[i] = p.x; centerY[i] = p.y; centerDepth[i] = d; radius[i] = r;
+			if (d + r < nearPlane || d - r > farPlane)
+			{
+				sliceMin[i] = 1;
+				sliceMax[i] = 0;
+				continue;
+			}
+			stats.visible++;
+			sliceMin[i] = sliceOf(std::max(d - r, nearPlane));
+			sliceMax[i] = sliceOf(std::min(d + r, farPlane));
+
+			float dNear = d - r, dFar = d + r;
+			if (dNear <= nearPlane)
+			{
+				// the box reaches the camera plane, its projection is unbounded
+				tileMinX[i] = 0; tileMaxX[i] = CLUSTER_GRID_X - 1;
+				tileMinY[i] = 0; tileMaxY[i] = CLUSTER_GRID_Y - 1;
+				continue;
+			}
+			float xs[2] = { p.x - r, p.x + r }, ys[2] = { p.y - r, p.y + r }, ds[2] = { dNear, dFar };
+			float nxMin = 1e30f, nxMax = -1e30f, nyMin = 1e30f, nyMax = -1e30f;
+			for (int a = 0; a < 2; a++)
+				for (int b = 0; b < 2; b++)
+				{
+					float nx = xs[a] * projection[0][0] / ds[b], ny = ys[a] * projection[1][1] / ds[b];
+					nxMin = std::min(nxMin, nx); nxMax = std::max(nxMax, nx);
+					nyMin = std::min(nyMin, ny); nyMax = std::max(nyMax, ny);
+				}
+			if (nxMax < -1.0f || nxMin > 1.0f || nyMax < -1.0f || nyMin > 1.0f)
+			{
+				sliceMin[i] = 1;
+				sliceMax[i] = 0;
+				stats.visible--;
+				continue;
+			}
+			tileMinX[i] = tileOf(nxMin, CLUSTER_GRID_X); tileMaxX[i] = tileOf(nxMax, CLUSTER_GRID_X);
+			tileMinY[i] = tileOf(nyMin, CLUSTER_GRID_Y); tileMaxY[i] = tileOf(nyMax, CLUSTER_GRID_Y);
+		}
+	}
+
+	bool sphereTouchesBox(size_t light, int cluster) const
+	{
+		glm::vec3 center(centerX[light], centerY[light], -centerDepth[light]);
+		glm::vec3 closest = glm::clamp(center, boxMin[cluster], boxMax[cluster]);
+		glm::vec3 offset = center - closest;
+		return glm::dot(offset, offset) <= radius[light] * radius[light];
+	}
+
+	// the textures keep pointing at their buffers when the buffers' storage is re-specified, so they're attached once
+	void create()
+	{
+		const GLenum formats[3] = { GL_RGBA32F, GL_RG32UI, GL_R16UI };
+		glGenBuffers(3, buffers);
+		glGenTextures(3, textures);
+		for (int i = 0; i < 3; i++)
+		{
+			GlState::get().bindBuffer(GL_TEXTURE_BUFFER, buffers[i]);
+			glBufferData(GL_TEXTURE_BUFFER, 16, NULL, GL_STREAM_DRAW);
+			GlState::get().bindTexture(GL_TEXTURE_BUFFER, textures[i]);
+			glTexBuffer(GL_TEXTURE_BUFFER, formats[i], buffers[i]);
+		}
+		GlState::get().bindBuffer(GL_TEXTURE_BUFFER, 0);
+	}
+
+	// re-specifies each buffer with this frame's data, orphaning the storage draws still in flight read from
+	void upload(size_t count)
+	{
+		if (!textures[0])
+			create();
+		lightTexels.resize(count * 2);
+		for (size_t i = 0; i < count; i++)
+		{
+			lightTexels[i * 2] = glm::vec4(lights[i].position, lights[i].radius);
+			lightTexels[i * 2 + 1] = glm::vec4(lights[i].color, 0.0f);
+		}
+		// empty buffers can't back a texture, keep at least one element
+		if (lightTexels.empty())
+			lightTexels.push_back(glm::vec4(0.0f));
+		if (indices.empty())
+			indices.push_back(0);
+
+		const void *data[3] = { &lightTexels[0], &grid[0], &indices[0] };
+		size_t sizes[3] = { lightTexels.size() * sizeof(glm::vec4), grid.size() * sizeof(uint32_t), indices.size() * sizeof(uint16_t) };
+		for (int i = 0; i < 3; i++)
+		{
+			GlState::get().bindBuffer(GL_TEXTURE_BUFFER, buffers[i]);
+			glBufferData(GL_TEXTURE_BUFFER, sizes[i], data[i], GL_STREAM_DRAW);
+		}
+		GlState::get().bindBuffer(GL_TEXTURE_BUFFER, 0);
+	}
+
+	LightClusters(const LightClusters&);
+	LightClusters &operator=(const LightClusters&);
+};
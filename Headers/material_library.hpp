@@ -0,0 +1,497 @@
+#pragma once
+
+#include <glad/glad.h>
+#include <stb_image.h>
+
+#include <bc_encoder.hpp>
+#include <compressed_texture.hpp>
+#include <file_utils.hpp>
+#include <gl_state.hpp>
+#include <mipmap.hpp>
+#include <texture_streamer.hpp>
+
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <map>
+#include <string>
+#include <utility>
+#include <vector>
+
+// PBR materials packed for drawing with as few binds and samplers as possible.
+// Occlusion, roughness and metalness are single channel data, so they're merged into one ORM image when the
+// material is imported: R = occlusion, G = roughness, B = the metalness map as it is, which pbrShader.frag turns
+// into 1 - B (see MATERIAL_DEFAULT_METALNESS). Materials whose images are the same size and were cooked to the same
+// formats share GL_TEXTURE_2D_ARRAYs, one for albedo, one for normals and one for ORM, and a draw picks its
+// material with a layer index instead of binding textures.
+//
+// The arrays are streamed by TextureStreamer (requestArray) like any other texture: coarse levels first, finer ones
+// once noteUsage() says a material is drawn large enough, and they count against the streamer's budget.
+// Every map is looked up through cooked_texture_path first. Cooked albedo and normal maps are uploaded as they
+// are, cooked (BC4) ORM maps are decoded and repacked with their mips; only maps without a cooked file are
+// decoded from the source and filtered here.
+
+// source images of one material, an empty path uses a neutral value for that map
+struct MaterialFiles {
+	std::string albedo, normal, roughness, metalness, occlusion;
+};
+
+// where a material ended up. group selects the arrays (see MaterialLibrary::bind), layer the slice in them.
+struct MaterialRef {
+	int group;
+	int layer;
+
+	MaterialRef() : group(-1), layer(0) {}
+	bool valid() const { return group >= 0; }
+};
+
+// values for maps a material doesn't have, RGBA with R in the high byte like the streamer's placeholders
+const uint32_t MATERIAL_DEFAULT_ALBEDO = 0x808080FF;
+const uint32_t MATERIAL_DEFAULT_NORMAL = 0x8080FFFF;
+const unsigned char MATERIAL_DEFAULT_OCCLUSION = 255;
+const unsigned char MATERIAL_DEFAULT_ROUGHNESS = 128;
+// pbrShader.frag takes 1 - B as the metalness term (as it did with the separate metalness map), so a material
+// without a metalness map gets a full B to come out non metallic
+const unsigned char MATERIAL_DEFAULT_METALNESS = 255;
+
+// decoded RGBA8 image
+struct MaterialImage {
+	int width, height;
+	std::vector<unsigned char> rgba;
+
+	MaterialImage() : width(0), height(0) {}
+};
+
+// loads an image as RGBA8, flipped if asked. Returns false (and leaves image empty) if it can't be decoded.
+inline bool material_load_image(const std::string &path, bool flip, MaterialImage &image)
+{
+	int components;
+	unsigned char *pixels = stbi_load(path.c_str(), &image.width, &image.height, &components, 4);
+	if (!pixels)
+	{
+		std::cout << "Texture failed to load at path: " << path << std::endl;
+		image = MaterialImage();
+		return false;
+	}
+	size_t row = (size_t)image.width * 4;
+	image.rgba.resize(row * image.height);
+	for (int y = 0; y < image.height; y++)
+		memcpy(&image.rgba[(flip ? image.height - 1 - y : y) * row], pixels + y * row, row);
+	stbi_image_free(pixels);
+	return true;
+}
+
+// bilinear resize, only used when a material's maps don't agree on a size
+inline void material_resample(const MaterialImage &src, int width, int height, MaterialImage &dst)
+{
+	dst.width = width;
+	dst.height = height;
+	dst.rgba.resize((size_t)width * height * 4);
+	for (int y = 0; y < height; y++)
+	{
+		float fy = (y + 0.5f) * src.height / height - 0.5f;
+		int y0 = fy < 0.0f ? 0 : (int)fy;
+		int y1 = y0 + 1 < src.height ? y0 + 1 : y0;
+		float ty = fy < 0.0f ? 0.0f : fy - y0;
+		for (int x = 0; x < width; x++)
+		{
+			float fx = (x + 0.5f) * src.width / width - 0.5f;
+			int x0 = fx < 0.0f ? 0 : (int)fx;
+			int x1 = x0 + 1 < src.width ? x0 + 1 : x0;
+			float tx = fx < 0.0f ? 0.0f : fx - x0;
+			for (int c = 0; c < 4; c++)
+			{
+				float a = src.rgba[((size_t)y0 * src.width + x0) * 4 + c], b = src.rgba[((size_t)y0 * src.width + x1) * 4 + c];
+				float d = src.rgba[((size_t)y1 * src.width + x0) * 4 + c], e = src.rgba[((size_t)y1 * src.width + x1) * 4 + c];
+				float top = a + (b - a) * tx, bottom = d + (e - d) * tx;
+				dst.rgba[((size_t)y * width + x) * 4 + c] = (unsigned char)(top + (bottom - top) * ty + 0.5f);
+			}
+		}
+	}
+}
+
+// makes image width x height: resampled if it's a different size, filled with fill if it's empty
+inline void material_fit(MaterialImage &image, int width, int height, uint32_t fill)
+{
+	if (image.rgba.empty())
+	{
+		image.width = width;
+		image.height = height;
+		image.rgba.resize((size_t)width * height * 4);
+		for (size_t p = 0; p < (size_t)width * height; p++)
+		{
+			image.rgba[p * 4] = (unsigned char)(fill >> 24);
+			image.rgba[p * 4 + 1] = (unsigned char)(fill >> 16);
+			image.rgba[p * 4 + 2] = (unsigned char)(fill >> 8);
+			image.rgba[p * 4 + 3] = (unsigned char)fill;
+		}
+	}
+	else if (image.width != width || image.height != height)
+	{
+		MaterialImage resized;
+		material_resample(image, width, height, resized);
+		image.rgba.swap(resized.rgba);
+		image.width = width;
+		image.height = height;
+	}
+}
+
+// merges the first channel of the three maps into one ORM image. All three must already be width x height.
+inline void pack_orm(const MaterialImage &occlusion, const MaterialImage &roughness, const MaterialImage &metalness, MaterialImage &orm)
+{
+	orm.width = roughness.width;
+	orm.height = roughness.height;
+	orm.rgba.resize((size_t)orm.width * orm.height * 4);
+	for (size_t p = 0; p < (size_t)orm.width * orm.height; p++)
+	{
+		orm.rgba[p * 4] = occlusion.rgba[p * 4];
+		orm.rgba[p * 4 + 1] = roughness.rgba[p * 4];
+		orm.rgba[p * 4 + 2] = metalness.rgba[p * 4];
+		orm.rgba[p * 4 + 3] = 255;
+	}
+}
+
+// Collects materials, then build() sorts them into one set of texture arrays per image size and cooked format and
+// hands those to the texture streamer, whose workers load the layers. Must be used on the GL thread.
+class MaterialLibrary
+{
+public:
+	MaterialLibrary() {}
+
+	~MaterialLibrary()
+	{
+		for (size_t i = 0; i < groups.size(); i++)
+		{
+			for (int a = 0; a < 3; a++)
+				TextureStreamer::get().forget(groups[i].arrays[a]);
+			GlState::get().deleteTextures(3, groups[i].arrays);
+		}
+	}
+
+	// queues a material for the next build(), returns its index for material()
+	unsigned int add(const MaterialFiles &files)
+	{
+		queued.push_back(files);
+		refs.push_back(MaterialRef());
+		return (unsigned int)refs.size() - 1;
+	}
+
+	// groups everything added since the last build and starts streaming it. Only image and cooked file headers are
+	// read here. Rows are flipped if the texture streamer currently flips.
+	void build()
+	{
+		std::chrono::high_resolution_clock::time_point start = std::chrono::high_resolution_clock::now();
+		unsigned int first = (unsigned int)(refs.size() - queued.size());
+		bool flip = TextureStreamer::get().flipVertically();
+
+		// same size and formats means same arrays, anything else starts a group
+		std::map<GroupKey, std::vector<MaterialSource> > byKey;
+		std::map<GroupKey, std::vector<unsigned int> > indices;
+		unsigned int cooked = 0;
+		for (unsigned int i = 0; i < queued.size(); i++)
+		{
+			MaterialSource source;
+			inspect(queued[i], flip, source);
+			for (int k = 0; k < MATERIAL_MAPS; k++)
+				cooked += source.cooked[k].empty() ? 0 : 1;
+			GroupKey key(source);
+			byKey[key].push_back(source);
+			indices[key].push_back(first + i);
+		}
+		for (std::map<GroupKey, std::vector<MaterialSource> >::iterator it = byKey.begin(); it != byKey.end(); ++it)
+		{
+			int group = (int)groups.size();
+			const std::vector<unsigned int> &members = indices[it->first];
+			for (unsigned int layer = 0; layer < members.size(); layer++)
+			{
+				refs[members[layer]].group = group;
+				refs[members[layer]].layer = (int)layer;
+			}
+			groups.push_back(MaterialGroup());
+			request(it->second, flip, groups.back());
+		}
+
+		double ms = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+		printf("MATERIALS:: %u materials in %u array groups, %u cooked maps (%.1f ms)\n", (unsigned int)queued.size(), (unsigned int)byKey.size(),
+			cooked, ms);
+		queued.clear();
+	}
+
+	MaterialRef material(unsigned int index) const { return refs[index]; }
+	unsigned int groupCount() const { return (unsigned int)groups.size(); }
+
+	// the material is drawn on something about pixels wide on screen, see TextureStreamer::noteUsage. All
+	// materials of a group share its arrays, so the largest use of any of them decides the group's levels
+	void noteUsage(unsigned int index, float pixels) const
+	{
+		const MaterialRef &ref = refs[index];
+		if (!ref.valid())
+			return;
+		for (int a = 0; a < 3; a++)
+			TextureStreamer::get().noteUsage(groups[ref.group].arrays[a], pixels);
+	}
+
+	// the material's normal array only stores x and y (cooked to BC5), the PBR program has to rebuild z for it
+	bool normalsWithoutBlue(unsigned int index) const
+	{
+		const MaterialRef &ref = refs[index];
+		return ref.valid() && groups[ref.group].normalFormat == GL_COMPRESSED_RG_RGTC2;
+	}
+
+	// binds a group's albedo, normal and ORM arrays to units firstUnit, firstUnit + 1 and firstUnit + 2
+	void bind(int group, unsigned int firstUnit) const
+	{
+		for (int i = 0; i < 3; i++)
+			GlState::get().bindTextureUnit(firstUnit + i, GL_TEXTURE_2D_ARRAY, group >= 0 ? groups[group].arrays[i] : 0);
+	}
+
+private:
+	// the maps of a material in the order MaterialSource keeps them
+	enum { MAP_ALBEDO, MAP_NORMAL, MAP_OCCLUSION, MAP_ROUGHNESS, MAP_METALNESS, MATERIAL_MAPS };
+
+	// what build() found out about a material's maps
+	struct MaterialSource {
+		std::string paths[MATERIAL_MAPS];
+		std::string cooked[MATERIAL_MAPS];	// usable cooked file of each map, empty where the source is decoded
+		int width, height;
+		GLenum albedoFormat, normalFormat;	// of the cooked albedo and normal maps, 0 for RGBA8
+		uint32_t albedoBlock, normalBlock;
+	};
+
+	struct GroupKey {
+		int width, height;
+		GLenum albedoFormat, normalFormat;
+
+		explicit GroupKey(const MaterialSource &source)
+			: width(source.width), height(source.height), albedoFormat(source.albedoFormat), normalFormat(source.normalFormat) {}
+
+		bool operator<(const GroupKey &other) const
+		{
+			if (width != other.width)
+				return width < other.width;
+			if (height != other.height)
+				return height < other.height;
+			if (albedoFormat != other.albedoFormat)
+				return albedoFormat < other.albedoFormat;
+			return normalFormat < other.normalFormat;
+		}
+	};
+
+	struct MaterialGroup {
+		unsigned int arrays[3];	// albedo, normal, ORM
+		GLenum normalFormat;	// 0 for RGBA8
+	};
+
+	std::vector<MaterialFiles> queued;
+	std::vector<MaterialRef> refs;
+	std::vector<MaterialGroup> groups;
+
+	static int chainLength(int width, int height)
+	{
+		int levels = 1;
+		for (; width > 1 || height > 1; levels++)
+		{
+			width = width > 1 ? width / 2 : 1;
+			height = height > 1 ? height / 2 : 1;
+		}
+		return levels;
+	}
+
+	static bool srgbFormat(GLenum format)
+	{
+		return (format >= GL_COMPRESSED_SRGB_S3TC_DXT1_EXT && format <= GL_COMPRESSED_SRGB_ALPHA_S3TC_DXT5_EXT) || format == GL_COMPRESSED_SRGB_ALPHA_BPTC_UNORM;
+	}
+
+	// the material's size (the first map that can be read decides it, 1x1 if none can) and which maps have a
+	// cooked file that fits into its arrays: same size, a full chain, and sampled like the RGBA8 arrays (no sRGB
+	// decoding). ORM maps are repacked, so only BC4 is taken for them
+	static void inspect(const MaterialFiles &files, bool flip, MaterialSource &source)
+	{
+		source.paths[MAP_ALBEDO] = files.albedo;
+		source.paths[MAP_NORMAL] = files.normal;
+		source.paths[MAP_OCCLUSION] = files.occlusion;
+		source.paths[MAP_ROUGHNESS] = files.roughness;
+		source.paths[MAP_METALNESS] = files.metalness;
+		source.width = source.height = 1;
+		source.albedoFormat = source.normalFormat = 0;
+		source.albedoBlock = source.normalBlock = 0;
+		for (int k = 0; k < MATERIAL_MAPS; k++)
+		{
+			int width, height, components;
+			if (!source.paths[k].empty() && stbi_info(source.paths[k].c_str(), &width, &height, &components))
+			{
+				source.width = width;
+				source.height = height;
+				break;
+			}
+		}
+
+		static const MipColorSpace spaces[MATERIAL_MAPS] = { MIP_SRGB, MIP_NORMAL, MIP_LINEAR, MIP_LINEAR, MIP_LINEAR };
+		for (int k = 0; k < MATERIAL_MAPS; k++)
+		{
+			if (source.paths[k].empty())
+				continue;
+			// two channel normals are fine, the PBR program rebuilds z for them (see normalsWithoutBlue)
+			std::string cooked = cooked_texture_path(source.paths[k], flip, spaces[k], k == MAP_NORMAL);
+			MappedFile file;
+			CompressedImage image;
+			std::string error;
+			if (cooked.empty() || !file.open(cooked) || !parse_compressed(file.data(), file.size(), image, error))
+				continue;
+			if ((int)image.levels[0].width != source.width || (int)image.levels[0].height != source.height ||
+				(int)image.levels.size() != chainLength(source.width, source.height) || srgbFormat(image.internalFormat) ||
+				!compressed_format_supported(image.internalFormat) || (k >= MAP_OCCLUSION && image.internalFormat != GL_COMPRESSED_RED_RGTC1) ||
+				(k == MAP_NORMAL && (image.internalFormat == GL_COMPRESSED_RED_RGTC1 || image.internalFormat == GL_COMPRESSED_SIGNED_RED_RGTC1 ||
+				image.internalFormat == GL_COMPRESSED_SIGNED_RG_RGTC2)))
+				continue;
+			source.cooked[k] = cooked;
+			if (k == MAP_ALBEDO)
+			{
+				source.albedoFormat = image.internalFormat;
+				source.albedoBlock = image.blockBytes;
+			}
+			else if (k == MAP_NORMAL)
+			{
+				source.normalFormat = image.internalFormat;
+				source.normalBlock = image.blockBytes;
+			}
+		}
+	}
+
+	// the whole chain of a cooked file
+	static bool loadCooked(const std::string &path, TextureStreamer::ArrayLayer &out)
+	{
+		MappedFile file;
+		CompressedImage image;
+		std::string error;
+		if (!file.open(path) || !parse_compressed(file.data(), file.size(), image, error))
+		{
+			printf("ERROR::MATERIALS::COOKED %s: %s\n", path.c_str(), error.c_str());
+			return false;
+		}
+		out.width = image.levels[0].width;
+		out.height = image.levels[0].height;
+		out.levels.resize(image.levels.size());
+		for (size_t i = 0; i < image.levels.size(); i++)
+			out.levels[i].assign(image.levels[i].data, image.levels[i].data + image.levels[i].size);
+		return true;
+	}
+
+	// loads path (or fills with fill if there is none) at the group's size
+	static void loadMap(const std::string &path, bool flip, int width, int height, uint32_t fill, MaterialImage &image)
+	{
+		if (!path.empty())
+			material_load_image(path, flip, image);
+		material_fit(image, width, height, fill);
+	}
+
+	// level 0 of an albedo or normal layer, or its cooked chain
+	static bool loadLayer(const MaterialSource &source, int map, bool flip, uint32_t fill, TextureStreamer::ArrayLayer &out)
+	{
+		if (!source.cooked[map].empty())
+			return loadCooked(source.cooked[map], out);
+		MaterialImage image;
+		loadMap(source.paths[map], flip, source.width, source.height, fill, image);
+		out.width = source.width;
+		out.height = source.height;
+		out.levels.resize(1);
+		out.levels[0].swap(image.rgba);
+		return true;
+	}
+
+	// the whole chain of one ORM map in the first channel: decoded from its cooked file, filtered from the source,
+	// or filled with value
+	static bool ormChain(const MaterialSource &source, int map, bool flip, unsigned char value, std::vector<MipLevel> &chain)
+	{
+		if (!source.cooked[map].empty())
+		{
+			TextureStreamer::ArrayLayer cooked;
+			if (!loadCooked(source.cooked[map], cooked))
+				return false;
+			chain.resize(cooked.levels.size());
+			for (size_t i = 0; i < chain.size(); i++)
+			{
+				chain[i].width = cooked.width >> i > 0 ? cooked.width >> i : 1;
+				chain[i].height = cooked.height >> i > 0 ? cooked.height >> i : 1;
+				chain[i].rgba.assign((size_t)chain[i].width * chain[i].height * 4, 0);
+				bc_decode_bc4_image(cooked.levels[i].data(), chain[i].width, chain[i].height, chain[i].rgba.data());
+			}
+			return true;
+		}
+		if (source.paths[map].empty())
+		{
+			chain.resize(chainLength(source.width, source.height));
+			for (size_t i = 0; i < chain.size(); i++)
+			{
+				chain[i].width = source.width >> i > 0 ? source.width >> i : 1;
+				chain[i].height = source.height >> i > 0 ? source.height >> i : 1;
+				chain[i].rgba.assign((size_t)chain[i].width * chain[i].height * 4, value);
+			}
+			return true;
+		}
+		MaterialImage image;
+		loadMap(source.paths[map], flip, source.width, source.height, value * 0x01010101u, image);
+		build_mip_chain(image.rgba.data(), source.width, source.height, MIP_LINEAR, chain, MIP_FILTER_KAISER);
+		return true;
+	}
+
+	// an ORM layer. Without cooked maps the three sources are packed and the streamer filters the result, otherwise
+	// every map brings its own chain and they're packed level by level
+	static bool loadOrm(const MaterialSource &source, bool flip, TextureStreamer::ArrayLayer &out)
+	{
+		static const unsigned char defaults[3] = { MATERIAL_DEFAULT_OCCLUSION, MATERIAL_DEFAULT_ROUGHNESS, MATERIAL_DEFAULT_METALNESS };
+		out.width = source.width;
+		out.height = source.height;
+		if (source.cooked[MAP_OCCLUSION].empty() && source.cooked[MAP_ROUGHNESS].empty() && source.cooked[MAP_METALNESS].empty())
+		{
+			MaterialImage maps[3], orm;
+			for (int k = 0; k < 3; k++)
+				loadMap(source.paths[MAP_OCCLUSION + k], flip, source.width, source.height, defaults[k] * 0x01010101u, maps[k]);
+			pack_orm(maps[0], maps[1], maps[2], orm);
+			out.levels.resize(1);
+			out.levels[0].swap(orm.rgba);
+			return true;
+		}
+		std::vector<MipLevel> chains[3];
+		for (int k = 0; k < 3; k++)
+			if (!ormChain(source, MAP_OCCLUSION + k, flip, defaults[k], chains[k]))
+				return false;
+		out.levels.resize(chains[0].size());
+		for (size_t i = 0; i < chains[0].size(); i++)
+		{
+			MaterialImage maps[3], orm;
+			for (int k = 0; k < 3; k++)
+			{
+				maps[k].width = chains[k][i].width;
+				maps[k].height = chains[k][i].height;
+				maps[k].rgba.swap(chains[k][i].rgba);
+			}
+			pack_orm(maps[0], maps[1], maps[2], orm);
+			out.levels[i].swap(orm.rgba);
+		}
+		return true;
+	}
+
+	// the loaders run on the streamer's workers every time finer levels are needed
+	static void request(const std::vector<MaterialSource> &members, bool flip, MaterialGroup &group)
+	{
+		int layers = (int)members.size();
+		const MaterialSource &shape = members[0];
+		std::string name = shape.paths[MAP_ALBEDO].empty() ? "material array" : shape.paths[MAP_ALBEDO];
+		group.normalFormat = shape.normalFormat;
+		group.arrays[0] = TextureStreamer::get().requestArray(name + " (albedo array)", layers,
+			[members, flip](int layer, TextureStreamer::ArrayLayer &out) { return loadLayer(members[layer], MAP_ALBEDO, flip, MATERIAL_DEFAULT_ALBEDO, out); },
+			MATERIAL_DEFAULT_ALBEDO, MIP_SRGB, shape.albedoFormat, shape.albedoBlock);
+		group.arrays[1] = TextureStreamer::get().requestArray(name + " (normal array)", layers,
+			[members, flip](int layer, TextureStreamer::ArrayLayer &out) { return loadLayer(members[layer], MAP_NORMAL, flip, MATERIAL_DEFAULT_NORMAL, out); },
+			MATERIAL_DEFAULT_NORMAL, MIP_NORMAL, shape.normalFormat, shape.normalBlock);
+		group.arrays[2] = TextureStreamer::get().requestArray(name + " (ORM array)", layers,
+			[members, flip](int layer, TextureStreamer::ArrayLayer &out) { return loadOrm(members[layer], flip, out); },
+			(uint32_t)MATERIAL_DEFAULT_OCCLUSION << 24 | (uint32_t)MATERIAL_DEFAULT_ROUGHNESS << 16 | (uint32_t)MATERIAL_DEFAULT_METALNESS << 8 | 0xFF, MIP_LINEAR);
+	}
+
+	MaterialLibrary(const MaterialLibrary&);
+	MaterialLibrary &operator=(const MaterialLibrary&);
+};
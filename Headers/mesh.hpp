@@ -7,7 +7,12 @@
 #include <glm/glm.hpp>
 #include <glm/gtc/matrix_transform.hpp>
 
+#include <gl_state.hpp>
 #include <shader.hpp>
+#include <resource_cache.hpp>
+#include <vertex_format.hpp>
+#include <geometry_arena.hpp>
+#include <instance_buffer.hpp>
 
 #include <string>
 #include <fstream>
@@ -33,6 +38,28 @@ struct Texture {
 	unsigned int id;
 	string type;
 	aiString path;
+	TextureHandle handle;	// keeps the texture alive in the resource cache while a mesh uses it
+};
+
+// a texture referenced by a material, before it has been loaded
+struct TextureSlot {
+	string type;
+	string path;
+};
+
+// one level of detail, a range of the mesh's index buffer. All levels share the same vertices.
+struct MeshLod {
+	uint32_t indexOffset;
+	uint32_t indexCount;
+	float error;	// how far (object space) this level may be off from the full resolution surface
+};
+
+// CPU side result of importing a mesh, everything needed to build a Mesh (or write it to the mesh cache)
+struct MeshData {
+	vector<VertexModel> vertices;
+	vector<unsigned int> indices;	// full resolution first, then the simplified levels
+	vector<TextureSlot> textures;
+	vector<MeshLod> lods;	// empty means a single level covering all indices
 };
 
 class Mesh {
@@ -42,21 +69,48 @@ public:
 	vector<unsigned int> indices;
 	vector<Texture> textures;
 	unsigned int VAO;
+	unsigned int indexCount;
+	GLenum indexType;	// GL_UNSIGNED_SHORT when every index fits, otherwise GL_UNSIGNED_INT
+	VertexFormat format;
+	// object space bounds, compact vertices store their positions relative to these
+	glm::vec3 boundsMin, boundsMax;
+	// object space bounding sphere, used to pick the level of detail
+	glm::vec3 boundsCenter;
+	float boundsRadius;
+	// level 0 is the full mesh, higher levels are coarser
+	vector<MeshLod> lods;
+	// set when the mesh lives in a shared GeometryArena instead of its own buffers, VAO is then the arena's
+	GeometryArena *arena;
+	ArenaAllocation allocation;
 
 	/*  Functions  */
 	// constructor
-	Mesh(vector<VertexModel> vertices, vector<unsigned int> indices, vector<Texture> textures)
+	Mesh(vector<VertexModel> vertices, vector<unsigned int> indices, vector<Texture> textures, VertexFormat format = VERTEX_FORMAT_FULL, vector<MeshLod> lods = vector<MeshLod>(), GeometryArena *arena = nullptr)
 	{
 		this->vertices = vertices;
 		this->indices = indices;
 		this->textures = textures;
+		this->format = format;
+		this->lods = lods;
+		this->arena = arena;
 
 		// now that we have all the required data, set the vertex buffers and its attribute pointers.
-		setupMesh();
+		setupMesh(this->vertices.data(), this->vertices.size(), this->indices.data(), this->indices.size());
 	}
 
-	// render the mesh
-	void Draw(Shader shader)
+	// constructor for data that lives somewhere else (e.g. a memory mapped mesh cache). The data is uploaded
+	// straight to the GPU and no CPU copy is kept, so vertices and indices stay empty.
+	Mesh(const VertexModel *vertexData, size_t vertexCount, const unsigned int *indexData, size_t indexCount, vector<Texture> textures, VertexFormat format = VERTEX_FORMAT_FULL, vector<MeshLod> lods = vector<MeshLod>(), GeometryArena *arena = nullptr)
+	{
+		this->textures = textures;
+		this->format = format;
+		this->lods = lods;
+		this->arena = arena;
+		setupMesh(vertexData, vertexCount, indexData, indexCount);
+	}
+
+	// render the mesh, lod picks the level of detail (clamped to the coarsest one)
+	void Draw(Shader &shader, unsigned int lod = 0)
 	{
 		// bind appropriate textures
 		unsigned int diffuseNr = 1;
@@ -85,13 +139,46 @@ public:
 			glBindTexture(GL_TEXTURE_2D, textures[i].id);/**/
 		}
 
-		// draw mesh
-		glBindVertexArray(VAO);
-		glDrawElements(GL_TRIANGLES, indices.size(), GL_UNSIGNED_INT, 0);
-		glBindVertexArray(0);
+		setFormatUniforms(shader);
+
+		// draw mesh. The VAO stays bound, the next mesh with the same one (e.g. everything in an arena) skips the bind
+		GlState::get().bindVertexArray(VAO);
+		if (arena)
+			glDrawElementsBaseVertex(GL_TRIANGLES, lodIndexCount(lod), indexType, lodIndexOffset(lod), allocation.baseVertex);
+		else
+			glDrawElements(GL_TRIANGLES, lodIndexCount(lod), indexType, lodIndexOffset(lod));
+	}
+
+	// count copies of the mesh in one call, copy i takes instance first + i of the uploaded instances
+	void DrawInstanced(Shader &shader, InstanceBuffer &instances, uint32_t first, GLsizei count, unsigned int lod = 0)
+	{
+		setFormatUniforms(shader);
+		GlState::get().bindVertexArray(VAO);
+		instances.attach(first);
+		if (arena)
+			glDrawElementsInstancedBaseVertex(GL_TRIANGLES, lodIndexCount(lod), indexType, lodIndexOffset(lod), count, allocation.baseVertex);
+		else
+			glDrawElementsInstanced(GL_TRIANGLES, lodIndexCount(lod), indexType, lodIndexOffset(lod), count);
+	}
+
+	// index count and index buffer offset of a level of detail, as glDrawElements wants them
+	GLsizei lodIndexCount(unsigned int lod) const
+	{
+		return (GLsizei)lods[lod < lods.size() ? lod : lods.size() - 1].indexCount;
+	}
+
+	const void *lodIndexOffset(unsigned int lod) const
+	{
+		size_t indexSize = indexType == GL_UNSIGNED_SHORT ? sizeof(uint16_t) : sizeof(unsigned int);
+		size_t offset = lods[lod < lods.size() ? lod : lods.size() - 1].indexOffset * indexSize;
+		return (const void*)((arena ? allocation.indexByteOffset : 0) + offset);
+	}
 
-		// always good practice to set everything back to defaults once configured.
-		glActiveTexture(GL_TEXTURE0);
+	// arena shared by every mesh drawn with the full vertex layout that opts into it (see Model)
+	static GeometryArena &sharedArena()
+	{
+		static GeometryArena shared(sizeof(VertexModel), setupFullAttributes);
+		return shared;
 	}
 
 private:
@@ -99,26 +186,122 @@ private:
 	unsigned int VBO, EBO;
 
 	/*  Functions    */
+	// compact vertices are decoded in the vertex shader
+	void setFormatUniforms(Shader &shader) const
+	{
+		shader.setBool("compactVertex", format == VERTEX_FORMAT_COMPACT);
+		if (format == VERTEX_FORMAT_COMPACT)
+		{
+			shader.setVec3("boundsMin", boundsMin);
+			shader.setVec3("boundsExtent", boundsMax - boundsMin);
+		}
+	}
+
 	// initializes all the buffer objects/arrays
-	void setupMesh()
+	void setupMesh(const VertexModel *vertexData, size_t vertexCount, const unsigned int *indexData, size_t indexCount)
 	{
+		this->indexCount = (unsigned int)indexCount;
+
+		boundsMin = glm::vec3(0.0f);
+		boundsMax = glm::vec3(0.0f);
+		for (size_t i = 0; i < vertexCount; i++)
+		{
+			boundsMin = i ? glm::min(boundsMin, vertexData[i].Position) : vertexData[i].Position;
+			boundsMax = i ? glm::max(boundsMax, vertexData[i].Position) : vertexData[i].Position;
+		}
+		boundsCenter = (boundsMin + boundsMax) * 0.5f;
+		boundsRadius = 0.0f;
+		for (size_t i = 0; i < vertexCount; i++)
+			boundsRadius = glm::max(boundsRadius, glm::length(vertexData[i].Position - boundsCenter));
+
+		if (lods.empty())
+		{
+			MeshLod full;
+			full.indexOffset = 0;
+			full.indexCount = (uint32_t)indexCount;
+			full.error = 0.0f;
+			lods.push_back(full);
+		}
+
+		// meshes with at most 65536 vertices get 16 bit indices, half the index memory and bandwidth
+		indexType = vertexCount <= 65536 ? GL_UNSIGNED_SHORT : GL_UNSIGNED_INT;
+		vector<uint16_t> shortIndices;
+		if (indexType == GL_UNSIGNED_SHORT)
+			shortIndices.assign(indexData, indexData + indexCount);
+
+		// arenas hold the full vertex layout only, compact meshes need their own bounds uniforms per draw anyway
+		if (arena && format == VERTEX_FORMAT_FULL && arena->vertexStride() == sizeof(VertexModel))
+		{
+			const void *indexBytes = indexType == GL_UNSIGNED_SHORT ? (const void*)shortIndices.data() : (const void*)indexData;
+			allocation = arena->add(vertexData, vertexCount, indexBytes, indexCount, indexType);
+			VAO = arena->vertexArray();
+			VBO = EBO = 0;
+			return;
+		}
+		arena = nullptr;
+		allocation.baseVertex = 0;
+		allocation.indexByteOffset = 0;
+
 		// create buffers/arrays
 		glGenVertexArrays(1, &VAO);
 		glGenBuffers(1, &VBO);
 		glGenBuffers(1, &EBO);
 
-		glBindVertexArray(VAO);
+		GlState::get().bindVertexArray(VAO);
 		// load data into vertex buffers
-		glBindBuffer(GL_ARRAY_BUFFER, VBO);
-		// A great thing about structs is that their memory layout is sequential for all its items.
-		// The effect is that we can simply pass a pointer to the struct and it translates perfectly to a glm::vec3/2 array which
-		// again translates to 3/2 floats which translates to a byte array.
-		glBufferData(GL_ARRAY_BUFFER, vertices.size() * sizeof(VertexModel), &vertices[0], GL_STATIC_DRAW);
+		GlState::get().bindBuffer(GL_ARRAY_BUFFER, VBO);
+		if (format == VERTEX_FORMAT_COMPACT)
+		{
+			vector<VertexCompact> compact;
+			compact_vertices(vertexData, vertexCount, boundsMin, boundsMax, compact);
+			glBufferData(GL_ARRAY_BUFFER, compact.size() * sizeof(VertexCompact), compact.data(), GL_STATIC_DRAW);
+		}
+		else
+		{
+			// A great thing about structs is that their memory layout is sequential for all its items.
+			// The effect is that we can simply pass a pointer to the struct and it translates perfectly to a glm::vec3/2 array which
+			// again translates to 3/2 floats which translates to a byte array.
+			glBufferData(GL_ARRAY_BUFFER, vertexCount * sizeof(VertexModel), vertexData, GL_STATIC_DRAW);
+		}
 
-		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, EBO);
-		glBufferData(GL_ELEMENT_ARRAY_BUFFER, indices.size() * sizeof(unsigned int), &indices[0], GL_STATIC_DRAW);
+		GlState::get().bindBuffer(GL_ELEMENT_ARRAY_BUFFER, EBO);
+		if (indexType == GL_UNSIGNED_SHORT)
+			glBufferData(GL_ELEMENT_ARRAY_BUFFER, indexCount * sizeof(uint16_t), shortIndices.data(), GL_STATIC_DRAW);
+		else
+			glBufferData(GL_ELEMENT_ARRAY_BUFFER, indexCount * sizeof(unsigned int), indexData, GL_STATIC_DRAW);
+
+		setupAttributes(format);
+
+		GlState::get().bindVertexArray(0);
+	}
+
+	static void setupFullAttributes()
+	{
+		setupAttributes(VERTEX_FORMAT_FULL);
+	}
+
+	// set the vertex attribute pointers for the bound VAO/VBO
+	static void setupAttributes(VertexFormat format)
+	{
+		if (format == VERTEX_FORMAT_COMPACT)
+		{
+			// positions (xyz) and bitangent sign (w)
+			glEnableVertexAttribArray(0);
+			glVertexAttribPointer(0, 4, GL_UNSIGNED_SHORT, GL_TRUE, sizeof(VertexCompact), (void*)offsetof(VertexCompact, Position));
+			// octahedral normal
+			glEnableVertexAttribArray(1);
+			glVertexAttribPointer(1, 2, GL_SHORT, GL_TRUE, sizeof(VertexCompact), (void*)offsetof(VertexCompact, Normal));
+			// half float texture coords
+			glEnableVertexAttribArray(2);
+			glVertexAttribPointer(2, 2, GL_HALF_FLOAT, GL_FALSE, sizeof(VertexCompact), (void*)offsetof(VertexCompact, TexCoords));
+			// octahedral tangent
+			glEnableVertexAttribArray(3);
+			glVertexAttribPointer(3, 2, GL_SHORT, GL_TRUE, sizeof(VertexCompact), (void*)offsetof(VertexCompact, Tangent));
+			// no bitangent, it's rebuilt in the shader
+			glDisableVertexAttribArray(4);
+			return;
+		}
 
-		// set the vertex attribute pointers
 		// vertex Positions
 		glEnableVertexAttribArray(0);
 		glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(VertexModel), (void*)0);
@@ -134,7 +317,5 @@ private:
 		// vertex bitangent
 		glEnableVertexAttribArray(4);
 		glVertexAttribPointer(4, 3, GL_FLOAT, GL_FALSE, sizeof(VertexModel), (void*)offsetof(VertexModel, Bitangent));
-
-		glBindVertexArray(0);
 	}
 };
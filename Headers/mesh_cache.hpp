@@ -0,0 +1,237 @@
+#pragma once
+
+#include <mesh.hpp>
+#include <file_utils.hpp>
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// Binary cache of fully processed meshes so a model only goes through Assimp the first time it's loaded.
+//
+// File layout (native endianness, every section 16 byte aligned):
+//   MeshCacheHeader
+//   MeshCacheRecord[meshCount]
+//   per mesh: texture slots (u32 type length, u32 path length, chars...), vertices, indices, MeshLod[lodCount]
+//
+// The cache is keyed by a hash of the source file plus the Assimp import flags. Bump MESH_CACHE_VERSION
+// whenever VertexModel or the processing done in Model::processMesh changes so stale files get rebuilt.
+#define MESH_CACHE_VERSION 3
+
+struct MeshCacheHeader {
+	char magic[4];
+	uint32_t version;
+	uint64_t sourceHash;
+	uint32_t importFlags;
+	uint32_t meshCount;
+	uint32_t vertexStride;
+	uint32_t reserved;
+};
+
+struct MeshCacheRecord {
+	uint32_t vertexCount;
+	uint32_t indexCount;
+	uint32_t textureCount;
+	uint32_t lodCount;
+	uint64_t textureOffset;
+	uint64_t vertexOffset;
+	uint64_t indexOffset;
+	uint64_t lodOffset;
+};
+
+class MeshCache
+{
+public:
+	// where the cache for a given model lives
+	static std::string pathFor(const std::string &modelPath)
+	{
+		return modelPath + ".meshcache";
+	}
+
+	// maps the cache file and checks it matches the source hash, flags and current version.
+	// returns false on any mismatch or corruption, which the caller treats as a cache miss.
+	bool open(const std::string &cachePath, uint64_t sourceHash, uint32_t importFlags)
+	{
+		close();
+		if (!file.open(cachePath))
+			return false;
+
+		const unsigned char *base = file.data();
+		size_t size = file.size();
+		if (size < sizeof(MeshCacheHeader))
+			return fail();
+
+		memcpy(&header, base, sizeof(header));
+		if (memcmp(header.magic, "RMSH", 4) != 0 || header.version != MESH_CACHE_VERSION ||
+			header.sourceHash != sourceHash || header.importFlags != importFlags || header.vertexStride != sizeof(VertexModel))
+			return fail();
+
+		uint64_t recordsEnd = sizeof(MeshCacheHeader) + (uint64_t)header.meshCount * sizeof(MeshCacheRecord);
+		if (recordsEnd > size)
+			return fail();
+		records.resize(header.meshCount);
+		if (header.meshCount)
+			memcpy(&records[0], base + sizeof(MeshCacheHeader), header.meshCount * sizeof(MeshCacheRecord));
+
+		// validate every range before anybody dereferences into the mapping
+		for (unsigned int i = 0; i < records.size(); i++)
+		{
+			const MeshCacheRecord &r = records[i];
+			if (!inRange(r.vertexOffset, (uint64_t)r.vertexCount * sizeof(VertexModel)) ||
+				!inRange(r.indexOffset, (uint64_t)r.indexCount * sizeof(unsigned int)) ||
+				r.vertexOffset % 4 != 0 || r.indexOffset % 4 != 0)
+				return fail();
+			for (unsigned int j = 0; j < r.indexCount; j++)
+				if (indices(i)[j] >= r.vertexCount)
+					return fail();
+			if (!inRange(r.lodOffset, (uint64_t)r.lodCount * sizeof(MeshLod)) || r.lodOffset % 4 != 0)
+				return fail();
+			vector<MeshLod> levels = lods(i);
+			for (unsigned int j = 0; j < levels.size(); j++)
+				if ((uint64_t)levels[j].indexOffset + levels[j].indexCount > r.indexCount)
+					return fail();
+			vector<TextureSlot> slots;
+			if (!readSlots(r, slots))
+				return fail();
+		}
+		return true;
+	}
+
+	void close()
+	{
+		file.close();
+		records.clear();
+	}
+
+	unsigned int meshCount() const { return (unsigned int)records.size(); }
+	const MeshCacheRecord &record(unsigned int i) const { return records[i]; }
+
+	const VertexModel *vertices(unsigned int i) const
+	{
+		return (const VertexModel*)(file.data() + records[i].vertexOffset);
+	}
+
+	const unsigned int *indices(unsigned int i) const
+	{
+		return (const unsigned int*)(file.data() + records[i].indexOffset);
+	}
+
+	vector<MeshLod> lods(unsigned int i) const
+	{
+		const MeshLod *first = (const MeshLod*)(file.data() + records[i].lodOffset);
+		return vector<MeshLod>(first, first + records[i].lodCount);
+	}
+
+	vector<TextureSlot> textures(unsigned int i) const
+	{
+		vector<TextureSlot> slots;
+		readSlots(records[i], slots);
+		return slots;
+	}
+
+	// serializes processed meshes, returns false if the file couldn't be written
+	static bool write(const std::string &cachePath, uint64_t sourceHash, uint32_t importFlags, const vector<MeshData> &meshes)
+	{
+		vector<unsigned char> out;
+		MeshCacheHeader h;
+		memcpy(h.magic, "RMSH", 4);
+		h.version = MESH_CACHE_VERSION;
+		h.sourceHash = sourceHash;
+		h.importFlags = importFlags;
+		h.meshCount = (uint32_t)meshes.size();
+		h.vertexStride = sizeof(VertexModel);
+		h.reserved = 0;
+		append(out, &h, sizeof(h));
+
+		vector<MeshCacheRecord> recs(meshes.size());
+		size_t recordsAt = out.size();
+		out.resize(out.size() + recs.size() * sizeof(MeshCacheRecord));
+
+		for (unsigned int i = 0; i < meshes.size(); i++)
+		{
+			const MeshData &m = meshes[i];
+			MeshCacheRecord &r = recs[i];
+			r.vertexCount = (uint32_t)m.vertices.size();
+			r.indexCount = (uint32_t)m.indices.size();
+			r.textureCount = (uint32_t)m.textures.size();
+			r.lodCount = (uint32_t)m.lods.size();
+
+			align(out);
+			r.textureOffset = out.size();
+			for (unsigned int t = 0; t < m.textures.size(); t++)
+			{
+				uint32_t lengths[2] = { (uint32_t)m.textures[t].type.size(), (uint32_t)m.textures[t].path.size() };
+				append(out, lengths, sizeof(lengths));
+				append(out, m.textures[t].type.data(), lengths[0]);
+				append(out, m.textures[t].path.data(), lengths[1]);
+			}
+
+			align(out);
+			r.vertexOffset = out.size();
+			append(out, m.vertices.data(), m.vertices.size() * sizeof(VertexModel));
+
+			align(out);
+			r.indexOffset = out.size();
+			append(out, m.indices.data(), m.indices.size() * sizeof(unsigned int));
+
+			align(out);
+			r.lodOffset = out.size();
+			append(out, m.lods.data(), m.lods.size() * sizeof(MeshLod));
+		}
+		if (!recs.empty())
+			memcpy(&out[recordsAt], &recs[0], recs.size() * sizeof(MeshCacheRecord));
+
+		return write_file_atomic(cachePath, out.data(), out.size());
+	}
+
+private:
+	MappedFile file;
+	MeshCacheHeader header;
+	vector<MeshCacheRecord> records;
+
+	bool fail()
+	{
+		close();
+		return false;
+	}
+
+	bool inRange(uint64_t offset, uint64_t bytes) const
+	{
+		return offset <= file.size() && bytes <= file.size() - offset;
+	}
+
+	bool readSlots(const MeshCacheRecord &r, vector<TextureSlot> &slots) const
+	{
+		uint64_t at = r.textureOffset;
+		for (unsigned int t = 0; t < r.textureCount; t++)
+		{
+			uint32_t lengths[2];
+			if (!inRange(at, sizeof(lengths)))
+				return false;
+			memcpy(lengths, file.data() + at, sizeof(lengths));
+			at += sizeof(lengths);
+			if (!inRange(at, (uint64_t)lengths[0] + lengths[1]))
+				return false;
+			TextureSlot slot;
+			slot.type.assign((const char*)file.data() + at, lengths[0]);
+			slot.path.assign((const char*)file.data() + at + lengths[0], lengths[1]);
+			at += lengths[0] + lengths[1];
+			slots.push_back(slot);
+		}
+		return true;
+	}
+
+	static void append(vector<unsigned char> &out, const void *data, size_t bytes)
+	{
+		if (bytes == 0)
+			return;
+		size_t at = out.size();
+		out.resize(at + bytes);
+		memcpy(&out[at], data, bytes);
+	}
+
+	static void align(vector<unsigned char> &out)
+	{
+		out.resize((out.size() + 15) & ~(size_t)15, 0);
+	}
+};
@@ -0,0 +1,364 @@
+#pragma once
+
+#include <mesh.hpp>
+#include <file_utils.hpp>
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <unordered_map>
+#include <vector>
+
+// before/after numbers for one mesh going through MeshOptimizer::optimize
+struct MeshOptimizeStats {
+	unsigned int verticesBefore, verticesAfter;
+	unsigned int triangles;
+	float acmrBefore, acmrAfter;	// average cache miss ratio, vertex shader runs per triangle (0.5 is ideal, 3 is no reuse)
+	size_t bytesBefore, bytesAfter;	// vertex + index buffer size
+	unsigned int lods;	// levels of detail built afterwards, their indices aren't part of bytesAfter
+
+	void print(unsigned int mesh) const
+	{
+		printf("    mesh %u: %u tris, %u -> %u verts, ACMR %.3f -> %.3f, %.1f KB -> %.1f KB (saved %.1f KB), %u lods\n", mesh, triangles,
+			verticesBefore, verticesAfter, acmrBefore, acmrAfter, bytesBefore / 1024.0, bytesAfter / 1024.0, ((double)bytesBefore - (double)bytesAfter) / 1024.0, lods);
+	}
+};
+
+// Post-import pass that makes a mesh cheaper to draw without changing how it looks:
+//   1. weld bit-identical vertices (Assimp hands every face its own copy without aiProcess_JoinIdenticalVertices)
+//   2. reorder triangles for the post-transform vertex cache (Forsyth's linear speed algorithm)
+//   3. reorder clusters of triangles so outward facing ones come first, which cuts overdraw
+//   4. reorder vertices in first-use order so vertex fetch walks memory linearly
+// Meshes that end up with at most 65536 vertices are drawn with 16 bit indices (see Mesh::setupMesh).
+class MeshOptimizer
+{
+public:
+	// size of the simulated vertex cache, a reasonable middle ground for current GPUs
+	static const unsigned int CACHE_SIZE = 32;
+	// overdraw reordering may make the vertex cache this much worse before it's rejected
+	static constexpr float OVERDRAW_THRESHOLD = 1.05f;
+
+	static MeshOptimizeStats optimize(MeshData &mesh)
+	{
+		MeshOptimizeStats stats;
+		stats.lods = 1;
+		stats.verticesBefore = (unsigned int)mesh.vertices.size();
+		stats.triangles = (unsigned int)(mesh.indices.size() / 3);
+		stats.acmrBefore = acmr(mesh.indices, mesh.vertices.size());
+		stats.bytesBefore = mesh.vertices.size() * sizeof(VertexModel) + mesh.indices.size() * sizeof(unsigned int);
+
+		if (!mesh.indices.empty())
+		{
+			weldVertices(mesh.vertices, mesh.indices);
+			optimizeVertexCache(mesh.indices, mesh.vertices.size());
+
+			vector<unsigned int> cacheOrder = mesh.indices;
+			float cacheAcmr = acmr(cacheOrder, mesh.vertices.size());
+			optimizeOverdraw(mesh.indices, mesh.vertices);
+			if (acmr(mesh.indices, mesh.vertices.size()) > cacheAcmr * OVERDRAW_THRESHOLD)
+				mesh.indices = cacheOrder;
+
+			optimizeVertexFetch(mesh.vertices, mesh.indices);
+		}
+
+		stats.verticesAfter = (unsigned int)mesh.vertices.size();
+		stats.acmrAfter = acmr(mesh.indices, mesh.vertices.size());
+		stats.bytesAfter = mesh.vertices.size() * sizeof(VertexModel) + mesh.indices.size() * (mesh.vertices.size() <= 65536 ? 2 : 4);
+		return stats;
+	}
+
+	// average cache miss ratio with a FIFO cache, the usual way to compare index orders
+	static float acmr(const vector<unsigned int> &indices, size_t vertexCount, unsigned int cacheSize = 16)
+	{
+		if (indices.size() < 3)
+			return 0.0f;
+		vector<unsigned int> timestamp(vertexCount, 0);
+		unsigned int time = cacheSize + 1;
+		unsigned int misses = 0;
+		for (size_t i = 0; i < indices.size(); i++)
+		{
+			unsigned int v = indices[i];
+			if (time - timestamp[v] > cacheSize)
+			{
+				timestamp[v] = time++;
+				misses++;
+			}
+		}
+		return (float)misses / (float)(indices.size() / 3);
+	}
+
+	// collapses bit-identical vertices into one
+	static void weldVertices(vector<VertexModel> &vertices, vector<unsigned int> &indices)
+	{
+		vector<unsigned int> remap(vertices.size());
+		vector<VertexModel> welded;
+		welded.reserve(vertices.size());
+
+		// hash -> first welded vertex with that hash, collisions are chained through next
+		std::unordered_map<uint64_t, unsigned int> buckets;
+		buckets.reserve(vertices.size());
+		vector<unsigned int> next;
+		next.reserve(vertices.size());
+
+		for (size_t i = 0; i < vertices.size(); i++)
+		{
+			uint64_t h = hash_bytes(&vertices[i], sizeof(VertexModel));
+			std::unordered_map<uint64_t, unsigned int>::iterator found = buckets.find(h);
+			unsigned int match = ~0u;
+			if (found != buckets.end())
+			{
+				for (unsigned int w = found->second; w != ~0u; w = next[w])
+				{
+					if (memcmp(&welded[w], &vertices[i], sizeof(VertexModel)) == 0)
+					{
+						match = w;
+						break;
+					}
+				}
+			}
+			if (match == ~0u)
+			{
+				match = (unsigned int)welded.size();
+				welded.push_back(vertices[i]);
+				next.push_back(found != buckets.end() ? found->second : ~0u);
+				buckets[h] = match;
+			}
+			remap[i] = match;
+		}
+
+		for (size_t i = 0; i < indices.size(); i++)
+			indices[i] = remap[indices[i]];
+		vertices.swap(welded);
+	}
+
+	// Tom Forsyth, "Linear-Speed Vertex Cache Optimisation". Greedily emits the triangle with the best score,
+	// where vertices score higher when they're recently used and when few of their triangles are left.
+	static void optimizeVertexCache(vector<unsigned int> &indices, size_t vertexCount)
+	{
+		size_t triangleCount = indices.size() / 3;
+		if (triangleCount == 0)
+			return;
+
+		// triangles around each vertex
+		vector<unsigned int> valence(vertexCount, 0);
+		for (size_t i = 0; i < indices.size(); i++)
+			valence[indices[i]]++;
+		vector<unsigned int> adjacencyStart(vertexCount + 1, 0);
+		for (size_t v = 0; v < vertexCount; v++)
+			adjacencyStart[v + 1] = adjacencyStart[v] + valence[v];
+		vector<unsigned int> adjacency(indices.size());
+		vector<unsigned int> fill(adjacencyStart.begin(), adjacencyStart.end() - 1);
+		for (size_t t = 0; t < triangleCount; t++)
+			for (int k = 0; k < 3; k++)
+				adjacency[fill[indices[t * 3 + k]]++] = (unsigned int)t;
+
+		vector<int> cachePosition(vertexCount, -1);
+		vector<float> vertexScore(vertexCount);
+		for (size_t v = 0; v < vertexCount; v++)
+			vertexScore[v] = score(-1, valence[v]);
+
+		vector<float> triangleScore(triangleCount);
+		vector<bool> emitted(triangleCount, false);
+		for (size_t t = 0; t < triangleCount; t++)
+			triangleScore[t] = vertexScore[indices[t * 3]] + vertexScore[indices[t * 3 + 1]] + vertexScore[indices[t * 3 + 2]];
+
+		vector<unsigned int> cache, newCache;
+		vector<unsigned int> out;
+		out.reserve(indices.size());
+		size_t scanCursor = 0;
+		long best = -1;
+
+		for (size_t emittedCount = 0; emittedCount < triangleCount; emittedCount++)
+		{
+			if (best < 0)
+			{
+				// nothing in the cache has triangles left, fall back to the next unemitted one in input order
+				while (emitted[scanCursor])
+					scanCursor++;
+				best = (long)scanCursor;
+			}
+
+			unsigned int tri = (unsigned int)best;
+			emitted[tri] = true;
+			newCache.clear();
+			for (int k = 0; k < 3; k++)
+			{
+				unsigned int v = indices[tri * 3 + k];
+				out.push_back(v);
+				newCache.push_back(v);
+
+				// drop the emitted triangle from the vertex's remaining list
+				unsigned int *begin = &adjacency[adjacencyStart[v]];
+				unsigned int *end = begin + valence[v];
+				unsigned int *at = std::find(begin, end, tri);
+				if (at != end)
+				{
+					*at = *(end - 1);
+					valence[v]--;
+				}
+			}
+			for (size_t c = 0; c < cache.size(); c++)
+			{
+				unsigned int v = cache[c];
+				if (v != newCache[0] && v != newCache[1] && v != newCache[2])
+					newCache.push_back(v);
+			}
+			// vertices pushed out of the cache lose their cache bonus
+			for (size_t c = CACHE_SIZE; c < newCache.size(); c++)
+			{
+				cachePosition[newCache[c]] = -1;
+				vertexScore[newCache[c]] = score(-1, valence[newCache[c]]);
+			}
+			if (newCache.size() > CACHE_SIZE)
+				newCache.resize(CACHE_SIZE);
+			cache.swap(newCache);
+
+			for (size_t c = 0; c < cache.size(); c++)
+			{
+				cachePosition[cache[c]] = (int)c;
+				vertexScore[cache[c]] = score((int)c, valence[cache[c]]);
+			}
+
+			// only triangles touching the cache changed score, the best next triangle is among them
+			best = -1;
+			float bestScore = -1.0f;
+			for (size_t c = 0; c < cache.size(); c++)
+			{
+				unsigned int v = cache[c];
+				for (unsigned int a = 0; a < valence[v]; a++)
+				{
+					unsigned int t = adjacency[adjacencyStart[v] + a];
+					float s = vertexScore[indices[t * 3]] + vertexScore[indices[t * 3 + 1]] + vertexScore[indices[t * 3 + 2]];
+					triangleScore[t] = s;
+					if (s > bestScore)
+					{
+						bestScore = s;
+						best = (long)t;
+					}
+				}
+			}
+		}
+		indices.swap(out);
+	}
+
+	// Splits the (already cache optimized) triangle list into clusters where the cache would be cold anyway,
+	// then sorts the clusters so the ones facing away from the mesh center are drawn first. Those tend to
+	// occlude the rest, so early-z rejects more of what follows. Based on Sander et al. "Fast triangle reordering
+	// for vertex locality and reduced overdraw".
+	static void optimizeOverdraw(vector<unsigned int> &indices, const vector<VertexModel> &vertices)
+	{
+		size_t triangleCount = indices.size() / 3;
+		if (triangleCount < 2)
+			return;
+
+		// cluster boundaries: triangles whose three vertices all miss the cache
+		vector<size_t> clusterStart;
+		vector<unsigned int> timestamp(vertices.size(), 0);
+		unsigned int time = CACHE_SIZE + 1;
+		for (size_t t = 0; t < triangleCount; t++)
+		{
+			int misses = 0;
+			for (int k = 0; k < 3; k++)
+			{
+				unsigned int v = indices[t * 3 + k];
+				if (time - timestamp[v] > CACHE_SIZE)
+				{
+					timestamp[v] = time++;
+					misses++;
+				}
+			}
+			if (t == 0 || misses == 3)
+				clusterStart.push_back(t);
+		}
+		clusterStart.push_back(triangleCount);
+		size_t clusterCount = clusterStart.size() - 1;
+		if (clusterCount < 2)
+			return;
+
+		// area weighted centroid and normal of each cluster and of the whole mesh
+		vector<glm::vec3> clusterCentroid(clusterCount, glm::vec3(0.0f));
+		vector<glm::vec3> clusterNormal(clusterCount, glm::vec3(0.0f));
+		glm::vec3 meshCentroid(0.0f);
+		float meshArea = 0.0f;
+		for (size_t c = 0; c < clusterCount; c++)
+		{
+			float area = 0.0f;
+			for (size_t t = clusterStart[c]; t < clusterStart[c + 1]; t++)
+			{
+				const glm::vec3 &a = vertices[indices[t * 3]].Position;
+				const glm::vec3 &b = vertices[indices[t * 3 + 1]].Position;
+				const glm::vec3 &d = vertices[indices[t * 3 + 2]].Position;
+				glm::vec3 n = glm::cross(b - a, d - a);
+				float triangleArea = glm::length(n);
+				clusterCentroid[c] += (a + b + d) * (triangleArea / 3.0f);
+				clusterNormal[c] += n;
+				area += triangleArea;
+			}
+			meshCentroid += clusterCentroid[c];
+			meshArea += area;
+			clusterCentroid[c] = area > 0.0f ? clusterCentroid[c] / area : clusterCentroid[c];
+		}
+		meshCentroid = meshArea > 0.0f ? meshCentroid / meshArea : meshCentroid;
+
+		vector<float> sortKey(clusterCount);
+		vector<unsigned int> order(clusterCount);
+		for (size_t c = 0; c < clusterCount; c++)
+		{
+			float normalLength = glm::length(clusterNormal[c]);
+			glm::vec3 n = normalLength > 0.0f ? clusterNormal[c] / normalLength : glm::vec3(0.0f);
+			sortKey[c] = glm::dot(clusterCentroid[c] - meshCentroid, n);
+			order[c] = (unsigned int)c;
+		}
+		std::stable_sort(order.begin(), order.end(), [&sortKey](unsigned int a, unsigned int b) { return sortKey[a] > sortKey[b]; });
+
+		vector<unsigned int> out;
+		out.reserve(indices.size());
+		for (size_t i = 0; i < clusterCount; i++)
+		{
+			size_t c = order[i];
+			out.insert(out.end(), indices.begin() + clusterStart[c] * 3, indices.begin() + clusterStart[c + 1] * 3);
+		}
+		indices.swap(out);
+	}
+
+	// renumbers vertices in the order the index buffer first touches them, unused vertices are dropped
+	static void optimizeVertexFetch(vector<VertexModel> &vertices, vector<unsigned int> &indices)
+	{
+		vector<unsigned int> remap(vertices.size(), ~0u);
+		vector<VertexModel> ordered;
+		ordered.reserve(vertices.size());
+		for (size_t i = 0; i < indices.size(); i++)
+		{
+			unsigned int v = indices[i];
+			if (remap[v] == ~0u)
+			{
+				remap[v] = (unsigned int)ordered.size();
+				ordered.push_back(vertices[v]);
+			}
+			indices[i] = remap[v];
+		}
+		vertices.swap(ordered);
+	}
+
+private:
+	// vertex score from Forsyth's article, cachePosition -1 means not in the cache
+	static float score(int cachePosition, unsigned int remainingValence)
+	{
+		if (remainingValence == 0)
+			return -1.0f;
+
+		float s = 0.0f;
+		if (cachePosition >= 0)
+		{
+			// the last triangle's vertices get a fixed score so the next triangle doesn't just reuse the same edge
+			if (cachePosition < 3)
+				s = 0.75f;
+			else
+				s = powf(1.0f - (float)(cachePosition - 3) / (float)(CACHE_SIZE - 3), 1.5f);
+		}
+		// boost vertices with few triangles left so they get finished off instead of leaving stragglers
+		s += 2.0f * powf((float)remainingValence, -0.5f);
+		return s;
+	}
+};
@@ -0,0 +1,309 @@
+#pragma once
+
+#include <mesh.hpp>
+#include <mesh_optimizer.hpp>
+#include <file_utils.hpp>
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <unordered_map>
+#include <vector>
+
+// Builds the LOD chain of a mesh with quadric error metrics (Garland & Heckbert, "Surface Simplification
+// Using Quadric Error Metrics"). Collapses are half-edge collapses onto an existing vertex, so every level
+// reuses the mesh's vertex buffer and only adds another index range behind the full resolution indices.
+//
+// Vertices on open borders and on attribute seams (same position, different normal/uv) are locked so the
+// silhouette and the texture mapping stay intact. Meshes that are mostly seams simply stop early.
+class MeshSimplifier
+{
+public:
+	// levels including the full resolution one
+	static const unsigned int MAX_LODS = 5;
+	// every level aims for this fraction of the previous level's triangles
+	static constexpr float LOD_REDUCTION = 0.5f;
+	// no level goes below this many triangles, there's nothing to gain from them
+	static const unsigned int MIN_LOD_TRIANGLES = 64;
+
+	// fills mesh.lods and appends the index ranges of the simplified levels to mesh.indices.
+	// runs on the worker threads after MeshOptimizer::optimize.
+	static void buildLods(MeshData &mesh)
+	{
+		mesh.lods.clear();
+		MeshLod base;
+		base.indexOffset = 0;
+		base.indexCount = (uint32_t)mesh.indices.size();
+		base.error = 0.0f;
+		mesh.lods.push_back(base);
+
+		// every level starts from the full mesh so its error is measured against the real surface
+		vector<unsigned int> full = mesh.indices;
+		size_t target = full.size();
+		float error = 0.0f;
+		while (mesh.lods.size() < MAX_LODS)
+		{
+			target = (size_t)(target / 3 * LOD_REDUCTION) * 3;
+			if (target < MIN_LOD_TRIANGLES * 3)
+				break;
+
+			float levelError = 0.0f;
+			vector<unsigned int> level = simplify(mesh.vertices, full, target, levelError);
+			// stuck on locked vertices, another level would look the same
+			if (level.size() > mesh.lods.back().indexCount * 9 / 10)
+				break;
+			MeshOptimizer::optimizeVertexCache(level, mesh.vertices.size());
+
+			error = std::max(error, levelError);
+			MeshLod lod;
+			lod.indexOffset = (uint32_t)mesh.indices.size();
+			lod.indexCount = (uint32_t)level.size();
+			lod.error = error;
+			mesh.lods.push_back(lod);
+			mesh.indices.insert(mesh.indices.end(), level.begin(), level.end());
+			target = level.size();
+		}
+	}
+
+	// returns a simplified index list with about targetIndexCount indices (or as close as the locked vertices allow).
+	// error is set to the object space distance the result may deviate from the input surface.
+	static vector<unsigned int> simplify(const vector<VertexModel> &vertices, const vector<unsigned int> &source, size_t targetIndexCount, float &error)
+	{
+		vector<unsigned int> indices = source;
+		size_t vertexCount = vertices.size();
+		error = 0.0f;
+
+		vector<bool> locked(vertexCount, false);
+		lockSeamsAndBorders(vertices, indices, locked);
+
+		// area weighted plane quadrics of the triangles around each vertex
+		vector<Quadric> quadrics(vertexCount);
+		for (size_t t = 0; t + 2 < indices.size(); t += 3)
+		{
+			const glm::vec3 &p0 = vertices[indices[t]].Position;
+			glm::vec3 n = glm::cross(vertices[indices[t + 1]].Position - p0, vertices[indices[t + 2]].Position - p0);
+			float length = glm::length(n);
+			if (length == 0.0f)
+				continue;
+			n /= length;
+			Quadric q = Quadric::plane(n, -glm::dot(n, p0), length * 0.5f);
+			for (int k = 0; k < 3; k++)
+				quadrics[indices[t + k]].add(q);
+		}
+
+		double maxError = 0.0;
+		vector<Collapse> candidates;
+		vector<unsigned int> remap(vertexCount);
+		vector<bool> touched(vertexCount);
+		vector<unsigned int> adjacencyStart, adjacency;
+
+		while (indices.size() > targetIndexCount)
+		{
+			// every collapse of an interior edge removes two triangles
+			size_t collapseBudget = (indices.size() - targetIndexCount) / 6 + 1;
+
+			candidates.clear();
+			for (size_t t = 0; t < indices.size(); t += 3)
+			{
+				for (int k = 0; k < 3; k++)
+				{
+					unsigned int a = indices[t + k];
+					unsigned int b = indices[t + (k + 1) % 3];
+					if (!locked[a])
+						candidates.push_back(makeCollapse(a, b, quadrics, vertices));
+					if (!locked[b])
+						candidates.push_back(makeCollapse(b, a, quadrics, vertices));
+				}
+			}
+			if (candidates.empty())
+				break;
+			std::sort(candidates.begin(), candidates.end(), [](const Collapse &x, const Collapse &y) { return x.cost < y.cost; });
+
+			buildAdjacency(indices, vertexCount, adjacencyStart, adjacency);
+			for (size_t v = 0; v < vertexCount; v++)
+				remap[v] = (unsigned int)v;
+			std::fill(touched.begin(), touched.end(), false);
+
+			size_t collapses = 0;
+			for (size_t c = 0; c < candidates.size() && collapses < collapseBudget; c++)
+			{
+				const Collapse &collapse = candidates[c];
+				unsigned int a = collapse.from, b = collapse.to;
+				if (touched[a] || touched[b])
+					continue;
+				if (flipsTriangle(a, b, indices, vertices, adjacencyStart, adjacency))
+					continue;
+
+				// the triangles around a change shape, so none of their vertices may move again this pass
+				for (unsigned int i = adjacencyStart[a]; i < adjacencyStart[a + 1]; i++)
+					for (int k = 0; k < 3; k++)
+						touched[indices[adjacency[i] * 3 + k]] = true;
+				touched[b] = true;
+
+				remap[a] = b;
+				quadrics[b].add(quadrics[a]);
+				maxError = std::max(maxError, collapse.error);
+				collapses++;
+			}
+			if (collapses == 0)
+				break;
+
+			// apply the collapses and drop the triangles that became degenerate
+			size_t out = 0;
+			for (size_t t = 0; t < indices.size(); t += 3)
+			{
+				unsigned int i0 = remap[indices[t]], i1 = remap[indices[t + 1]], i2 = remap[indices[t + 2]];
+				if (i0 == i1 || i1 == i2 || i0 == i2)
+					continue;
+				indices[out++] = i0;
+				indices[out++] = i1;
+				indices[out++] = i2;
+			}
+			indices.resize(out);
+		}
+
+		error = (float)maxError;
+		return indices;
+	}
+
+private:
+	// symmetric 4x4 matrix, only the upper triangle is stored. weight is the total area of the planes.
+	struct Quadric {
+		double a2, ab, ac, ad, b2, bc, bd, c2, cd, d2;
+		double weight;
+
+		Quadric() : a2(0), ab(0), ac(0), ad(0), b2(0), bc(0), bd(0), c2(0), cd(0), d2(0), weight(0) {}
+
+		static Quadric plane(glm::vec3 n, float d, float area)
+		{
+			Quadric q;
+			q.a2 = (double)n.x * n.x * area; q.ab = (double)n.x * n.y * area; q.ac = (double)n.x * n.z * area; q.ad = (double)n.x * d * area;
+			q.b2 = (double)n.y * n.y * area; q.bc = (double)n.y * n.z * area; q.bd = (double)n.y * d * area;
+			q.c2 = (double)n.z * n.z * area; q.cd = (double)n.z * d * area;
+			q.d2 = (double)d * d * area;
+			q.weight = area;
+			return q;
+		}
+
+		void add(const Quadric &q)
+		{
+			a2 += q.a2; ab += q.ab; ac += q.ac; ad += q.ad;
+			b2 += q.b2; bc += q.bc; bd += q.bd;
+			c2 += q.c2; cd += q.cd;
+			d2 += q.d2;
+			weight += q.weight;
+		}
+
+		// area weighted sum of squared distances of p to the accumulated planes
+		double eval(glm::vec3 p) const
+		{
+			double x = p.x, y = p.y, z = p.z;
+			double e = a2 * x * x + 2 * ab * x * y + 2 * ac * x * z + 2 * ad * x
+				+ b2 * y * y + 2 * bc * y * z + 2 * bd * y
+				+ c2 * z * z + 2 * cd * z
+				+ d2;
+			return e > 0.0 ? e : 0.0;
+		}
+	};
+
+	struct Collapse {
+		unsigned int from, to;
+		double cost;	// quadric error, collapses are done cheapest first
+		double error;	// root mean square distance to the planes, in object space units
+	};
+
+	static Collapse makeCollapse(unsigned int from, unsigned int to, const vector<Quadric> &quadrics, const vector<VertexModel> &vertices)
+	{
+		Quadric q = quadrics[from];
+		q.add(quadrics[to]);
+		Collapse c;
+		c.from = from;
+		c.to = to;
+		c.cost = q.eval(vertices[to].Position);
+		c.error = q.weight > 0.0 ? sqrt(c.cost / q.weight) : 0.0;
+		return c;
+	}
+
+	// locks vertices that share their position with another vertex (uv or normal seams) and vertices on open edges
+	static void lockSeamsAndBorders(const vector<VertexModel> &vertices, const vector<unsigned int> &indices, vector<bool> &locked)
+	{
+		// position id of every vertex, seams are several vertices with one position
+		vector<unsigned int> position(vertices.size());
+		std::unordered_map<uint64_t, unsigned int> firstAt;
+		firstAt.reserve(vertices.size());
+		for (size_t v = 0; v < vertices.size(); v++)
+		{
+			uint64_t h = hash_bytes(&vertices[v].Position, sizeof(glm::vec3));
+			std::unordered_map<uint64_t, unsigned int>::iterator found = firstAt.find(h);
+			if (found == firstAt.end())
+				firstAt[h] = position[v] = (unsigned int)v;
+			else
+			{
+				position[v] = found->second;
+				locked[v] = true;
+				locked[found->second] = true;
+			}
+		}
+
+		// edges between positions that only one triangle uses are on a border
+		std::unordered_map<uint64_t, unsigned int> edgeUses;
+		edgeUses.reserve(indices.size());
+		for (size_t t = 0; t + 2 < indices.size(); t += 3)
+			for (int k = 0; k < 3; k++)
+				edgeUses[edgeKey(position[indices[t + k]], position[indices[t + (k + 1) % 3]])]++;
+		for (size_t t = 0; t + 2 < indices.size(); t += 3)
+		{
+			for (int k = 0; k < 3; k++)
+			{
+				unsigned int a = indices[t + k], b = indices[t + (k + 1) % 3];
+				if (edgeUses[edgeKey(position[a], position[b])] == 1)
+				{
+					locked[a] = true;
+					locked[b] = true;
+				}
+			}
+		}
+	}
+
+	static uint64_t edgeKey(unsigned int a, unsigned int b)
+	{
+		return a < b ? ((uint64_t)a << 32) | b : ((uint64_t)b << 32) | a;
+	}
+
+	static void buildAdjacency(const vector<unsigned int> &indices, size_t vertexCount, vector<unsigned int> &start, vector<unsigned int> &adjacency)
+	{
+		start.assign(vertexCount + 1, 0);
+		for (size_t i = 0; i < indices.size(); i++)
+			start[indices[i] + 1]++;
+		for (size_t v = 0; v < vertexCount; v++)
+			start[v + 1] += start[v];
+		adjacency.resize(indices.size());
+		vector<unsigned int> fill(start.begin(), start.end() - 1);
+		for (size_t i = 0; i < indices.size(); i++)
+			adjacency[fill[indices[i]]++] = (unsigned int)(i / 3);
+	}
+
+	// moving a onto b must not turn any of a's remaining triangles over (or flat)
+	static bool flipsTriangle(unsigned int a, unsigned int b, const vector<unsigned int> &indices, const vector<VertexModel> &vertices,
+		const vector<unsigned int> &adjacencyStart, const vector<unsigned int> &adjacency)
+	{
+		for (unsigned int i = adjacencyStart[a]; i < adjacencyStart[a + 1]; i++)
+		{
+			const unsigned int *tri = &indices[adjacency[i] * 3];
+			if (tri[0] == b || tri[1] == b || tri[2] == b)
+				continue; // collapses away
+
+			glm::vec3 before[3], after[3];
+			for (int k = 0; k < 3; k++)
+			{
+				before[k] = vertices[tri[k]].Position;
+				after[k] = tri[k] == a ? vertices[b].Position : before[k];
+			}
+			glm::vec3 n0 = glm::cross(before[1] - before[0], before[2] - before[0]);
+			glm::vec3 n1 = glm::cross(after[1] - after[0], after[2] - after[0]);
+			if (glm::dot(n0, n1) <= 0.0f)
+				return true;
+		}
+		return false;
+	}
+};
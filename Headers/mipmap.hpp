@@ -0,0 +1,439 @@
+#pragma once
+
+#include <thread_pool.hpp>
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <functional>
+#include <vector>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define MIP_SSE 1
+#endif
+#if defined(MIP_SSE) && defined(__AVX2__)
+#include <immintrin.h>
+#define MIP_AVX2 1
+#endif
+
+// CPU mip chain generation for RGBA8 images. Used by the texture cooker, so cooked textures carry their own
+// mips, and on the loading threads of the texture streamer and the material library, which upload each level
+// themselves. The GL thread never filters anything.
+//
+// Levels are filtered in float from the previous float level, so the 8 bit rounding of one level doesn't
+// accumulate into the next. A pixel is 4 floats, the inner loops handle one pixel per SSE register and two per
+// AVX2 register, and fall back to plain C++ elsewhere. The AVX2 loops are only built with the PROJECT2_AVX2
+// CMake option. Every path adds in the same order and avoids FMA, so the results don't depend on which one was
+// compiled in.
+
+// how the channels of an image are interpreted while filtering
+enum MipColorSpace {
+	MIP_LINEAR,	// data (roughness, metalness, masks): averaged as stored
+	MIP_SRGB,	// colour: RGB is decoded to linear light before averaging and encoded again, alpha is linear
+	MIP_NORMAL	// tangent space normals: RGB is unpacked to [-1, 1], averaged and renormalized
+};
+
+// downsampling filter from one level to the next
+enum MipFilter {
+	MIP_FILTER_BOX,		// 2x2 average, like glGenerateMipmap. Cheap, but blurs and lets some aliasing through
+	MIP_FILTER_KAISER	// 8 tap Kaiser windowed sinc, keeps the smaller levels noticeably sharper
+};
+
+struct MipLevel {
+	int width, height;
+	std::vector<unsigned char> rgba;
+};
+
+// levels with fewer pixels than this are filtered on the calling thread even when a pool is given
+#define MIP_PARALLEL_MIN_PIXELS (256 * 256)
+// rows handed to a worker at a time
+#define MIP_PARALLEL_ROWS 16
+
+inline float srgb_to_linear(float c)
+{
+	return c <= 0.04045f ? c / 12.92f : powf((c + 0.055f) / 1.055f, 2.4f);
+}
+
+inline float linear_to_srgb(float c)
+{
+	return c <= 0.0031308f ? c * 12.92f : 1.055f * powf(c, 1.0f / 2.4f) - 0.055f;
+}
+
+// 8 bit sRGB to linear, built once (thread safe static init)
+struct SrgbDecodeTable {
+	float value[256];
+
+	SrgbDecodeTable()
+	{
+		for (int i = 0; i < 256; i++)
+			value[i] = srgb_to_linear(i / 255.0f);
+	}
+};
+
+// linear to 8 bit sRGB without a pow per channel: threshold[i] is the linear value where the encoded byte
+// goes from i to i + 1, so the byte is the number of thresholds at or below the value
+struct SrgbEncodeTable {
+	float threshold[255];
+
+	SrgbEncodeTable()
+	{
+		for (int i = 0; i < 255; i++)
+			threshold[i] = srgb_to_linear((i + 0.5f) / 255.0f);
+	}
+
+	unsigned char encode(float v) const
+	{
+		int b = 0;
+		for (int step = 128; step > 0; step >>= 1)
+			if (b + step <= 255 && threshold[b + step - 1] <= v)
+				b += step;
+		return (unsigned char)b;
+	}
+};
+
+// weights of the 8 source pixels around an output pixel, for source offsets -3.5 .. 3.5 from its centre.
+// sinc with its first zero at 2 source pixels (half the rate) under a Kaiser window (alpha 4) 4 pixels wide
+struct MipKaiserKernel {
+	float weight[8];
+
+	MipKaiserKernel()
+	{
+		const double alpha = 4.0;
+		double sum = 0.0;
+		double w[8];
+		for (int k = 0; k < 8; k++)
+		{
+			double d = k - 3.5;
+			double x = d * 0.5 * 3.14159265358979323846;
+			double t = d / 4.0;
+			w[k] = sin(x) / x * bessel_i0(alpha * sqrt(1.0 - t * t)) / bessel_i0(alpha);
+			sum += w[k];
+		}
+		for (int k = 0; k < 8; k++)
+			weight[k] = (float)(w[k] / sum);
+	}
+
+	static double bessel_i0(double x)
+	{
+		double sum = 1.0, term = 1.0;
+		for (int k = 1; k < 32; k++)
+		{
+			term *= (x * 0.5 / k) * (x * 0.5 / k);
+			sum += term;
+		}
+		return sum;
+	}
+};
+
+inline unsigned char mip_quantize(float v)
+{
+	v = v < 0.0f ? 0.0f : (v > 1.0f ? 1.0f : v);
+	return (unsigned char)(v * 255.0f + 0.5f);
+}
+
+// runs fn(first, end) over bands of [0, rows), spread over the pool for big levels
+inline void mip_for_rows(ThreadPool *pool, int rows, int width, const std::function<void(int, int)> &fn)
+{
+	if (!pool || pool->size() == 0 || (size_t)rows * width < MIP_PARALLEL_MIN_PIXELS)
+	{
+		fn(0, rows);
+		return;
+	}
+	size_t bands = (size_t)(rows + MIP_PARALLEL_ROWS - 1) / MIP_PARALLEL_ROWS;
+	pool->parallel_for(bands, [rows, &fn](size_t band) {
+		int first = (int)band * MIP_PARALLEL_ROWS;
+		fn(first, std::min(rows, first + MIP_PARALLEL_ROWS));
+	});
+}
+
+// 2x2 average of one output row. step is 4 floats (the next pixel), or 0 when the source is 1 pixel wide
+inline void mip_box_row(const float *row0, const float *row1, int step, float *out, int width)
+{
+	int x = 0;
+#ifdef MIP_AVX2
+	if (step)
+	{
+		const __m256 quarter = _mm256_set1_ps(0.25f);
+		for (; x + 2 <= width; x += 2)
+		{
+			const float *a = row0 + x * 8, *c = row1 + x * 8;
+			// [p0 p1] + [p0 p1] of the next row, then the left and right columns of both outputs added together
+			__m256 left = _mm256_add_ps(_mm256_loadu_ps(a), _mm256_loadu_ps(c));
+			__m256 right = _mm256_add_ps(_mm256_loadu_ps(a + 8), _mm256_loadu_ps(c + 8));
+			__m256 sum = _mm256_add_ps(_mm256_permute2f128_ps(left, right, 0x20), _mm256_permute2f128_ps(left, right, 0x31));
+			_mm256_storeu_ps(out + x * 4, _mm256_mul_ps(sum, quarter));
+		}
+	}
+#endif
+	for (; x < width; x++)
+	{
+		const float *a = row0 + x * 2 * step, *c = row1 + x * 2 * step;
+#ifdef MIP_SSE
+		__m128 sum = _mm_add_ps(_mm_add_ps(_mm_loadu_ps(a), _mm_loadu_ps(c)), _mm_add_ps(_mm_loadu_ps(a + step), _mm_loadu_ps(c + step)));
+		_mm_storeu_ps(out + x * 4, _mm_mul_ps(sum, _mm_set1_ps(0.25f)));
+#else
+		for (int k = 0; k < 4; k++)
+			out[x * 4 + k] = ((a[k] + c[k]) + (a[step + k] + c[step + k])) * 0.25f;
+#endif
+	}
+}
+
+// one output pixel of the horizontal Kaiser pass, taps clamped to the row
+inline void mip_kaiser_pixel(const float *row, int srcWidth, int x, const float *weight, float *out)
+{
+#ifdef MIP_SSE
+	__m128 sum = _mm_setzero_ps();
+	for (int k = 0; k < 8; k++)
+	{
+		int sx = std::min(std::max(x * 2 - 3 + k, 0), srcWidth - 1);
+		sum = _mm_add_ps(sum, _mm_mul_ps(_mm_loadu_ps(row + sx * 4), _mm_set1_ps(weight[k])));
+	}
+	_mm_storeu_ps(out, sum);
+#else
+	float sum[4] = { 0.0f, 0.0f, 0.0f, 0.0f };
+	for (int k = 0; k < 8; k++)
+	{
+		int sx = std::min(std::max(x * 2 - 3 + k, 0), srcWidth - 1);
+		for (int c = 0; c < 4; c++)
+			sum[c] += row[sx * 4 + c] * weight[k];
+	}
+	for (int c = 0; c < 4; c++)
+		out[c] = sum[c];
+#endif
+}
+
+// horizontal Kaiser pass of one row, srcWidth > 1
+inline void mip_kaiser_row(const float *row, int srcWidth, float *out, int width, const float *weight)
+{
+	int x = 0;
+#ifdef MIP_AVX2
+	// outputs from 2 up to interiorEnd have all their taps inside the row and skip the clamping
+	int interiorEnd = (srcWidth - 5) / 2 + 1;
+	for (; x < std::min(2, width); x++)
+		mip_kaiser_pixel(row, srcWidth, x, weight, out + x * 4);
+	for (; x + 2 <= interiorEnd && x + 2 <= width; x += 2)
+	{
+		const float *tap = row + (x * 2 - 3) * 4;
+		__m256 sum = _mm256_setzero_ps();
+		for (int k = 0; k < 8; k++)
+		{
+			// tap k of output x in the low half, of output x + 1 (two source pixels on) in the high half
+			__m256 pair = _mm256_insertf128_ps(_mm256_castps128_ps256(_mm_loadu_ps(tap + k * 4)), _mm_loadu_ps(tap + (k + 2) * 4), 1);
+			sum = _mm256_add_ps(sum, _mm256_mul_ps(pair, _mm256_set1_ps(weight[k])));
+		}
+		_mm256_storeu_ps(out + x * 4, sum);
+	}
+#endif
+	for (; x < width; x++)
+		mip_kaiser_pixel(row, srcWidth, x, weight, out + x * 4);
+}
+
+// vertical Kaiser pass of one output row from the 8 horizontally filtered rows around it
+inline void mip_kaiser_column(const float *const *rows, float *out, int width, const float *weight)
+{
+	int count = width * 4, i = 0;
+#ifdef MIP_AVX2
+	for (; i + 8 <= count; i += 8)
+	{
+		__m256 sum = _mm256_setzero_ps();
+		for (int k = 0; k < 8; k++)
+			sum = _mm256_add_ps(sum, _mm256_mul_ps(_mm256_loadu_ps(rows[k] + i), _mm256_set1_ps(weight[k])));
+		_mm256_storeu_ps(out + i, sum);
+	}
+#endif
+#ifdef MIP_SSE
+	for (; i + 4 <= count; i += 4)
+	{
+		__m128 sum = _mm_setzero_ps();
+		for (int k = 0; k < 8; k++)
+			sum = _mm_add_ps(sum, _mm_mul_ps(_mm_loadu_ps(rows[k] + i), _mm_set1_ps(weight[k])));
+		_mm_storeu_ps(out + i, sum);
+	}
+#endif
+	for (; i < count; i++)
+	{
+		float sum = 0.0f;
+		for (int k = 0; k < 8; k++)
+			sum += rows[k][i] * weight[k];
+		out[i] = sum;
+	}
+}
+
+// renormalizes normals in place and writes the row as RGBA8
+inline void mip_encode_row(float *row, int width, MipColorSpace space, unsigned char *out)
+{
+	static const SrgbEncodeTable srgbTable;
+	if (space == MIP_NORMAL)
+	{
+		for (int x = 0; x < width; x++)
+		{
+			float *n = row + x * 4;
+			float length = sqrtf(n[0] * n[0] + n[1] * n[1] + n[2] * n[2]);
+			if (length > 0.0f)
+				for (int k = 0; k < 3; k++)
+					n[k] /= length;
+		}
+	}
+	if (space == MIP_SRGB)
+	{
+		for (int x = 0; x < width; x++)
+		{
+			for (int k = 0; k < 3; k++)
+				out[x * 4 + k] = srgbTable.encode(row[x * 4 + k]);
+			out[x * 4 + 3] = mip_quantize(row[x * 4 + 3]);
+		}
+		return;
+	}
+
+	// normals go from [-1, 1] to [0, 1] first, alpha is always stored as is
+	float scale[4] = { 1.0f, 1.0f, 1.0f, 1.0f }, bias[4] = { 0.0f, 0.0f, 0.0f, 0.0f };
+	if (space == MIP_NORMAL)
+		for (int k = 0; k < 3; k++)
+			scale[k] = bias[k] = 0.5f;
+	int x = 0;
+#ifdef MIP_SSE
+	const __m128 vscale = _mm_loadu_ps(scale), vbias = _mm_loadu_ps(bias);
+	const __m128 zero = _mm_setzero_ps(), one = _mm_set1_ps(1.0f), max = _mm_set1_ps(255.0f), half = _mm_set1_ps(0.5f);
+	for (; x + 4 <= width; x += 4)
+	{
+		__m128i bytes[4];
+		for (int p = 0; p < 4; p++)
+		{
+			__m128 v = _mm_add_ps(_mm_mul_ps(_mm_loadu_ps(row + (x + p) * 4), vscale), vbias);
+			v = _mm_min_ps(_mm_max_ps(v, zero), one);
+			bytes[p] = _mm_cvttps_epi32(_mm_add_ps(_mm_mul_ps(v, max), half));
+		}
+		__m128i packed = _mm_packus_epi16(_mm_packs_epi32(bytes[0], bytes[1]), _mm_packs_epi32(bytes[2], bytes[3]));
+		_mm_storeu_si128((__m128i *)(out + x * 4), packed);
+	}
+#endif
+	for (; x < width; x++)
+		for (int k = 0; k < 4; k++)
+			out[x * 4 + k] = mip_quantize(row[x * 4 + k] * scale[k] + bias[k]);
+}
+
+// Builds the full chain down to 1x1, level 0 is a copy of the input. With the box filter odd sizes drop the
+// last row/column like GL's own, the Kaiser filter clamps its taps at the edges. Big levels are split into
+// bands of rows over pool if one is given, callers that already run on a worker usually pass none.
+inline void build_mip_chain(const unsigned char *rgba, int width, int height, MipColorSpace space, std::vector<MipLevel> &levels,
+	MipFilter filter = MIP_FILTER_BOX, ThreadPool *pool = nullptr)
+{
+	levels.clear();
+	MipLevel base;
+	base.width = width;
+	base.height = height;
+	base.rgba.assign(rgba, rgba + (size_t)width * height * 4);
+	levels.push_back(base);
+
+	// level 0 in the filtering space
+	static const SrgbDecodeTable srgbTable;
+	static const MipKaiserKernel kaiser;
+	std::vector<float> current((size_t)width * height * 4);
+	size_t pixels = (size_t)width * height, p = 0;
+	if (space == MIP_SRGB)
+	{
+		for (; p < pixels; p++)
+		{
+			for (int k = 0; k < 3; k++)
+				current[p * 4 + k] = srgbTable.value[rgba[p * 4 + k]];
+			current[p * 4 + 3] = rgba[p * 4 + 3] / 255.0f;
+		}
+	}
+	else
+	{
+		float scale[4] = { 1.0f, 1.0f, 1.0f, 1.0f }, bias[4] = { 0.0f, 0.0f, 0.0f, 0.0f };
+		if (space == MIP_NORMAL)
+			for (int k = 0; k < 3; k++)
+			{
+				scale[k] = 2.0f;
+				bias[k] = -1.0f;
+			}
+#ifdef MIP_SSE
+		const __m128 vscale = _mm_loadu_ps(scale), vbias = _mm_loadu_ps(bias), max = _mm_set1_ps(255.0f);
+		const __m128i zero = _mm_setzero_si128();
+		for (; p + 4 <= pixels; p += 4)
+		{
+			__m128i bytes = _mm_loadu_si128((const __m128i *)(rgba + p * 4));
+			__m128i lo = _mm_unpacklo_epi8(bytes, zero), hi = _mm_unpackhi_epi8(bytes, zero);
+			__m128i words[4] = { _mm_unpacklo_epi16(lo, zero), _mm_unpackhi_epi16(lo, zero), _mm_unpacklo_epi16(hi, zero), _mm_unpackhi_epi16(hi, zero) };
+			for (int i = 0; i < 4; i++)
+			{
+				__m128 v = _mm_div_ps(_mm_cvtepi32_ps(words[i]), max);
+				_mm_storeu_ps(&current[(p + i) * 4], _mm_add_ps(_mm_mul_ps(v, vscale), vbias));
+			}
+		}
+#endif
+		for (; p < pixels; p++)
+			for (int k = 0; k < 4; k++)
+				current[p * 4 + k] = rgba[p * 4 + k] / 255.0f * scale[k] + bias[k];
+	}
+
+	std::vector<float> next, horizontal;
+	while (width > 1 || height > 1)
+	{
+		int nextWidth = width > 1 ? width / 2 : 1;
+		int nextHeight = height > 1 ? height / 2 : 1;
+		next.resize((size_t)nextWidth * nextHeight * 4);
+
+		MipLevel level;
+		level.width = nextWidth;
+		level.height = nextHeight;
+		level.rgba.resize(next.size());
+
+		const float *src = current.data();
+		float *dst = next.data();
+		unsigned char *bytes = level.rgba.data();
+		int srcWidth = width, srcHeight = height;
+		if (filter == MIP_FILTER_KAISER)
+		{
+			// separable: every source row is narrowed first, then the output rows are filtered down the columns
+			horizontal.resize((size_t)nextWidth * height * 4);
+			float *narrow = horizontal.data();
+			mip_for_rows(pool, height, width, [=](int first, int end) {
+				for (int y = first; y < end; y++)
+				{
+					if (srcWidth > 1)
+						mip_kaiser_row(src + (size_t)y * srcWidth * 4, srcWidth, narrow + (size_t)y * nextWidth * 4, nextWidth, kaiser.weight);
+					else
+						std::copy(src + (size_t)y * 4, src + (size_t)y * 4 + 4, narrow + (size_t)y * 4);
+				}
+			});
+			mip_for_rows(pool, nextHeight, nextWidth, [=](int first, int end) {
+				for (int y = first; y < end; y++)
+				{
+					float *out = dst + (size_t)y * nextWidth * 4;
+					if (srcHeight > 1)
+					{
+						const float *rows[8];
+						for (int k = 0; k < 8; k++)
+							rows[k] = narrow + (size_t)std::min(std::max(y * 2 - 3 + k, 0), srcHeight - 1) * nextWidth * 4;
+						mip_kaiser_column(rows, out, nextWidth, kaiser.weight);
+					}
+					else
+						std::copy(narrow, narrow + (size_t)nextWidth * 4, out);
+					mip_encode_row(out, nextWidth, space, bytes + (size_t)y * nextWidth * 4);
+				}
+			});
+		}
+		else
+		{
+			mip_for_rows(pool, nextHeight, nextWidth, [=](int first, int end) {
+				for (int y = first; y < end; y++)
+				{
+					// 1 pixel sides are reused for both taps
+					const float *row0 = src + (size_t)(srcHeight > 1 ? y * 2 : 0) * srcWidth * 4;
+					const float *row1 = src + (size_t)(srcHeight > 1 ? y * 2 + 1 : 0) * srcWidth * 4;
+					float *out = dst + (size_t)y * nextWidth * 4;
+					mip_box_row(row0, row1, srcWidth > 1 ? 4 : 0, out, nextWidth);
+					mip_encode_row(out, nextWidth, space, bytes + (size_t)y * nextWidth * 4);
+				}
+			});
+		}
+
+		levels.push_back(level);
+		current.swap(next);
+		width = nextWidth;
+		height = nextHeight;
+	}
+}
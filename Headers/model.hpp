@@ -9,9 +9,19 @@
 #include <assimp/scene.h>
 #include <assimp/postprocess.h>
 
+#include <gl_state.hpp>
 #include <mesh.hpp>
+#include <mesh_cache.hpp>
+#include <mesh_optimizer.hpp>
+#include <mesh_simplifier.hpp>
+#include <file_utils.hpp>
+#include <thread_pool.hpp>
+#include <texture_streamer.hpp>
+#include <compressed_texture.hpp>
+#include <frustum_culling.hpp>
 #include <shader.hpp>
 
+#include <chrono>
 #include <string>
 #include <fstream>
 #include <sstream>
@@ -21,78 +31,394 @@
 
 using namespace std;
 
-unsigned int TextureFromFile(const char *path, const string &directory, bool gamma = false);
-GLuint texture_loadDDS(const char* path);
+// post processing applied to every imported model, part of the mesh cache key
+const unsigned int MODEL_IMPORT_FLAGS = aiProcess_Triangulate | aiProcess_FlipUVs | aiProcess_CalcTangentSpace | aiProcess_GenSmoothNormals;
+
+TextureHandle TextureHandleFromFile(const char *path, const string &directory, bool gamma = false, uint32_t placeholder = TEXTURE_PLACEHOLDER_GREY, MipColorSpace space = MIP_SRGB);
+unsigned int TextureFromFile(const char *path, const string &directory, bool gamma = false, uint32_t placeholder = TEXTURE_PLACEHOLDER_GREY, MipColorSpace space = MIP_SRGB);
+
+// how the mips of a material slot are filtered: normal maps as normals, diffuse colour in sRGB, data maps
+// (texture_specular, texture_height) linearly. Slots this doesn't know are colour if the model is gamma corrected
+inline MipColorSpace texture_slot_mip_space(const string &type, bool gamma)
+{
+	if (type == "texture_normal")
+		return MIP_NORMAL;
+	if (type == "texture_diffuse")
+		return MIP_SRGB;
+	if (type == "texture_specular" || type == "texture_height")
+		return MIP_LINEAR;
+	return gamma ? MIP_SRGB : MIP_LINEAR;
+}
+
+// where the time went while loading a model
+struct ModelLoadStats {
+	bool cacheHit;
+	double hashMs, importMs, processMs, textureMs, uploadMs, cacheWriteMs;
+	vector<MeshOptimizeStats> meshStats;	// only filled on a cache miss, cached meshes are stored already optimized
+
+	ModelLoadStats() : cacheHit(false), hashMs(0), importMs(0), processMs(0), textureMs(0), uploadMs(0), cacheWriteMs(0) {}
+
+	double totalMs() const { return hashMs + importMs + processMs + textureMs + uploadMs + cacheWriteMs; }
+
+	void print(const string &path, unsigned int meshCount) const
+	{
+		printf("MODEL::LOAD %s (%u meshes, %s, %u threads)\n", path.c_str(), meshCount, cacheHit ? "cache hit" : "cache miss", ThreadPool::shared().size() + 1);
+		printf("    hash %.1f ms | import %.1f ms | process %.1f ms | textures %.1f ms | upload %.1f ms | cache write %.1f ms | total %.1f ms\n",
+			hashMs, importMs, processMs, textureMs, uploadMs, cacheWriteMs, totalMs());
+		if (meshStats.empty())
+			return;
+		size_t before = 0, after = 0;
+		for (unsigned int i = 0; i < meshStats.size(); i++)
+		{
+			meshStats[i].print(i);
+			before += meshStats[i].bytesBefore;
+			after += meshStats[i].bytesAfter;
+		}
+		printf("    mesh optimization saved %.1f KB of %.1f KB\n", ((double)before - (double)after) / 1024.0, before / 1024.0);
+	}
+};
+
+// measures the time between successive calls to lap()
+struct ModelLoadTimer {
+	std::chrono::high_resolution_clock::time_point last;
+
+	ModelLoadTimer() : last(std::chrono::high_resolution_clock::now()) {}
+
+	double lap()
+	{
+		std::chrono::high_resolution_clock::time_point now = std::chrono::high_resolution_clock::now();
+		double ms = std::chrono::duration<double, std::milli>(now - last).count();
+		last = now;
+		return ms;
+	}
+};
+
+// level of detail each mesh of a model is currently drawn at. Keep one per drawn instance, switching
+// levels depends on the previous choice (see Model::Draw).
+struct LodState {
+	vector<unsigned int> meshLod;
+};
 
 class Model
 {
 public:
 	/*  Model Data */
-	vector<Texture> textures_loaded;	// stores all the textures loaded so far, optimization to make sure textures aren't loaded more than once.
 	vector<Mesh> meshes;
 	string directory;
 	bool gammaCorrection;
+	VertexFormat vertexFormat;
+	ModelLoadStats loadStats;
+	// a coarser level is used once its error covers less than this many pixels on screen
+	float lodPixelError;
+	// fraction of lodPixelError a level must be below before switching to it, keeps levels from flickering at the boundary
+	float lodHysteresis;
+	// shared vertex/index buffers the meshes were put in, null if every mesh has its own
+	GeometryArena *arena;
+	// object space box around every mesh
+	glm::vec3 boundsMin, boundsMax;
 
 	/*  Functions   */
 	// constructor, expects a filepath to a 3D model.
-	Model(string const &path, bool gamma = false) : gammaCorrection(gamma)
+	// VERTEX_FORMAT_COMPACT quantizes the vertices to less than half the size, the shader has to decode them (see pbrShader.vert).
+	// with an arena (e.g. Mesh::sharedArena()) all meshes are suballocated from its buffers and drawn with one
+	// multi-draw per index type. Arenas only take the full vertex format, compact models ignore it.
+	Model(string const &path, bool gamma = false, VertexFormat format = VERTEX_FORMAT_FULL, GeometryArena *arena = nullptr)
+		: gammaCorrection(gamma), vertexFormat(format), lodPixelError(1.0f), lodHysteresis(0.75f), arena(format == VERTEX_FORMAT_FULL ? arena : nullptr)
 	{
 		loadModel(path);
+		buildBatches();
+		computeBounds();
 	}
 
 	// draws the model, and thus all its meshes
-	void Draw(Shader shader)
+	void Draw(Shader &shader)
 	{
+		if (!batches.empty())
+		{
+			drawBatches(shader, nullptr, nullptr);
+			return;
+		}
 		for (unsigned int i = 0; i < meshes.size(); i++)
 			meshes[i].Draw(shader);
 	}
 
+	// draws the model with each mesh at a level of detail picked from its size on screen. model, view and projection
+	// are the matrices the shader is drawing with, viewportHeight is in pixels. state remembers the levels between frames.
+	// the same size estimate tells the texture streamer how much of each mesh's textures is worth having resident.
+	// meshes outside the view frustum are skipped.
+	void Draw(Shader &shader, const glm::mat4 &model, const glm::mat4 &view, const glm::mat4 &projection, float viewportHeight, LodState &state)
+	{
+		state.meshLod.resize(meshes.size(), 0);
+		cullMeshes(Frustum(projection * view * model));
+		glm::mat4 modelView = view * model;
+		// largest axis scale, so the sphere stays a bound under non-uniform scaling
+		float scale = glm::max(glm::length(glm::vec3(model[0])), glm::max(glm::length(glm::vec3(model[1])), glm::length(glm::vec3(model[2]))));
+		// pixels covered by one unit at distance 1
+		float pixelsPerUnit = projection[1][1] * viewportHeight * 0.5f;
+
+		for (unsigned int i = 0; i < meshes.size(); i++)
+		{
+			const Mesh &mesh = meshes[i];
+			unsigned int &lod = state.meshLod[i];
+			float distance = glm::length(glm::vec3(modelView * glm::vec4(mesh.boundsCenter, 1.0f)));
+			float radius = mesh.boundsRadius * scale;
+			float diameter = distance <= radius ? viewportHeight : glm::min(2.0f * radius * pixelsPerUnit / distance, viewportHeight);
+			for (unsigned int t = 0; t < mesh.textures.size(); t++)
+				TextureStreamer::get().noteUsage(mesh.textures[t].id, diameter);
+			if (distance <= radius)
+				lod = 0; // camera inside the bounding sphere
+			else
+			{
+				// the projected sphere gives the pixels per object space unit, which turns each level's error into pixels
+				float pixels = scale * pixelsPerUnit / distance;
+				if (lod >= mesh.lods.size())
+					lod = (unsigned int)mesh.lods.size() - 1;
+				while (lod + 1 < mesh.lods.size() && mesh.lods[lod + 1].error * pixels < lodPixelError * lodHysteresis)
+					lod++;
+				while (lod > 0 && mesh.lods[lod].error * pixels > lodPixelError)
+					lod--;
+			}
+		}
+
+		if (!batches.empty())
+		{
+			drawBatches(shader, &state.meshLod, &meshVisible);
+			return;
+		}
+		for (unsigned int i = 0; i < meshes.size(); i++)
+			if (meshVisible[i])
+				meshes[i].Draw(shader, state.meshLod[i]);
+	}
+
+	// count copies of the model, each placed by its InstanceData (instances first on, uploaded already). One call per
+	// mesh, GL 3.3 has no instanced multi-draw. Meshes aren't culled and draw at full detail, the caller culls instances
+	void DrawInstanced(Shader &shader, InstanceBuffer &instances, uint32_t first, GLsizei count)
+	{
+		if (!batches.empty())
+		{
+			// the arena's vertex array is shared by every mesh, so the instance attributes are pointed once
+			shader.setBool("compactVertex", false);
+			GlState::get().bindVertexArray(arena->vertexArray());
+			instances.attach(first);
+			for (unsigned int b = 0; b < batches.size(); b++)
+				for (unsigned int i = 0; i < batches[b].meshes.size(); i++)
+				{
+					const Mesh &mesh = meshes[batches[b].meshes[i]];
+					glDrawElementsInstancedBaseVertex(GL_TRIANGLES, mesh.lodIndexCount(0), mesh.indexType, mesh.lodIndexOffset(0), count, mesh.allocation.baseVertex);
+				}
+			return;
+		}
+		for (unsigned int i = 0; i < meshes.size(); i++)
+			meshes[i].DrawInstanced(shader, instances, first, count);
+	}
+
+	// diameter in pixels of the whole model's bounds on screen (viewportHeight if the camera is inside), for
+	// reporting textures that are bound outside the model to the texture streamer
+	float screenSize(const glm::mat4 &model, const glm::mat4 &view, const glm::mat4 &projection, float viewportHeight) const
+	{
+		glm::mat4 modelView = view * model;
+		float scale = glm::max(glm::length(glm::vec3(model[0])), glm::max(glm::length(glm::vec3(model[1])), glm::length(glm::vec3(model[2]))));
+		float pixelsPerUnit = projection[1][1] * viewportHeight * 0.5f;
+		float size = 0.0f;
+		for (unsigned int i = 0; i < meshes.size(); i++)
+		{
+			float distance = glm::length(glm::vec3(modelView * glm::vec4(meshes[i].boundsCenter, 1.0f)));
+			float radius = meshes[i].boundsRadius * scale;
+			if (distance <= radius)
+				return viewportHeight;
+			size = glm::max(size, 2.0f * radius * pixelsPerUnit / distance);
+		}
+		return glm::min(size, viewportHeight);
+	}
+
 private:
+	// meshes in the arena that can go into one glMultiDrawElementsBaseVertex call. Batches are geometry only: like
+	// Mesh::Draw they bind no textures, the caller binds the material (see MaterialLibrary) for the whole model
+	struct MeshBatch {
+		GLenum indexType;
+		vector<unsigned int> meshes;
+	};
+	vector<MeshBatch> batches;
+	// per draw arguments, kept around so drawing doesn't allocate
+	vector<GLsizei> batchCounts;
+	vector<const void*> batchOffsets;
+	vector<GLint> batchBaseVertices;
+	// the meshes' object space boxes, and which of them the last Draw with matrices found in the frustum
+	BoxCuller meshCuller;
+	vector<uint8_t> meshVisible;
+
 	/*  Functions   */
+	// groups the meshes by index type, only if all of them ended up in the arena
+	void buildBatches()
+	{
+		batches.clear();
+		if (!arena || meshes.empty())
+			return;
+		for (unsigned int i = 0; i < meshes.size(); i++)
+			if (meshes[i].arena != arena)
+				return;
+
+		for (unsigned int i = 0; i < meshes.size(); i++)
+		{
+			unsigned int b = 0;
+			while (b < batches.size() && batches[b].indexType != meshes[i].indexType)
+				b++;
+			if (b == batches.size())
+			{
+				batches.push_back(MeshBatch());
+				batches[b].indexType = meshes[i].indexType;
+			}
+			batches[b].meshes.push_back(i);
+		}
+		arena->countBatches(meshes.size(), batches.size());
+	}
+
+	void computeBounds()
+	{
+		boundsMin = boundsMax = glm::vec3(0.0f);
+		meshCuller.clear();
+		for (unsigned int i = 0; i < meshes.size(); i++)
+		{
+			boundsMin = i ? glm::min(boundsMin, meshes[i].boundsMin) : meshes[i].boundsMin;
+			boundsMax = i ? glm::max(boundsMax, meshes[i].boundsMax) : meshes[i].boundsMax;
+			meshCuller.add(meshes[i].boundsMin, meshes[i].boundsMax);
+		}
+	}
+
+	// frustum is in object space (built from projection * view * model), so the boxes are tested as they are
+	void cullMeshes(const Frustum &frustum)
+	{
+		size_t visible = meshCuller.cull(frustum, meshVisible);
+		CullStats::get().count(CULL_MESHES, visible, meshes.size());
+	}
+
+	// one draw call per batch, lods picks each mesh's level of detail (null for full resolution) and visible which
+	// meshes are drawn (null for all)
+	void drawBatches(Shader &shader, const vector<unsigned int> *lods, const vector<uint8_t> *visible)
+	{
+		shader.setBool("compactVertex", false);
+		GlState::get().bindVertexArray(arena->vertexArray());
+		for (unsigned int b = 0; b < batches.size(); b++)
+		{
+			const MeshBatch &batch = batches[b];
+			batchCounts.clear();
+			batchOffsets.clear();
+			batchBaseVertices.clear();
+			for (unsigned int i = 0; i < batch.meshes.size(); i++)
+			{
+				if (visible && !(*visible)[batch.meshes[i]])
+					continue;
+				const Mesh &mesh = meshes[batch.meshes[i]];
+				unsigned int lod = lods ? (*lods)[batch.meshes[i]] : 0;
+				batchCounts.push_back(mesh.lodIndexCount(lod));
+				batchOffsets.push_back(mesh.lodIndexOffset(lod));
+				batchBaseVertices.push_back(mesh.allocation.baseVertex);
+			}
+			if (batchCounts.empty())
+				continue;
+			glMultiDrawElementsBaseVertex(GL_TRIANGLES, batchCounts.data(), batch.indexType, batchOffsets.data(), (GLsizei)batchCounts.size(), batchBaseVertices.data());
+		}
+	}
+
 	// loads a model with supported ASSIMP extensions from file and stores the resulting meshes in the meshes vector.
+	// the processed meshes are kept in a mesh cache next to the model, so ASSIMP only runs when that cache is missing or stale.
 	void loadModel(string const &path)
 	{
+		ModelLoadTimer timer;
+
+		// retrieve the directory path of the filepath
+		directory = path.substr(0, path.find_last_of('/'));
+
+		// try the mesh cache first, it is keyed by the contents of the model file and the import flags
+		uint64_t sourceHash = 0;
+		bool hashed = hash_file(path, sourceHash);
+		loadStats.hashMs = timer.lap();
+		MeshCache cache;
+		if (hashed && cache.open(MeshCache::pathFor(path), sourceHash, MODEL_IMPORT_FLAGS))
+		{
+			loadStats.cacheHit = true;
+			// vertex and index data go straight from the mapping into the GL buffers
+			vector<vector<Texture> > textures(cache.meshCount());
+			for (unsigned int i = 0; i < cache.meshCount(); i++)
+				textures[i] = loadTextures(cache.textures(i));
+			loadStats.textureMs = timer.lap();
+			for (unsigned int i = 0; i < cache.meshCount(); i++)
+			{
+				const MeshCacheRecord &r = cache.record(i);
+				meshes.push_back(Mesh(cache.vertices(i), r.vertexCount, cache.indices(i), r.indexCount, textures[i], vertexFormat, cache.lods(i), arena));
+			}
+			loadStats.uploadMs = timer.lap();
+			loadStats.print(path, (unsigned int)meshes.size());
+			return;
+		}
+
 		// read file via ASSIMP
 		Assimp::Importer importer;
-		const aiScene* scene = importer.ReadFile(path, aiProcess_Triangulate | aiProcess_FlipUVs | aiProcess_CalcTangentSpace | aiProcess_GenSmoothNormals);
+		const aiScene* scene = importer.ReadFile(path, MODEL_IMPORT_FLAGS);
 		// check for errors
 		if (!scene || scene->mFlags & AI_SCENE_FLAGS_INCOMPLETE || !scene->mRootNode) // if is Not Zero
 		{
 			cout << "ERROR::ASSIMP:: " << importer.GetErrorString() << endl;
 			return;
 		}
-		// retrieve the directory path of the filepath
-		directory = path.substr(0, path.find_last_of('/'));
-
-		// process ASSIMP's root node recursively
-		processNode(scene->mRootNode, scene);
+		loadStats.importMs = timer.lap();
+
+		// flatten ASSIMP's node tree, then process, optimize and simplify the meshes on the thread pool.
+		// every mesh writes to its own slot so the result is in node order no matter which thread finishes first.
+		vector<aiMesh*> sceneMeshes;
+		collectMeshes(scene->mRootNode, scene, sceneMeshes);
+		vector<MeshData> meshData(sceneMeshes.size());
+		loadStats.meshStats.resize(sceneMeshes.size());
+		ThreadPool::shared().parallel_for(sceneMeshes.size(), [&](size_t i) {
+			meshData[i] = processMesh(sceneMeshes[i], scene);
+			loadStats.meshStats[i] = MeshOptimizer::optimize(meshData[i]);
+			MeshSimplifier::buildLods(meshData[i]);
+			loadStats.meshStats[i].lods = (unsigned int)meshData[i].lods.size();
+		});
+		loadStats.processMs = timer.lap();
+
+		// everything below needs the GL context, so it runs here as one batch
+		vector<vector<Texture> > textures(meshData.size());
+		for (unsigned int i = 0; i < meshData.size(); i++)
+			textures[i] = loadTextures(meshData[i].textures);
+		loadStats.textureMs = timer.lap();
+
+		for (unsigned int i = 0; i < meshData.size(); i++)
+			meshes.push_back(Mesh(meshData[i].vertices, meshData[i].indices, textures[i], vertexFormat, meshData[i].lods, arena));
+		loadStats.uploadMs = timer.lap();
+
+		if (hashed && !MeshCache::write(MeshCache::pathFor(path), sourceHash, MODEL_IMPORT_FLAGS, meshData))
+			cout << "WARNING::MESH_CACHE:: could not write cache for " << path << endl;
+		loadStats.cacheWriteMs = timer.lap();
+		loadStats.print(path, (unsigned int)meshes.size());
 	}
 
-	// processes a node in a recursive fashion. Processes each individual mesh located at the node and repeats this process on its children nodes (if any).
-	void processNode(aiNode *node, const aiScene *scene)
+	// walks the node tree in a recursive fashion and collects the meshes of each node, parents before their children.
+	void collectMeshes(aiNode *node, const aiScene *scene, vector<aiMesh*> &sceneMeshes)
 	{
-		// process each mesh located at the current node
+		// collect each mesh located at the current node
 		for (unsigned int i = 0; i < node->mNumMeshes; i++)
 		{
 			// the node object only contains indices to index the actual objects in the scene. 
 			// the scene contains all the data, node is just to keep stuff organized (like relations between nodes).
-			aiMesh* mesh = scene->mMeshes[node->mMeshes[i]];
-			meshes.push_back(processMesh(mesh, scene));
+			sceneMeshes.push_back(scene->mMeshes[node->mMeshes[i]]);
 		}
-		// after we've processed all of the meshes (if any) we then recursively process each of the children nodes
+		// after we've collected all of the meshes (if any) we then recursively collect each of the children nodes
 		for (unsigned int i = 0; i < node->mNumChildren; i++)
 		{
-			processNode(node->mChildren[i], scene);
+			collectMeshes(node->mChildren[i], scene, sceneMeshes);
 		}
 
 	}
 
-	Mesh processMesh(aiMesh *mesh, const aiScene *scene)
+	// CPU side only, this runs on the worker threads so it must not touch GL or any Model state
+	MeshData processMesh(aiMesh *mesh, const aiScene *scene)
 	{
 		// data to fill
-		vector<VertexModel> vertices;
-		vector<unsigned int> indices;
-		vector<Texture> textures;
+		MeshData data;
+		vector<VertexModel> &vertices = data.vertices;
+		vector<unsigned int> &indices = data.indices;
+		vector<TextureSlot> &textures = data.textures;
 
 		// Walk through each of the mesh's vertices
 		for (unsigned int i = 0; i < mesh->mNumVertices; i++)
@@ -153,223 +479,83 @@ private:
 		printf("diff: %d, roughness: %d, normal: %d, other: %d\n", material->GetTextureCount(aiTextureType_DIFFUSE), material->GetTextureCount(aiTextureType_REFLECTION), material->GetTextureCount(aiTextureType_NORMALS), material->GetTextureCount(aiTextureType_UNKNOWN));
 		
 		// 1. diffuse maps
-		vector<Texture> diffuseMaps = loadMaterialTextures(material, aiTextureType_DIFFUSE, "texture_diffuse");
-		textures.insert(textures.end(), diffuseMaps.begin(), diffuseMaps.end());
+		collectMaterialTextures(material, aiTextureType_DIFFUSE, "texture_diffuse", textures);
 		// 2. specular maps
-		vector<Texture> specularMaps = loadMaterialTextures(material, aiTextureType_SPECULAR, "texture_specular");
-		textures.insert(textures.end(), specularMaps.begin(), specularMaps.end());
+		collectMaterialTextures(material, aiTextureType_SPECULAR, "texture_specular", textures);
 		// 3. normal maps
-		std::vector<Texture> normalMaps = loadMaterialTextures(material, aiTextureType_HEIGHT, "texture_normal");
-		textures.insert(textures.end(), normalMaps.begin(), normalMaps.end());
+		collectMaterialTextures(material, aiTextureType_HEIGHT, "texture_normal", textures);
 		// 4. height maps
-		std::vector<Texture> heightMaps = loadMaterialTextures(material, aiTextureType_AMBIENT, "texture_height");
-		textures.insert(textures.end(), heightMaps.begin(), heightMaps.end());
-		
+		collectMaterialTextures(material, aiTextureType_AMBIENT, "texture_height", textures);
 		
-		// return a mesh object created from the extracted mesh data
-		return Mesh(vertices, indices, textures);
+		// return the extracted mesh data, the GL side is created by the caller
+		return data;
 	}
 
-	// checks all material textures of a given type and loads the textures if they're not loaded yet.
-	// the required info is returned as a Texture struct.
-	vector<Texture> loadMaterialTextures(aiMaterial *mat, aiTextureType type, string typeName)
+	// records the paths of all material textures of a given type, they're loaded later by loadTextures
+	void collectMaterialTextures(aiMaterial *mat, aiTextureType type, string typeName, vector<TextureSlot> &slots)
 	{
-		vector<Texture> textures;
 		for (unsigned int i = 0; i < mat->GetTextureCount(type); i++)
 		{
 			aiString str;
 			mat->GetTexture(type, i, &str);
-			// check if texture was loaded before and if so, continue to next iteration: skip loading a new texture
-			bool skip = false;
-			for (unsigned int j = 0; j < textures_loaded.size(); j++)
-			{
-				if (std::strcmp(textures_loaded[j].path.C_Str(), str.C_Str()) == 0)
-				{
-					textures.push_back(textures_loaded[j]);
-					skip = true; // a texture with the same filepath has already been loaded, continue to next one. (optimization)
-					break;
-				}
-			}
-			if (!skip)
-			{   // if texture hasn't been loaded already, load it
-				Texture texture;
-				texture.id = TextureFromFile(str.C_Str(), this->directory);
-				texture.type = typeName;
-				texture.path = str;
-				textures.push_back(texture);
-				textures_loaded.push_back(texture);  // store it as texture loaded for entire model, to ensure we won't unnecesery load duplicate textures.
-			}
+			TextureSlot slot;
+			slot.type = typeName;
+			slot.path = str.C_Str();
+			slots.push_back(slot);
+		}
+	}
+
+	// loads the textures of a mesh. textures shared with other meshes or models come out of the resource cache.
+	// the required info is returned as a Texture struct.
+	vector<Texture> loadTextures(const vector<TextureSlot> &slots)
+	{
+		vector<Texture> textures;
+		for (unsigned int i = 0; i < slots.size(); i++)
+		{
+			// normal maps get a flat normal while they stream in, everything else a neutral grey
+			uint32_t placeholder = slots[i].type == "texture_normal" ? TEXTURE_PLACEHOLDER_FLAT_NORMAL : TEXTURE_PLACEHOLDER_GREY;
+			Texture texture;
+			MipColorSpace space = texture_slot_mip_space(slots[i].type, gammaCorrection);
+			texture.handle = TextureHandleFromFile(slots[i].path.c_str(), this->directory, gammaCorrection, placeholder, space);
+			texture.id = texture.handle.id();
+			texture.type = slots[i].type;
+			texture.path.Set(slots[i].path.c_str());
+			textures.push_back(texture);
 		}
 		return textures;
 	}
 };
 
 
-unsigned int TextureFromFile(const char* path, const string& directory, bool gamma)
+// returns right away with a placeholder texture, the image itself is decoded in the background and
+// uploaded by TextureStreamer::update(). DDS and KTX2 files are already GPU ready and are loaded directly,
+// and so is an up to date cooked version of the image (see Tools/texture_cooker.cpp).
+// textures are shared through the resource cache, so loading the same file twice returns the same texture.
+// space picks how the streamer builds the mips, see texture_slot_mip_space.
+TextureHandle TextureHandleFromFile(const char* path, const string& directory, bool gamma, uint32_t placeholder, MipColorSpace space)
 {
 	string filename = string(path);
 	filename = directory + '/' + filename;
 
-	unsigned int textureID;
-	glGenTextures(1, &textureID);
-
-	int width, height, nrComponents;
-	unsigned char* data = stbi_load(filename.c_str(), &width, &height, &nrComponents, 0);
-	if (data)
-	{
-		GLenum format;
-		if (nrComponents == 1)
-			format = GL_RED;
-		else if (nrComponents == 3)
-			format = GL_RGB;
-		else if (nrComponents == 4)
-			format = GL_RGBA;
-
-		glBindTexture(GL_TEXTURE_2D, textureID);
-		glTexImage2D(GL_TEXTURE_2D, 0, format, width, height, 0, format, GL_UNSIGNED_BYTE, data);
-		glGenerateMipmap(GL_TEXTURE_2D);
-
-		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
-		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
-		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
-		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-
-		stbi_image_free(data);
-	}
-	else
-	{
-		textureID = texture_loadDDS(filename.c_str());
-		std::cout << "Texture failed to load at path: " << filename << std::endl;
-		stbi_image_free(data);
-	}
-
-	return textureID;
+	uint32_t params = RESOURCE_TEXTURE_2D | (gamma ? RESOURCE_GAMMA : 0) | (TextureStreamer::get().flipVertically() ? RESOURCE_FLIP_VERTICALLY : 0) |
+		(uint32_t)space << RESOURCE_MIP_SPACE_SHIFT;
+	return ResourceCache::get().acquire(filename, params, GL_TEXTURE_2D, [&](size_t &gpuBytes) {
+		string extension = filename.substr(filename.find_last_of('.') + 1);
+		if (extension == "dds" || extension == "DDS" || extension == "ktx2" || extension == "KTX2")
+			return TextureStreamer::get().requestCompressed(filename, &gpuBytes);
+		string cooked = cooked_texture_path(filename, TextureStreamer::get().flipVertically(), space);
+		if (!cooked.empty())
+		{
+			unsigned int id = TextureStreamer::get().requestCompressed(cooked, &gpuBytes);
+			if (id)
+				return id;
+		}
+		return TextureStreamer::get().request(filename, placeholder, GL_REPEAT, space);
+	});
 }
 
-
-
-
-GLuint texture_loadDDS(const char* path) {
-	// lay out variables to be used
-	unsigned char* header;
-
-	unsigned int width;
-	unsigned int height;
-	unsigned int mipMapCount;
-
-	unsigned int blockSize;
-	unsigned int format;
-
-	unsigned int w;
-	unsigned int h;
-
-	unsigned char* buffer = 0;
-
-	GLuint tid = 0;
-
-	// open the DDS file for binary reading and get file size
-	FILE* f;
-	if ((f = fopen(path, "rb")) == 0)
-	{
-		perror("error ): ");
-		return 0;
-	}
-
-	fseek(f, 0, SEEK_END);
-	long file_size = ftell(f);
-	fseek(f, 0, SEEK_SET);
-
-	// allocate new unsigned char space with 4 (file code) + 124 (header size) bytes
-	// read in 128 bytes from the file
-	header = (unsigned char*)malloc(128);
-	fread(header, 1, 128, f);
-
-	// compare the `DDS ` signature
-	if (memcmp(header, "DDS ", 4) != 0)
-		goto exit;
-
-	// extract height, width, and amount of mipmaps - yes it is stored height then width
-	height = (header[12]) | (header[13] << 8) | (header[14] << 16) | (header[15] << 24);
-	width = (header[16]) | (header[17] << 8) | (header[18] << 16) | (header[19] << 24);
-	mipMapCount = (header[28]) | (header[29] << 8) | (header[30] << 16) | (header[31] << 24);
-
-	// figure out what format to use for what fourCC file type it is
-	// block size is about physical chunk storage of compressed data in file (important)
-	if (header[84] == 'D') {
-		switch (header[87]) {
-		case '1': // DXT1
-			format = GL_COMPRESSED_RGBA_S3TC_DXT1_EXT;
-			blockSize = 8;
-			break;
-		case '3': // DXT3
-			format = GL_COMPRESSED_RGBA_S3TC_DXT3_EXT;
-			blockSize = 16;
-			break;
-		case '5': // DXT5
-			format = GL_COMPRESSED_RGBA_S3TC_DXT5_EXT;
-			blockSize = 16;
-			break;
-		case '0': // DX10
-			// unsupported, else will error
-			// as it adds sizeof(struct DDS_HEADER_DXT10) between pixels
-			// so, buffer = malloc((file_size - 128) - sizeof(struct DDS_HEADER_DXT10));
-		default: goto exit;
-		}
-	}
-	else // BC4U/BC4S/ATI2/BC55/R8G8_B8G8/G8R8_G8B8/UYVY-packed/YUY2-packed unsupported
-		goto exit;
-
-	// allocate new unsigned char space with file_size - (file_code + header_size) magnitude
-	// read rest of file
-	buffer = (unsigned char*)malloc(file_size - 128);
-	if (buffer == 0)
-		goto exit;
-	fread(buffer, 1, file_size, f);
-
-	// prepare new incomplete texture
-	glGenTextures(1, &tid);
-	if (tid == 0)
-		goto exit;
-
-	// bind the texture
-	// make it complete by specifying all needed parameters and ensuring all mipmaps are filled
-	glBindTexture(GL_TEXTURE_2D, tid);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, 0);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, mipMapCount - 1); // opengl likes array length of mipmaps
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR); // don't forget to enable mipmaping
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
-
-	// prepare some variables
-	unsigned int offset = 0;
-	unsigned int size = 0;
-	w = width;
-	h = height;
-
-	// loop through sending block at a time with the magic formula
-	// upload to opengl properly, note the offset transverses the pointer
-	// assumes each mipmap is 1/2 the size of the previous mipmap
-	for (unsigned int i = 0; i < mipMapCount; i++) {
-		if (w == 0 || h == 0) { // discard any odd mipmaps 0x1 0x2 resolutions
-			mipMapCount--;
-			continue;
-		}
-		size = ((w + 3) / 4) * ((h + 3) / 4) * blockSize;
-		glCompressedTexImage2D(GL_TEXTURE_2D, i, format, w, h, 0, size, buffer + offset);
-		offset += size;
-		w /= 2;
-		h /= 2;
-	}
-	// discard any odd mipmaps, ensure a complete texture
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, mipMapCount - 1);
-	// unbind
-	glBindTexture(GL_TEXTURE_2D, 0);
-
-	// easy macro to get out quick and uniform (minus like 15 lines of bulk)
-exit:
-	free(buffer);
-	free(header);
-	fclose(f);
-	return tid;
-}
\ No newline at end of file
+// same as TextureHandleFromFile for callers that only keep the id, the texture stays loaded for the rest of the program
+unsigned int TextureFromFile(const char* path, const string& directory, bool gamma, uint32_t placeholder, MipColorSpace space)
+{
+	return TextureHandleFromFile(path, directory, gamma, placeholder, space).pin();
+}
@@ -0,0 +1,156 @@
+#pragma once
+
+#include <glad/glad.h>
+
+#include <file_utils.hpp>
+
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#ifndef GL_PROGRAM_BINARY_RETRIEVABLE_HINT
+#define GL_PROGRAM_BINARY_RETRIEVABLE_HINT 0x8257
+#endif
+#ifndef GL_PROGRAM_BINARY_LENGTH
+#define GL_PROGRAM_BINARY_LENGTH 0x8741
+#endif
+#ifndef GL_NUM_PROGRAM_BINARY_FORMATS
+#define GL_NUM_PROGRAM_BINARY_FORMATS 0x87FE
+#endif
+
+// bump when the file layout changes
+#define PROGRAM_CACHE_VERSION 1
+
+// Linked programs saved with glGetProgramBinary next to the fragment shader, one file per variant
+// (<fragment>.<variant>.program). The key covers the preprocessed sources and the driver, so an edited include or
+// a driver update just misses and the caller compiles as usual. Binaries need GL 4.1 or ARB_get_program_binary;
+// without either every load misses.
+class ProgramCache
+{
+public:
+	// key of a program: everything that changes the binary the driver produces
+	static uint64_t key(const std::vector<std::string> &sources)
+	{
+		uint64_t h = hash_string(driver(), PROGRAM_CACHE_VERSION);
+		for (size_t i = 0; i < sources.size(); i++)
+			h = hash_string(sources[i], h);
+		return h;
+	}
+
+	static std::string path(const std::string &fragmentPath, const std::string &variant)
+	{
+		char name[32];
+		snprintf(name, sizeof(name), ".%016llx.program", (unsigned long long)hash_string(variant));
+		return fragmentPath + name;
+	}
+
+	static bool supported()
+	{
+#if defined(GL_VERSION_4_1) || defined(GL_ARB_get_program_binary)
+		static int formats = -1;
+		if (formats < 0)
+		{
+			formats = 0;
+			if (glGetProgramBinary && glProgramBinary)
+				glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &formats);
+		}
+		return formats > 0;
+#else
+		return false;
+#endif
+	}
+
+	// call before linking a program that will be stored
+	static void prepare(GLuint program)
+	{
+#if defined(GL_VERSION_4_1) || defined(GL_ARB_get_program_binary)
+		if (supported())
+			glProgramParameteri(program, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+#else
+		(void)program;
+#endif
+	}
+
+	// loads the binary into program, false if there is none for this key or the driver rejects it
+	static bool load(const std::string &file, uint64_t key, GLuint program)
+	{
+#if defined(GL_VERSION_4_1) || defined(GL_ARB_get_program_binary)
+		if (!supported())
+			return false;
+		MappedFile mapped;
+		if (!mapped.open(file) || mapped.size() < sizeof(Header))
+			return false;
+		Header header;
+		memcpy(&header, mapped.data(), sizeof(header));
+		if (memcmp(header.magic, "RPRG", 4) != 0 || header.version != PROGRAM_CACHE_VERSION || header.key != key
+			|| header.length != mapped.size() - sizeof(Header))
+			return false;
+
+		const unsigned char *binary = (const unsigned char *)mapped.data() + sizeof(Header);
+		glProgramBinary(program, header.format, binary, (GLsizei)header.length);
+		GLint linked = GL_FALSE;
+		glGetProgramiv(program, GL_LINK_STATUS, &linked);
+		return linked == GL_TRUE;
+#else
+		(void)file; (void)key; (void)program;
+		return false;
+#endif
+	}
+
+	static bool store(const std::string &file, uint64_t key, GLuint program)
+	{
+#if defined(GL_VERSION_4_1) || defined(GL_ARB_get_program_binary)
+		if (!supported())
+			return false;
+		GLint length = 0;
+		glGetProgramiv(program, GL_PROGRAM_BINARY_LENGTH, &length);
+		if (length <= 0)
+			return false;
+
+		std::vector<unsigned char> data(sizeof(Header) + length);
+		Header header;
+		memcpy(header.magic, "RPRG", 4);
+		header.version = PROGRAM_CACHE_VERSION;
+		header.key = key;
+		GLsizei written = 0;
+		glGetProgramBinary(program, length, &written, &header.format, &data[sizeof(Header)]);
+		if (written <= 0)
+			return false;
+		header.length = (uint32_t)written;
+		memcpy(&data[0], &header, sizeof(header));
+		if (!write_file_atomic(file, &data[0], sizeof(Header) + written))
+		{
+			printf("ERROR::PROGRAM_CACHE::WRITE_FAILED %s\n", file.c_str());
+			return false;
+		}
+		return true;
+#else
+		(void)file; (void)key; (void)program;
+		return false;
+#endif
+	}
+
+private:
+	struct Header {
+		char magic[4];
+		uint32_t version;
+		uint64_t key;
+		GLenum format;
+		uint32_t length;	// bytes of binary following the header
+	};
+
+	static std::string driver()
+	{
+		std::string id;
+		const GLenum names[] = { GL_VENDOR, GL_RENDERER, GL_VERSION };
+		for (int i = 0; i < 3; i++)
+		{
+			const GLubyte *s = glGetString(names[i]);
+			id += s ? (const char *)s : "";
+			id += '\n';
+		}
+		return id;
+	}
+};
@@ -0,0 +1,283 @@
+#pragma once
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+
+#include <frustum_culling.hpp>
+#include <gl_state.hpp>
+#include <instance_buffer.hpp>
+#include <model.hpp>
+#include <shader.hpp>
+#include <uniform_buffers.hpp>
+
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <functional>
+#include <vector>
+
+// sort key layout, most significant bits first
+//   opaque:       layer (2) | program (14) | material (16) | depth (24) | 0 (8)
+//   transparent:  layer (2) | far to near depth (24) | program (14) | material (16) | 0 (8)
+// so opaque draws are grouped by program, then material, and go front to back inside a group, while
+// transparent ones are drawn back to front whatever their state.
+#define RENDER_LAYER_OPAQUE 0u
+#define RENDER_LAYER_TRANSPARENT 1u
+#define RENDER_PROGRAM_BITS 14
+#define RENDER_MATERIAL_BITS 16
+#define RENDER_DEPTH_BITS 24
+
+// one draw of a model, collected during the frame and drawn in key order by RenderQueue::flush()
+struct RenderItem {
+	Model *model;
+	LodState *lod;			// levels of detail of this object, required for plain draws: every object keeps its own
+	unsigned int program;	// caller's id of the program (e.g. ShaderVariants::id()), below 2^RENDER_PROGRAM_BITS
+	unsigned int material;	// caller's id of the material, below 2^RENDER_MATERIAL_BITS
+	glm::mat4 transform;
+	glm::vec4 parameters;	// per draw values handed to RenderQueueBindings::setItem, e.g. constant material terms
+	bool transparent;
+	// set by RenderQueue::submitInstanced, the item's range of the queue's instances. 0 instances is a plain draw
+	uint32_t firstInstance, instanceCount;
+
+	RenderItem() : model(nullptr), lod(nullptr), program(0), material(0), transform(1.0f), parameters(0.0f), transparent(false),
+		firstInstance(0), instanceCount(0) {}
+};
+
+// how flush() talks to the caller's programs and materials. bindProgram is called once per run of items with the
+// same program and returns the Shader they are drawn with, bindMaterial once per run with the same program and
+// material, setItem (optional) before every draw
+struct RenderQueueBindings {
+	std::function<Shader &(unsigned int program)> bindProgram;
+	std::function<void(unsigned int program, unsigned int material)> bindMaterial;
+	std::function<void(unsigned int program, const RenderItem &item)> setItem;
+};
+
+// Collects the frame's draws, radix sorts them by a packed 64 bit key and submits them in one loop, so state
+// changes follow the number of distinct programs and materials instead of the number of objects.
+class RenderQueue
+{
+public:
+	RenderQueue() : preculled(false), programBinds(0), materialBinds(0), draws(0), instancesDrawn(0) {}
+
+	// starts a frame, the view matrix gives each item its depth. culled says the caller only submits what it
+	// already found in the frustum (e.g. with Scene::queryFrustum), so flush() doesn't test the items again
+	void begin(const glm::mat4 &view, bool culled = false)
+	{
+		this->view = view;
+		preculled = culled;
+		items.clear();
+		keys.clear();
+		boxMin.clear();
+		boxMax.clear();
+		instances.clear();
+	}
+
+	void submit(const RenderItem &item)
+	{
+		if (!item.lod)
+		{
+			// sharing the model's state would make copies of it fight over their levels
+			printf("ERROR::RENDERQUEUE::ITEM_WITHOUT_LOD_STATE\n");
+			return;
+		}
+		// distance along the view direction, what front to back means for the depth buffer
+		float depth = -(view * item.transform[3]).z;
+		keys.push_back(sortKey(item, depth));
+		items.push_back(item);
+		items.back().instanceCount = 0;
+		if (preculled)
+			return;
+		glm::vec3 min, max;
+		transform_bounds(item.transform, item.model->boundsMin, item.model->boundsMax, min, max);
+		boxMin.push_back(min);
+		boxMax.push_back(max);
+	}
+
+	// count copies of item.model in one draw call, each with its own transform and parameters. item.program has to
+	// read them from the instance attributes (see InstanceBuffer), item.transform and item.lod are ignored. The
+	// copies are culled and depth sorted together, by the box around all of them
+	void submitInstanced(const RenderItem &item, const InstanceData *data, size_t count)
+	{
+		if (!count)
+			return;
+		glm::vec3 min, max, instanceMin, instanceMax;
+		for (size_t i = 0; i < count; i++)
+		{
+			transform_bounds(data[i].transform, item.model->boundsMin, item.model->boundsMax, instanceMin, instanceMax);
+			min = i ? glm::min(min, instanceMin) : instanceMin;
+			max = i ? glm::max(max, instanceMax) : instanceMax;
+		}
+		float depth = -(view * glm::vec4((min + max) * 0.5f, 1.0f)).z;
+		keys.push_back(sortKey(item, depth));
+		items.push_back(item);
+		items.back().firstInstance = instances.add(data, count);
+		items.back().instanceCount = (uint32_t)count;
+		if (preculled)
+			return;
+		boxMin.push_back(min);
+		boxMax.push_back(max);
+	}
+
+	// drops what's outside the view frustum (unless begin() was told it's culled already), sorts and draws the rest
+	// of what was submitted since begin()
+	void flush(const glm::mat4 &projection, float viewportHeight, const RenderQueueBindings &bindings)
+	{
+		if (!preculled)
+			cull(Frustum(projection * view));
+		sort();
+		instances.upload();
+		programBinds = materialBinds = 0;
+		draws = items.size();
+		instancesDrawn = 0;
+
+		Shader *shader = nullptr;
+		unsigned int program = 0, material = 0;
+		bool transparent = false;
+		for (size_t i = 0; i < order.size(); i++)
+		{
+			RenderItem &item = items[order[i]];
+			if (!shader || item.program != program)
+			{
+				shader = &bindings.bindProgram(item.program);
+				program = item.program;
+				programBinds++;
+				materialBinds++;
+				bindings.bindMaterial(program, item.material);
+				material = item.material;
+			}
+			else if (item.material != material)
+			{
+				materialBinds++;
+				bindings.bindMaterial(program, item.material);
+				material = item.material;
+			}
+			// transparent draws test against the opaque depth but don't write it
+			if (item.transparent != transparent)
+			{
+				transparent = item.transparent;
+				GlState::get().depthMask(transparent ? GL_FALSE : GL_TRUE);
+			}
+			if (bindings.setItem)
+				bindings.setItem(program, item);
+
+			if (item.instanceCount)
+			{
+				item.model->DrawInstanced(*shader, instances, item.firstInstance, (GLsizei)item.instanceCount);
+				instancesDrawn += item.instanceCount;
+				continue;
+			}
+			UniformBuffers::get().setObject(item.transform);
+			item.model->Draw(*shader, item.transform, view, projection, viewportHeight, *item.lod);
+		}
+		if (transparent)
+			GlState::get().depthMask(GL_TRUE);
+	}
+
+	size_t size() const { return items.size(); }
+
+	void printStats() const
+	{
+		printf("RENDERQUEUE:: %u draws (%u instances in instanced ones), %u program binds, %u material binds\n", (unsigned int)draws,
+			(unsigned int)instancesDrawn, (unsigned int)programBinds, (unsigned int)materialBinds);
+	}
+
+private:
+	glm::mat4 view;
+	bool preculled;
+	std::vector<RenderItem> items;
+	std::vector<uint64_t> keys;
+	// item indices in draw order, and the buffers the sort ping-pongs between
+	std::vector<uint32_t> order, scratch;
+	std::vector<uint64_t> sortedKeys, scratchKeys;
+	std::vector<glm::vec3> boxMin, boxMax;	// world space boxes of the items, not kept if preculled
+	BoxCuller culler;
+	std::vector<uint8_t> visible;
+	InstanceBuffer instances;
+	size_t programBinds, materialBinds, draws, instancesDrawn;
+
+	// tests every item's world space box in one batch and keeps the visible items (and their keys) in order
+	void cull(const Frustum &frustum)
+	{
+		culler.clear();
+		for (size_t i = 0; i < items.size(); i++)
+			culler.add(boxMin[i], boxMax[i]);
+		size_t kept = culler.cull(frustum, visible);
+		CullStats::get().count(CULL_OBJECTS, kept, items.size());
+
+		size_t to = 0;
+		for (size_t i = 0; i < items.size(); i++)
+			if (visible[i])
+			{
+				items[to] = items[i];
+				keys[to] = keys[i];
+				boxMin[to] = boxMin[i];
+				boxMax[to] = boxMax[i];
+				to++;
+			}
+		items.resize(to);
+		keys.resize(to);
+		boxMin.resize(to);
+		boxMax.resize(to);
+	}
+
+	// the top RENDER_DEPTH_BITS of the float's bits. Non-negative floats sort like their bit patterns, so no near
+	// and far plane are needed to quantize; anything behind the camera counts as 0
+	static uint64_t depthBits(float depth)
+	{
+		if (!(depth > 0.0f))
+			return 0;
+		uint32_t bits;
+		memcpy(&bits, &depth, sizeof(bits));
+		return bits >> (31 - RENDER_DEPTH_BITS);
+	}
+
+	static uint64_t sortKey(const RenderItem &item, float depth)
+	{
+		const uint64_t programMask = (1u << RENDER_PROGRAM_BITS) - 1, materialMask = (1u << RENDER_MATERIAL_BITS) - 1;
+		const uint64_t depthMask = (1u << RENDER_DEPTH_BITS) - 1;
+		uint64_t program = item.program & programMask, material = item.material & materialMask;
+		uint64_t d = depthBits(depth);
+		if (!item.transparent)
+			return (uint64_t)RENDER_LAYER_OPAQUE << 62 | program << 48 | material << 32 | d << 8;
+		return (uint64_t)RENDER_LAYER_TRANSPARENT << 62 | (depthMask - d) << 38 | program << 24 | material << 8;
+	}
+
+	// least significant digit radix sort, 8 bits per pass. Stable, and passes where every key has the same digit
+	// (e.g. the unused low byte, or the program when there is only one) are skipped
+	void sort()
+	{
+		size_t n = keys.size();
+		order.resize(n);
+		scratch.resize(n);
+		sortedKeys = keys;
+		scratchKeys.resize(n);
+		for (size_t i = 0; i < n; i++)
+			order[i] = (uint32_t)i;
+
+		for (int shift = 0; shift < 64; shift += 8)
+		{
+			size_t counts[256];
+			memset(counts, 0, sizeof(counts));
+			for (size_t i = 0; i < n; i++)
+				counts[(sortedKeys[i] >> shift) & 0xFF]++;
+			if (n == 0 || counts[(sortedKeys[0] >> shift) & 0xFF] == n)
+				continue;
+
+			size_t offset = 0;
+			for (int b = 0; b < 256; b++)
+			{
+				size_t count = counts[b];
+				counts[b] = offset;
+				offset += count;
+			}
+			for (size_t i = 0; i < n; i++)
+			{
+				size_t to = counts[(sortedKeys[i] >> shift) & 0xFF]++;
+				scratchKeys[to] = sortedKeys[i];
+				scratch[to] = order[i];
+			}
+			sortedKeys.swap(scratchKeys);
+			order.swap(scratch);
+		}
+	}
+};
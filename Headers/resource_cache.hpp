@@ -0,0 +1,296 @@
+#pragma once
+
+#include <glad/glad.h>
+
+#include <gl_state.hpp>
+#include <file_utils.hpp>
+#include <texture_streamer.hpp>
+
+#include <cctype>
+#include <cstdint>
+#include <cstdio>
+#include <functional>
+#include <list>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// what kind of resource a cache entry is, part of the key so the same file loaded two ways gets two entries
+enum ResourceKind {
+	RESOURCE_TEXTURE_2D = 1,
+	RESOURCE_CUBEMAP = 2,
+	RESOURCE_ENVIRONMENT_MAP = 3
+};
+
+// load parameters that change the resulting GL object
+const uint32_t RESOURCE_FLIP_VERTICALLY = 1u << 8;
+const uint32_t RESOURCE_GAMMA = 1u << 9;
+// the MipColorSpace a texture's mips are built in, two bits from here
+const uint32_t RESOURCE_MIP_SPACE_SHIFT = 10;
+
+struct ResourceKey {
+	std::string path;	// normalized, see ResourceCache::normalizePath
+	uint32_t params;	// ResourceKind | RESOURCE_* flags
+
+	bool operator==(const ResourceKey &other) const { return params == other.params && path == other.path; }
+};
+
+struct ResourceKeyHash {
+	size_t operator()(const ResourceKey &key) const { return (size_t)hash_string(key.path, key.params); }
+};
+
+class ResourceCache;
+
+struct ResourceEntry {
+	ResourceKey key;
+	unsigned int id;
+	GLenum target;
+	size_t gpuBytes;
+	int refs;
+	bool pending;	// still streaming in, can't be evicted yet
+	std::list<ResourceEntry*>::iterator lruPosition;
+};
+
+// ref-counted reference to a cached GL texture. Copying a handle adds a reference, destroying it drops one.
+// Once nothing references an entry it becomes a candidate for eviction, but stays cached until the budget needs the room.
+class TextureHandle
+{
+public:
+	TextureHandle() : entry(nullptr) {}
+	TextureHandle(const TextureHandle &other) : entry(other.entry) { retain(); }
+	~TextureHandle() { release(); }
+
+	TextureHandle &operator=(const TextureHandle &other)
+	{
+		if (entry != other.entry)
+		{
+			release();
+			entry = other.entry;
+			retain();
+		}
+		return *this;
+	}
+
+	unsigned int id() const { return entry ? entry->id : 0; }
+	bool valid() const { return entry != nullptr; }
+
+	// for callers that only keep the raw id around: the reference is never dropped, so the id stays valid for the rest of the program
+	unsigned int pin()
+	{
+		retain();
+		return id();
+	}
+
+private:
+	friend class ResourceCache;
+	explicit TextureHandle(ResourceEntry *entry) : entry(entry) { retain(); }
+
+	ResourceEntry *entry;
+
+	inline void retain();
+	inline void release();
+};
+
+// Process wide cache of GL textures keyed by normalized path and load parameters, shared by every loader so
+// a texture used by several models is only decoded and uploaded once. Unreferenced entries are kept in LRU
+// order and deleted once the configured GPU budget is exceeded. There's no CPU budget: the cache only holds GL
+// objects, and the streamer drops its decoded images once they're uploaded, so entries own no CPU memory.
+// Everything in here must be called on the GL thread.
+class ResourceCache
+{
+public:
+	static ResourceCache &get()
+	{
+		static ResourceCache cache;
+		return cache;
+	}
+
+	// loader creates the resource on a miss, filling in its size if known (streamed textures report it later)
+	typedef std::function<unsigned int(size_t &gpuBytes)> Loader;
+
+	TextureHandle acquire(const std::string &path, uint32_t params, GLenum target, const Loader &loader)
+	{
+		ResourceKey key;
+		key.path = normalizePath(path);
+		key.params = params;
+
+		std::unordered_map<ResourceKey, ResourceEntry*, ResourceKeyHash>::iterator found = entries.find(key);
+		if (found != entries.end())
+		{
+			hits++;
+			return TextureHandle(found->second);
+		}
+
+		misses++;
+		ResourceEntry *entry = new ResourceEntry();
+		entry->key = key;
+		entry->target = target;
+		entry->gpuBytes = 0;
+		entry->refs = 0;
+		entry->id = loader(entry->gpuBytes);
+		if (entry->id == 0)
+		{
+			// failed loads aren't cached so fixing the file on disk works without a restart
+			delete entry;
+			return TextureHandle();
+		}
+		entry->pending = entry->gpuBytes == 0;
+		entry->lruPosition = unused.end();
+		entries[key] = entry;
+		byId[entry->id] = entry;
+		gpuUsed += entry->gpuBytes;
+
+		TextureHandle handle(entry);
+		evict();
+		return handle;
+	}
+
+	// streamed textures only know their size once uploaded
+	void setSize(unsigned int id, size_t gpuBytes)
+	{
+		std::unordered_map<unsigned int, ResourceEntry*>::iterator found = byId.find(id);
+		if (found == byId.end())
+			return;
+		ResourceEntry *entry = found->second;
+		gpuUsed += gpuBytes - entry->gpuBytes;
+		entry->gpuBytes = gpuBytes;
+		entry->pending = false;
+		evict();
+	}
+
+	// budget in bytes, 0 means unlimited
+	void setBudget(size_t gpuBudget)
+	{
+		this->gpuBudget = gpuBudget;
+		evict();
+	}
+
+	size_t gpuBytes() const { return gpuUsed; }
+
+	void printStats() const
+	{
+		printf("RESOURCE_CACHE:: %u entries (%u unreferenced), %.1f MB gpu, %u hits, %u misses, %u evictions\n",
+			(unsigned int)entries.size(), (unsigned int)unused.size(), gpuUsed / (1024.0 * 1024.0), hits, misses, evictions);
+	}
+
+	// makes paths that name the same file compare equal: forward slashes, no "." or "dir/.." segments,
+	// and case folded on windows where the file system ignores case
+	static std::string normalizePath(const std::string &path)
+	{
+		std::string p = path;
+		for (size_t i = 0; i < p.size(); i++)
+		{
+			if (p[i] == '\\')
+				p[i] = '/';
+#ifdef _WIN32
+			p[i] = (char)tolower((unsigned char)p[i]);
+#endif
+		}
+
+		bool absolute = !p.empty() && p[0] == '/';
+		std::vector<std::string> parts;
+		size_t start = 0;
+		while (start <= p.size())
+		{
+			size_t end = p.find('/', start);
+			if (end == std::string::npos)
+				end = p.size();
+			std::string part = p.substr(start, end - start);
+			if (part == "..")
+			{
+				if (!parts.empty() && parts.back() != "..")
+					parts.pop_back();
+				else if (!absolute)
+					parts.push_back(part);
+			}
+			else if (!part.empty() && part != ".")
+				parts.push_back(part);
+			start = end + 1;
+		}
+
+		std::string out = absolute ? "/" : "";
+		for (size_t i = 0; i < parts.size(); i++)
+		{
+			if (i)
+				out += '/';
+			out += parts[i];
+		}
+		return out;
+	}
+
+private:
+	friend class TextureHandle;
+
+	std::unordered_map<ResourceKey, ResourceEntry*, ResourceKeyHash> entries;
+	std::unordered_map<unsigned int, ResourceEntry*> byId;
+	std::list<ResourceEntry*> unused;	// unreferenced entries, least recently used at the front
+	size_t gpuUsed;
+	size_t gpuBudget;
+	unsigned int hits, misses, evictions;
+
+	ResourceCache() : gpuUsed(0), gpuBudget(0), hits(0), misses(0), evictions(0)
+	{
+		TextureStreamer::get().setUploadListener([this](unsigned int id, size_t bytes) { setSize(id, bytes); });
+	}
+
+	void retain(ResourceEntry *entry)
+	{
+		if (entry->refs++ == 0 && entry->lruPosition != unused.end())
+		{
+			unused.erase(entry->lruPosition);
+			entry->lruPosition = unused.end();
+		}
+	}
+
+	void release(ResourceEntry *entry)
+	{
+		if (--entry->refs == 0)
+		{
+			entry->lruPosition = unused.insert(unused.end(), entry);
+			evict();
+		}
+	}
+
+	bool overBudget() const
+	{
+		return gpuBudget && gpuUsed > gpuBudget;
+	}
+
+	void evict()
+	{
+		std::list<ResourceEntry*>::iterator it = unused.begin();
+		while (overBudget() && it != unused.end())
+		{
+			ResourceEntry *entry = *it;
+			if (entry->pending)
+			{
+				++it;
+				continue;
+			}
+			it = unused.erase(it);
+			TextureStreamer::get().forget(entry->id);
+			GlState::get().deleteTextures(1, &entry->id);
+			gpuUsed -= entry->gpuBytes;
+			entries.erase(entry->key);
+			byId.erase(entry->id);
+			delete entry;
+			evictions++;
+		}
+	}
+
+	ResourceCache(const ResourceCache&);
+	ResourceCache &operator=(const ResourceCache&);
+};
+
+inline void TextureHandle::retain()
+{
+	if (entry)
+		ResourceCache::get().retain(entry);
+}
+
+inline void TextureHandle::release()
+{
+	if (entry)
+		ResourceCache::get().release(entry);
+	entry = nullptr;
+}
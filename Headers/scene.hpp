@@ -0,0 +1,182 @@
+#pragma once
+
+#include <glm/glm.hpp>
+
+#include <bvh.hpp>
+#include <frustum_culling.hpp>
+#include <render_queue.hpp>
+
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <deque>
+#include <vector>
+
+// a refitted tree is rebuilt once its SAH cost has grown past this multiple of the cost it was built with
+#define SCENE_REBUILD_RATIO 1.5f
+// once more than one in this many objects moved, refitting the whole tree in one pass beats walking up from each
+#define SCENE_FULL_REFIT_SHARE 16
+
+// The objects of the level, each a RenderItem with a world space box, kept in a BVH so visibility, proximity and
+// picking queries don't go over every object. Moving objects are remembered and only the tree above them is
+// refitted; adding or removing objects, or a refit that made the tree too loose, rebuilds it. Both happen in
+// update(), once per frame.
+class Scene
+{
+public:
+	Scene() : structureChanged(false), live(0), builds(0), refits(0), lastBuildMs(0.0), lastRefitMs(0.0) {}
+
+	// returns the object's id, valid until it's removed. The item's transform places it. Objects without LodState
+	// of their own get one from the scene, see lodState()
+	unsigned int add(const RenderItem &item)
+	{
+		unsigned int id;
+		if (!freeIds.empty())
+		{
+			id = freeIds.back();
+			freeIds.pop_back();
+		}
+		else
+		{
+			id = (unsigned int)items.size();
+			items.push_back(RenderItem());
+			alive.push_back(false);
+			boxMin.push_back(glm::vec3(0.0f));
+			boxMax.push_back(glm::vec3(0.0f));
+			lods.push_back(LodState());
+			dirty.push_back(false);
+		}
+		items[id] = item;
+		lods[id] = LodState();
+		alive[id] = true;
+		live++;
+		updateBounds(id);
+		structureChanged = true;
+		return id;
+	}
+
+	void remove(unsigned int id)
+	{
+		if (id >= items.size() || !alive[id])
+			return;
+		alive[id] = false;
+		items[id] = RenderItem();
+		freeIds.push_back(id);
+		live--;
+		structureChanged = true;
+	}
+
+	void setTransform(unsigned int id, const glm::mat4 &transform)
+	{
+		items[id].transform = transform;
+		updateBounds(id);
+		if (!dirty[id])
+		{
+			dirty[id] = true;
+			moved.push_back(id);
+		}
+	}
+
+	// everything but the transform can be changed through this, setTransform() keeps the tree up to date
+	RenderItem &item(unsigned int id) { return items[id]; }
+	const RenderItem &item(unsigned int id) const { return items[id]; }
+
+	size_t size() const { return live; }
+
+	// the levels of detail the object is drawn with on its own: the item's lod if it brought one, otherwise the
+	// scene's state for this object. Stays at the same address until the object is removed
+	LodState &lodState(unsigned int id) { return items[id].lod ? *items[id].lod : lods[id]; }
+
+	// brings the tree up to date with this frame's adds, removes and moves
+	void update()
+	{
+		if (!structureChanged && moved.empty())
+			return;
+		std::chrono::high_resolution_clock::time_point start = std::chrono::high_resolution_clock::now();
+		if (!structureChanged)
+		{
+			if (moved.size() * SCENE_FULL_REFIT_SHARE > live)
+				bvh.refit(boxMin, boxMax);
+			else
+				bvh.refit(boxMin, boxMax, moved);
+			clearMoved();
+			lastRefitMs = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+			refits++;
+			// the refit keeps the cost current, so checking it costs nothing
+			if (bvh.cost() <= bvh.costAtBuild() * SCENE_REBUILD_RATIO)
+				return;
+			start = std::chrono::high_resolution_clock::now();
+		}
+		ids.clear();
+		for (unsigned int id = 0; id < items.size(); id++)
+			if (alive[id])
+				ids.push_back(id);
+		bvh.build(boxMin, boxMax, ids);
+		lastBuildMs = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+		builds++;
+		structureChanged = false;
+		clearMoved();
+	}
+
+	// ids of the objects whose boxes touch the frustum, appended to out
+	void queryFrustum(const Frustum &frustum, std::vector<uint32_t> &out) const
+	{
+		size_t before = out.size();
+		bvh.queryFrustum(frustum, out, boxMin, boxMax);
+		CullStats::get().count(CULL_OBJECTS, out.size() - before, live);
+	}
+
+	// ids of the objects whose boxes are within radius of center
+	void querySphere(const glm::vec3 &center, float radius, std::vector<uint32_t> &out) const
+	{
+		bvh.querySphere(center, radius, out, boxMin, boxMax);
+	}
+
+	// nearest object box along the ray, e.g. for picking with the mouse
+	bool raycast(const glm::vec3 &origin, const glm::vec3 &direction, float maxDistance, unsigned int &id, float &distance) const
+	{
+		uint32_t hit;
+		if (!bvh.queryRay(origin, direction, maxDistance, hit, distance, boxMin, boxMax))
+			return false;
+		id = hit;
+		return true;
+	}
+
+	void printStats() const
+	{
+		printf("SCENE:: %u objects, %u bvh nodes, depth %u, cost %.2f (%.2f at build)\n", (unsigned int)live,
+			(unsigned int)bvh.nodeCount(), bvh.depth(), bvh.cost(), bvh.costAtBuild());
+		printf("SCENE:: %u builds (last %.3f ms), %u refits (last %.3f ms)\n", builds, lastBuildMs, refits, lastRefitMs);
+	}
+
+private:
+	std::vector<RenderItem> items;		// by id, removed ones stay as empty slots until reused
+	std::vector<bool> alive;
+	std::vector<unsigned int> freeIds;
+	std::vector<glm::vec3> boxMin, boxMax;	// world space boxes by id
+	std::deque<LodState> lods;	// by id, a deque so the states don't move when objects are added
+	std::vector<bool> dirty;	// by id, moved since the last update()
+	std::vector<uint32_t> moved;	// the dirty ids
+	std::vector<uint32_t> ids;
+	Bvh bvh;
+	bool structureChanged;
+	size_t live;
+	unsigned int builds, refits;
+	double lastBuildMs, lastRefitMs;
+
+	void clearMoved()
+	{
+		for (size_t i = 0; i < moved.size(); i++)
+			dirty[moved[i]] = false;
+		moved.clear();
+	}
+
+	void updateBounds(unsigned int id)
+	{
+		const RenderItem &item = items[id];
+		transform_bounds(item.transform, item.model->boundsMin, item.model->boundsMax, boxMin[id], boxMax[id]);
+	}
+
+	Scene(const Scene&);
+	Scene &operator=(const Scene&);
+};
@@ -4,169 +4,332 @@
 #include <glad/glad.h>
 #include <glm/glm.hpp>
 
+#include <gl_state.hpp>
+#include <uniform_buffers.hpp>
+#include <shader_preprocessor.hpp>
+#include <program_cache.hpp>
+
+#include <chrono>
+#include <cstdio>
 #include <string>
 #include <fstream>
 #include <sstream>
 #include <iostream>
+#include <cstring>
+#include <memory>
+#include <unordered_map>
+#include <vector>
+
+// a uniform of one linked program, looked up once with Shader::uniform() and passed to the set functions instead
+// of its name. Names the program doesn't use (or optimized away) give an invalid handle, setting it does nothing
+struct UniformHandle
+{
+	int index;
+
+	UniformHandle(int index = -1) : index(index) {}
+	bool valid() const { return index >= 0; }
+};
+
+// every active uniform of a program, reflected once after linking, together with a CPU copy of the values the
+// program currently holds so setting a uniform to the value it already has doesn't reach GL
+struct UniformTable
+{
+	struct Entry
+	{
+		GLint location;
+		int count;				// elements from this one to the end of its array
+		size_t offset;			// into shadow
+		size_t elementBytes;
+	};
 
+	std::vector<Entry> entries;
+	std::unordered_map<std::string, int> byName;
+	std::vector<unsigned char> shadow;
+
+	// copies value into the shadow, returns false if it was already there
+	bool update(UniformHandle handle, const void *value, size_t bytes)
+	{
+		if (!handle.valid())
+			return false;
+		const Entry &entry = entries[handle.index];
+		if (bytes > entry.elementBytes * entry.count)
+			bytes = entry.elementBytes * entry.count;
+		unsigned char *current = &shadow[entry.offset];
+		if (memcmp(current, value, bytes) == 0)
+			return false;
+		memcpy(current, value, bytes);
+		return true;
+	}
+};
+
+// Copies of a Shader share the program and its uniform table, so handles and the shadowed values stay valid when a
+// Shader is passed by value. The set functions expect the program to be in use, like glUniform* itself.
 class Shader
 {
 public:
 	unsigned int ID;
-	// constructor generates the shader on the fly
+	// constructor generates the shader on the fly. The sources go through ShaderPreprocessor first (#include and
+	// the given defines, see shader_preprocessor.hpp), a program linked before from the same sources on the same
+	// driver is loaded from ProgramCache instead of being compiled again
 	// ------------------------------------------------------------------------
-	Shader(const char* vertexPath, const char* fragmentPath, const char* geometryPath = nullptr)
-	{
-		// 1. retrieve the vertex/fragment source code from filePath
-		std::string vertexCode;
-		std::string fragmentCode;
-		std::string geometryCode;
-		std::ifstream vShaderFile;
-		std::ifstream fShaderFile;
-		std::ifstream gShaderFile;
-		// ensure ifstream objects can throw exceptions:
-		vShaderFile.exceptions(std::ifstream::failbit | std::ifstream::badbit);
-		fShaderFile.exceptions(std::ifstream::failbit | std::ifstream::badbit);
-		gShaderFile.exceptions(std::ifstream::failbit | std::ifstream::badbit);
-		try
+	Shader(const char* vertexPath, const char* fragmentPath, const char* geometryPath = nullptr, const ShaderDefines &defines = ShaderDefines())
+	{
+		std::chrono::high_resolution_clock::time_point start = std::chrono::high_resolution_clock::now();
+		// 1. preprocess the sources of every stage
+		std::vector<ShaderSource> sources(geometryPath != nullptr ? 3 : 2);
+		ShaderPreprocessor::process(vertexPath, defines, sources[0]);
+		ShaderPreprocessor::process(fragmentPath, defines, sources[1]);
+		if (geometryPath != nullptr)
+			ShaderPreprocessor::process(geometryPath, defines, sources[2]);
+
+		std::vector<std::string> codes;
+		std::string variant = std::string(vertexPath) + "\n" + (geometryPath != nullptr ? geometryPath : "") + "\n";
+		for (size_t i = 0; i < sources.size(); i++)
+			codes.push_back(sources[i].code);
+		for (size_t i = 0; i < defines.size(); i++)
+			variant += defines[i] + "\n";
+		uint64_t key = ProgramCache::key(codes);
+		std::string cacheFile = ProgramCache::path(fragmentPath, variant);
+
+		// 2. load the linked program, or compile and link it
+		ID = glCreateProgram();
+		bool cached = ProgramCache::load(cacheFile, key, ID);
+		if (!cached)
 		{
-			// open files
-			vShaderFile.open(vertexPath);
-			fShaderFile.open(fragmentPath);
-			std::stringstream vShaderStream, fShaderStream;
-			// read file's buffer contents into streams
-			vShaderStream << vShaderFile.rdbuf();
-			fShaderStream << fShaderFile.rdbuf();
-			// close file handlers
-			vShaderFile.close();
-			fShaderFile.close();
-			// convert stream into string
-			vertexCode = vShaderStream.str();
-			fragmentCode = fShaderStream.str();
-			// if geometry shader path is present, also load a geometry shader
-			if (geometryPath != nullptr)
+			static const GLenum stages[] = { GL_VERTEX_SHADER, GL_FRAGMENT_SHADER, GL_GEOMETRY_SHADER };
+			static const char *stageNames[] = { "VERTEX", "FRAGMENT", "GEOMETRY" };
+			unsigned int shaders[3];
+			bool compiled = true;
+			for (size_t i = 0; i < sources.size(); i++)
 			{
-				gShaderFile.open(geometryPath);
-				std::stringstream gShaderStream;
-				gShaderStream << gShaderFile.rdbuf();
-				gShaderFile.close();
-				geometryCode = gShaderStream.str();
+				const char *code = sources[i].code.c_str();
+				shaders[i] = glCreateShader(stages[i]);
+				glShaderSource(shaders[i], 1, &code, NULL);
+				glCompileShader(shaders[i]);
+				compiled = checkCompileErrors(shaders[i], stageNames[i], &sources[i]) && compiled;
+				glAttachShader(ID, shaders[i]);
 			}
+			ProgramCache::prepare(ID);
+			glLinkProgram(ID);
+			bool linked = checkCompileErrors(ID, "PROGRAM");
+			// delete the shaders as they're linked into our program now and no longer necessery
+			for (size_t i = 0; i < sources.size(); i++)
+			{
+				glDetachShader(ID, shaders[i]);
+				glDeleteShader(shaders[i]);
+			}
+			if (compiled && linked)
+				ProgramCache::store(cacheFile, key, ID);
 		}
-		catch (std::ifstream::failure e)
-		{
-			std::cout << "ERROR::SHADER::FILE_NOT_SUCCESFULLY_READ" << std::endl;
-		}
-		const char* vShaderCode = vertexCode.c_str();
-		const char * fShaderCode = fragmentCode.c_str();
-		// 2. compile shaders
-		unsigned int vertex, fragment;
-		int success;
-		char infoLog[512];
-		// vertex shader
-		vertex = glCreateShader(GL_VERTEX_SHADER);
-		glShaderSource(vertex, 1, &vShaderCode, NULL);
-		glCompileShader(vertex);
-		checkCompileErrors(vertex, "VERTEX");
-		// fragment Shader
-		fragment = glCreateShader(GL_FRAGMENT_SHADER);
-		glShaderSource(fragment, 1, &fShaderCode, NULL);
-		glCompileShader(fragment);
-		checkCompileErrors(fragment, "FRAGMENT");
-		// if geometry shader is given, compile geometry shader
-		unsigned int geometry;
-		if (geometryPath != nullptr)
-		{
-			const char * gShaderCode = geometryCode.c_str();
-			geometry = glCreateShader(GL_GEOMETRY_SHADER);
-			glShaderSource(geometry, 1, &gShaderCode, NULL);
-			glCompileShader(geometry);
-			checkCompileErrors(geometry, "GEOMETRY");
-		}
-		// shader Program
-		ID = glCreateProgram();
-		glAttachShader(ID, vertex);
-		glAttachShader(ID, fragment);
-		if (geometryPath != nullptr)
-			glAttachShader(ID, geometry);
-		glLinkProgram(ID);
-		checkCompileErrors(ID, "PROGRAM");
-		// delete the shaders as they're linked into our program now and no longer necessery
-		glDeleteShader(vertex);
-		glDeleteShader(fragment);
-		if (geometryPath != nullptr)
-			glDeleteShader(geometry);
-
+		bindUniformBlocks();
+		reflectUniforms();
+		double ms = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+		printf("SHADER::LOAD %s (%s) in %.1f ms\n", fragmentPath, cached ? "cache hit" : "compiled", ms);
 	}
 	// activate the shader
 	// ------------------------------------------------------------------------
 	void use()
 	{
-		glUseProgram(ID);
+		GlState::get().useProgram(ID);
 	}
-	// utility uniform functions
+	// handle of a uniform by name, once per program is enough. Array elements are "name[i]", the first can also be
+	// given as "name", and setting an element with a count starts at that element
+	UniformHandle uniform(const std::string &name) const
+	{
+		std::unordered_map<std::string, int>::const_iterator it = uniforms->byName.find(name);
+		return it == uniforms->byName.end() ? UniformHandle() : UniformHandle(it->second);
+	}
+	// utility uniform functions, only values that differ from what the program holds are uploaded
 	// ------------------------------------------------------------------------
-	void setBool(const std::string &name, bool value) const
+	void setBool(UniformHandle uniform, bool value) const
 	{
-		glUniform1i(glGetUniformLocation(ID, name.c_str()), (int)value);
+		setInt(uniform, (int)value);
 	}
 	// ------------------------------------------------------------------------
-	void setInt(const std::string &name, int value) const
+	void setInt(UniformHandle uniform, int value) const
 	{
-		glUniform1i(glGetUniformLocation(ID, name.c_str()), value);
+		if (uniforms->update(uniform, &value, sizeof(value)))
+			glUniform1i(location(uniform), value);
 	}
 	// ------------------------------------------------------------------------
-	void setFloat(const std::string &name, float value) const
+	void setFloat(UniformHandle uniform, float value) const
 	{
-		glUniform1f(glGetUniformLocation(ID, name.c_str()), value);
+		if (uniforms->update(uniform, &value, sizeof(value)))
+			glUniform1f(location(uniform), value);
 	}
 	// ------------------------------------------------------------------------
-	void setVec2(const std::string &name, const glm::vec2 &value) const
+	void setVec2(UniformHandle uniform, const glm::vec2 &value) const
 	{
-		glUniform2fv(glGetUniformLocation(ID, name.c_str()), 1, &value[0]);
+		if (uniforms->update(uniform, &value[0], sizeof(value)))
+			glUniform2fv(location(uniform), 1, &value[0]);
 	}
-	void setVec2(const std::string &name, float x, float y) const
+	void setVec2(UniformHandle uniform, float x, float y) const
 	{
-		glUniform2f(glGetUniformLocation(ID, name.c_str()), x, y);
+		setVec2(uniform, glm::vec2(x, y));
 	}
 	// ------------------------------------------------------------------------
-	void setVec3(const std::string &name, const glm::vec3 &value) const
+	void setVec3(UniformHandle uniform, const glm::vec3 &value) const
+	{
+		if (uniforms->update(uniform, &value[0], sizeof(value)))
+			glUniform3fv(location(uniform), 1, &value[0]);
+	}
+	void setVec3(UniformHandle uniform, float x, float y, float z) const
 	{
-		glUniform3fv(glGetUniformLocation(ID, name.c_str()), 1, &value[0]);
+		setVec3(uniform, glm::vec3(x, y, z));
 	}
-	void setVec3(const std::string &name, float x, float y, float z) const
+	// count vec3s, 3 floats each
+	void setVec3Array(UniformHandle uniform, const float *values, int count) const
 	{
-		glUniform3f(glGetUniformLocation(ID, name.c_str()), x, y, z);
+		if (uniforms->update(uniform, values, sizeof(float) * 3 * count))
+			glUniform3fv(location(uniform), count, values);
 	}
 	// ------------------------------------------------------------------------
-	void setVec4(const std::string &name, const glm::vec4 &value) const
+	void setVec4(UniformHandle uniform, const glm::vec4 &value) const
 	{
-		glUniform4fv(glGetUniformLocation(ID, name.c_str()), 1, &value[0]);
+		if (uniforms->update(uniform, &value[0], sizeof(value)))
+			glUniform4fv(location(uniform), 1, &value[0]);
 	}
-	void setVec4(const std::string &name, float x, float y, float z, float w)
+	void setVec4(UniformHandle uniform, float x, float y, float z, float w) const
 	{
-		glUniform4f(glGetUniformLocation(ID, name.c_str()), x, y, z, w);
+		setVec4(uniform, glm::vec4(x, y, z, w));
 	}
 	// ------------------------------------------------------------------------
-	void setMat2(const std::string &name, const glm::mat2 &mat) const
+	void setMat2(UniformHandle uniform, const glm::mat2 &mat) const
 	{
-		glUniformMatrix2fv(glGetUniformLocation(ID, name.c_str()), 1, GL_FALSE, &mat[0][0]);
+		if (uniforms->update(uniform, &mat[0][0], sizeof(mat)))
+			glUniformMatrix2fv(location(uniform), 1, GL_FALSE, &mat[0][0]);
 	}
 	// ------------------------------------------------------------------------
-	void setMat3(const std::string &name, const glm::mat3 &mat) const
+	void setMat3(UniformHandle uniform, const glm::mat3 &mat) const
 	{
-		glUniformMatrix3fv(glGetUniformLocation(ID, name.c_str()), 1, GL_FALSE, &mat[0][0]);
+		if (uniforms->update(uniform, &mat[0][0], sizeof(mat)))
+			glUniformMatrix3fv(location(uniform), 1, GL_FALSE, &mat[0][0]);
 	}
 	// ------------------------------------------------------------------------
-	void setMat4(const std::string &name, const glm::mat4 &mat) const
+	void setMat4(UniformHandle uniform, const glm::mat4 &mat) const
 	{
-		glUniformMatrix4fv(glGetUniformLocation(ID, name.c_str()), 1, GL_FALSE, &mat[0][0]);
+		if (uniforms->update(uniform, &mat[0][0], sizeof(mat)))
+			glUniformMatrix4fv(location(uniform), 1, GL_FALSE, &mat[0][0]);
 	}
+	// by name: a hash lookup instead of glGetUniformLocation, prefer handles for anything set every frame
+	// ------------------------------------------------------------------------
+	void setBool(const std::string &name, bool value) const { setBool(uniform(name), value); }
+	void setInt(const std::string &name, int value) const { setInt(uniform(name), value); }
+	void setFloat(const std::string &name, float value) const { setFloat(uniform(name), value); }
+	void setVec2(const std::string &name, const glm::vec2 &value) const { setVec2(uniform(name), value); }
+	void setVec2(const std::string &name, float x, float y) const { setVec2(uniform(name), x, y); }
+	void setVec3(const std::string &name, const glm::vec3 &value) const { setVec3(uniform(name), value); }
+	void setVec3(const std::string &name, float x, float y, float z) const { setVec3(uniform(name), x, y, z); }
+	void setVec3Array(const std::string &name, const float *values, int count) const { setVec3Array(uniform(name), values, count); }
+	void setVec4(const std::string &name, const glm::vec4 &value) const { setVec4(uniform(name), value); }
+	void setVec4(const std::string &name, float x, float y, float z, float w) const { setVec4(uniform(name), x, y, z, w); }
+	void setMat2(const std::string &name, const glm::mat2 &mat) const { setMat2(uniform(name), mat); }
+	void setMat3(const std::string &name, const glm::mat3 &mat) const { setMat3(uniform(name), mat); }
+	void setMat4(const std::string &name, const glm::mat4 &mat) const { setMat4(uniform(name), mat); }
 
 private:
-	// utility function for checking shader compilation/linking errors.
+	std::shared_ptr<UniformTable> uniforms;
+
+	GLint location(UniformHandle uniform) const
+	{
+		return uniforms->entries[uniform.index].location;
+	}
+
+	// floats (or ints) one element of a uniform type takes, isFloat tells which
+	static int uniformComponents(GLenum type, bool &isFloat)
+	{
+		isFloat = true;
+		switch (type)
+		{
+		case GL_FLOAT: return 1;
+		case GL_FLOAT_VEC2: return 2;
+		case GL_FLOAT_VEC3: return 3;
+		case GL_FLOAT_VEC4: return 4;
+		case GL_FLOAT_MAT2: return 4;
+		case GL_FLOAT_MAT3: return 9;
+		case GL_FLOAT_MAT4: return 16;
+		case GL_FLOAT_MAT2x3: case GL_FLOAT_MAT3x2: return 6;
+		case GL_FLOAT_MAT2x4: case GL_FLOAT_MAT4x2: return 8;
+		case GL_FLOAT_MAT3x4: case GL_FLOAT_MAT4x3: return 12;
+		}
+		isFloat = false;
+		switch (type)
+		{
+		case GL_INT_VEC2: case GL_UNSIGNED_INT_VEC2: case GL_BOOL_VEC2: return 2;
+		case GL_INT_VEC3: case GL_UNSIGNED_INT_VEC3: case GL_BOOL_VEC3: return 3;
+		case GL_INT_VEC4: case GL_UNSIGNED_INT_VEC4: case GL_BOOL_VEC4: return 4;
+		}
+		// int, unsigned int, bool and all the samplers
+		return 1;
+	}
+
+	// the shared blocks sit at fixed binding points, GLSL 3.30 can't say so itself. Blocks the program doesn't use are skipped
+	void bindUniformBlocks()
+	{
+		static const char *names[] = { "Camera", "Lights", "Object" };
+		static const GLuint bindings[] = { UNIFORM_BINDING_CAMERA, UNIFORM_BINDING_LIGHTS, UNIFORM_BINDING_OBJECT };
+		for (int i = 0; i < 3; i++)
+		{
+			GLuint index = glGetUniformBlockIndex(ID, names[i]);
+			if (index != GL_INVALID_INDEX)
+				glUniformBlockBinding(ID, index, bindings[i]);
+		}
+	}
+
+	// builds the uniform table from the linked program. The shadow starts out with the values GL reports, which
+	// are zero unless the shader gives an initializer
+	void reflectUniforms()
+	{
+		uniforms.reset(new UniformTable());
+		GLint count = 0, maxLength = 0;
+		glGetProgramiv(ID, GL_ACTIVE_UNIFORMS, &count);
+		glGetProgramiv(ID, GL_ACTIVE_UNIFORM_MAX_LENGTH, &maxLength);
+		std::vector<GLchar> nameBuffer(maxLength + 1);
+		for (GLint i = 0; i < count; i++)
+		{
+			GLint size = 0;
+			GLenum type = 0;
+			GLsizei length = 0;
+			glGetActiveUniform(ID, i, maxLength + 1, &length, &size, &type, &nameBuffer[0]);
+			std::string name(&nameBuffer[0], length);
+			// members of uniform blocks have no location
+			if (glGetUniformLocation(ID, name.c_str()) < 0)
+				continue;
+
+			bool isFloat;
+			size_t elementBytes = uniformComponents(type, isFloat) * 4;
+			size_t offset = uniforms->shadow.size();
+			uniforms->shadow.resize(offset + elementBytes * size);
+
+			// arrays are reported as "name[0]", every element gets an entry of its own
+			bool isArray = name.size() > 3 && name.compare(name.size() - 3, 3, "[0]") == 0;
+			std::string base = isArray ? name.substr(0, name.size() - 3) : name;
+			for (GLint e = 0; e < size; e++)
+			{
+				std::string elementName = isArray ? base + "[" + std::to_string(e) + "]" : base;
+				UniformTable::Entry entry;
+				entry.location = glGetUniformLocation(ID, elementName.c_str());
+				entry.count = size - e;
+				entry.offset = offset + e * elementBytes;
+				entry.elementBytes = elementBytes;
+				if (entry.location < 0)
+					continue;
+				if (isFloat)
+					glGetUniformfv(ID, entry.location, (GLfloat *)&uniforms->shadow[entry.offset]);
+				else
+					glGetUniformiv(ID, entry.location, (GLint *)&uniforms->shadow[entry.offset]);
+				uniforms->byName[elementName] = (int)uniforms->entries.size();
+				if (e == 0)
+					uniforms->byName[base] = (int)uniforms->entries.size();
+				uniforms->entries.push_back(entry);
+			}
+		}
+	}
+
+	// utility function for checking shader compilation/linking errors, returns false on failure. GL reports
+	// errors as source:line, source being the index into the preprocessed stage's file list
 	// ------------------------------------------------------------------------
-	void checkCompileErrors(GLuint shader, std::string type)
+	bool checkCompileErrors(GLuint shader, std::string type, const ShaderSource *source = nullptr)
 	{
 		GLint success;
 		GLchar infoLog[1024];
@@ -176,7 +339,10 @@ private:
 			if (!success)
 			{
 				glGetShaderInfoLog(shader, 1024, NULL, infoLog);
-				std::cout << "ERROR::SHADER_COMPILATION_ERROR of type: " << type << "\n" << infoLog << "\n -- --------------------------------------------------- -- " << std::endl;
+				std::cout << "ERROR::SHADER_COMPILATION_ERROR of type: " << type << "\n";
+				for (size_t i = 0; source && i < source->files.size(); i++)
+					std::cout << "  source " << i << ": " << source->files[i] << "\n";
+				std::cout << infoLog << "\n -- --------------------------------------------------- -- " << std::endl;
 			}
 		}
 		else
@@ -188,6 +354,7 @@ private:
 				std::cout << "ERROR::PROGRAM_LINKING_ERROR of type: " << type << "\n" << infoLog << "\n -- --------------------------------------------------- -- " << std::endl;
 			}
 		}
+		return success != 0;
 	}
 };
 #endif
\ No newline at end of file
@@ -0,0 +1,116 @@
+#pragma once
+
+#include <cstdio>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+// names (and optional values) injected as "#define NAME VALUE" right after a shader's #version line
+typedef std::vector<std::string> ShaderDefines;
+
+// A GLSL source after preprocessing. files[n] is the file GL reports as source string n in its error logs,
+// 0 being the stage's own file.
+struct ShaderSource {
+	std::string code;
+	std::vector<std::string> files;
+};
+
+// Minimal preprocessor run before a stage goes to GL:
+//   #include "file"   is replaced by that file, relative to the including file. Every file is included once,
+//                     so shared files need no include guards
+//   defines           are injected after #version, a #line keeps the line numbers of the stage file intact
+// Everything else, #ifdef included, is left to the GLSL compiler.
+class ShaderPreprocessor
+{
+public:
+	static bool process(const std::string &path, const ShaderDefines &defines, ShaderSource &out)
+	{
+		out.code.clear();
+		out.files.clear();
+		return append(path, defines, out);
+	}
+
+private:
+	static bool readFile(const std::string &path, std::string &text)
+	{
+		std::ifstream file(path.c_str(), std::ios::in | std::ios::binary);
+		if (!file)
+			return false;
+		std::stringstream stream;
+		stream << file.rdbuf();
+		text = stream.str();
+		return true;
+	}
+
+	static std::string directoryOf(const std::string &path)
+	{
+		size_t slash = path.find_last_of("/\\");
+		return slash == std::string::npos ? std::string() : path.substr(0, slash + 1);
+	}
+
+	// the quoted name of an #include line, empty if the line isn't one
+	static std::string includeName(const std::string &line)
+	{
+		size_t start = line.find_first_not_of(" \t");
+		if (start == std::string::npos || line.compare(start, 8, "#include") != 0)
+			return std::string();
+		size_t open = line.find('"', start + 8);
+		size_t close = open == std::string::npos ? open : line.find('"', open + 1);
+		if (close == std::string::npos)
+			return std::string();
+		return line.substr(open + 1, close - open - 1);
+	}
+
+	static bool append(const std::string &path, const ShaderDefines &defines, ShaderSource &out)
+	{
+		std::string text;
+		if (!readFile(path, text))
+		{
+			printf("ERROR::SHADER::FILE_NOT_SUCCESFULLY_READ %s\n", path.c_str());
+			return false;
+		}
+		int sourceNumber = (int)out.files.size();
+		out.files.push_back(path);
+
+		std::istringstream lines(text);
+		std::string line;
+		int lineNumber = 0;
+		while (std::getline(lines, line))
+		{
+			lineNumber++;
+			if (!line.empty() && line[line.size() - 1] == '\r')
+				line.erase(line.size() - 1);
+
+			std::string name = includeName(line);
+			if (!name.empty())
+			{
+				std::string includePath = directoryOf(path) + name;
+				bool seen = false;
+				for (size_t i = 0; i < out.files.size(); i++)
+					seen = seen || out.files[i] == includePath;
+				if (!seen)
+				{
+					out.code += "#line 1 " + std::to_string(out.files.size()) + "\n";
+					if (!append(includePath, ShaderDefines(), out))
+					{
+						printf("ERROR::SHADER::INCLUDE %s, included from %s line %d\n", includePath.c_str(), path.c_str(), lineNumber);
+						return false;
+					}
+				}
+				out.code += "#line " + std::to_string(lineNumber + 1) + " " + std::to_string(sourceNumber) + "\n";
+				continue;
+			}
+
+			out.code += line;
+			out.code += '\n';
+			if (sourceNumber == 0 && !defines.empty() && line.compare(0, 8, "#version") == 0)
+			{
+				for (size_t i = 0; i < defines.size(); i++)
+					out.code += "#define " + defines[i] + "\n";
+				out.code += "#line " + std::to_string(lineNumber + 1) + " 0\n";
+			}
+		}
+		return true;
+	}
+};
@@ -0,0 +1,83 @@
+#pragma once
+
+#include <shader.hpp>
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// A variant key is a set of feature bits plus a light count. Bit i turns on the i-th define a ShaderVariants was
+// given, the light count goes in as "#define LIGHT_COUNT n", so loops over the lights unroll to exactly that many.
+#define SHADER_VARIANT_FEATURE_BITS 24
+#define SHADER_VARIANT_FEATURE_MASK ((1u << SHADER_VARIANT_FEATURE_BITS) - 1)
+
+inline uint32_t shader_variant_key(uint32_t features, uint32_t lightCount)
+{
+	return (features & SHADER_VARIANT_FEATURE_MASK) | (lightCount << SHADER_VARIANT_FEATURE_BITS);
+}
+
+// Compile-time permutations of one vertex/fragment pair. Each key is compiled (or loaded from the program cache)
+// the first time it's asked for and kept after that, so a draw picks its variant with a hash lookup and the GPU
+// only runs the branches that variant needs.
+//
+// Program is what gets kept per variant, it's built from the compiled Shader. Shader itself works, a struct that
+// also looks up its uniform handles in its constructor saves doing that per draw.
+template <typename Program = Shader>
+class ShaderVariants
+{
+public:
+	ShaderVariants(const std::string &vertexPath, const std::string &fragmentPath, const std::vector<std::string> &features)
+		: vertexPath(vertexPath), fragmentPath(fragmentPath), features(features) {}
+
+	Program &get(uint32_t key)
+	{
+		return *programs[id(key)];
+	}
+
+	Program &get(uint32_t features, uint32_t lightCount)
+	{
+		return get(shader_variant_key(features, lightCount));
+	}
+
+	// dense id of a variant, in the order variants were first asked for (e.g. for RenderQueue's sort keys)
+	unsigned int id(uint32_t key)
+	{
+		std::unordered_map<uint32_t, unsigned int>::iterator it = ids.find(key);
+		if (it != ids.end())
+			return it->second;
+		Shader shader(vertexPath.c_str(), fragmentPath.c_str(), nullptr, defines(key));
+		programs.push_back(std::unique_ptr<Program>(new Program(shader)));
+		ids[key] = (unsigned int)programs.size() - 1;
+		return (unsigned int)programs.size() - 1;
+	}
+
+	unsigned int id(uint32_t features, uint32_t lightCount)
+	{
+		return id(shader_variant_key(features, lightCount));
+	}
+
+	Program &byId(unsigned int id) { return *programs[id]; }
+
+	ShaderDefines defines(uint32_t key) const
+	{
+		ShaderDefines out;
+		for (size_t i = 0; i < features.size() && i < SHADER_VARIANT_FEATURE_BITS; i++)
+			if (key & (1u << i))
+				out.push_back(features[i]);
+		out.push_back("LIGHT_COUNT " + std::to_string(key >> SHADER_VARIANT_FEATURE_BITS));
+		return out;
+	}
+
+	size_t size() const { return programs.size(); }
+
+private:
+	std::string vertexPath, fragmentPath;
+	std::vector<std::string> features;	// define of feature bit i
+	std::vector<std::unique_ptr<Program> > programs;
+	std::unordered_map<uint32_t, unsigned int> ids;	// key to index into programs
+
+	ShaderVariants(const ShaderVariants&);
+	ShaderVariants &operator=(const ShaderVariants&);
+};
@@ -0,0 +1,786 @@
+#pragma once
+
+#include <glad/glad.h>
+#include <stb_image.h>
+
+#include <gl_state.hpp>
+#include <compressed_texture.hpp>
+#include <mipmap.hpp>
+#include <thread_pool.hpp>
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <condition_variable>
+#include <cstring>
+#include <deque>
+#include <functional>
+#include <iostream>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// colours a streamed texture shows until its real data has been uploaded (RGBA, R in the high byte)
+const uint32_t TEXTURE_PLACEHOLDER_GREY = 0x808080FF;
+const uint32_t TEXTURE_PLACEHOLDER_FLAT_NORMAL = 0x8080FFFF;
+
+// levels no bigger than this are loaded up front, everything finer only once a draw needs it
+#define STREAM_INITIAL_SIZE 128
+// textures that haven't been drawn for this many frames are the first to give up their fine levels
+#define STREAM_IDLE_FRAMES 120
+// at most this many textures are loading finer levels at the same time
+#define STREAM_MAX_JOBS 8
+
+// Streams textures into GL one range of mip levels at a time without blocking the render loop.
+// request() (images decoded with stb_image) hands back a texture id right away that holds a 1x1 placeholder,
+// requestCompressed() (DDS/KTX2) uploads straight from the file, requestArray() builds a GL_TEXTURE_2D_ARRAY
+// from images the caller produces. Either way only the levels up to STREAM_INITIAL_SIZE are loaded at first.
+//
+// Draws report how large a texture ends up on screen with noteUsage(). update(), called once per frame on the
+// GL thread, turns that into the finest level each texture needs, streams those levels in on the thread pool and
+// uploads finished ones through a pixel buffer object until the per frame byte budget is used up. Levels that
+// aren't needed anymore stay resident until the levels of all streamed textures go over setBudget(), then the
+// least recently drawn and smallest on screen textures drop back first. Textures that never get feedback are
+// streamed to full resolution, but are the first to drop under pressure.
+//
+// Residency is controlled with GL_TEXTURE_BASE_LEVEL, and levels below it are released by respecifying them
+// empty, so the id never changes and meshes that already reference it just get sharper or blurrier.
+class TextureStreamer
+{
+public:
+	static TextureStreamer &get()
+	{
+		static TextureStreamer streamer;
+		return streamer;
+	}
+
+	// stb_image's flip flag is global and would race with the decoding threads, so streamed loads use this instead.
+	// the value at the time of request() applies to that texture.
+	void setFlipVertically(bool flip) { flipRows = flip; }
+	bool flipVertically() const { return flipRows; }
+
+	// called on the GL thread whenever the resident size of a texture changed, with its size in bytes (0 if it failed to load)
+	void setUploadListener(std::function<void(unsigned int, size_t)> listener) { uploadListener = listener; }
+
+	// one layer of an array texture as a LayerLoader hands it over: either level 0 alone as RGBA8, and the streamer
+	// builds the mips, or the whole chain in the array's format (RGBA8, or the compressed format of requestArray())
+	struct ArrayLayer {
+		int width, height;
+		std::vector<std::vector<unsigned char> > levels;
+
+		ArrayLayer() : width(0), height(0) {}
+	};
+
+	// produces a layer of an array texture, on a worker thread. Every layer must come out the same size
+	typedef std::function<bool(int layer, ArrayLayer &out)> LayerLoader;
+
+	// bytes the resident levels of all streamed textures may take, 0 means unlimited
+	void setBudget(size_t bytes) { budget = bytes; }
+	size_t residentBytes() const { return residentTotal; }
+
+	// must be called on the GL thread. space picks how the mips are filtered, images with one or two channels
+	// are data and always filtered linearly
+	unsigned int request(const std::string &path, uint32_t placeholder = TEXTURE_PLACEHOLDER_GREY, GLenum wrap = GL_REPEAT, MipColorSpace space = MIP_SRGB)
+	{
+		unsigned int textureID;
+		glGenTextures(1, &textureID);
+		GlState::get().bindTexture(GL_TEXTURE_2D, textureID);
+		unsigned char pixel[4] = { (unsigned char)(placeholder >> 24), (unsigned char)(placeholder >> 16), (unsigned char)(placeholder >> 8), (unsigned char)placeholder };
+		glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, 1, 1, 0, GL_RGBA, GL_UNSIGNED_BYTE, pixel);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, wrap);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, wrap);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, 0);
+		GlState::get().bindTexture(GL_TEXTURE_2D, 0);
+
+		StreamedTexture *texture = new StreamedTexture(textureID, path, false, flipRows);
+		texture->mipSpace = space;
+		textures[textureID] = texture;
+		// the size isn't known before decoding, the first job picks the coarse levels itself
+		startLoading(texture, -1, -1);
+		return textureID;
+	}
+
+	// like request(), for a GL_TEXTURE_2D_ARRAY of layers images that loader makes. The layers share their
+	// residency, so usage reported for the array id covers all of them. name is only used in messages.
+	// compressedFormat (with the size of its blocks) is for loaders that hand over cooked chains, 0 for RGBA8.
+	unsigned int requestArray(const std::string &name, int layers, LayerLoader loader, uint32_t placeholder = TEXTURE_PLACEHOLDER_GREY,
+		MipColorSpace space = MIP_SRGB, GLenum compressedFormat = 0, uint32_t blockBytes = 0)
+	{
+		unsigned int textureID;
+		glGenTextures(1, &textureID);
+		GlState::get().bindTexture(GL_TEXTURE_2D_ARRAY, textureID);
+		std::vector<unsigned char> pixels((size_t)layers * 4);
+		for (int layer = 0; layer < layers; layer++)
+			for (int c = 0; c < 4; c++)
+				pixels[layer * 4 + c] = (unsigned char)(placeholder >> (24 - c * 8));
+		glTexImage3D(GL_TEXTURE_2D_ARRAY, 0, GL_RGBA, 1, 1, layers, 0, GL_RGBA, GL_UNSIGNED_BYTE, pixels.data());
+		glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_REPEAT);
+		glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_REPEAT);
+		glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+		glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+		glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAX_LEVEL, 0);
+		GlState::get().bindTexture(GL_TEXTURE_2D_ARRAY, 0);
+
+		StreamedTexture *texture = new StreamedTexture(textureID, name, false, false);
+		texture->target = GL_TEXTURE_2D_ARRAY;
+		texture->layers = layers;
+		texture->loader = loader;
+		texture->mipSpace = space;
+		if (compressedFormat)
+		{
+			texture->internalFormat = compressedFormat;
+			texture->blockBytes = blockBytes;
+		}
+		textures[textureID] = texture;
+		startLoading(texture, -1, -1);
+		return textureID;
+	}
+
+	// loads the coarse levels of a .dds or .ktx2 file right away, finer ones stream in like any other texture.
+	// returns 0 if the file can't be used. gpuBytes (if given) receives the size of the levels loaded now.
+	unsigned int requestCompressed(const std::string &path, size_t *gpuBytes = nullptr)
+	{
+		MappedFile file;
+		if (!file.open(path))
+		{
+			printf("ERROR::TEXTURE::COMPRESSED could not open %s\n", path.c_str());
+			return 0;
+		}
+		CompressedImage image;
+		std::string error;
+		if (!parse_compressed(file.data(), file.size(), image, error))
+		{
+			printf("ERROR::TEXTURE::COMPRESSED %s: %s\n", path.c_str(), error.c_str());
+			return 0;
+		}
+		if (!compressed_format_supported(image.internalFormat))
+		{
+			printf("ERROR::TEXTURE::COMPRESSED %s: format 0x%X is not supported by the driver\n", path.c_str(), image.internalFormat);
+			return 0;
+		}
+
+		unsigned int textureID;
+		glGenTextures(1, &textureID);
+		GlState::get().bindTexture(GL_TEXTURE_2D, textureID);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, image.levels.size() > 1 ? GL_LINEAR_MIPMAP_LINEAR : GL_LINEAR);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
+
+		StreamedTexture *texture = new StreamedTexture(textureID, path, true, false);
+		texture->internalFormat = image.internalFormat;
+		for (size_t i = 0; i < image.levels.size(); i++)
+			texture->levelBytes.push_back(image.levels[i].size);
+		setLevels(texture, image.levels[0].width, image.levels[0].height, (int)image.levels.size());
+
+		// straight from the mapping, the driver copies it before the call returns
+		for (int i = texture->floorBase; i < texture->levels; i++)
+		{
+			const CompressedLevel &level = image.levels[i];
+			glCompressedTexImage2D(GL_TEXTURE_2D, i, image.internalFormat, level.width, level.height, 0, (GLsizei)level.size, level.data);
+		}
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, texture->floorBase);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, texture->levels - 1);
+		GlState::get().bindTexture(GL_TEXTURE_2D, 0);
+		texture->residentBase = texture->floorBase;
+		residentTotal += bytesFrom(texture, texture->residentBase);
+
+		textures[textureID] = texture;
+		if (gpuBytes)
+			*gpuBytes = bytesFrom(texture, texture->residentBase);
+		return textureID;
+	}
+
+	// draw time feedback: the texture is drawn on something about pixels wide on screen. Assumes the texture is
+	// stretched across the object once, the finest level needed is the one with about as many texels as pixels.
+	// Cheap enough to call for every texture of every draw, ids the streamer doesn't own are ignored.
+	void noteUsage(unsigned int textureID, float pixels)
+	{
+		std::unordered_map<unsigned int, StreamedTexture*>::iterator found = textures.find(textureID);
+		if (found == textures.end())
+			return;
+		StreamedTexture *texture = found->second;
+		texture->pixels = std::max(texture->pixels, pixels);
+		texture->lastUsed = frame;
+	}
+
+	// stops tracking a texture before it gets deleted, anything still loading for it is thrown away
+	void forget(unsigned int textureID)
+	{
+		std::unordered_map<unsigned int, StreamedTexture*>::iterator found = textures.find(textureID);
+		if (found == textures.end())
+			return;
+		residentTotal -= bytesFrom(found->second, found->second->residentBase);
+		delete found->second;
+		textures.erase(found);
+	}
+
+	// decides which levels every texture should have, drops what the budget can't hold, starts loading what's missing,
+	// then uploads decoded levels until byteBudget bytes went to the GPU this frame. At least one job is always
+	// uploaded if one is ready, so a level bigger than the budget still gets through (alone in its frame).
+	void update(size_t byteBudget = 16 * 1024 * 1024)
+	{
+		schedule();
+
+		uploadedLastFrame = 0;
+		for (;;)
+		{
+			DecodedLevels decoded;
+			{
+				std::lock_guard<std::mutex> lock(mutex);
+				if (ready.empty())
+					break;
+				size_t bytes = ready.front().bytes();
+				if (uploadedLastFrame > 0 && uploadedLastFrame + bytes > byteBudget)
+					break;
+				std::swap(decoded, ready.front());
+				ready.pop_front();
+			}
+			uploadedLastFrame += decoded.bytes();
+			upload(decoded);
+		}
+		frame++;
+	}
+
+	// uploads everything that has been requested so far, blocking until it is decoded. For tools and tests, not the render loop.
+	void finish()
+	{
+		for (;;)
+		{
+			{
+				std::unique_lock<std::mutex> lock(mutex);
+				decodedReady.wait(lock, [this]() { return !ready.empty() || inFlight == 0; });
+				if (ready.empty() && inFlight == 0)
+					return;
+			}
+			update((size_t)-1);
+		}
+	}
+
+	// number of textures with levels still on their way to the GPU
+	unsigned int pending()
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		return inFlight;
+	}
+
+	size_t bytesUploadedLastFrame() const { return uploadedLastFrame; }
+
+	void printStats() const
+	{
+		unsigned int full = 0;
+		for (std::unordered_map<unsigned int, StreamedTexture*>::const_iterator it = textures.begin(); it != textures.end(); ++it)
+			if (it->second->levels && it->second->residentBase == 0)
+				full++;
+		printf("TEXTURE_STREAMER:: %u textures (%u at full resolution), %.1f MB resident of %.1f MB budget\n",
+			(unsigned int)textures.size(), full, residentTotal / (1024.0 * 1024.0), budget / (1024.0 * 1024.0));
+	}
+
+private:
+	// GL thread bookkeeping for one texture. Levels are numbered like GL's, 0 is the full resolution.
+	struct StreamedTexture {
+		unsigned int id;
+		std::string path;
+		bool compressed;
+		bool flip;
+		MipColorSpace mipSpace;
+		GLenum target;		// GL_TEXTURE_2D, or GL_TEXTURE_2D_ARRAY for requestArray()
+		int layers;
+		LayerLoader loader;	// only for arrays
+		uint32_t blockBytes;	// compressed arrays, 0 otherwise
+		GLenum internalFormat;
+		std::vector<size_t> levelBytes;
+		int width, height;
+		int levels;			// 0 until the first decode told us the size
+		int floorBase;		// the coarse levels loaded up front, never dropped
+		int residentBase;	// finest level on the GPU, levels if there is none yet
+		int wantedBase;		// finest level the draws asked for
+		int plannedBase;	// wantedBase limited by the budget
+		float pixels;		// largest on screen size reported since the last update
+		float lastPixels;
+		unsigned int lastUsed;	// frame of the last noteUsage, 0 if it never got any
+		bool loading;
+
+		StreamedTexture(unsigned int id, const std::string &path, bool compressed, bool flip)
+			: id(id), path(path), compressed(compressed), flip(flip), mipSpace(MIP_SRGB), target(GL_TEXTURE_2D), layers(1), blockBytes(0), internalFormat(GL_RGBA), width(0), height(0), levels(0), floorBase(0), residentBase(0),
+			wantedBase(0), plannedBase(0), pixels(0.0f), lastPixels(0.0f), lastUsed(0), loading(false)
+		{
+		}
+	};
+
+	// what a worker hands back: levels [first, first + data.size()) of a texture, all layers of a level after each other
+	struct DecodedLevels {
+		unsigned int textureID;
+		std::string path;
+		bool ok;
+		int first;
+		int width, height, levels;	// of the whole texture, the first decode of an image needs them
+		GLenum format;				// GL_RED..GL_RGBA for images, the compressed internal format otherwise
+		bool compressed;
+		std::vector<std::vector<unsigned char> > data;
+
+		size_t bytes() const
+		{
+			size_t total = 0;
+			for (size_t i = 0; i < data.size(); i++)
+				total += data[i].size();
+			return total;
+		}
+	};
+
+	std::unordered_map<unsigned int, StreamedTexture*> textures;
+	std::vector<StreamedTexture*> order;	// scratch for schedule(), kept so it doesn't allocate every frame
+	unsigned int frame;
+	size_t budget;
+	size_t residentTotal;
+
+	std::mutex mutex;
+	std::condition_variable decodedReady;
+	std::deque<DecodedLevels> ready;
+	unsigned int inFlight;
+	bool flipRows;
+	size_t uploadedLastFrame;
+	std::function<void(unsigned int, size_t)> uploadListener;
+
+	// a single pixel unpack buffer, orphaned on every upload so the driver can keep the previous one in flight
+	unsigned int pbo;
+
+	TextureStreamer() : frame(1), budget(0), residentTotal(0), inFlight(0), flipRows(false), uploadedLastFrame(0), pbo(0) {}
+
+	static int dimension(int size, int level)
+	{
+		return size >> level > 0 ? size >> level : 1;
+	}
+
+	// first level that fits in STREAM_INITIAL_SIZE
+	static int initialBase(int width, int height, int levels)
+	{
+		int base = 0;
+		while (base + 1 < levels && std::max(dimension(width, base), dimension(height, base)) > STREAM_INITIAL_SIZE)
+			base++;
+		return base;
+	}
+
+	void setLevels(StreamedTexture *texture, int width, int height, int levels)
+	{
+		texture->levels = levels;
+		texture->floorBase = initialBase(width, height, levels);
+		texture->residentBase = levels;
+		texture->wantedBase = 0;
+		texture->plannedBase = 0;
+		texture->width = width;
+		texture->height = height;
+	}
+
+	static size_t bytesFrom(const StreamedTexture *texture, int base)
+	{
+		size_t total = 0;
+		for (int i = base; i < texture->levels; i++)
+			total += texture->levelBytes[i];
+		return total;
+	}
+
+	// finest level with at least as many texels across as the texture covers pixels
+	static int baseForPixels(const StreamedTexture *texture, float pixels)
+	{
+		float texelsPerPixel = std::max(texture->width, texture->height) / std::max(pixels, 1.0f);
+		int base = texelsPerPixel > 1.0f ? (int)floorf(log2f(texelsPerPixel)) : 0;
+		return std::min(base, texture->floorBase);
+	}
+
+	// idle textures first (longest idle first), then the ones smallest on screen
+	static bool dropsBefore(const StreamedTexture *a, const StreamedTexture *b, unsigned int frame)
+	{
+		bool aIdle = frame - a->lastUsed > STREAM_IDLE_FRAMES, bIdle = frame - b->lastUsed > STREAM_IDLE_FRAMES;
+		if (aIdle != bIdle)
+			return aIdle;
+		if (aIdle)
+			return a->lastUsed < b->lastUsed;
+		return a->lastPixels < b->lastPixels;
+	}
+
+	void schedule()
+	{
+		order.clear();
+		size_t planned = 0, incoming = 0;
+		for (std::unordered_map<unsigned int, StreamedTexture*>::iterator it = textures.begin(); it != textures.end(); ++it)
+		{
+			StreamedTexture *texture = it->second;
+			if (texture->levels == 0)
+				continue;
+			if (texture->pixels > 0.0f)
+			{
+				texture->wantedBase = baseForPixels(texture, texture->pixels);
+				texture->lastPixels = texture->pixels;
+				texture->pixels = 0.0f;
+			}
+			texture->plannedBase = texture->wantedBase;
+			planned += bytesFrom(texture, texture->plannedBase);
+			order.push_back(texture);
+		}
+		unsigned int now = frame;
+		std::sort(order.begin(), order.end(), [now](const StreamedTexture *a, const StreamedTexture *b) { return dropsBefore(a, b, now); });
+
+		if (budget && planned > budget)
+		{
+			// idle textures go down to their coarse levels one after the other, the rest lose a level per pass
+			for (size_t i = 0; i < order.size() && planned > budget; i++)
+			{
+				StreamedTexture *texture = order[i];
+				if (frame - texture->lastUsed <= STREAM_IDLE_FRAMES)
+					break;
+				planned -= bytesFrom(texture, texture->plannedBase) - bytesFrom(texture, texture->floorBase);
+				texture->plannedBase = texture->floorBase;
+			}
+			bool progress = true;
+			while (planned > budget && progress)
+			{
+				progress = false;
+				for (size_t i = 0; i < order.size() && planned > budget; i++)
+				{
+					StreamedTexture *texture = order[i];
+					if (texture->plannedBase >= texture->floorBase)
+						continue;
+					planned -= texture->levelBytes[texture->plannedBase];
+					texture->plannedBase++;
+					progress = true;
+				}
+			}
+		}
+
+		for (size_t i = 0; i < order.size(); i++)
+			if (order[i]->plannedBase < order[i]->residentBase)
+				incoming += bytesFrom(order[i], order[i]->plannedBase) - bytesFrom(order[i], order[i]->residentBase);
+
+		// levels beyond the plan stay as a cache until the finished plan wouldn't fit next to them
+		for (size_t i = 0; i < order.size() && budget && residentTotal + incoming > budget; i++)
+			if (order[i]->residentBase < order[i]->plannedBase)
+				dropLevels(order[i], order[i]->plannedBase);
+
+		// largest on screen first
+		unsigned int jobs = 0;
+		for (std::unordered_map<unsigned int, StreamedTexture*>::iterator it = textures.begin(); it != textures.end(); ++it)
+			if (it->second->loading)
+				jobs++;
+		for (size_t i = order.size(); i-- > 0 && jobs < STREAM_MAX_JOBS;)
+		{
+			StreamedTexture *texture = order[i];
+			if (!texture->loading && texture->plannedBase < texture->residentBase)
+			{
+				startLoading(texture, texture->plannedBase, texture->residentBase);
+				jobs++;
+			}
+		}
+	}
+
+	// first < 0: first decode of an image, the worker picks the range
+	void startLoading(StreamedTexture *texture, int first, int end)
+	{
+		texture->loading = true;
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			inFlight++;
+		}
+		unsigned int textureID = texture->id;
+		std::string path = texture->path;
+		bool flip = texture->flip;
+		MipColorSpace space = texture->mipSpace;
+		if (texture->compressed)
+			ThreadPool::shared().submit([this, path, textureID, first, end]() { readCompressed(path, textureID, first, end); });
+		else if (texture->loader)
+		{
+			LayerLoader loader = texture->loader;
+			int layers = texture->layers;
+			GLenum format = texture->blockBytes ? texture->internalFormat : GL_RGBA;
+			ThreadPool::shared().submit([this, path, textureID, loader, layers, space, format, first, end]() { decodeLayers(path, textureID, loader, layers, space, format, first, end); });
+		}
+		else
+			ThreadPool::shared().submit([this, path, textureID, flip, space, first, end]() { decode(path, textureID, flip, space, first, end); });
+	}
+
+	void dropLevels(StreamedTexture *texture, int base)
+	{
+		GlState::get().bindTexture(texture->target, texture->id);
+		glTexParameteri(texture->target, GL_TEXTURE_BASE_LEVEL, base);
+		// an empty image gives the level's memory back
+		for (int i = texture->residentBase; i < base; i++)
+		{
+			if (texture->target == GL_TEXTURE_2D_ARRAY)
+				glTexImage3D(GL_TEXTURE_2D_ARRAY, i, texture->internalFormat, 0, 0, 0, 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+			else
+				glTexImage2D(GL_TEXTURE_2D, i, texture->internalFormat, 0, 0, 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+		}
+		GlState::get().bindTexture(texture->target, 0);
+		residentTotal -= bytesFrom(texture, texture->residentBase) - bytesFrom(texture, base);
+		texture->residentBase = base;
+		if (uploadListener)
+			uploadListener(texture->id, bytesFrom(texture, base));
+	}
+
+	// runs on a worker thread, no GL in here. Images can only be decoded whole, so the chain is rebuilt every time
+	// and only the asked for levels are kept.
+	void decode(const std::string &path, unsigned int textureID, bool flip, MipColorSpace space, int first, int end)
+	{
+		DecodedLevels result;
+		result.textureID = textureID;
+		result.path = path;
+		result.compressed = false;
+		result.ok = false;
+		int components = 0;
+		unsigned char *pixels = stbi_load(path.c_str(), &result.width, &result.height, &components, 0);
+		if (pixels)
+		{
+			if (flip)
+				flipImage(pixels, (size_t)result.width * components, result.height);
+
+			// mips are built from RGBA, channels the image doesn't have stay zero
+			std::vector<unsigned char> rgba((size_t)result.width * result.height * 4, 0);
+			for (size_t p = 0; p < (size_t)result.width * result.height; p++)
+			{
+				for (int c = 0; c < components; c++)
+					rgba[p * 4 + c] = pixels[p * components + c];
+				if (components < 4)
+					rgba[p * 4 + 3] = 255;
+			}
+			stbi_image_free(pixels);
+			std::vector<MipLevel> chain;
+			build_mip_chain(rgba.data(), result.width, result.height, components <= 2 ? MIP_LINEAR : space, chain, MIP_FILTER_KAISER);
+
+			result.levels = (int)chain.size();
+			if (first < 0)
+			{
+				first = initialBase(result.width, result.height, result.levels);
+				end = result.levels;
+			}
+			static const GLenum formats[4] = { GL_RED, GL_RG, GL_RGB, GL_RGBA };
+			result.format = formats[components - 1];
+			result.first = first;
+			for (int level = first; level < end && level < result.levels; level++)
+			{
+				const MipLevel &mip = chain[level];
+				std::vector<unsigned char> packed((size_t)mip.width * mip.height * components);
+				for (size_t p = 0; p < (size_t)mip.width * mip.height; p++)
+					for (int c = 0; c < components; c++)
+						packed[p * components + c] = mip.rgba[p * 4 + c];
+				result.data.push_back(std::vector<unsigned char>());
+				result.data.back().swap(packed);
+			}
+			result.ok = true;
+		}
+		finishJob(result);
+	}
+
+	// runs on a worker thread like decode(). Layers that come as a single RGBA8 level get their chain built here;
+	// either way every layer is made whole and the asked for levels of all of them are kept
+	void decodeLayers(const std::string &name, unsigned int textureID, const LayerLoader &loader, int layers, MipColorSpace space, GLenum format,
+		int first, int end)
+	{
+		DecodedLevels result;
+		result.textureID = textureID;
+		result.path = name;
+		result.compressed = format != GL_RGBA;
+		result.ok = true;
+		result.format = format;
+		std::vector<MipLevel> chain;
+		for (int layer = 0; layer < layers && result.ok; layer++)
+		{
+			ArrayLayer out;
+			if (!loader(layer, out) || out.levels.empty())
+			{
+				result.ok = false;
+				break;
+			}
+			if (!result.compressed && out.levels.size() == 1)
+			{
+				build_mip_chain(out.levels[0].data(), out.width, out.height, space, chain, MIP_FILTER_KAISER);
+				out.levels.resize(chain.size());
+				for (size_t i = 0; i < chain.size(); i++)
+					out.levels[i].swap(chain[i].rgba);
+			}
+			if (layer == 0)
+			{
+				result.width = out.width;
+				result.height = out.height;
+				result.levels = (int)out.levels.size();
+				if (first < 0)
+				{
+					first = initialBase(out.width, out.height, result.levels);
+					end = result.levels;
+				}
+				result.first = first;
+				for (int level = first; level < end && level < result.levels; level++)
+					result.data.push_back(std::vector<unsigned char>());
+			}
+			else if (out.width != result.width || out.height != result.height || (int)out.levels.size() != result.levels)
+			{
+				result.ok = false;
+				break;
+			}
+			for (size_t i = 0; i < result.data.size(); i++)
+				result.data[i].insert(result.data[i].end(), out.levels[first + i].begin(), out.levels[first + i].end());
+		}
+		if (!result.ok)
+			result.data.clear();
+		finishJob(result);
+	}
+
+	// runs on a worker thread, copies the levels out of the file so the mapping can be closed right away
+	void readCompressed(const std::string &path, unsigned int textureID, int first, int end)
+	{
+		DecodedLevels result;
+		result.textureID = textureID;
+		result.path = path;
+		result.compressed = true;
+		result.ok = false;
+		result.first = first;
+		MappedFile file;
+		CompressedImage image;
+		std::string error;
+		if (file.open(path) && parse_compressed(file.data(), file.size(), image, error) && end <= (int)image.levels.size())
+		{
+			result.width = image.levels[0].width;
+			result.height = image.levels[0].height;
+			result.levels = (int)image.levels.size();
+			result.format = image.internalFormat;
+			for (int level = first; level < end; level++)
+				result.data.push_back(std::vector<unsigned char>(image.levels[level].data, image.levels[level].data + image.levels[level].size));
+			result.ok = true;
+		}
+		finishJob(result);
+	}
+
+	void finishJob(DecodedLevels &result)
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		ready.push_back(DecodedLevels());
+		std::swap(ready.back(), result);
+		decodedReady.notify_all();
+	}
+
+	static void flipImage(unsigned char *pixels, size_t rowBytes, int height)
+	{
+		std::vector<unsigned char> row(rowBytes);
+		for (int y = 0; y < height / 2; y++)
+		{
+			unsigned char *top = pixels + y * rowBytes;
+			unsigned char *bottom = pixels + (height - 1 - y) * rowBytes;
+			memcpy(&row[0], top, rowBytes);
+			memcpy(top, bottom, rowBytes);
+			memcpy(bottom, &row[0], rowBytes);
+		}
+	}
+
+	void upload(DecodedLevels &decoded)
+	{
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			inFlight--;
+		}
+		std::unordered_map<unsigned int, StreamedTexture*>::iterator found = textures.find(decoded.textureID);
+		if (found == textures.end())
+			return; // forgotten while loading
+		StreamedTexture *texture = found->second;
+		texture->loading = false;
+
+		if (!decoded.ok)
+		{
+			std::cout << "Texture failed to load at path: " << decoded.path << std::endl;
+			// a texture that never loaded keeps its placeholder, one that lost its file keeps what it has
+			if (texture->levels == 0)
+			{
+				forget(decoded.textureID);
+				if (uploadListener)
+					uploadListener(decoded.textureID, 0);
+			}
+			return;
+		}
+
+		if (texture->levels == 0)
+		{
+			texture->internalFormat = decoded.format;
+			int components = decoded.format == GL_RED ? 1 : decoded.format == GL_RG ? 2 : decoded.format == GL_RGB ? 3 : 4;
+			for (int i = 0; i < decoded.levels; i++)
+			{
+				int width = dimension(decoded.width, i), height = dimension(decoded.height, i);
+				size_t bytes = decoded.compressed ? (size_t)((width + 3) / 4) * ((height + 3) / 4) * texture->blockBytes : (size_t)width * height * components;
+				texture->levelBytes.push_back(bytes * texture->layers);
+			}
+			setLevels(texture, decoded.width, decoded.height, decoded.levels);
+		}
+
+		// the texture changed while this was loading (levels dropped, or the file changed size), the next schedule asks again
+		int end = decoded.first + (int)decoded.data.size();
+		if (end != texture->residentBase || decoded.levels != texture->levels || decoded.data.empty())
+			return;
+
+		GlState::get().bindTexture(texture->target, texture->id);
+		if (decoded.compressed)
+		{
+			for (size_t i = 0; i < decoded.data.size(); i++)
+			{
+				int level = decoded.first + (int)i;
+				if (texture->target == GL_TEXTURE_2D_ARRAY)
+					glCompressedTexImage3D(GL_TEXTURE_2D_ARRAY, level, decoded.format, dimension(texture->width, level), dimension(texture->height, level), texture->layers, 0,
+						(GLsizei)decoded.data[i].size(), decoded.data[i].data());
+				else
+					glCompressedTexImage2D(GL_TEXTURE_2D, level, decoded.format, dimension(texture->width, level), dimension(texture->height, level), 0,
+						(GLsizei)decoded.data[i].size(), decoded.data[i].data());
+			}
+		}
+		else
+			uploadImageLevels(texture, decoded);
+		glTexParameteri(texture->target, GL_TEXTURE_BASE_LEVEL, decoded.first);
+		glTexParameteri(texture->target, GL_TEXTURE_MAX_LEVEL, texture->levels - 1);
+		GlState::get().bindTexture(texture->target, 0);
+
+		residentTotal += bytesFrom(texture, decoded.first) - bytesFrom(texture, texture->residentBase);
+		texture->residentBase = decoded.first;
+		if (uploadListener)
+			uploadListener(texture->id, bytesFrom(texture, texture->residentBase));
+	}
+
+	// all levels of the job go through the pixel buffer in one go, the texture is bound
+	void uploadImageLevels(const StreamedTexture *texture, const DecodedLevels &decoded)
+	{
+		size_t bytes = decoded.bytes();
+		if (pbo == 0)
+			glGenBuffers(1, &pbo);
+		GlState::get().bindBuffer(GL_PIXEL_UNPACK_BUFFER, pbo);
+		glBufferData(GL_PIXEL_UNPACK_BUFFER, bytes, NULL, GL_STREAM_DRAW);
+		unsigned char *dst = (unsigned char*)glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, bytes, GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT);
+		if (dst)
+		{
+			size_t offset = 0;
+			for (size_t i = 0; i < decoded.data.size(); i++)
+			{
+				memcpy(dst + offset, decoded.data[i].data(), decoded.data[i].size());
+				offset += decoded.data[i].size();
+			}
+			glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+		}
+		else // mapping failed, fall back to plain uploads
+			GlState::get().bindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+
+		// rows of 1 and 3 channel images aren't 4 byte aligned
+		glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+		size_t offset = 0;
+		for (size_t i = 0; i < decoded.data.size(); i++)
+		{
+			int level = decoded.first + (int)i;
+			const void *pixels = dst ? (const void*)offset : (const void*)decoded.data[i].data();
+			if (texture->target == GL_TEXTURE_2D_ARRAY)
+				glTexImage3D(GL_TEXTURE_2D_ARRAY, level, decoded.format, dimension(texture->width, level), dimension(texture->height, level), texture->layers, 0, decoded.format, GL_UNSIGNED_BYTE, pixels);
+			else
+				glTexImage2D(GL_TEXTURE_2D, level, decoded.format, dimension(texture->width, level), dimension(texture->height, level), 0, decoded.format, GL_UNSIGNED_BYTE, pixels);
+			offset += decoded.data[i].size();
+		}
+		glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+		GlState::get().bindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+	}
+
+	TextureStreamer(const TextureStreamer&);
+	TextureStreamer &operator=(const TextureStreamer&);
+};
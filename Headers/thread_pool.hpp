@@ -0,0 +1,139 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Fixed size pool of worker threads for CPU side loading work (mesh processing, image decoding, ...).
+// Nothing submitted here may touch GL, the context only exists on the main thread.
+class ThreadPool
+{
+public:
+	// threads = 0 uses one worker per hardware thread, minus the calling thread
+	explicit ThreadPool(unsigned int threads = 0) : stopping(false)
+	{
+		if (threads == 0)
+		{
+			unsigned int hw = std::thread::hardware_concurrency();
+			threads = hw > 1 ? hw - 1 : 1;
+		}
+		for (unsigned int i = 0; i < threads; i++)
+			workers.push_back(std::thread(&ThreadPool::workerLoop, this));
+	}
+
+	~ThreadPool()
+	{
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			stopping = true;
+		}
+		wake.notify_all();
+		for (unsigned int i = 0; i < workers.size(); i++)
+			workers[i].join();
+	}
+
+	// the pool used by the loaders, created on first use
+	static ThreadPool &shared()
+	{
+		static ThreadPool pool;
+		return pool;
+	}
+
+	unsigned int size() const { return (unsigned int)workers.size(); }
+
+	// queues a job to run on some worker
+	void submit(std::function<void()> job)
+	{
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			jobs.push_back(job);
+		}
+		wake.notify_one();
+	}
+
+	// runs fn(i) for every i in [0, count) on the workers and the calling thread, returns once all calls finished.
+	// Indices are handed out one at a time so uneven work (big and small meshes) still balances.
+	void parallel_for(size_t count, const std::function<void(size_t)> &fn)
+	{
+		if (count == 0)
+			return;
+		if (count == 1 || workers.empty())
+		{
+			for (size_t i = 0; i < count; i++)
+				fn(i);
+			return;
+		}
+
+		// shared so helpers that only get scheduled after everything is done can still exit safely
+		std::shared_ptr<ParallelFor> state(new ParallelFor(count, fn));
+		size_t helpers = std::min(count - 1, workers.size());
+		for (size_t h = 0; h < helpers; h++)
+			submit([state]() { state->run(); });
+
+		state->run();
+
+		std::unique_lock<std::mutex> lock(state->mutex);
+		state->finished.wait(lock, [&state]() { return state->completed == state->count; });
+	}
+
+private:
+	struct ParallelFor
+	{
+		size_t count;
+		std::function<void(size_t)> fn;
+		std::atomic<size_t> next;
+		size_t completed;
+		std::mutex mutex;
+		std::condition_variable finished;
+
+		ParallelFor(size_t count, const std::function<void(size_t)> &fn) : count(count), fn(fn), next(0), completed(0) {}
+
+		void run()
+		{
+			size_t done = 0;
+			for (size_t i = next++; i < count; i = next++)
+			{
+				fn(i);
+				done++;
+			}
+			if (done == 0)
+				return;
+			std::lock_guard<std::mutex> lock(mutex);
+			completed += done;
+			if (completed == count)
+				finished.notify_all();
+		}
+	};
+
+	std::vector<std::thread> workers;
+	std::deque<std::function<void()> > jobs;
+	std::mutex mutex;
+	std::condition_variable wake;
+	bool stopping;
+
+	void workerLoop()
+	{
+		for (;;)
+		{
+			std::function<void()> job;
+			{
+				std::unique_lock<std::mutex> lock(mutex);
+				wake.wait(lock, [this]() { return stopping || !jobs.empty(); });
+				if (stopping && jobs.empty())
+					return;
+				job = jobs.front();
+				jobs.pop_front();
+			}
+			job();
+		}
+	}
+
+	ThreadPool(const ThreadPool&);
+	ThreadPool &operator=(const ThreadPool&);
+};
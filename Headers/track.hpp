@@ -7,6 +7,7 @@
 #include <vector>
 #include <iostream>
 
+#include <gl_state.hpp>
 #include <shader.hpp>
 #include <rc_spline.h>
 
@@ -63,29 +64,23 @@ public:
 	}
 
 	// render the mesh
-	void Draw(Shader shader, unsigned int textureID)
+	void Draw(Shader &shader, unsigned int textureID)
 	{
 		// Set the shader properties
 		shader.use();
 		glm::mat4 model;
 		//model = glm::scale(model, glm::vec3(20.0f, 10.0f, 20.0f));
 		//model = glm::scale(model, glm::vec3(200.0f, 100.0f, 200.0f));
-		shader.setMat4("model", model);
+		UniformBuffers::get().setObject(model);
 
 
 
-		// active proper texture unit before binding
-		glActiveTexture(GL_TEXTURE0);
-		// and finally bind the textures
-		glBindTexture(GL_TEXTURE_2D, textureID);
+		// texture on unit 0 and the VAO, both skipped when they are already bound
+		GlState::get().bindTextureUnit(0, GL_TEXTURE_2D, textureID);
 
 		// draw mesh
-		glBindVertexArray(VAO);
+		GlState::get().bindVertexArray(VAO);
 		glDrawArrays(GL_TRIANGLES, 0, vertices.size());
-		glBindVertexArray(0);
-
-		// always good practice to set everything back to defaults once configured.
-		glActiveTexture(GL_TEXTURE0);
 	}
 
 	// give a positive float s, find the point by interpolation
@@ -118,9 +113,9 @@ public:
 
 	void delete_buffers()
 	{
-		glDeleteVertexArrays(1, &VAO);
-		glDeleteBuffers(1, &VBO);
-		glDeleteBuffers(1, &EBO);
+		GlState::get().deleteVertexArrays(1, &VAO);
+		GlState::get().deleteBuffers(1, &VBO);
+		GlState::get().deleteBuffers(1, &EBO);
 	}
 
 private:
@@ -293,8 +288,8 @@ private:
 		glGenVertexArrays(1, &VAO);
 		glGenBuffers(1, &VBO);
 
-		glBindVertexArray(VAO);
-		glBindBuffer(GL_ARRAY_BUFFER, VBO);
+		GlState::get().bindVertexArray(VAO);
+		GlState::get().bindBuffer(GL_ARRAY_BUFFER, VBO);
 		glBufferData(GL_ARRAY_BUFFER, vertices.size() * sizeof(Vertex), &vertices[0], GL_STATIC_DRAW);
 
 		//position coords
@@ -310,7 +305,7 @@ private:
 		glEnableVertexAttribArray(2);
 		glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)offsetof(Vertex, TexCoords));
 
-		glBindVertexArray(0);
+		GlState::get().bindVertexArray(0);
 	}
 
 };
\ No newline at end of file
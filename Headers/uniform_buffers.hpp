@@ -0,0 +1,162 @@
+#pragma once
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+
+#include <gl_state.hpp>
+
+#include <cstddef>
+#include <cstdio>
+
+// fixed binding points of the uniform blocks every shader shares, Shader binds blocks with these names at link time
+#define UNIFORM_BINDING_CAMERA 0
+#define UNIFORM_BINDING_LIGHTS 1
+#define UNIFORM_BINDING_OBJECT 2
+
+// must match NR_POINT_LIGHTS in the shaders
+#define UNIFORM_POINT_LIGHTS 4
+// bytes of the per object ring, wrapping around orphans it so draws still in flight keep their data
+#define UNIFORM_OBJECT_RING_SIZE (256 * 1024)
+
+// The C++ side of the std140 blocks below. vec3s are followed by a float so every member lands where std140 puts it.
+//
+// layout (std140) uniform Camera { mat4 view; mat4 projection; mat4 viewProjection; vec4 cameraPosition; };
+struct CameraBlock {
+	glm::mat4 view;
+	glm::mat4 projection;
+	glm::mat4 viewProjection;
+	glm::vec4 position;
+};
+
+// struct Light of the shaders. Point lights use position and the attenuation terms, the PBR shader takes diffuse as
+// the light's colour, the spot light also uses direction and the cone
+struct LightStd140 {
+	glm::vec3 position;
+	float cutOff;
+	glm::vec3 direction;
+	float outerCutOff;
+	glm::vec3 ambient;
+	float constant;
+	glm::vec3 diffuse;
+	float linear;
+	glm::vec3 specular;
+	float quadratic;
+};
+
+// layout (std140) uniform Lights { Light dirLight; Light pointLights[NR_POINT_LIGHTS]; Light spotLight; };
+struct LightsBlock {
+	LightStd140 dirLight;
+	LightStd140 pointLights[UNIFORM_POINT_LIGHTS];
+	LightStd140 spotLight;
+};
+
+// layout (std140) uniform Object { mat4 model; mat4 normalMatrix; };
+struct ObjectBlock {
+	glm::mat4 model;
+	glm::mat4 normalMatrix;	// transpose(inverse(model)), only the upper 3x3 is used
+};
+
+static_assert(sizeof(CameraBlock) == 208, "CameraBlock must match the std140 layout");
+static_assert(sizeof(LightStd140) == 80, "LightStd140 must match the std140 layout");
+static_assert(sizeof(ObjectBlock) == 128, "ObjectBlock must match the std140 layout");
+
+// Owns the shared uniform buffers. Camera and lights are written once per frame and stay bound to their binding
+// points, so switching shaders doesn't need any uniform calls for them. Per object data goes into a ring buffer,
+// every setObject() writes the next slot and binds that range to UNIFORM_BINDING_OBJECT.
+// All of it must be used on the GL thread, the buffers are created on first use.
+class UniformBuffers
+{
+public:
+	static UniformBuffers &get()
+	{
+		static UniformBuffers buffers;
+		return buffers;
+	}
+
+	void setCamera(const glm::mat4 &view, const glm::mat4 &projection, const glm::vec3 &position)
+	{
+		create();
+		CameraBlock block;
+		block.view = view;
+		block.projection = projection;
+		block.viewProjection = projection * view;
+		block.position = glm::vec4(position, 1.0f);
+		GlState::get().bindBuffer(GL_UNIFORM_BUFFER, cameraBuffer);
+		glBufferSubData(GL_UNIFORM_BUFFER, 0, sizeof(block), &block);
+		GlState::get().bindBuffer(GL_UNIFORM_BUFFER, 0);
+	}
+
+	void setLights(const LightsBlock &block)
+	{
+		create();
+		GlState::get().bindBuffer(GL_UNIFORM_BUFFER, lightsBuffer);
+		glBufferSubData(GL_UNIFORM_BUFFER, 0, sizeof(block), &block);
+		GlState::get().bindBuffer(GL_UNIFORM_BUFFER, 0);
+	}
+
+	// per object data for the draws that follow
+	void setObject(const glm::mat4 &model)
+	{
+		create();
+		ObjectBlock block;
+		block.model = model;
+		block.normalMatrix = glm::transpose(glm::inverse(model));
+
+		if (objectOffset + objectStride > UNIFORM_OBJECT_RING_SIZE)
+		{
+			GlState::get().bindBuffer(GL_UNIFORM_BUFFER, objectBuffer);
+			glBufferData(GL_UNIFORM_BUFFER, UNIFORM_OBJECT_RING_SIZE, NULL, GL_STREAM_DRAW);
+			objectOffset = 0;
+			wraps++;
+		}
+		else
+			GlState::get().bindBuffer(GL_UNIFORM_BUFFER, objectBuffer);
+		glBufferSubData(GL_UNIFORM_BUFFER, objectOffset, sizeof(block), &block);
+		GlState::get().bindBuffer(GL_UNIFORM_BUFFER, 0);
+		GlState::get().bindBufferRange(GL_UNIFORM_BUFFER, UNIFORM_BINDING_OBJECT, objectBuffer, objectOffset, sizeof(block));
+		objectOffset += objectStride;
+		objectWrites++;
+	}
+
+	void printStats() const
+	{
+		printf("UNIFORMS:: %u object writes, ring wrapped %u times (%u byte slots)\n", (unsigned int)objectWrites, (unsigned int)wraps, (unsigned int)objectStride);
+	}
+
+private:
+	unsigned int cameraBuffer, lightsBuffer, objectBuffer;
+	size_t objectStride;
+	size_t objectOffset;
+	size_t objectWrites, wraps;
+
+	UniformBuffers() : cameraBuffer(0), lightsBuffer(0), objectBuffer(0), objectStride(0), objectOffset(0), objectWrites(0), wraps(0) {}
+
+	void create()
+	{
+		if (cameraBuffer)
+			return;
+		glGenBuffers(1, &cameraBuffer);
+		glGenBuffers(1, &lightsBuffer);
+		glGenBuffers(1, &objectBuffer);
+
+		GlState::get().bindBuffer(GL_UNIFORM_BUFFER, cameraBuffer);
+		glBufferData(GL_UNIFORM_BUFFER, sizeof(CameraBlock), NULL, GL_DYNAMIC_DRAW);
+		GlState::get().bindBuffer(GL_UNIFORM_BUFFER, lightsBuffer);
+		LightsBlock noLights = LightsBlock();
+		glBufferData(GL_UNIFORM_BUFFER, sizeof(LightsBlock), &noLights, GL_DYNAMIC_DRAW);
+		GlState::get().bindBuffer(GL_UNIFORM_BUFFER, objectBuffer);
+		glBufferData(GL_UNIFORM_BUFFER, UNIFORM_OBJECT_RING_SIZE, NULL, GL_STREAM_DRAW);
+		GlState::get().bindBuffer(GL_UNIFORM_BUFFER, 0);
+
+		GlState::get().bindBufferBase(GL_UNIFORM_BUFFER, UNIFORM_BINDING_CAMERA, cameraBuffer);
+		GlState::get().bindBufferBase(GL_UNIFORM_BUFFER, UNIFORM_BINDING_LIGHTS, lightsBuffer);
+
+		// bound ranges have to start at a multiple of the alignment
+		GLint alignment = 256;
+		glGetIntegerv(GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT, &alignment);
+		objectStride = (sizeof(ObjectBlock) + alignment - 1) / alignment * alignment;
+	}
+
+	UniformBuffers(const UniformBuffers&);
+	UniformBuffers &operator=(const UniformBuffers&);
+};
@@ -0,0 +1,88 @@
+#pragma once
+
+#include <glm/glm.hpp>
+#include <glm/gtc/packing.hpp>
+
+#include <cmath>
+#include <cstdint>
+#include <vector>
+
+// which vertex layout a mesh is uploaded with
+enum VertexFormat {
+	VERTEX_FORMAT_FULL,		// VertexModel, 56 bytes of floats
+	VERTEX_FORMAT_COMPACT	// VertexCompact, 20 bytes
+};
+
+// Quantized vertex, decoded in pbrShader.vert when compactVertex is set.
+//   Position:  xyz as unorm16 relative to the mesh bounds, w is the bitangent sign (0 = -1, 65535 = +1)
+//   Normal:    octahedral encoded snorm16
+//   Tangent:   octahedral encoded snorm16, the bitangent is rebuilt as cross(normal, tangent) * sign
+//   TexCoords: half floats
+struct VertexCompact {
+	uint16_t Position[4];
+	int16_t Normal[2];
+	int16_t Tangent[2];
+	uint16_t TexCoords[2];
+};
+
+inline int16_t quantize_snorm16(float v)
+{
+	v = v < -1.0f ? -1.0f : (v > 1.0f ? 1.0f : v);
+	return (int16_t)floorf(v * 32767.0f + (v >= 0.0f ? 0.5f : -0.5f));
+}
+
+inline uint16_t quantize_unorm16(float v)
+{
+	v = v < 0.0f ? 0.0f : (v > 1.0f ? 1.0f : v);
+	return (uint16_t)(v * 65535.0f + 0.5f);
+}
+
+// maps a unit vector onto the octahedron and unfolds it into [-1, 1]^2
+inline void oct_encode(glm::vec3 n, int16_t out[2])
+{
+	float l1 = fabsf(n.x) + fabsf(n.y) + fabsf(n.z);
+	if (l1 == 0.0f)
+	{
+		out[0] = 0;
+		out[1] = 0;
+		return;
+	}
+	float x = n.x / l1;
+	float y = n.y / l1;
+	if (n.z < 0.0f)
+	{
+		float ox = x;
+		x = (1.0f - fabsf(y)) * (ox >= 0.0f ? 1.0f : -1.0f);
+		y = (1.0f - fabsf(ox)) * (y >= 0.0f ? 1.0f : -1.0f);
+	}
+	out[0] = quantize_snorm16(x);
+	out[1] = quantize_snorm16(y);
+}
+
+// converts full vertices into the compact layout. boundsMin/boundsMax must contain every position.
+template <typename VertexType>
+void compact_vertices(const VertexType *vertices, size_t count, glm::vec3 boundsMin, glm::vec3 boundsMax, std::vector<VertexCompact> &out)
+{
+	glm::vec3 extent = boundsMax - boundsMin;
+	glm::vec3 scale(extent.x > 0.0f ? 1.0f / extent.x : 0.0f, extent.y > 0.0f ? 1.0f / extent.y : 0.0f, extent.z > 0.0f ? 1.0f / extent.z : 0.0f);
+
+	out.resize(count);
+	for (size_t i = 0; i < count; i++)
+	{
+		const VertexType &v = vertices[i];
+		VertexCompact &c = out[i];
+
+		glm::vec3 p = (v.Position - boundsMin) * scale;
+		c.Position[0] = quantize_unorm16(p.x);
+		c.Position[1] = quantize_unorm16(p.y);
+		c.Position[2] = quantize_unorm16(p.z);
+		// handedness of the tangent frame, mirrored UVs flip it
+		c.Position[3] = glm::dot(glm::cross(v.Normal, v.Tangent), v.Bitangent) < 0.0f ? 0 : 65535;
+
+		oct_encode(v.Normal, c.Normal);
+		oct_encode(v.Tangent, c.Tangent);
+
+		c.TexCoords[0] = glm::packHalf1x16(v.TexCoords.x);
+		c.TexCoords[1] = glm::packHalf1x16(v.TexCoords.y);
+	}
+}
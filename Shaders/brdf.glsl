@@ -0,0 +1,83 @@
+// BRDF terms shared by the PBR shaders
+
+//from learnopengl
+float DistributionGGX(vec3 N, vec3 H, float a)
+{
+	a = a * a; //adding because apparently roughness should be squared according to disney and epic
+	float a2, NdotH, NdotH2, num, denom;
+	a2 = a * a;
+	NdotH = max(dot(N, H), 0.0f);
+	NdotH2 = NdotH * NdotH;
+
+	num = a2;
+	denom = 3.14159 * pow((NdotH2 * (a2 - 1.0f) + 1.0f), 2.0f);
+	return num / max(denom, .001);
+}
+
+//from the epic games slides --- I prefer this one
+float DistributionGGX1(vec3 N, vec3 H, float a)
+{
+	a = a * a; //adding because apparently roughness should be squared according to disney and epic
+	float a2, NdotH, NdotH2, num, denom;
+	a2 = a * a;
+	NdotH = max(dot(N, H), 0.0f);
+	NdotH2 = NdotH * NdotH;
+
+	num = a2;
+	denom = 3.14159 * pow((pow(NdotH2, 2.0f) * (a2 - 1.0f) + 1.0f), 2.0f);
+	return num / max(denom, .001);
+}
+
+//normal, view, and roughness alpha
+float GeometrySchlickGGX(vec3 N, vec3 v, float a)
+{
+	a = a * a; //adding because apparently roughness should be squared according to disney and epic
+	float k, NdotV;
+	k = pow(a + 1, 2) / 8.0f; //remaps differently if we do IBL --- becomes (a^2)/2
+	NdotV = max(dot(N, v), 0.0f);
+
+	return NdotV / (NdotV * (1 - k) + k);
+}
+
+//normal, view, light (to/from surface) and alpha
+float GeometrySmith(vec3 N, vec3 v, vec3 l, float a)
+{
+	a = a * a; //adding because apparently roughness should be squared according to disney and epic
+	return GeometrySchlickGGX(N, v, a) * GeometrySchlickGGX(N, l, a);
+}
+
+//incidence angle (from dot product of normal and halfway vector, index of refraction
+float FresnelSchlick(float VdotH, float ior)
+{
+	float F0 = pow((ior - 1) / (ior + 1), 2.0f);
+	//float F0 = .04;
+	return F0 + (1.0 - F0) * pow(clamp(1.0 - VdotH, 0.0f, 1.0f), 5.0);
+}
+
+//the epic games version. Indistinguishable from regular schlick approx.
+float FresnelSchlick1(float VdotH, float ior)
+{
+	float F0 = pow((ior - 1) / (ior + 1), 2.0f);
+	return F0 + (1.0 - F0) * pow(2.0f, (-5.55473*VdotH-6.98316)*VdotH);
+}
+
+float Attenuate(vec3 lightPos, vec3 surface)
+{
+	return 1.0f / pow(length(lightPos-surface), 2.0f) ;
+}
+
+//inverse square falloff windowed to reach 0 at radius, so lights can be culled past it
+float AttenuateWindowed(vec3 lightPos, vec3 surface, float radius)
+{
+	float d = length(lightPos - surface);
+	float window = clamp(1.0f - pow(d / radius, 4.0f), 0.0f, 1.0f);
+	return window * window / max(d * d, .0001f);
+}
+
+float Radiance(vec3 surface, vec3 lightPos, vec3 N)
+{
+	vec3 wi = normalize(lightPos - surface);
+	float cosTheta = max(dot(N, wi), 0.0f);
+	float attenuation = Attenuate(lightPos, surface);
+	return attenuation * cosTheta;
+}
@@ -0,0 +1,40 @@
+// clustered light lookup, see light_clusters.hpp. Needs uniform_blocks.glsl for the view matrix
+#ifndef CLUSTER_GRID_X
+#define CLUSTER_GRID_X 16
+#define CLUSTER_GRID_Y 9
+#define CLUSTER_GRID_Z 24
+#endif
+
+// two texels per light: position and radius, colour
+uniform samplerBuffer clusterLights;
+// per cluster: first entry in clusterIndices and light count
+uniform usamplerBuffer clusterGrid;
+uniform usamplerBuffer clusterIndices;
+// clusters per pixel in x and y, scale and bias from log(view depth) to slice
+uniform vec4 clusterParams;
+
+// first index and light count of the cluster worldPos falls in
+uvec2 clusterRange(vec3 worldPos)
+{
+	float depth = max(-(view * vec4(worldPos, 1.0)).z, 1e-4);
+	ivec3 cell = ivec3(ivec2(gl_FragCoord.xy * clusterParams.xy), int(floor(log(depth) * clusterParams.z + clusterParams.w)));
+	cell = clamp(cell, ivec3(0), ivec3(CLUSTER_GRID_X - 1, CLUSTER_GRID_Y - 1, CLUSTER_GRID_Z - 1));
+	int cluster = cell.x + CLUSTER_GRID_X * (cell.y + CLUSTER_GRID_Y * cell.z);
+	return texelFetch(clusterGrid, cluster).rg;
+}
+
+vec4 clusterLightPositionRadius(uint light)
+{
+	return texelFetch(clusterLights, int(light) * 2);
+}
+
+vec3 clusterLightColor(uint light)
+{
+	return texelFetch(clusterLights, int(light) * 2 + 1).rgb;
+}
+
+// index of the i-th light of a cluster's range
+uint clusterLightIndex(uvec2 range, uint i)
+{
+	return texelFetch(clusterIndices, int(range.x + i)).r;
+}
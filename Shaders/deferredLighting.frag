@@ -0,0 +1,39 @@
+#version 330 core
+out vec4 FragColor;
+
+#include "uniform_blocks.glsl"
+#include "brdf.glsl"
+#include "gbuffer.glsl"
+#include "pbr_lighting.glsl"
+
+//lighting pass of the deferred path (see gbuffer.hpp): shades every covered pixel once from the G-buffer.
+//Variants as in pbrShader.frag: LIGHT_COUNT, CLUSTERED_LIGHTS
+
+uniform sampler2D gAlbedoRoughness;
+uniform sampler2D gNormalMetalness;
+uniform sampler2D gDepth;
+//clip space back to world space, inverse of the camera's viewProjection
+uniform mat4 inverseViewProjection;
+
+void main()
+{
+	ivec2 pixel = ivec2(gl_FragCoord.xy);
+	float depth = texelFetch(gDepth, pixel, 0).r;
+	//nothing was drawn here, leave it to the skybox
+	if (depth >= 1.0f)
+		discard;
+
+	vec2 uv = gl_FragCoord.xy / vec2(textureSize(gDepth, 0));
+	vec4 world = inverseViewProjection * vec4(vec3(uv, depth) * 2.0f - 1.0f, 1.0f);
+	vec3 position = world.xyz / world.w;
+
+	vec4 albedoRoughness = texelFetch(gAlbedoRoughness, pixel, 0);
+	vec4 normalMetalness = texelFetch(gNormalMetalness, pixel, 0);
+	vec3 N = octDecode(normalMetalness.xy);
+	vec2 metalnessOcclusion = unpackMetalnessOcclusion(normalMetalness.z);
+
+	vec3 final = ShadeSurface(position, N, albedoRoughness.rgb, albedoRoughness.a, metalnessOcclusion.x, metalnessOcclusion.y);
+	FragColor = vec4(ToneMap(final), 1.0f);
+	//the scene's depth goes to the default framebuffer with the colour, so the skybox still tests against it
+	gl_FragDepth = depth;
+}
@@ -0,0 +1,34 @@
+// G-buffer layout shared by the geometry and lighting passes, see gbuffer.hpp
+//   0  SRGB8_A8  albedo, roughness (written with GL_FRAMEBUFFER_SRGB, read back linear)
+//   1  RGB10_A2  octahedral normal, metalness and occlusion (5 bits each in the 10 bit channel)
+// position isn't stored, the lighting pass rebuilds it from depth
+
+vec2 octEncode(vec3 n)
+{
+	n /= abs(n.x) + abs(n.y) + abs(n.z);
+	vec2 e = n.xy;
+	if (n.z < 0.0)
+		e = (1.0 - abs(n.yx)) * vec2(n.x >= 0.0 ? 1.0 : -1.0, n.y >= 0.0 ? 1.0 : -1.0);
+	return e * 0.5 + 0.5;
+}
+
+vec3 octDecode(vec2 e)
+{
+	e = e * 2.0 - 1.0;
+	vec3 n = vec3(e.xy, 1.0 - abs(e.x) - abs(e.y));
+	float t = max(-n.z, 0.0);
+	n.x += n.x >= 0.0 ? -t : t;
+	n.y += n.y >= 0.0 ? -t : t;
+	return normalize(n);
+}
+
+float packMetalnessOcclusion(float metalness, float occlusion)
+{
+	return (round(clamp(metalness, 0.0, 1.0) * 31.0) * 32.0 + round(clamp(occlusion, 0.0, 1.0) * 31.0)) / 1023.0;
+}
+
+vec2 unpackMetalnessOcclusion(float packed)
+{
+	float bits = round(packed * 1023.0);
+	return vec2(floor(bits / 32.0), mod(bits, 32.0)) / 31.0;
+}
@@ -7,31 +7,11 @@ struct Material {
     float shininess;
 }; 
 
-struct Light {
-    vec3 position;
-    vec3 direction;
-    float cutOff;
-    float outerCutOff;
-  
-    float constant;
-    float linear;
-    float quadratic;
-  
-    vec3 ambient;
-    vec3 diffuse;
-    vec3 specular;       
-};
-
-#define NR_POINT_LIGHTS 4
-
 in vec3 FragPos;
 in vec3 Normal;
 in vec2 TexCoords;
 
-uniform vec3 viewPos;
-uniform Light dirLight;
-uniform Light pointLights[NR_POINT_LIGHTS];
-uniform Light spotLight;
+#include "uniform_blocks.glsl"
 uniform Material material;
 
 // function prototypes
@@ -43,7 +23,7 @@ void main()
 {    
     // properties
     vec3 norm = normalize(Normal);
-    vec3 viewDir = normalize(viewPos - FragPos);
+    vec3 viewDir = normalize(cameraPosition.xyz - FragPos);
     
     // == =====================================================
     // Our lighting is set up in 3 phases: directional, point lights and an optional flashlight
@@ -8,25 +8,6 @@ struct Material {
     float shininess;
 }; 
 
-struct Light {
-    vec3 position;
-    vec3 TangentLightPos;
-    vec3 direction;
-    float cutOff;
-    float outerCutOff;
-  
-    float constant;
-    float linear;
-    float quadratic;
-  
-    vec3 ambient;
-    vec3 diffuse;
-    vec3 specular;       
-};
-
-#define NR_POINT_LIGHTS 4
-
-
 in VS_OUT {
     vec3 FragPos;
     vec2 TexCoords;
@@ -36,10 +17,7 @@ in VS_OUT {
     mat3 TBN;
 } fs_in;
 
-uniform vec3 viewPos;
-uniform Light dirLight;
-uniform Light pointLights[NR_POINT_LIGHTS];
-uniform Light spotLight;
+#include "uniform_blocks.glsl"
 uniform Material material;
 
 // function prototypes
@@ -111,8 +89,7 @@ vec3 CalcDirLight(Light light, vec3 normal, vec3 viewDir, vec3 color, vec3 color
 // calculates the color when using a point light.
 vec3 CalcPointLight(Light light, vec3 normal, vec3 fragPos, vec3 viewDir, vec3 color, vec3 color_spec)
 {
-    light.TangentLightPos = fs_in.TBN * light.position;
-    //vec3 lightDir = normalize(light.TangentLightPos - fragPos);
+    //vec3 lightDir = normalize(fs_in.TBN * light.position - fragPos);
     vec3 lightDir = fs_in.TBN * normalize(light.position - fs_in.FragPos);
     // diffuse shading
     float diff = max(dot(normal, lightDir), 0.0);
@@ -135,7 +112,6 @@ vec3 CalcPointLight(Light light, vec3 normal, vec3 fragPos, vec3 viewDir, vec3 c
 // calculates the color when using a spot light.
 vec3 CalcSpotLight(Light light, vec3 normal, vec3 fragPos, vec3 viewDir, vec3 color, vec3 color_spec)
 {
-    light.TangentLightPos = fs_in.TBN * light.position;
     vec3 lightDir = normalize(light.position - fragPos);
     // diffuse shading
     float diff = max(dot(normal, lightDir), 0.0);
@@ -14,12 +14,9 @@ out VS_OUT {
     mat3 TBN;
 } vs_out;
 
-uniform mat4 projection;
-uniform mat4 view;
-uniform mat4 model;
+#include "uniform_blocks.glsl"
 
 uniform vec3 lightPos;
-uniform vec3 viewPos;
 
 void main()
 {
@@ -36,9 +33,9 @@ void main()
     vs_out.TBN = transpose(mat3(T, B, N));
    
     vs_out.TangentLightPos = vs_out.TBN * lightPos;
-    vs_out.TangentViewPos  = vs_out.TBN * viewPos;
+    vs_out.TangentViewPos  = vs_out.TBN * cameraPosition.xyz;
     vs_out.TangentFragPos  = vs_out.TBN * vs_out.FragPos;
         
-    gl_Position = projection * view * model * vec4(aPos, 1.0);
+    gl_Position = viewProjection * vec4(vs_out.FragPos, 1.0);
 }
 
@@ -6,15 +6,13 @@ out VS_OUT {
     vec3 normal;
 } vs_out;
 
-uniform mat4 projection;
-uniform mat4 view;
-uniform mat4 model;
+#include "uniform_blocks.glsl"
 
 void main()
 {
     vec3 normal = normalize(aNormal);
-    mat3 normalMatrix = mat3(transpose(inverse(view * model)));
-    vs_out.normal = normalize(vec3(projection * vec4(normalMatrix * normal, 1.0)));
-    gl_Position = projection * view * model * vec4(aPos, 1.0); 
+    mat3 viewNormalMatrix = mat3(transpose(inverse(view * model)));
+    vs_out.normal = normalize(vec3(projection * vec4(viewNormalMatrix * normal, 1.0)));
+    gl_Position = viewProjection * model * vec4(aPos, 1.0); 
 }
 
@@ -1,5 +1,5 @@
 #version 330 core
-layout (location = 0) in vec3 aPos;
+layout (location = 0) in vec4 aPos;
 layout (location = 1) in vec3 aNormal;
 layout (location = 2) in vec2 aTexCoords;
 layout (location = 3) in vec3 aTangent;
@@ -10,17 +10,61 @@ out vec3 Normal;
 out vec2 TexCoords;
 out mat3 TBN;
 
-uniform mat4 model;
-uniform mat4 view;
-uniform mat4 projection;
-uniform bool useTex;
+#ifdef INSTANCED
+//per instance transform and material parameters (see instance_buffer.hpp), in place of the Object block and the
+//constant material uniforms
+layout (location = 5) in mat4 aInstanceModel;
+layout (location = 9) in vec4 aInstanceParameters;
+flat out vec4 InstanceParameters;
+#endif
+
+#include "uniform_blocks.glsl"
+
+//compact vertices (see vertex_format.hpp): positions are relative to the mesh bounds, normal and tangent are
+//octahedral encoded and the bitangent is rebuilt from the sign stored in aPos.w
+uniform bool compactVertex;
+uniform vec3 boundsMin;
+uniform vec3 boundsExtent;
+
+vec3 octDecode(vec2 e)
+{
+    vec3 n = vec3(e.xy, 1.0 - abs(e.x) - abs(e.y));
+    float t = max(-n.z, 0.0);
+    n.x += n.x >= 0.0 ? -t : t;
+    n.y += n.y >= 0.0 ? -t : t;
+    return normalize(n);
+}
 
 void main()
 {
-    FragPos = vec3(model * vec4(aPos, 1.0));
-    Normal = mat3(transpose(inverse(model))) * normalize(aNormal);
+    vec3 position = aPos.xyz;
+    vec3 normal = aNormal;
+    vec3 tangent = aTangent;
+    vec3 bitangent = aBitangent;
+    if (compactVertex)
+    {
+        position = boundsMin + aPos.xyz * boundsExtent;
+        normal = octDecode(aNormal.xy);
+        tangent = octDecode(aTangent.xy);
+        bitangent = cross(normal, tangent) * (aPos.w * 2.0 - 1.0);
+    }
+
+#ifdef INSTANCED
+    mat4 objectModel = aInstanceModel;
+    //the cofactor matrix is the inverse transpose times the determinant, a scale the fragment shader normalizes away.
+    //a mirroring transform has a negative determinant that would flip the normals, multiplying by its sign undoes that
+    mat3 objectNormal = mat3(cross(objectModel[1].xyz, objectModel[2].xyz), cross(objectModel[2].xyz, objectModel[0].xyz),
+        cross(objectModel[0].xyz, objectModel[1].xyz)) * sign(determinant(mat3(objectModel)));
+    InstanceParameters = aInstanceParameters;
+#else
+    mat4 objectModel = model;
+    mat3 objectNormal = mat3(normalMatrix);
+#endif
+
+    FragPos = vec3(objectModel * vec4(position, 1.0));
+    Normal = objectNormal * normalize(normal);
     TexCoords = aTexCoords;
-    TBN = mat3(transpose(inverse(model))) * mat3(aTangent, aBitangent, aNormal);
+    TBN = objectNormal * mat3(tangent, bitangent, normal);
 
-    gl_Position = projection * view * vec4(FragPos, 1.0);
+    gl_Position = viewProjection * vec4(FragPos, 1.0);
 }
@@ -0,0 +1,99 @@
+// PBR shading of a surface point, shared by the forward shader and the deferred lighting pass.
+// Needs uniform_blocks.glsl and brdf.glsl. Lights come from the Lights block (LIGHT_COUNT of them) or, with
+// CLUSTERED_LIGHTS, from the point's cluster (light_clusters.hpp)
+#ifndef LIGHT_COUNT
+#define LIGHT_COUNT NR_POINT_LIGHTS
+#endif
+#ifdef CLUSTERED_LIGHTS
+#include "clusters.glsl"
+#endif
+
+uniform float fader;
+
+// image based ambient light, see ibl_baker.hpp
+uniform vec3 irradianceSH[9];
+uniform samplerCube prefilterMap;
+uniform sampler2D brdfLUT;
+uniform float prefilterMaxLod;
+uniform bool useIBL;
+
+//diffuse irradiance / pi around n. The cosine convolution and SH constants are baked into the coefficients
+vec3 irradianceFromSH(vec3 n)
+{
+	vec3 e = irradianceSH[0]
+		+ irradianceSH[1] * n.y + irradianceSH[2] * n.z + irradianceSH[3] * n.x
+		+ irradianceSH[4] * (n.x * n.y) + irradianceSH[5] * (n.y * n.z) + irradianceSH[6] * (3.0f * n.z * n.z - 1.0f)
+		+ irradianceSH[7] * (n.x * n.z) + irradianceSH[8] * (n.x * n.x - n.y * n.y);
+	return max(e, vec3(0.0f));
+}
+
+//split sum ambient: prefiltered radiance along the reflection times the BRDF LUT's scale and bias for F0
+vec3 AmbientIBL(vec3 N, vec3 v, vec3 albedo, float roughness, float F0)
+{
+	float NdotV = max(dot(N, v), 0.0f);
+	float Fr = F0 + (max(1.0f - roughness, F0) - F0) * pow(1.0f - NdotV, 5.0f);
+	vec2 envBRDF = texture(brdfLUT, vec2(NdotV, roughness)).rg;
+	vec3 prefiltered = textureLod(prefilterMap, reflect(-v, N), roughness * prefilterMaxLod).rgb;
+
+	return (1.0f - Fr) * albedo * irradianceFromSH(N) + prefiltered * (F0 * envBRDF.x + envBRDF.y);
+}
+
+//reflected light from one point light, l is frag to light
+vec3 PointLight(vec3 N, vec3 v, vec3 l, vec3 radiance, vec3 albedo, float roughness, float metalness)
+{
+	//D: microfacet roughness normal distribution, G: microfacet self shadowing, f: fresnel
+	float pi = 3.1415926;
+	vec3 H = normalize(l + v);
+	float D = DistributionGGX1(N, H, roughness);
+	float G = 1.0f / pow(max(dot(l, H), .001f), 2.0f);
+	float f = FresnelSchlick1(max(dot(H, N), 0.0f), metalness);
+
+	//specular and diffuse ratio values, total specular
+	vec3 kS = vec3(f);
+	vec3 kD = vec3(1.0f) - kS;
+	vec3 spec = (D * G * kS) / 4.0f;
+
+	float NdotL = max(dot(N, l), 0.0f);
+	return (kD * albedo / pi + spec) * radiance * NdotL;
+}
+
+//every point light plus the ambient term at a world space position, before tone mapping
+vec3 ShadeSurface(vec3 position, vec3 N, vec3 albedo, float roughness, float metalness, float occlusion)
+{
+	vec3 v = normalize(cameraPosition.xyz - position);
+	vec3 l, radiance, final = vec3(0.0f);
+
+#ifdef CLUSTERED_LIGHTS
+	uvec2 range = clusterRange(position);
+	for(uint i=0u; i<range.y; i++)
+	{
+		uint light = clusterLightIndex(range, i);
+		vec4 positionRadius = clusterLightPositionRadius(light);
+		l = normalize(positionRadius.xyz - position);
+		radiance = fader * clusterLightColor(light) * AttenuateWindowed(positionRadius.xyz, position, positionRadius.w);
+		final += PointLight(N, v, l, radiance, albedo, roughness, metalness);
+	}
+#else
+	for(int i=0; i<LIGHT_COUNT; i++)
+	{
+		l = normalize(pointLights[i].position - position);
+		radiance = fader * pointLights[i].diffuse * Attenuate(pointLights[i].position, position);
+		final += PointLight(N, v, l, radiance, albedo, roughness, metalness);
+	}
+#endif
+
+	if(useIBL)
+	{
+		//same F0 FresnelSchlick1 derives from the metalness texture
+		float F0 = pow((metalness - 1) / (metalness + 1), 2.0f);
+		final += occlusion * AmbientIBL(N, v, albedo, roughness, F0);
+	}
+	return final;
+}
+
+//reinhard and gamma correction
+vec3 ToneMap(vec3 color)
+{
+	vec3 mapped = color / (color + vec3(1.0)); //why is this the value for mapped?
+	return pow(mapped, vec3(1.0 / 2.2));
+}
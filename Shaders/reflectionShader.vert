@@ -5,13 +5,11 @@ layout (location = 1) in vec3 aNormal;
 out vec3 Normal;
 out vec3 Position;
 
-uniform mat4 model;
-uniform mat4 view;
-uniform mat4 projection;
+#include "uniform_blocks.glsl"
 
 void main()
 {
-    Normal = mat3(transpose(inverse(model))) * aNormal;
+    Normal = mat3(normalMatrix) * aNormal;
     Position = vec3(model * vec4(aPos, 1.0));
-    gl_Position = projection * view * model * vec4(aPos, 1.0);
+    gl_Position = viewProjection * vec4(Position, 1.0);
 }
\ No newline at end of file
@@ -0,0 +1,40 @@
+// blocks shared by every shader, see uniform_buffers.hpp. Stages that don't use a block leave it inactive
+#ifndef NR_POINT_LIGHTS
+#define NR_POINT_LIGHTS 4
+#endif
+
+layout (std140) uniform Camera
+{
+    mat4 view;
+    mat4 projection;
+    mat4 viewProjection;
+    vec4 cameraPosition;
+};
+
+layout (std140) uniform Object
+{
+    mat4 model;
+    mat4 normalMatrix;
+};
+
+// member order keeps std140 from padding. The PBR shader only uses the point lights, diffuse is their colour
+struct Light {
+    vec3 position;
+    float cutOff;
+    vec3 direction;
+    float outerCutOff;
+
+    vec3 ambient;
+    float constant;
+    vec3 diffuse;
+    float linear;
+    vec3 specular;
+    float quadratic;
+};
+
+layout (std140) uniform Lights
+{
+    Light dirLight;
+    Light pointLights[NR_POINT_LIGHTS];
+    Light spotLight;
+};
@@ -8,11 +8,20 @@
 #define GLM_ENABLE_EXPERIMENTAL
 //#include <D:\PA2_Starter\Vendor\gli-0.8.2.0\gli\gli\gli.hpp>
 
-bool useTex = true, waitForRelease = false, stop_rotating = false;
+bool useTex = true, useClusters = true, useDeferred = false, useInstancing = true, waitForRelease = false, stop_rotating = false;
 glm::vec3 lightPos(0.0f);
 float rot = 0.0f;
 float fader = 50.0f;
 
+// the frame's draws, submitted sorted by program, material and depth
+RenderQueue renderQueue;
+// every object of the level in a BVH, the render queue only gets the ones in view
+Scene scene;
+// point lights of the PBR shader, binned into view clusters every frame
+LightClusters lightClusters;
+// GPU time of the forward pass and of the deferred geometry and lighting passes, printed with P
+GpuTimer forwardTimer, geometryTimer, lightingTimer;
+
 GLuint texture_loadDDS(const char* path);
 /*typedef struct gliGenericImage {
 	GLsizei width;
@@ -29,6 +38,78 @@ float map_val(float i, float a, float b, float x, float y)
 	return percent_of_ab * (y - x) + x;
 }
 
+// features of the PBR shader variants, bit i compiles in pbrFeatureDefines[i] (see pbrShader.frag)
+enum PbrFeature {
+	PBR_TEXTURED = 1 << 0,
+	PBR_NORMAL_MAP = 1 << 1,
+	PBR_NORMAL_MAP_NO_BLUE = 1 << 2,
+	PBR_CLUSTERED = 1 << 3,
+	PBR_GBUFFER = 1 << 4,
+	PBR_INSTANCED = 1 << 5
+};
+const char *pbrFeatureDefines[] = { "MATERIAL_TEXTURED", "NORMAL_MAP", "NORMAL_MAP_NO_BLUE", "CLUSTERED_LIGHTS", "GBUFFER_OUTPUT", "INSTANCED" };
+
+// one compiled variant of the PBR shader. Everything set per frame or per draw goes through handles looked up once
+// here. Camera, lights and model matrices aren't plain uniforms, they go through the shared uniform blocks
+// (see uniform_buffers.hpp)
+struct PbrProgram
+{
+	Shader shader;
+	UniformHandle fader, materialLayer, irradianceSH, prefilterMaxLod, useIBL, albedoF, roughnessF, metalnessF, clusterParams;
+
+	PbrProgram(const Shader &compiled) : shader(compiled)
+	{
+		// texture units never change, so the samplers are only set once
+		shader.use();
+		shader.setInt("albedoArray", 1);
+		shader.setInt("normalArray", 2);
+		shader.setInt("ormArray", 3);
+		shader.setInt("prefilterMap", 5);
+		shader.setInt("brdfLUT", 6);
+		shader.setInt("clusterLights", 7);
+		shader.setInt("clusterGrid", 8);
+		shader.setInt("clusterIndices", 9);
+
+		fader = shader.uniform("fader");
+		materialLayer = shader.uniform("materialLayer");
+		irradianceSH = shader.uniform("irradianceSH");
+		prefilterMaxLod = shader.uniform("prefilterMaxLod");
+		useIBL = shader.uniform("useIBL");
+		albedoF = shader.uniform("albedoF");
+		roughnessF = shader.uniform("roughnessF");
+		metalnessF = shader.uniform("metalnessF");
+		clusterParams = shader.uniform("clusterParams");
+	}
+};
+
+// the lighting pass of the deferred path. Its variants use the PBR feature bits, only PBR_CLUSTERED and the light
+// count change anything
+struct DeferredProgram
+{
+	Shader shader;
+	UniformHandle fader, irradianceSH, prefilterMaxLod, useIBL, clusterParams, inverseViewProjection;
+
+	DeferredProgram(const Shader &compiled) : shader(compiled)
+	{
+		shader.use();
+		shader.setInt("prefilterMap", 5);
+		shader.setInt("brdfLUT", 6);
+		shader.setInt("clusterLights", 7);
+		shader.setInt("clusterGrid", 8);
+		shader.setInt("clusterIndices", 9);
+		shader.setInt("gAlbedoRoughness", 10);
+		shader.setInt("gNormalMetalness", 11);
+		shader.setInt("gDepth", 12);
+
+		fader = shader.uniform("fader");
+		irradianceSH = shader.uniform("irradianceSH");
+		prefilterMaxLod = shader.uniform("prefilterMaxLod");
+		useIBL = shader.uniform("useIBL");
+		clusterParams = shader.uniform("clusterParams");
+		inverseViewProjection = shader.uniform("inverseViewProjection");
+	}
+};
+
 vector<Model> load_scene(const char *folder)
 {
 	vector<Model> models;
@@ -79,15 +160,19 @@ int main()
 
 	// configure global opengl state
 	// -----------------------------
-	glEnable(GL_MULTISAMPLE); // Enabled by default on some drivers, but not all so always enable to make sure
-	glEnable(GL_DEPTH_TEST);
-	glEnable(GL_BLEND);
-	glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+	GlState::get().enable(GL_MULTISAMPLE); // Enabled by default on some drivers, but not all so always enable to make sure
+	GlState::get().enable(GL_DEPTH_TEST);
+	GlState::get().enable(GL_BLEND);
+	GlState::get().blendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
 
 	// build and compile shaders
 	// -------------------------
 	Shader skyboxShader("../Project_2/Shaders/skyboxShader.vert", "../Project_2/Shaders/skyboxShader.frag");
-	Shader pbrShader("../Project_2/Shaders/pbrShader.vert", "../Project_2/Shaders/pbrShader.frag");
+	// the PBR shader is compiled per feature set the first time a draw asks for it
+	ShaderVariants<PbrProgram> pbrVariants("../Project_2/Shaders/pbrShader.vert", "../Project_2/Shaders/pbrShader.frag",
+		std::vector<std::string>(pbrFeatureDefines, pbrFeatureDefines + 6));
+	ShaderVariants<DeferredProgram> deferredVariants("../Project_2/Shaders/deferredLighting.vert", "../Project_2/Shaders/deferredLighting.frag",
+		std::vector<std::string>(pbrFeatureDefines, pbrFeatureDefines + 6));
 
 	// set up vertex data (and buffer(s)) and configure vertex attributes
 	// ------------------------------------------------------------------
@@ -141,10 +226,10 @@ int main()
 	glGenVertexArrays(1, &cubeVAO);
 	glGenBuffers(1, &VBO);
 
-	glBindBuffer(GL_ARRAY_BUFFER, VBO);
+	GlState::get().bindBuffer(GL_ARRAY_BUFFER, VBO);
 	glBufferData(GL_ARRAY_BUFFER, sizeof(vertices), vertices, GL_STATIC_DRAW);
 
-	glBindVertexArray(cubeVAO);
+	GlState::get().bindVertexArray(cubeVAO);
 	glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 8 * sizeof(float), (void*)0);
 	glEnableVertexAttribArray(0);
 	glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, 8 * sizeof(float), (void*)(3 * sizeof(float)));
@@ -155,8 +240,8 @@ int main()
 	// second, configure the light's VAO (VBO stays the same; the vertices are the same for the light object which is also a 3D cube)
 	unsigned int lightVAO;
 	glGenVertexArrays(1, &lightVAO);
-	glBindVertexArray(lightVAO);
-	glBindBuffer(GL_ARRAY_BUFFER, VBO);
+	GlState::get().bindVertexArray(lightVAO);
+	GlState::get().bindBuffer(GL_ARRAY_BUFFER, VBO);
 	// note that we update the lamp's position attribute's stride to reflect the updated buffer data
 	glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 8 * sizeof(float), (void*)0);
 	glEnableVertexAttribArray(0);
@@ -166,6 +251,10 @@ int main()
 
 	// load textures
 	// -------------
+	// unreferenced textures are dropped least recently used first once these are exceeded
+	ResourceCache::get().setBudget(1024u * 1024u * 1024u);
+	// fine mip levels of streamed textures beyond this are dropped, least recently drawn and smallest on screen first
+	TextureStreamer::get().setBudget(384u * 1024u * 1024u);
 
 	std::vector<std::string> faces =
 	{
@@ -180,32 +269,60 @@ int main()
 
 	// load models
 	// -----------
-	Model sphere("../Project_2/Media/SphereModel/Sphere.obj");
+	Model sphere("../Project_2/Media/SphereModel/Sphere.obj", false, VERTEX_FORMAT_FULL, &Mesh::sharedArena());
 	//Model hall("../Project_2/Media/PT_assets/PTHallway2.obj");
 
 	//Model sphere("../Project_2/Media/cube_model/cube_model.fbx");
 	//load_scene("D:\BioshockClone\BlenderScene\NiceExport2");
-	Model hall("C:/Users/ncala/Downloads/Cerberus_by_Andrew_Maximov/Cerberus_LP.fbx");
+	Model hall("C:/Users/ncala/Downloads/Cerberus_by_Andrew_Maximov/Cerberus_LP.fbx", false, VERTEX_FORMAT_COMPACT);
 
 	//hdr map load
 	unsigned hdr_tex_id = load_environment_map("../Project_2/Media/textures/noon_grass_1k.hdr");
 
-	//pbr texture loading
-	unsigned int diffuse, roughness, metalness, normal;
-/*	diffuse = loadTexture("../Project_2/Media/textures/metalCol.jpg");
-	roughness = loadTexture("../Project_2/Media/textures/metalRoughness.jpg");
-	metalness = loadTexture("../Project_2/Media/textures/metalMetalness.jpg");
-	normal = loadTexture("../Project_2/Media/textures/metalNorm.jpg");*/
-
-	diffuse = loadTexture("C:/Users/ncala/Downloads/Cerberus_A.jpg");
-	roughness = loadTexture("C:/Users/ncala/Downloads/Cerberus_R.jpg");
-	metalness = loadTexture("C:/Users/ncala/Downloads/Cerberus_M.jpg");
-	normal = loadTexture("C:/Users/ncala/Downloads/Cerberus_N.jpg");
-
-	diffuse = loadTexture("C:/Users/ncala/Downloads/Cerberus_by_Andrew_Maximov/Textures/Cerberus_A.tga");
-	roughness = loadTexture("C:/Users/ncala/Downloads/Cerberus_by_Andrew_Maximov/Textures/Cerberus_R.tga");
-	metalness = loadTexture("C:/Users/ncala/Downloads/Cerberus_by_Andrew_Maximov/Textures/Cerberus_M.tga");
-	normal = loadTexture("C:/Users/ncala/Downloads/Cerberus_by_Andrew_Maximov/Textures/Cerberus_N.tga");
+	// ambient light from the same map, baked on the first run and read from <hdr>.iblcache after that
+	IblMaps ibl = IblBaker::load("../Project_2/Media/textures/noon_grass_1k.hdr");
+
+	//pbr material loading: roughness and metalness are packed into one ORM image and every material of the
+	//same size shares a set of texture arrays, so a draw only picks a layer
+	MaterialLibrary materials;
+	MaterialFiles cerberusFiles;
+/*	cerberusFiles.albedo = "../Project_2/Media/textures/metalCol.jpg";
+	cerberusFiles.roughness = "../Project_2/Media/textures/metalRoughness.jpg";
+	cerberusFiles.metalness = "../Project_2/Media/textures/metalMetalness.jpg";
+	cerberusFiles.normal = "../Project_2/Media/textures/metalNorm.jpg";*/
+
+	cerberusFiles.albedo = "C:/Users/ncala/Downloads/Cerberus_by_Andrew_Maximov/Textures/Cerberus_A.tga";
+	cerberusFiles.roughness = "C:/Users/ncala/Downloads/Cerberus_by_Andrew_Maximov/Textures/Cerberus_R.tga";
+	cerberusFiles.metalness = "C:/Users/ncala/Downloads/Cerberus_by_Andrew_Maximov/Textures/Cerberus_M.tga";
+	cerberusFiles.normal = "C:/Users/ncala/Downloads/Cerberus_by_Andrew_Maximov/Textures/Cerberus_N.tga";
+	unsigned int cerberusIndex = materials.add(cerberusFiles);
+	materials.build();
+
+	// point lights the PBR variants loop over
+	unsigned int pbrLightCount = UNIFORM_POINT_LIGHTS;
+
+	// the PBR shader lights with the point lights only, their diffuse colour is the radiance
+	LightsBlock lights = LightsBlock();
+	glm::vec3 pbrLightPositions[UNIFORM_POINT_LIGHTS] = {
+		lightPos,
+		glm::vec3(-5.000000, -2.400000, -27.600033),
+		glm::vec3(-14.799991, -3.200000, -27.800034),
+		glm::vec3(-5.200000, -2.200000, -19.200001)
+	};
+	for (int i = 0; i < UNIFORM_POINT_LIGHTS; i++)
+		lights.pointLights[i].diffuse = glm::vec3(0.5f, 0.5f, 0.5f);
+
+	// the clustered variants light with these instead: the same four, then a few hundred dim coloured ones
+	// scattered around the hall. Radii are where a light falls under 1% at the starting fader
+	for (int i = 0; i < UNIFORM_POINT_LIGHTS; i++)
+		lightClusters.lights.push_back(ClusterLight(pbrLightPositions[i], cluster_light_radius(lights.pointLights[i].diffuse, fader), lights.pointLights[i].diffuse));
+	srand(7);
+	for (int i = 0; i < 256; i++)
+	{
+		glm::vec3 position(map_val(rand() % 1000, 0, 1000, -25, 15), map_val(rand() % 1000, 0, 1000, -5, 3), map_val(rand() % 1000, 0, 1000, -35, 5));
+		glm::vec3 color = 0.02f * glm::vec3(rand() % 100, rand() % 100, rand() % 100) / 100.0f;
+		lightClusters.lights.push_back(ClusterLight(position, cluster_light_radius(color, fader), color));
+	}
 
 	int* bufsize, * nummips;
 	GLuint img = texture_loadDDS("D:/PT_Remake_Blender/textures/shsb_hous001_w1_nrm.dds");
@@ -222,40 +339,80 @@ int main()
 		glm::vec3(0.0f,  0.0f, -3.0f)
 	};
 
-	//frame buffer stuff --- going to leave this here for now. Might want to import objects better first.
-	/*unsigned int gBuffer;
-	glGenFramebuffers(1, &gBuffer);
-	glBindFramebuffer(GL_FRAMEBUFFER, gBuffer);
-	unsigned int gPosition, gDiffuse, gNormal;
-
-	// - position color buffer
-	glGenTextures(1, &gPosition);
-	glBindTexture(GL_TEXTURE_2D, gPosition);
-	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA16F, SCR_WIDTH, SCR_HEIGHT, 0, GL_RGBA, GL_FLOAT, NULL);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
-	glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT1, GL_TEXTURE_2D, gPosition, 0);
-	
-	// - diffuse color buffer (roughness in alpha channel)
-	glGenTextures(1, &gDiffuse);
-	glBindTexture(GL_TEXTURE_2D, gDiffuse);
-	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA16F, SCR_WIDTH, SCR_HEIGHT, 0, GL_RGBA, GL_FLOAT, NULL);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
-	glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT2, GL_TEXTURE_2D, gDiffuse, 0);
-	
-	// - normal color buffer (metalness in alpha channel)
-	glGenTextures(1, &gNormal);
-	glBindTexture(GL_TEXTURE_2D, gNormal);
-	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA16F, SCR_WIDTH, SCR_HEIGHT, 0, GL_RGBA, GL_FLOAT, NULL);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
-	glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT3, GL_TEXTURE_2D, gNormal, 0);
+	// deferred path: the render queue fills the G-buffer, then one screen sized pass lights it. The G-buffer
+	// follows the window size, it's created the first time it's used
+	GBuffer gbuffer;
+	GLuint fullscreenVAO;	// the lighting pass has no vertices, but core profile draws need a vertex array bound
+	glGenVertexArrays(1, &fullscreenVAO);
+
+
+	// the light's sphere follows lightPos, it's moved every frame. The sphere model is also drawn as props, the
+	// light's one brings its own level of detail state and is never instanced. The scene keeps the state of the others
+	LodState lightSphereLod;
+	RenderItem object;
+	object.material = cerberusIndex;
+	object.model = &sphere;
+	object.lod = &lightSphereLod;
+	unsigned int lightSphereId = scene.add(object);
+	object.lod = nullptr;
+	for (unsigned int i = 0; i < 25; i++)
+	{
+		// calculate the model matrix for each object, a 5 x 5 grid in front of the origin
+		glm::mat4 box_model;
+
+		box_model = glm::translate(box_model, glm::vec3(((int)(i % 5) - 2) * 2.5f, ((int)(i / 5) - 2) * 2.5f, -5.0f));
+		box_model = glm::scale(box_model, glm::vec3(.01f, .01f, .01f));
+		//box_model = glm::rotate(box_model, rot, glm::vec3(0.0f, 1.0f, 0.0f));
+		box_model = glm::rotate(box_model, glm::radians(-90.0f), glm::vec3(1.0f, 0.0f, 0.0f));
 
-	// - tell OpenGL which color attachments we'll use (of this framebuffer) for rendering 
-	unsigned int attachments[4] = { GL_COLOR_ATTACHMENT0, GL_COLOR_ATTACHMENT1, GL_COLOR_ATTACHMENT2, GL_COLOR_ATTACHMENT3 };
-	glDrawBuffers(4, attachments);*/
+		// roughness and metalness of the constant material
+		object.parameters = glm::vec4(map_val(i, 0, 25, 0, 1), map_val(i, 0, 25, 0, 1), 0.0f, 0.0f);
 
+		object.model = &hall;
+		object.transform = box_model;
+		scene.add(object);
+
+		object.model = &sphere;
+		scene.add(object);
+	}
+	// a field of small spheres below the grid, thousands of copies of one model that go down as a few instanced draws
+	for (int x = 0; x < 64; x++)
+		for (int z = 0; z < 64; z++)
+		{
+			object.transform = glm::scale(glm::translate(glm::mat4(1.0f), glm::vec3((x - 32) * 0.5f, -3.0f, (z - 32) * 0.5f)), glm::vec3(.1f));
+			object.parameters = glm::vec4(map_val((float)x, 0, 63, 0, 1), map_val((float)z, 0, 63, 0, 1), 0.0f, 0.0f);
+			scene.add(object);
+		}
+	std::vector<uint32_t> visibleObjects;
+	std::vector<InstanceData> instanceData;
+
+	// how the render queue sets up the PBR variants. Program ids are ShaderVariants ids, material ids are
+	// MaterialLibrary indices. Per frame values are set on every program bind, the shadowed uniforms drop the
+	// ones a program already has
+	RenderQueueBindings pbrBindings;
+	pbrBindings.bindProgram = [&](unsigned int program) -> Shader & {
+		PbrProgram &pbr = pbrVariants.byId(program);
+		pbr.shader.use();
+		pbr.shader.setFloat(pbr.fader, fader);
+		pbr.shader.setVec3(pbr.albedoF, glm::vec3(0.8f));
+		pbr.shader.setVec3Array(pbr.irradianceSH, &ibl.sh[0][0], 9);
+		pbr.shader.setFloat(pbr.prefilterMaxLod, ibl.specularMaxLod);
+		pbr.shader.setBool(pbr.useIBL, ibl.valid());
+		pbr.shader.setVec4(pbr.clusterParams, lightClusters.shaderParams((float)SCR_WIDTH, (float)SCR_HEIGHT));
+		return pbr.shader;
+	};
+	pbrBindings.bindMaterial = [&](unsigned int program, unsigned int material) {
+		// albedo, normal and ORM arrays on units 1 to 3, every material in them is one layer
+		PbrProgram &pbr = pbrVariants.byId(program);
+		MaterialRef ref = materials.material(material);
+		materials.bind(ref.group, 1);
+		pbr.shader.setInt(pbr.materialLayer, ref.layer);
+	};
+	pbrBindings.setItem = [&](unsigned int program, const RenderItem &item) {
+		PbrProgram &pbr = pbrVariants.byId(program);
+		pbr.shader.setFloat(pbr.roughnessF, item.parameters.x);
+		pbr.shader.setFloat(pbr.metalnessF, item.parameters.y);
+	};
 
 	// render loop
 	// -----------
@@ -274,6 +431,9 @@ int main()
 		// -----
 		processInput(window);
 
+		// upload whatever textures finished decoding since last frame
+		TextureStreamer::get().update();
+
 		// render
 		// ------
 		glClearColor(0.1f, 0.1f, 0.1f, 1.0f);
@@ -285,96 +445,143 @@ int main()
 		glm::mat4 projection = glm::perspective(glm::radians(camera.Zoom), (float)SCR_WIDTH / (float)SCR_HEIGHT, 0.1f, 100.0f);
 		model = glm::rotate(model, glm::radians(10.0f*currentFrame), glm::vec3(1.0f, 0.3f, 0.5f));
 
+		// camera and lights for every shader, written once per frame
+		UniformBuffers::get().setCamera(view, projection, camera.Position);
+		pbrLightPositions[0] = lightPos;
+		for (int i = 0; i < UNIFORM_POINT_LIGHTS; i++)
+			lights.pointLights[i].position = pbrLightPositions[i];
+		UniformBuffers::get().setLights(lights);
+		lightClusters.lights[0].position = lightPos;
+		if (useClusters)
+		{
+			lightClusters.update(view, projection);
+			lightClusters.bind(7);
+		}
+
 		//MY PBR SHADER SETUP
-		pbrShader.use();
-		pbrShader.setMat4("model", model);
-		pbrShader.setMat4("view", view);
-		pbrShader.setMat4("projection", projection);
-		pbrShader.setVec3("cameraPos", camera.Position);
-
-		pbrShader.setBool("useTex", useTex);
-		pbrShader.setVec3("lights[0].position", lightPos);
-		pbrShader.setVec3("lights[0].color", glm::vec3(0.5f, 0.5f, 0.5f));
-		pbrShader.setVec3("camPos", camera.Position);
-		pbrShader.setFloat("fader", fader);
-
-		pbrShader.setVec3("lights[1].position", glm::vec3(-5.000000, -2.400000, -27.600033));
-		pbrShader.setVec3("lights[1].color", glm::vec3(0.5f, 0.5f, 0.5f));
-		pbrShader.setVec3("lights[2].position", glm::vec3(-14.799991, -3.200000, -27.800034));
-		pbrShader.setVec3("lights[2].color", glm::vec3(0.5f, 0.5f, 0.5f));
-		pbrShader.setVec3("lights[3].position", glm::vec3(-5.200000, -2.200000, -19.200001));
-		pbrShader.setVec3("lights[3].color", glm::vec3(0.5f, 0.5f, 0.5f));
-
-
-		/**/glActiveTexture(GL_TEXTURE1);
-		glBindTexture(GL_TEXTURE_2D, diffuse);
-		glUniform1i(glGetUniformLocation(pbrShader.ID, "diffuseTex"), 1);
-
-		glActiveTexture(GL_TEXTURE2);
-		glBindTexture(GL_TEXTURE_2D, roughness);
-		glUniform1i(glGetUniformLocation(pbrShader.ID, "roughnessTex"), 2);
-
-		glActiveTexture(GL_TEXTURE3);
-		glBindTexture(GL_TEXTURE_2D, metalness);
-		glUniform1i(glGetUniformLocation(pbrShader.ID, "metalnessTex"), 3);
-
-		glActiveTexture(GL_TEXTURE4);
-		glBindTexture(GL_TEXTURE_2D, normal);
-		glUniform1i(glGetUniformLocation(pbrShader.ID, "normalTex"), 4);/**/
+		// the material toggle picks a variant instead of branching per fragment: the textured material with its
+		// normal map, or constant albedo with the roughness and metalness sweep below
+		uint32_t pbrFeatures = useTex ? PBR_TEXTURED | PBR_NORMAL_MAP : 0;
+		if (useClusters)
+			pbrFeatures |= PBR_CLUSTERED;
+		// the deferred path draws the same items with G-buffer variants. Those don't light, so the light features
+		// stay out of their key and both light paths share them
+		bool deferred = useDeferred && gbuffer.resize(SCR_WIDTH, SCR_HEIGHT);
+		uint32_t programFeatures = deferred ? (pbrFeatures & ~PBR_CLUSTERED) | PBR_GBUFFER : pbrFeatures;
+		unsigned int programLights = deferred ? 0 : pbrLightCount;
+		// materials whose normal maps were cooked without blue need the variant that rebuilds z
+		auto programFor = [&](unsigned int material, uint32_t extra) {
+			uint32_t features = programFeatures | extra;
+			if ((features & PBR_NORMAL_MAP) && materials.normalsWithoutBlue(material))
+				features |= PBR_NORMAL_MAP_NO_BLUE;
+			return pbrVariants.id(features, programLights);
+		};
 
 		model = glm::mat4(1.0f);
 		
 		model = glm::translate(model, lightPos);
 		model = glm::scale(model, glm::vec3(.1f));
-
-		pbrShader.setMat4("model", model);
-		sphere.Draw(pbrShader);
-
-		for (unsigned int i = 0; i < 1; i++)
+		scene.setTransform(lightSphereId, model);
+
+		if(!stop_rotating)
+			rot += .00005;
+
+		// only what the BVH finds in the frustum reaches the render queue, which then doesn't cull again. Objects
+		// without their own level of detail state that share a model and material are drawn as one instanced item
+		scene.update();
+		visibleObjects.clear();
+		scene.queryFrustum(Frustum(projection * view), visibleObjects);
+		renderQueue.begin(view, true);
+		size_t instanceable = 0;
+		for (size_t i = 0; i < visibleObjects.size(); i++)
 		{
-			// calculate the model matrix for each object and pass it to shader before drawing
-			glm::mat4 box_model;
-
-			box_model = glm::scale(box_model, glm::vec3(.01f, .01f, .01f));
-			
-			box_model = glm::translate(box_model, glm::vec3((float)((int)i % (int)5) + 2  * (i%5) , (float)(i / 5) + 2 * (i/5), -5.0f));
-			box_model = glm::translate(box_model, glm::vec3(-5, -5, 0));
-			//box_model = glm::rotate(box_model, rot, glm::vec3(0.0f, 1.0f, 0.0f));
-			box_model = glm::rotate(box_model, glm::radians(-90.0f), glm::vec3(1.0f, 0.0f, 0.0f));
-
-			pbrShader.setFloat("roughnessF", map_val(i, 0, 25, 0, 1));
-			pbrShader.setFloat("metalnessF", map_val(i, 0, 25, 0, 1));
-
-			if(!stop_rotating)
-				rot += .00005;
-
-			pbrShader.setMat4("model", box_model);
-			hall.Draw(pbrShader);
-
-			box_model = glm::scale(box_model, glm::vec3(1, 1, 1));
-			pbrShader.setMat4("model", box_model);
-			sphere.Draw(pbrShader);
+			RenderItem &item = scene.item(visibleObjects[i]);
+			// the material arrays are streamed, the largest object drawn with a material decides how sharp it gets
+			materials.noteUsage(item.material, item.model->screenSize(item.transform, view, projection, (float)SCR_HEIGHT));
+			if (useInstancing && !item.lod)
+				visibleObjects[instanceable++] = visibleObjects[i];
+			else
+			{
+				item.program = programFor(item.material, 0);
+				RenderItem single = item;
+				single.lod = &scene.lodState(visibleObjects[i]);
+				renderQueue.submit(single);
+			}
+		}
+		visibleObjects.resize(instanceable);
+		std::sort(visibleObjects.begin(), visibleObjects.end(), [&](uint32_t a, uint32_t b) {
+			const RenderItem &first = scene.item(a), &second = scene.item(b);
+			if (first.model != second.model)
+				return std::less<Model*>()(first.model, second.model);
+			return first.material < second.material;
+		});
+		for (size_t i = 0; i < visibleObjects.size();)
+		{
+			RenderItem item = scene.item(visibleObjects[i]);
+			instanceData.clear();
+			for (; i < visibleObjects.size() && scene.item(visibleObjects[i]).model == item.model && scene.item(visibleObjects[i]).material == item.material; i++)
+			{
+				InstanceData data;
+				data.transform = scene.item(visibleObjects[i]).transform;
+				data.parameters = scene.item(visibleObjects[i]).parameters;
+				instanceData.push_back(data);
+			}
+			item.program = programFor(item.material, PBR_INSTANCED);
+			renderQueue.submitInstanced(item, instanceData.data(), instanceData.size());
+		}
 
+		// image based lighting maps are the same for every PBR variant
+		GlState::get().bindTextureUnit(5, GL_TEXTURE_CUBE_MAP, ibl.specularCube);
+		GlState::get().bindTextureUnit(6, GL_TEXTURE_2D, ibl.brdfLut);
+		if (deferred)
+		{
+			geometryTimer.begin();
+			gbuffer.bindForGeometry();
+			renderQueue.flush(projection, (float)SCR_HEIGHT, pbrBindings);
+			geometryTimer.end();
+			gbuffer.endGeometry();
+
+			// every covered pixel is shaded once, whatever the overdraw of the geometry pass. It also writes the
+			// scene's depth, so it runs with the depth test passing everywhere
+			lightingTimer.begin();
+			DeferredProgram &lighting = deferredVariants.get(pbrFeatures & PBR_CLUSTERED, pbrLightCount);
+			lighting.shader.use();
+			lighting.shader.setFloat(lighting.fader, fader);
+			lighting.shader.setVec3Array(lighting.irradianceSH, &ibl.sh[0][0], 9);
+			lighting.shader.setFloat(lighting.prefilterMaxLod, ibl.specularMaxLod);
+			lighting.shader.setBool(lighting.useIBL, ibl.valid());
+			lighting.shader.setVec4(lighting.clusterParams, lightClusters.shaderParams((float)SCR_WIDTH, (float)SCR_HEIGHT));
+			lighting.shader.setMat4(lighting.inverseViewProjection, glm::inverse(projection * view));
+			gbuffer.bind(10);
+			GlState::get().depthFunc(GL_ALWAYS);
+			GlState::get().bindVertexArray(fullscreenVAO);
+			glDrawArrays(GL_TRIANGLES, 0, 3);
+			GlState::get().depthFunc(GL_LESS);
+			lightingTimer.end();
+		}
+		else
+		{
+			forwardTimer.begin();
+			renderQueue.flush(projection, (float)SCR_HEIGHT, pbrBindings);
+			forwardTimer.end();
 		}
-		glBindVertexArray(0);
 
 		
 
 
 		// draw skybox as last
-		glDepthFunc(GL_LEQUAL);  // change depth function so depth test passes when values are equal to depth buffer's content
-		skyboxShader.use();
-		view = glm::mat4(glm::mat3(camera.GetViewMatrix())); // remove translation from the view matrix
-		skyboxShader.setMat4("view", view);
-		skyboxShader.setMat4("projection", projection);
+		GlState::get().depthFunc(GL_LEQUAL);  // change depth function so depth test passes when values are equal to depth buffer's content
+		skyboxShader.use();	// the shader drops the translation from the camera block's view matrix
 		// skybox cube
-		glBindVertexArray(skyboxVAO);
-		glActiveTexture(GL_TEXTURE0);
-		glBindTexture(GL_TEXTURE_CUBE_MAP, cubemapTexture);
+		GlState::get().bindVertexArray(skyboxVAO);
+		GlState::get().bindTextureUnit(0, GL_TEXTURE_CUBE_MAP, cubemapTexture);
 		glDrawArrays(GL_TRIANGLES, 0, 36);
-		glBindVertexArray(0);
 		
-		glDepthFunc(GL_LESS); // set depth function back to default
+		GlState::get().depthFunc(GL_LESS); // set depth function back to default
+
+		// redundant binds filtered and objects culled this frame, printed with P
+		GlState::get().endFrame();
+		CullStats::get().endFrame();
 
 							  // glfw: swap buffers and poll IO events (keys pressed/released, mouse moved etc.)
 							  // -------------------------------------------------------------------------------
@@ -385,10 +592,11 @@ int main()
 
 	// optional: de-allocate all resources once they've outlived their purpose:
 	// ------------------------------------------------------------------------
-	glDeleteVertexArrays(1, &cubeVAO);
-	glDeleteVertexArrays(1, &skyboxVAO);
-	glDeleteBuffers(1, &VBO);
-	glDeleteBuffers(1, &skyboxVAO);
+	GlState::get().deleteVertexArrays(1, &cubeVAO);
+	GlState::get().deleteVertexArrays(1, &skyboxVAO);
+	GlState::get().deleteVertexArrays(1, &fullscreenVAO);
+	GlState::get().deleteBuffers(1, &VBO);
+	GlState::get().deleteBuffers(1, &skyboxVAO);
 
 	glfwTerminate();
 	return 0;
@@ -432,6 +640,9 @@ void processInput(GLFWwindow *window)
 		glfwGetKey(window, GLFW_KEY_G) == GLFW_PRESS ||
 		glfwGetKey(window, GLFW_KEY_P) == GLFW_PRESS ||
 		glfwGetKey(window, GLFW_KEY_E) == GLFW_PRESS ||
+		glfwGetKey(window, GLFW_KEY_M) == GLFW_PRESS ||
+		glfwGetKey(window, GLFW_KEY_F) == GLFW_PRESS ||
+		glfwGetKey(window, GLFW_KEY_T) == GLFW_PRESS ||
 		glfwGetKey(window, GLFW_KEY_N) == GLFW_PRESS;
 	if (somethingPressed && last_pressed < currentFrame - 0.5f || last_pressed == 0.0f)
 	{
@@ -441,6 +652,25 @@ void processInput(GLFWwindow *window)
 			drawBoxes ? drawBoxes = false : drawBoxes = true;
 		if (glfwGetKey(window, GLFW_KEY_N) == GLFW_PRESS)
 			drawNormals ? drawNormals = false : drawNormals = true;
+		// clustered lights or the four from the Lights block
+		if (glfwGetKey(window, GLFW_KEY_M) == GLFW_PRESS)
+		{
+			useClusters = !useClusters;
+			std::printf(useClusters ? "Clustered lighting, %u lights\n" : "Fixed %u light loop\n",
+				useClusters ? (unsigned int)lightClusters.lights.size() : (unsigned int)UNIFORM_POINT_LIGHTS);
+		}
+		// forward or deferred shading of the PBR objects
+		if (glfwGetKey(window, GLFW_KEY_F) == GLFW_PRESS)
+		{
+			useDeferred = !useDeferred;
+			std::printf(useDeferred ? "Deferred shading\n" : "Forward shading\n");
+		}
+		// repeated objects as instanced draws or one draw each
+		if (glfwGetKey(window, GLFW_KEY_T) == GLFW_PRESS)
+		{
+			useInstancing = !useInstancing;
+			std::printf(useInstancing ? "Instanced drawing\n" : "One draw per object\n");
+		}
 		if (glfwGetKey(window, GLFW_KEY_Q) == GLFW_PRESS)
 			if (quaterians)
 			{
@@ -479,6 +709,21 @@ void processInput(GLFWwindow *window)
 		if (glfwGetKey(window, GLFW_KEY_P) == GLFW_PRESS)
 		{
 			std::printf("Current light pos: (%f, %f, %f)\n", lightPos.x, lightPos.y, lightPos.z);
+			ResourceCache::get().printStats();
+			UniformBuffers::get().printStats();
+			GlState::get().printStats();
+			renderQueue.printStats();
+			Mesh::sharedArena().printStats();
+			scene.printStats();
+			CullStats::get().printStats();
+			lightClusters.printStats();
+			if (useDeferred)
+			{
+				geometryTimer.print("deferred geometry pass");
+				lightingTimer.print("deferred lighting pass");
+			}
+			else
+				forwardTimer.print("forward pass");
 
 			
 		}
@@ -510,7 +755,7 @@ void processInput(GLFWwindow *window)
 	if (glfwGetKey(window, GLFW_KEY_C) == GLFW_PRESS)
 		fader += .1;
 
-	//doing roughness change in shader
+	//switches the PBR shader between the textured and the constant material variant
 	if (glfwGetKey(window, GLFW_KEY_E) == GLFW_PRESS)
 		waitForRelease = true;
 
@@ -569,50 +814,22 @@ void scroll_callback(GLFWwindow* window, double xoffset, double yoffset)
 	camera.ProcessMouseScroll(yoffset);
 }
 
-// utility function for loading a 2D texture from file
-// ---------------------------------------------------
-unsigned int loadTexture(char const * path)
+unsigned load_environment_map(const char *path)
 {
-	unsigned int textureID;
-	glGenTextures(1, &textureID);
+	unsigned hdr_texture_id = ResourceCache::get().acquire(path, RESOURCE_ENVIRONMENT_MAP, GL_TEXTURE_2D, [&](size_t &gpuBytes) {
+		return load_environment_map_uncached(path, gpuBytes);
+	}).pin();
 
-	int width, height, nrComponents;
-	unsigned char *data = stbi_load(path, &width, &height, &nrComponents, 0);
-	if (data)
-	{
-		GLenum format;
-		if (nrComponents == 1)
-			format = GL_RED;
-		else if (nrComponents == 3)
-			format = GL_RGB;
-		else if (nrComponents == 4)
-			format = GL_RGBA;
-
-		glBindTexture(GL_TEXTURE_2D, textureID);
-		glTexImage2D(GL_TEXTURE_2D, 0, format, width, height, 0, format, GL_UNSIGNED_BYTE, data);
-		glGenerateMipmap(GL_TEXTURE_2D);
-
-		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
-		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
-		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
-		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-
-		stbi_image_free(data);
-	}
-	else
-	{
-		std::cout << "Texture fai4led to load at path: " << path << std::endl;
-		stbi_image_free(data);
-	}
+	// this used to turn stb's flip flag on for good, keep textures loaded after it flipped like before
+	TextureStreamer::get().setFlipVertically(true);
 
-	return textureID;
+	return hdr_texture_id;
 }
 
-unsigned load_environment_map(const char *path)
+unsigned load_environment_map_uncached(const char *path, size_t &gpuBytes)
 {
-	stbi_set_flip_vertically_on_load(true);
 	int width, height, nr_components;
-	unsigned hdr_texture_id;
+	unsigned hdr_texture_id = 0;
 
 	//load the hdri map
 	float* hdri_raw = stbi_loadf(path, &width, &height, &nr_components, 0);
@@ -620,8 +837,19 @@ unsigned load_environment_map(const char *path)
 	//if loading didn't fail, create a texture for it
 	if (hdri_raw)
 	{
+		// flip by hand, stb's flip flag is global and the texture streamer is decoding on other threads
+		std::vector<float> row(width * nr_components);
+		for (int y = 0; y < height / 2; y++)
+		{
+			float *top = hdri_raw + y * width * nr_components;
+			float *bottom = hdri_raw + (height - 1 - y) * width * nr_components;
+			memcpy(&row[0], top, row.size() * sizeof(float));
+			memcpy(top, bottom, row.size() * sizeof(float));
+			memcpy(bottom, &row[0], row.size() * sizeof(float));
+		}
+
 		glGenTextures(1, &hdr_texture_id);
-		glBindTexture(GL_TEXTURE_2D, hdr_texture_id);
+		GlState::get().bindTexture(GL_TEXTURE_2D, hdr_texture_id);
 		glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB16F, width, height, 0, GL_RGB, GL_FLOAT, hdri_raw);
 
 		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
@@ -631,6 +859,7 @@ unsigned load_environment_map(const char *path)
 
 		//be a good citizen
 		stbi_image_free(hdri_raw);
+		gpuBytes = (size_t)width * height * 3 * 2;
 	}
 	else
 	{
@@ -651,10 +880,22 @@ unsigned load_environment_map(const char *path)
 // -Z (back)
 // -------------------------------------------------------
 unsigned int loadCubemap(std::vector<std::string> faces)
+{
+	// the cache key is all six faces
+	std::string key;
+	for (unsigned int i = 0; i < faces.size(); i++)
+		key += ResourceCache::normalizePath(faces[i]) + "|";
+
+	return ResourceCache::get().acquire(key, RESOURCE_CUBEMAP, GL_TEXTURE_CUBE_MAP, [&](size_t &gpuBytes) {
+		return loadCubemapUncached(faces, gpuBytes);
+	}).pin();
+}
+
+unsigned int loadCubemapUncached(const std::vector<std::string> &faces, size_t &gpuBytes)
 {
 	unsigned int textureID;
 	glGenTextures(1, &textureID);
-	glBindTexture(GL_TEXTURE_CUBE_MAP, textureID);
+	GlState::get().bindTexture(GL_TEXTURE_CUBE_MAP, textureID);
 
 	int width, height, nrComponents;
 	for (unsigned int i = 0; i < faces.size(); i++)
@@ -663,6 +904,7 @@ unsigned int loadCubemap(std::vector<std::string> faces)
 		if (data)
 		{
 			glTexImage2D(GL_TEXTURE_CUBE_MAP_POSITIVE_X + i, 0, GL_RGB, width, height, 0, GL_RGB, GL_UNSIGNED_BYTE, data);
+			gpuBytes += (size_t)width * height * 3;
 			stbi_image_free(data);
 		}
 		else
@@ -680,67 +922,40 @@ unsigned int loadCubemap(std::vector<std::string> faces)
 	return textureID;
 }
 
-void set_lighting(Shader shader, glm::vec3 * pointLightPositions)
+// fills the lights of the phong lighting shaders, the caller uploads them with UniformBuffers::setLights().
+// the viewer position comes from the camera block
+void set_lighting(LightsBlock &lights, glm::vec3 * pointLightPositions)
 {
-	shader.use();
-	shader.setVec3("viewPos", camera.Position);
-
-	/*
-	Here we set all the uniforms for the 5/6 types of lights we have. We have to set them manually and index
-	the proper PointLight struct in the array to set each uniform variable. This can be done more code-friendly
-	by defining light types as classes and set their values in there, or by using a more efficient uniform approach
-	by using 'Uniform buffer objects', but that is something we'll discuss in the 'Advanced GLSL' tutorial.
-	*/
+	lights = LightsBlock();
+
 	// directional light
-	//shader.setVec3("dirLight.direction", -0.2f, -1.0f, -0.3f);
-	shader.setVec3("dirLight.direction", 0.24f, -.3f, 0.91f); // Tried to target the sun
-	shader.setVec3("dirLight.ambient", 0.05f, 0.05f, 0.05f);
-	shader.setVec3("dirLight.diffuse", 0.5f, 0.5f, 0.5f);
-	shader.setVec3("dirLight.specular", 0.5f, 0.5f, 0.5f);
-	// point light 1
-	shader.setVec3("pointLights[0].position", pointLightPositions[0]);
-	shader.setVec3("pointLights[0].ambient", 0.05f, 0.05f, 0.05f);
-	shader.setVec3("pointLights[0].diffuse", 0.8f, 0.8f, 0.8f);
-	shader.setVec3("pointLights[0].specular", 1.0f, 1.0f, 1.0f);
-	shader.setFloat("pointLights[0].constant", 1.0f);
-	shader.setFloat("pointLights[0].linear", 0.09);
-	shader.setFloat("pointLights[0].quadratic", 0.032);
-	// point light 2
-	shader.setVec3("pointLights[1].position", pointLightPositions[1]);
-	shader.setVec3("pointLights[1].ambient", 0.05f, 0.05f, 0.05f);
-	shader.setVec3("pointLights[1].diffuse", 0.8f, 0.8f, 0.8f);
-	shader.setVec3("pointLights[1].specular", 1.0f, 1.0f, 1.0f);
-	shader.setFloat("pointLights[1].constant", 1.0f);
-	shader.setFloat("pointLights[1].linear", 0.09);
-	shader.setFloat("pointLights[1].quadratic", 0.032);
-	// point light 3
-	shader.setVec3("pointLights[2].position", pointLightPositions[2]);
-	shader.setVec3("pointLights[2].ambient", 0.05f, 0.05f, 0.05f);
-	shader.setVec3("pointLights[2].diffuse", 0.8f, 0.8f, 0.8f);
-	shader.setVec3("pointLights[2].specular", 1.0f, 1.0f, 1.0f);
-	shader.setFloat("pointLights[2].constant", 1.0f);
-	shader.setFloat("pointLights[2].linear", 0.09);
-	shader.setFloat("pointLights[2].quadratic", 0.032);
-	// point light 4
-	shader.setVec3("pointLights[3].position", pointLightPositions[3]);
-	shader.setVec3("pointLights[3].ambient", 0.05f, 0.05f, 0.05f);
-	shader.setVec3("pointLights[3].diffuse", 0.8f, 0.8f, 0.8f);
-	shader.setVec3("pointLights[3].specular", 1.0f, 1.0f, 1.0f);
-	shader.setFloat("pointLights[3].constant", 1.0f);
-	shader.setFloat("pointLights[3].linear", 0.09);
-	shader.setFloat("pointLights[3].quadratic", 0.032);
+	//lights.dirLight.direction = glm::vec3(-0.2f, -1.0f, -0.3f);
+	lights.dirLight.direction = glm::vec3(0.24f, -.3f, 0.91f); // Tried to target the sun
+	lights.dirLight.ambient = glm::vec3(0.05f, 0.05f, 0.05f);
+	lights.dirLight.diffuse = glm::vec3(0.5f, 0.5f, 0.5f);
+	lights.dirLight.specular = glm::vec3(0.5f, 0.5f, 0.5f);
+	// point lights
+	for (int i = 0; i < UNIFORM_POINT_LIGHTS; i++)
+	{
+		lights.pointLights[i].position = pointLightPositions[i];
+		lights.pointLights[i].ambient = glm::vec3(0.05f, 0.05f, 0.05f);
+		lights.pointLights[i].diffuse = glm::vec3(0.8f, 0.8f, 0.8f);
+		lights.pointLights[i].specular = glm::vec3(1.0f, 1.0f, 1.0f);
+		lights.pointLights[i].constant = 1.0f;
+		lights.pointLights[i].linear = 0.09f;
+		lights.pointLights[i].quadratic = 0.032f;
+	}
 	// spotLight
-	shader.setVec3("spotLight.position", camera.Position);
-	shader.setVec3("spotLight.direction", camera.Front);
-	shader.setVec3("spotLight.ambient", 0.0f, 0.0f, 0.0f);
-	shader.setVec3("spotLight.diffuse", 1.0f, 1.0f, 1.0f);
-	shader.setVec3("spotLight.specular", 1.0f, 1.0f, 1.0f);
-	shader.setFloat("spotLight.constant", 1.0f);
-	shader.setFloat("spotLight.linear", 0.09);
-	shader.setFloat("spotLight.quadratic", 0.032);
-	shader.setFloat("spotLight.cutOff", glm::cos(glm::radians(12.5f)));
-	shader.setFloat("spotLight.outerCutOff", glm::cos(glm::radians(15.0f)));
-
+	lights.spotLight.position = camera.Position;
+	lights.spotLight.direction = camera.Front;
+	lights.spotLight.ambient = glm::vec3(0.0f, 0.0f, 0.0f);
+	lights.spotLight.diffuse = glm::vec3(1.0f, 1.0f, 1.0f);
+	lights.spotLight.specular = glm::vec3(1.0f, 1.0f, 1.0f);
+	lights.spotLight.constant = 1.0f;
+	lights.spotLight.linear = 0.09f;
+	lights.spotLight.quadratic = 0.032f;
+	lights.spotLight.cutOff = glm::cos(glm::radians(12.5f));
+	lights.spotLight.outerCutOff = glm::cos(glm::radians(15.0f));
 }
 
 /*
@@ -0,0 +1,274 @@
+// Offline texture cooker: converts source images into block compressed DDS files with a full mip chain,
+// written next to the source as "<source>.dds". The engine's loaders pick those up instead of decoding
+// the source whenever they're at least as new and were cooked for the kind of map the slot holds (see
+// cooked_texture_path in compressed_texture.hpp).
+//
+// usage: texture_cooker [options] images...
+//   --format auto|bc1|bc3|bc4|bc5|bc7   block format, auto picks from the image (default)
+//   --normal                            treat the images as normal maps (BC5, renormalized mips)
+//   --linear                            data textures, mips are averaged without sRGB conversion
+//   --filter kaiser|box                 mip downsampling filter (default kaiser)
+//   --srgb-format                       tag colour textures as sRGB so the GPU decodes them
+//   --flip                              flip vertically, for textures loaded after stbi flipping was turned on
+//   --force                             cook even if the output is up to date
+//   -j N                                worker threads (default: all cores)
+//
+// An output is up to date when it's newer than its source and was cooked with the same options by the same
+// version of the cooker (both are stored in its header, see cooked_texture.hpp).
+
+#define STB_IMAGE_IMPLEMENTATION
+#include <stb_image.h>
+
+#include <bc_encoder.hpp>
+#include <cooked_texture.hpp>
+#include <file_utils.hpp>
+#include <mipmap.hpp>
+#include <thread_pool.hpp>
+
+#include <algorithm>
+#include <cctype>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+static const char *formatOptions[] = { "auto", "bc1", "bc3", "bc4", "bc5", "bc7" };
+
+struct CookOptions {
+	std::string format;
+	MipFilter filter;
+	bool normal;
+	bool linear;
+	bool srgbFormat;
+	bool flip;
+	bool force;
+	unsigned int threads;
+
+	CookOptions() : format("auto"), filter(MIP_FILTER_KAISER), normal(false), linear(false), srgbFormat(false), flip(false), force(false), threads(0) {}
+
+	// what goes into the cooked header, everything that changes the output
+	uint32_t settings() const
+	{
+		uint32_t formatIndex = (uint32_t)(std::find(formatOptions, formatOptions + 6, format) - formatOptions);
+		return cooked_texture_settings(formatIndex, filter, normal, linear, srgbFormat, flip);
+	}
+};
+
+static std::string lowercase(std::string s)
+{
+	for (size_t i = 0; i < s.size(); i++)
+		s[i] = (char)tolower((unsigned char)s[i]);
+	return s;
+}
+
+// normal maps are usually named like Cerberus_N.tga or brick_normal.png
+static bool looks_like_normal_map(const std::string &path)
+{
+	std::string name = lowercase(path.substr(path.find_last_of("/\\") + 1));
+	name = name.substr(0, name.find('.'));
+	size_t length = name.size();
+	return name.find("normal") != std::string::npos || name.find("nrm") != std::string::npos ||
+		(length > 2 && name.compare(length - 2, 2, "_n") == 0);
+}
+
+static bool has_alpha(const unsigned char *rgba, size_t pixels)
+{
+	for (size_t i = 0; i < pixels; i++)
+		if (rgba[i * 4 + 3] != 255)
+			return true;
+	return false;
+}
+
+// DXGI_FORMAT values for the DX10 header
+static uint32_t dxgi_format(BCFormat format, bool srgb)
+{
+	switch (format)
+	{
+	case BC_FORMAT_BC1: return srgb ? 72 : 71;
+	case BC_FORMAT_BC3: return srgb ? 78 : 77;
+	case BC_FORMAT_BC4: return 80;
+	case BC_FORMAT_BC5: return 83;
+	case BC_FORMAT_BC7: return srgb ? 99 : 98;
+	}
+	return 0;
+}
+
+static void put_u32(std::vector<unsigned char> &out, size_t offset, uint32_t value)
+{
+	for (int i = 0; i < 4; i++)
+		out[offset + i] = (unsigned char)(value >> (i * 8));
+}
+
+// DDS with a DX10 header, the levels are stored back to back, largest first
+static bool write_dds(const std::string &path, uint32_t dxgi, int width, int height, const std::vector<std::vector<unsigned char> > &levels, uint32_t cookFlags, uint32_t cookSettings)
+{
+	std::vector<unsigned char> out(148, 0);
+	memcpy(&out[0], "DDS ", 4);
+	put_u32(out, 4, 124);							// dwSize
+	put_u32(out, 8, 0x1 | 0x2 | 0x4 | 0x1000 | 0x20000 | 0x80000);	// CAPS | HEIGHT | WIDTH | PIXELFORMAT | MIPMAPCOUNT | LINEARSIZE
+	put_u32(out, 12, height);
+	put_u32(out, 16, width);
+	put_u32(out, 20, (uint32_t)levels[0].size());	// dwPitchOrLinearSize
+	put_u32(out, 28, (uint32_t)levels.size());		// dwMipMapCount
+	put_u32(out, 32, COOKED_TEXTURE_TAG);			// dwReserved1[0..1]
+	put_u32(out, 36, cookFlags);
+	put_u32(out, 40, cookSettings);
+	put_u32(out, 76, 32);							// ddspf.dwSize
+	put_u32(out, 80, 0x4);							// DDPF_FOURCC
+	memcpy(&out[84], "DX10", 4);
+	put_u32(out, 108, 0x1000 | 0x8 | 0x400000);		// TEXTURE | COMPLEX | MIPMAP
+	put_u32(out, 128, dxgi);
+	put_u32(out, 132, 3);							// D3D10_RESOURCE_DIMENSION_TEXTURE2D
+	put_u32(out, 140, 1);							// arraySize
+	for (size_t i = 0; i < levels.size(); i++)
+		out.insert(out.end(), levels[i].begin(), levels[i].end());
+	return write_file_atomic(path, out.data(), out.size());
+}
+
+static bool cook(const std::string &source, const CookOptions &options, ThreadPool *pool)
+{
+	std::string target = source + ".dds";
+	int64_t sourceTime, targetTime;
+	if (!file_mtime(source, sourceTime))
+	{
+		printf("ERROR::COOKER:: %s does not exist\n", source.c_str());
+		return false;
+	}
+	uint32_t cookedFlags, cookedSettings;
+	if (!options.force && file_mtime(target, targetTime) && targetTime >= sourceTime &&
+		read_cooked_texture_header(target, cookedFlags, cookedSettings) && cookedSettings == options.settings())
+	{
+		printf("COOK %s is up to date\n", source.c_str());
+		return true;
+	}
+
+	std::chrono::high_resolution_clock::time_point start = std::chrono::high_resolution_clock::now();
+	int width, height, components;
+	unsigned char *pixels = stbi_load(source.c_str(), &width, &height, &components, 4);
+	if (!pixels)
+	{
+		printf("ERROR::COOKER:: could not decode %s: %s\n", source.c_str(), stbi_failure_reason());
+		return false;
+	}
+	if (options.flip)
+	{
+		size_t row = (size_t)width * 4;
+		std::vector<unsigned char> temp(row);
+		for (int y = 0; y < height / 2; y++)
+		{
+			memcpy(&temp[0], pixels + y * row, row);
+			memcpy(pixels + y * row, pixels + (height - 1 - y) * row, row);
+			memcpy(pixels + (height - 1 - y) * row, &temp[0], row);
+		}
+	}
+
+	bool normal = options.normal || (options.format == "auto" && looks_like_normal_map(source));
+	BCFormat format;
+	if (options.format == "bc1")
+		format = BC_FORMAT_BC1;
+	else if (options.format == "bc3")
+		format = BC_FORMAT_BC3;
+	else if (options.format == "bc4")
+		format = BC_FORMAT_BC4;
+	else if (options.format == "bc5")
+		format = BC_FORMAT_BC5;
+	else if (options.format == "bc7")
+		format = BC_FORMAT_BC7;
+	else if (normal)
+		format = BC_FORMAT_BC5;
+	else if (components == 1)
+		format = BC_FORMAT_BC4;
+	else
+		format = has_alpha(pixels, (size_t)width * height) ? BC_FORMAT_BC3 : BC_FORMAT_BC1;
+
+	// single channel sources are data, everything else is colour unless told otherwise
+	MipColorSpace space = normal ? MIP_NORMAL : ((options.linear || components <= 2) ? MIP_LINEAR : MIP_SRGB);
+	std::vector<MipLevel> mips;
+	build_mip_chain(pixels, width, height, space, mips, options.filter, pool);
+	stbi_image_free(pixels);
+
+	std::vector<std::vector<unsigned char> > levels(mips.size());
+	size_t bytes = 0;
+	for (size_t i = 0; i < mips.size(); i++)
+	{
+		bc_encode_image(mips[i].rgba.data(), mips[i].width, mips[i].height, format, levels[i], pool);
+		bytes += levels[i].size();
+	}
+
+	bool srgb = options.srgbFormat && space == MIP_SRGB;
+	// what loaders check before they take the file for a slot, see cooked_texture_path
+	uint32_t cookFlags = (options.flip ? COOKED_TEXTURE_FLIPPED : 0) | (uint32_t)space << COOKED_TEXTURE_SPACE_SHIFT |
+		(format == BC_FORMAT_BC4 || format == BC_FORMAT_BC5 ? COOKED_TEXTURE_TWO_CHANNEL : 0);
+	if (!write_dds(target, dxgi_format(format, srgb), width, height, levels, cookFlags, options.settings()))
+	{
+		printf("ERROR::COOKER:: could not write %s\n", target.c_str());
+		return false;
+	}
+
+	static const char *formatNames[] = { "BC1", "BC3", "BC4", "BC5", "BC7" };
+	double ms = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+	printf("COOK %s -> %s (%s%s, %dx%d, %u mips, %.2f MB) in %.0f ms\n", source.c_str(), target.c_str(), formatNames[format], srgb ? " sRGB" : "",
+		width, height, (unsigned int)levels.size(), bytes / (1024.0 * 1024.0), ms);
+	return true;
+}
+
+int main(int argc, char **argv)
+{
+	CookOptions options;
+	std::vector<std::string> sources;
+	for (int i = 1; i < argc; i++)
+	{
+		std::string arg = argv[i];
+		if (arg == "--format" && i + 1 < argc)
+			options.format = lowercase(argv[++i]);
+		else if (arg == "--filter" && i + 1 < argc)
+		{
+			std::string filter = lowercase(argv[++i]);
+			if (filter != "kaiser" && filter != "box")
+			{
+				printf("ERROR::COOKER:: unknown filter %s\n", filter.c_str());
+				return 1;
+			}
+			options.filter = filter == "box" ? MIP_FILTER_BOX : MIP_FILTER_KAISER;
+		}
+		else if (arg == "--normal")
+			options.normal = true;
+		else if (arg == "--linear")
+			options.linear = true;
+		else if (arg == "--srgb-format")
+			options.srgbFormat = true;
+		else if (arg == "--flip")
+			options.flip = true;
+		else if (arg == "--force")
+			options.force = true;
+		else if (arg == "-j" && i + 1 < argc)
+			options.threads = (unsigned int)atoi(argv[++i]);
+		else if (!arg.empty() && arg[0] == '-')
+		{
+			printf("ERROR::COOKER:: unknown option %s\n", arg.c_str());
+			return 1;
+		}
+		else
+			sources.push_back(arg);
+	}
+	if (std::find(formatOptions, formatOptions + 6, options.format) == formatOptions + 6)
+	{
+		printf("ERROR::COOKER:: unknown format %s\n", options.format.c_str());
+		return 1;
+	}
+	if (sources.empty())
+	{
+		printf("usage: texture_cooker [--format auto|bc1|bc3|bc4|bc5|bc7] [--normal] [--linear] [--filter kaiser|box] [--srgb-format] [--flip] [--force] [-j threads] images...\n");
+		return 1;
+	}
+
+	// the rows of each mip level and its blocks are spread over the pool, the calling thread helps out
+	ThreadPool *pool = options.threads == 1 ? nullptr : new ThreadPool(options.threads ? options.threads - 1 : 0);
+	bool ok = true;
+	for (size_t i = 0; i < sources.size(); i++)
+		ok = cook(sources[i], options, pool) && ok;
+	delete pool;
+	return ok ? 0 : 1;
+}